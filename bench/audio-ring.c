@@ -0,0 +1,282 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// audioring microbenchmark and randomised test.
+//
+// The test runs random sized enqueues and dequeues against rings with random channel counts and capacities (not only
+// powers of two), starting the free-running positions just below UINT_MAX so that they wrap as well as the buffer.
+// Every dequeued sample is checked against the stream that was enqueued, and every call is checked to be
+// all-or-nothing. It exits with an error if anything is wrong, before benchmarking.
+//
+// The benchmark moves device periods through a ring on one thread, first through the per-sample ck_ring wrappers
+// that audioring replaced (copied below as they were, not inlined), then through audioring. It reports ns per sample
+// for each channel count.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "ck/ck_ring.h"
+#include "globals.h"
+#include "utils.h"
+#include "audio-ring.h"
+
+#define DEFAULT_CHANNELS "1,2,8,64"
+#define DEFAULT_PERIOD_FRAMES 128
+#define DEFAULT_CAPACITY 4096 // frames
+#define DEFAULT_SAMPLES 200000000 // moved through each ring per channel count
+#define DEFAULT_TEST_OPS 2000000
+#define TEST_TRIALS 200
+#define TEST_MAX_CHANNELS 8
+#define TEST_MAX_CAPACITY 300
+#define MAX_CHANNEL_COUNTS 32
+
+/////////////////////
+// old ring
+/////////////////////
+
+// on 32-bit arch we will store 1 double using 2 ring elements (2 x intptr_t), a float fits in one
+#if defined(W_32_BIT_POINTERS) && !defined(W_SAMPLE_F32)
+#define RING_SPLIT_SAMPLES
+#endif
+
+static int oldRingInit (ck_ring_t *ring, ck_ring_buffer_t **ringBuf, int size) {
+  #ifdef RING_SPLIT_SAMPLES
+  size *= 2;
+  #endif
+
+  int ringAllocSize = utils_roundUpPowerOfTwo(size);
+  *ringBuf = (ck_ring_buffer_t*)calloc(ringAllocSize, sizeof(ck_ring_buffer_t));
+  if (*ringBuf == NULL) return -1;
+
+  ck_ring_init(ring, ringAllocSize);
+  return 0;
+}
+
+__attribute__ ((noinline)) static unsigned int oldRingSize (const ck_ring_t *ring) {
+  #ifdef RING_SPLIT_SAMPLES
+  return ck_ring_size(ring) / 2;
+  #else
+  return ck_ring_size(ring);
+  #endif
+}
+
+__attribute__ ((noinline)) static sample_t oldRingDequeueSample (ck_ring_t *ring, ck_ring_buffer_t *ringBuf) {
+  sample_t x;
+
+  #ifdef RING_SPLIT_SAMPLES
+  intptr_t sample[2] __attribute__ ((aligned (8)));
+  ck_ring_dequeue_spsc(ring, ringBuf, (void*)&sample[0]);
+  ck_ring_dequeue_spsc(ring, ringBuf, (void*)&sample[1]);
+  memcpy(&x, sample, sizeof(x));
+  #else
+  intptr_t sample = 0;
+  ck_ring_dequeue_spsc(ring, ringBuf, (void*)&sample);
+  memcpy(&x, &sample, sizeof(x));
+  #endif
+
+  return x;
+}
+
+__attribute__ ((noinline)) static void oldRingEnqueueSample (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, sample_t x) {
+  #ifdef RING_SPLIT_SAMPLES
+  intptr_t sample[2] __attribute__ ((aligned (8)));
+  memcpy(sample, &x, sizeof(x));
+  ck_ring_enqueue_spsc(ring, ringBuf, (void*)sample[0]);
+  ck_ring_enqueue_spsc(ring, ringBuf, (void*)sample[1]);
+  #else
+  intptr_t sample = 0;
+  memcpy(&sample, &x, sizeof(x));
+  ck_ring_enqueue_spsc(ring, ringBuf, (void*)sample);
+  #endif
+}
+
+/////////////////////
+// test
+/////////////////////
+
+// Sample n of the stream, exactly representable in float and double
+static sample_t streamSample (uint64_t n) {
+  return (sample_t)(n % 1000003);
+}
+
+// returns: number of errors
+static int runTrial (int channelCount, int capacity, unsigned int startPos, int opCount) {
+  audioring_t ring;
+  if (audioring_init(&ring, channelCount, capacity) < 0) return 1;
+  atomic_store(&ring.writePos, startPos);
+  atomic_store(&ring.readPos, startPos);
+
+  sample_t buf[TEST_MAX_CHANNELS * (TEST_MAX_CAPACITY + 16)];
+  uint64_t written = 0, read = 0; // in frames
+  int errorCount = 0;
+
+  for (int op = 0; op < opCount; op++) {
+    int frameCount = rand() % (capacity + 16); // sometimes more than the ring can hold
+    int size = (int)(written - read);
+
+    if (rand() & 1) {
+      for (int i = 0; i < channelCount * frameCount; i++) buf[i] = streamSample(written * channelCount + i);
+      int err = audioring_enqueueFrames(&ring, buf, frameCount);
+      if (err == 0) written += frameCount;
+      if ((err == 0) != (size + frameCount <= capacity)) errorCount++;
+    } else {
+      int err = audioring_dequeueFrames(&ring, buf, frameCount);
+      if (err == 0) {
+        for (int i = 0; i < channelCount * frameCount; i++) {
+          if (buf[i] != streamSample(read * channelCount + i)) errorCount++;
+        }
+        read += frameCount;
+      }
+      if ((err == 0) != (size >= frameCount)) errorCount++;
+    }
+
+    if (audioring_size(&ring) != written - read) errorCount++;
+  }
+
+  audioring_deinit(&ring);
+  return errorCount;
+}
+
+static int runTest (int opCount) {
+  int errorCount = 0;
+  for (int trial = 0; trial < TEST_TRIALS; trial++) {
+    int channelCount = 1 + rand() % TEST_MAX_CHANNELS;
+    int capacity = 1 + rand() % TEST_MAX_CAPACITY;
+    // half the trials wrap the positions through UINT_MAX
+    unsigned int startPos = trial % 2 ? UINT_MAX - (unsigned int)(rand() % (8 * TEST_MAX_CAPACITY)) : 0;
+    errorCount += runTrial(channelCount, capacity, startPos, opCount / TEST_TRIALS);
+  }
+  return errorCount;
+}
+
+/////////////////////
+// benchmark
+/////////////////////
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+static int benchChannelCount (int channelCount, int periodFrames, int capacity, long samples) {
+  int periodSamples = channelCount * periodFrames;
+  long periods = samples / periodSamples;
+  sample_t *in = (sample_t *)malloc(sizeof(sample_t) * periodSamples);
+  sample_t *out = (sample_t *)malloc(sizeof(sample_t) * periodSamples);
+  if (in == NULL || out == NULL) return -1;
+  for (int i = 0; i < periodSamples; i++) in[i] = streamSample(i);
+  volatile sample_t sink = 0;
+
+  ck_ring_t oldRing;
+  ck_ring_buffer_t *oldRingBuf;
+  if (oldRingInit(&oldRing, &oldRingBuf, channelCount * capacity) < 0) return -2;
+  int64_t startNs = getCurrentNs();
+  for (long p = 0; p < periods; p++) {
+    // the old call sites checked the size before moving a period
+    if (oldRingSize(&oldRing) + periodSamples <= (unsigned int)(channelCount * capacity)) {
+      for (int i = 0; i < periodSamples; i++) oldRingEnqueueSample(&oldRing, oldRingBuf, in[i]);
+    }
+    if (oldRingSize(&oldRing) >= (unsigned int)periodSamples) {
+      for (int i = 0; i < periodSamples; i++) out[i] = oldRingDequeueSample(&oldRing, oldRingBuf);
+    }
+    sink += out[periodSamples - 1];
+  }
+  int64_t oldNs = getCurrentNs() - startNs;
+  free(oldRingBuf);
+
+  audioring_t ring;
+  if (audioring_init(&ring, channelCount, capacity) < 0) return -3;
+  startNs = getCurrentNs();
+  for (long p = 0; p < periods; p++) {
+    audioring_enqueueFrames(&ring, in, periodFrames);
+    audioring_dequeueFrames(&ring, out, periodFrames);
+    sink += out[periodSamples - 1];
+  }
+  int64_t newNs = getCurrentNs() - startNs;
+  audioring_deinit(&ring);
+
+  double sampleCount = (double)periods * periodSamples;
+  printf("%s,%d,%d,%.3f,%.3f,%.1f\n",
+    SAMPLE_FORMAT_NAME, channelCount, periodFrames, oldNs / sampleCount, newNs / sampleCount, (double)oldNs / newNs);
+  free(in);
+  free(out);
+  return 0;
+}
+
+static int parseChannelCounts (const char *str, int *channelCounts) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_CHANNEL_COUNTS) {
+    char *end;
+    long channelCount = strtol(pos, &end, 10);
+    if (end == pos || channelCount <= 0) return -1;
+    channelCounts[count++] = channelCount;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-audio-ring [OPTIONS]\n"
+    " -c CHANNELS  Comma separated channel counts (default %s)\n"
+    " -p FRAMES    Frames per period (default %d)\n"
+    " -n FRAMES    Ring capacity (default %d)\n"
+    " -m SAMPLES   Samples to move through each ring (default %d)\n"
+    " -t OPS       Randomised test operations, 0 to skip (default %d)\n"
+    " -s SEED      Random seed (default 1)\n",
+    DEFAULT_CHANNELS, DEFAULT_PERIOD_FRAMES, DEFAULT_CAPACITY, DEFAULT_SAMPLES, DEFAULT_TEST_OPS
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *channelsStr = DEFAULT_CHANNELS;
+  int periodFrames = DEFAULT_PERIOD_FRAMES;
+  int capacity = DEFAULT_CAPACITY;
+  long samples = DEFAULT_SAMPLES;
+  int testOps = DEFAULT_TEST_OPS;
+  unsigned int seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:p:n:m:t:s:h")) != -1) {
+    switch (opt) {
+      case 'c': channelsStr = optarg; break;
+      case 'p': periodFrames = atoi(optarg); break;
+      case 'n': capacity = atoi(optarg); break;
+      case 'm': samples = atol(optarg); break;
+      case 't': testOps = atoi(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int channelCounts[MAX_CHANNEL_COUNTS];
+  int channelCountCount = parseChannelCounts(channelsStr, channelCounts);
+  if (channelCountCount <= 0 || periodFrames <= 0 || capacity < periodFrames || samples <= 0 || testOps < 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  srand(seed);
+  if (testOps > 0) {
+    int errorCount = runTest(testOps);
+    fprintf(stderr, "Randomised test: %d operations, %d errors\n", testOps, errorCount);
+    if (errorCount > 0) return EXIT_FAILURE;
+  }
+
+  printf("format,channels,period_frames,ck_per_sample_ns,audioring_ns,speedup\n");
+  for (int i = 0; i < channelCountCount; i++) {
+    if (benchChannelCount(channelCounts[i], periodFrames, capacity, samples) < 0) return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// CRC kernel throughput. For CRC16 and CRC32 it times every kernel built for this arch that the CPU supports
+// (bit-at-a-time, slicing-by-8, then PCLMULQDQ folding on x86 or PMULL folding and the CRC32 instructions on ARM64)
+// over buffers of each length, and reports ns per call and GB/s. Each result is checked against the bit-at-a-time
+// kernel, over random data and starting CRCs at every length up to 300 bytes, exiting with an error on a mismatch.
+
+// The kernels are static, include them directly
+#include "../src/utils.c"
+
+#include <stdint.h>
+#include <time.h>
+
+#define DEFAULT_LENGTHS "16,64,256,1024,1500,4096,65536"
+#define DEFAULT_BYTES 1000000000 // checksummed per kernel and length
+#define CHECK_MAX_LEN 300
+#define MAX_LENGTHS 32
+
+typedef uint32_t (*crcKernel_t)(uint32_t crc, const uint8_t *buf, int bufLen);
+
+typedef struct {
+  const char *name;
+  int width;
+  crcKernel_t kernel;
+} kernel_t;
+
+// returns: number of kernels
+static int getKernels (kernel_t *kernels) {
+  int count = 0;
+  kernels[count++] = (kernel_t){ "bitwise", 16, crc16Bitwise };
+  kernels[count++] = (kernel_t){ "slicing-by-8", 16, crc16Slicing };
+#if defined(CRC_CLMUL_X86)
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    kernels[count++] = (kernel_t){ "pclmul", 16, crc16Clmul };
+  }
+#elif defined(CRC_CLMUL_ARM)
+  #if defined(__linux__)
+  if (getauxval(AT_HWCAP) & HWCAP_PMULL) kernels[count++] = (kernel_t){ "pmull", 16, crc16Pmull };
+  #else
+  kernels[count++] = (kernel_t){ "pmull", 16, crc16Pmull };
+  #endif
+#endif
+
+  kernels[count++] = (kernel_t){ "bitwise", 32, crc32Bitwise };
+  kernels[count++] = (kernel_t){ "slicing-by-8", 32, crc32Slicing };
+#if defined(CRC_CLMUL_X86)
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    kernels[count++] = (kernel_t){ "pclmul", 32, crc32Clmul };
+  }
+#elif defined(CRC_CLMUL_ARM)
+  #if defined(__linux__)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) kernels[count++] = (kernel_t){ "crc32", 32, crc32Arm };
+  #else
+  kernels[count++] = (kernel_t){ "crc32", 32, crc32Arm };
+  #endif
+#endif
+  return count;
+}
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+// returns: number of mismatches against the bit-at-a-time kernel
+static int checkKernel (const kernel_t *kernel, const uint8_t *buf) {
+  crcKernel_t reference = kernel->width == 16 ? crc16Bitwise : crc32Bitwise;
+  uint32_t mask = kernel->width == 16 ? 0xffff : 0xffffffffu;
+  int errorCount = 0;
+  for (int len = 0; len <= CHECK_MAX_LEN; len++) {
+    // also start at an odd offset, the kernels load unaligned
+    for (int offset = 0; offset < 2; offset++) {
+      uint32_t crc = ((uint32_t)rand() << 16 ^ rand()) & mask;
+      if (kernel->kernel(crc, &buf[offset], len) != reference(crc, &buf[offset], len)) errorCount++;
+    }
+  }
+  return errorCount;
+}
+
+static void benchKernel (const kernel_t *kernel, const uint8_t *buf, int len, long bytes) {
+  long calls = bytes / len;
+  if (calls < 1) calls = 1;
+  volatile uint32_t sink = 0;
+  int64_t startNs = getCurrentNs();
+  for (long i = 0; i < calls; i++) sink += kernel->kernel(0, buf, len);
+  int64_t elapsedNs = getCurrentNs() - startNs;
+
+  printf("crc%d,%s,%d,%.1f,%.2f\n", kernel->width, kernel->name, len, (double)elapsedNs / calls, (double)calls * len / elapsedNs);
+}
+
+static int parseLengths (const char *str, int *lengths) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_LENGTHS) {
+    char *end;
+    long len = strtol(pos, &end, 10);
+    if (end == pos || len <= 0 || len > INT32_MAX) return -1;
+    lengths[count++] = len;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-crc [OPTIONS]\n"
+    " -l LENGTHS  Comma separated buffer lengths in bytes (default %s)\n"
+    " -m BYTES    Bytes to checksum per kernel and length (default %d)\n"
+    "The bit-at-a-time kernel gets a hundredth of the bytes.\n",
+    DEFAULT_LENGTHS, DEFAULT_BYTES
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *lengthsStr = DEFAULT_LENGTHS;
+  long bytes = DEFAULT_BYTES;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "l:m:h")) != -1) {
+    switch (opt) {
+      case 'l': lengthsStr = optarg; break;
+      case 'm': bytes = atol(optarg); break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int lengths[MAX_LENGTHS];
+  int lengthCount = parseLengths(lengthsStr, lengths);
+  if (lengthCount <= 0 || bytes <= 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  int maxLen = CHECK_MAX_LEN + 1;
+  for (int i = 0; i < lengthCount; i++) {
+    if (lengths[i] > maxLen) maxLen = lengths[i];
+  }
+  uint8_t *buf = (uint8_t *)malloc(maxLen);
+  if (buf == NULL) return EXIT_FAILURE;
+  for (int i = 0; i < maxLen; i++) buf[i] = rand();
+
+  fprintf(stderr, "utils_crcInit picked %s\n", utils_crcInit());
+  kernel_t kernels[8];
+  int kernelCount = getKernels(kernels);
+
+  int errorCount = 0;
+  for (int k = 0; k < kernelCount; k++) errorCount += checkKernel(&kernels[k], buf);
+  if (errorCount > 0) {
+    fprintf(stderr, "%d CRC mismatches against the bit-at-a-time kernel\n", errorCount);
+    return EXIT_FAILURE;
+  }
+
+  printf("crc,kernel,len,ns_per_call,gb_per_s\n");
+  for (int k = 0; k < kernelCount; k++) {
+    for (int i = 0; i < lengthCount; i++) {
+      benchKernel(&kernels[k], buf, lengths[i], kernels[k].kernel == crc16Bitwise || kernels[k].kernel == crc32Bitwise ? bytes / 100 : bytes);
+    }
+  }
+
+  free(buf);
+  return EXIT_SUCCESS;
+}
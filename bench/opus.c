@@ -0,0 +1,186 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// Opus multistream CPU per channel, mono versus coupled layouts. For each channel count it encodes and decodes the
+// same audio with one mono stream per channel (the default layout) and then with one coupled stream per channel pair,
+// set up as opus-groups does it for one group (OPUS_APPLICATION_AUDIO, CBR), at the same bitrate per channel. The
+// audio is stereo pairs of tones and noise with a common part, like typical stereo-pair content, so the coupled
+// encoder has some inter-channel redundancy to use. It reports time per frame and the share of one core used per
+// channel in real time, for the encoder and the decoder.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "opus/opus_multistream.h"
+#include "globals.h"
+
+#define DEFAULT_CHANNELS "2,8,16,32,64"
+#define DEFAULT_BITRATE 64000 // per channel
+#define DEFAULT_FRAME_SIZE 240
+#define DEFAULT_COMPLEXITY 10
+#define DEFAULT_CORRELATION 0.8
+#define DEFAULT_DURATION 10 // seconds of audio per run
+#define SIGNAL_FRAMES AUDIO_OPUS_SAMPLE_RATE // one second of audio is generated and looped
+#define MAX_CHANNEL_COUNTS 32
+#define PI 3.14159265358979323846
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+static double noise (void) {
+  return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+// Each pair of channels shares a part made of a few tones and noise, mixed with correlation of its own independent part
+static void makeSignal (float *signal, int channelCount, double correlation) {
+  for (int pair = 0; pair < channelCount / 2; pair++) {
+    double freqs[3] = { 50.0 + 1000.0 * rand() / RAND_MAX, 1000.0 + 4000.0 * rand() / RAND_MAX, 5000.0 + 10000.0 * rand() / RAND_MAX };
+    for (int i = 0; i < SIGNAL_FRAMES; i++) {
+      double common = 0.0;
+      for (int f = 0; f < 3; f++) common += 0.2 * sin(2.0 * PI * freqs[f] * i / AUDIO_OPUS_SAMPLE_RATE);
+      common += 0.1 * noise();
+      for (int side = 0; side < 2; side++) {
+        double own = 0.2 * sin(2.0 * PI * freqs[side] * (1.0 + 0.01 * (side + 1)) * i / AUDIO_OPUS_SAMPLE_RATE) + 0.1 * noise();
+        signal[channelCount * i + 2 * pair + side] = correlation * common + (1.0 - correlation) * own;
+      }
+    }
+  }
+}
+
+// returns: 0 on success or negative error code
+static int benchLayout (const float *signal, int channelCount, bool coupled, int bitrate, int frameSize, int complexity, int duration) {
+  int streamCount = coupled ? channelCount / 2 : channelCount;
+  int coupledStreamCount = coupled ? channelCount / 2 : 0;
+  unsigned char mapping[MAX_AUDIO_CHANNELS];
+  for (int i = 0; i < channelCount; i++) mapping[i] = i;
+  // CBR, the bitrate is rounded to whole bytes per frame as opus-groups does
+  int encodedLen = bitrate * channelCount * frameSize / (8 * AUDIO_OPUS_SAMPLE_RATE);
+
+  int err;
+  OpusMSEncoder *encoder = opus_multistream_encoder_create(AUDIO_OPUS_SAMPLE_RATE, channelCount, streamCount, coupledStreamCount, mapping, OPUS_APPLICATION_AUDIO, &err);
+  if (err != OPUS_OK) return -1;
+  int err1 = opus_multistream_encoder_ctl(encoder, OPUS_SET_BITRATE(8 * AUDIO_OPUS_SAMPLE_RATE * encodedLen / frameSize));
+  int err2 = opus_multistream_encoder_ctl(encoder, OPUS_SET_VBR(0));
+  int err3 = opus_multistream_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+  if (err1 != OPUS_OK || err2 != OPUS_OK || err3 != OPUS_OK) return -2;
+  OpusMSDecoder *decoder = opus_multistream_decoder_create(AUDIO_OPUS_SAMPLE_RATE, channelCount, streamCount, coupledStreamCount, mapping, &err);
+  if (err != OPUS_OK) return -3;
+
+  unsigned char *encoded = (unsigned char *)malloc(encodedLen);
+  float *decoded = (float *)malloc(sizeof(float) * channelCount * frameSize);
+  if (encoded == NULL || decoded == NULL) return -4;
+
+  long frames = (long)duration * AUDIO_OPUS_SAMPLE_RATE / frameSize;
+  int64_t encodeNs = 0, decodeNs = 0;
+  for (long f = 0; f < frames; f++) {
+    const float *samples = &signal[channelCount * (f * frameSize % (SIGNAL_FRAMES - frameSize))];
+    int64_t t0 = getCurrentNs();
+    int len = opus_multistream_encode_float(encoder, samples, frameSize, encoded, encodedLen);
+    int64_t t1 = getCurrentNs();
+    if (len != encodedLen) return -5;
+    int result = opus_multistream_decode_float(decoder, encoded, len, decoded, frameSize, 0);
+    int64_t t2 = getCurrentNs();
+    if (result != frameSize) return -6;
+    encodeNs += t1 - t0;
+    decodeNs += t2 - t1;
+  }
+
+  double realTimeNs = 1000000000.0 * frames * frameSize / AUDIO_OPUS_SAMPLE_RATE;
+  printf("%s,%d,%d,%d,%d,%d,%d,%.1f,%.1f,%.3f,%.3f\n",
+    coupled ? "coupled" : "mono", channelCount, streamCount, coupledStreamCount, bitrate, frameSize, complexity,
+    encodeNs / 1000.0 / frames, decodeNs / 1000.0 / frames,
+    100.0 * encodeNs / realTimeNs / channelCount, 100.0 * decodeNs / realTimeNs / channelCount);
+
+  opus_multistream_encoder_destroy(encoder);
+  opus_multistream_decoder_destroy(decoder);
+  free(encoded);
+  free(decoded);
+  return 0;
+}
+
+static int parseChannelCounts (const char *str, int *channelCounts) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_CHANNEL_COUNTS) {
+    char *end;
+    long channelCount = strtol(pos, &end, 10);
+    // coupled streams need channel pairs
+    if (end == pos || channelCount <= 0 || channelCount > MAX_AUDIO_CHANNELS || channelCount % 2 != 0) return -1;
+    channelCounts[count++] = channelCount;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-opus [OPTIONS]\n"
+    " -c CHANNELS     Comma separated even channel counts (default %s)\n"
+    " -b BITRATE      Bits per second per channel (default %d)\n"
+    " -f FRAMES       Frame size (default %d)\n"
+    " -x COMPLEXITY   Encoder complexity 0 to 10 (default %d)\n"
+    " -r CORRELATION  Share of each channel pair's signal in common, 0 to 1 (default %.1f)\n"
+    " -d SECONDS      Audio per run (default %d)\n"
+    "cpu_pct_per_channel is the share of one core used per channel to keep up in real time.\n",
+    DEFAULT_CHANNELS, DEFAULT_BITRATE, DEFAULT_FRAME_SIZE, DEFAULT_COMPLEXITY, DEFAULT_CORRELATION, DEFAULT_DURATION
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *channelsStr = DEFAULT_CHANNELS;
+  int bitrate = DEFAULT_BITRATE;
+  int frameSize = DEFAULT_FRAME_SIZE;
+  int complexity = DEFAULT_COMPLEXITY;
+  double correlation = DEFAULT_CORRELATION;
+  int duration = DEFAULT_DURATION;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:b:f:x:r:d:h")) != -1) {
+    switch (opt) {
+      case 'c': channelsStr = optarg; break;
+      case 'b': bitrate = atoi(optarg); break;
+      case 'f': frameSize = atoi(optarg); break;
+      case 'x': complexity = atoi(optarg); break;
+      case 'r': correlation = atof(optarg); break;
+      case 'd': duration = atoi(optarg); break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int channelCounts[MAX_CHANNEL_COUNTS];
+  int channelCountCount = parseChannelCounts(channelsStr, channelCounts);
+  if (channelCountCount <= 0 || bitrate <= 0 || frameSize <= 0 || frameSize > SIGNAL_FRAMES / 2 || complexity < 0 ||
+      complexity > 10 || correlation < 0.0 || correlation > 1.0 || duration <= 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  printf("layout,channels,streams,coupled_streams,bitrate_per_channel,frame_size,complexity,encode_us_per_frame,decode_us_per_frame,encode_cpu_pct_per_channel,decode_cpu_pct_per_channel\n");
+  for (int i = 0; i < channelCountCount; i++) {
+    float *signal = (float *)malloc(sizeof(float) * channelCounts[i] * SIGNAL_FRAMES);
+    if (signal == NULL) return EXIT_FAILURE;
+    makeSignal(signal, channelCounts[i], correlation);
+
+    for (int coupled = 0; coupled < 2; coupled++) {
+      int err = benchLayout(signal, channelCounts[i], coupled, bitrate, frameSize, complexity, duration);
+      if (err < 0) {
+        printf("Opus error %d for %d channels\n", err, channelCounts[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    free(signal);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// Receiver sync simulation. The sender's clock is off by each drift in the list, packets arrive with exponential
+// network jitter and the audio device consumes fixed periods. syncer_onPacket and syncer_onAudio are driven in
+// simulated time and the sync thread's step runs inline whenever syncer_onAudio signals it, so a 10 minute run takes
+// well under a second and is repeatable. The resampler is modelled as an exact ratio that changes as soon as
+// syncer_changeRate is called.
+//
+// For each drift it reports how long the clockError stat took to settle within 10 ppm and 1 ppm of the true drift
+// (in the stat's own terms, 1 - srcRate / senderRate), the largest ring fill error (in device frames, relative to the
+// fill 1 s in) after 10, 60 and 300 s, and the largest single rate step.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <random>
+
+// The sync thread's state and step function are static, include them directly so they can be run in simulated time
+#include "../src/syncer/receiver-sync.cpp"
+
+#define DEFAULT_DRIFTS "0,10,-10,50,100,-100,250,1000,-1000,5000"
+#define DEFAULT_JITTER_MS 2.0
+#define DEFAULT_DURATION 600 // seconds
+#define DEFAULT_PACKET_FRAMES 240
+#define DEFAULT_PERIOD_FRAMES 128
+#define SAMPLE_RATE 48000.0
+#define MAX_DRIFTS 64
+#define FILL_WINDOW 0.5 // seconds, the fill error is averaged over this long
+
+static std::atomic<double> requestedSrcRate = SAMPLE_RATE;
+static double rateRatio = 1.0;
+
+/////////////////////
+// syncer stubs
+/////////////////////
+
+int syncer_changeRate (double srcRate) {
+  if (fabs(srcRate / SAMPLE_RATE - 1.0) > RESAMPLER_MAX_RATIO_DEVIATION) return -1;
+  requestedSrcRate = srcRate;
+  return 0;
+}
+
+double syncer_getRateRatio (void) {
+  return rateRatio;
+}
+
+/////////////////////
+// simulation
+/////////////////////
+
+static void runDrift (double ppm, double jitterMs, int duration, int packetFrames, int periodFrames, unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::exponential_distribution<double> jitter(1.0 / (0.001 * jitterMs));
+  const double senderRate = SAMPLE_RATE * (1.0 + 0.000001 * ppm);
+  const double expectedClockError = 1000000.0 * (1.0 - SAMPLE_RATE / senderRate);
+  const double afterTimes[3] = { 10.0, 60.0, 300.0 };
+  const int windowPeriods = (int)(FILL_WINDOW * SAMPLE_RATE / periodFrames);
+
+  _srcRate = SAMPLE_RATE;
+  _dstRate = SAMPLE_RATE;
+  currentSrcRate = SAMPLE_RATE;
+
+  double nextPacketTime = 0.0, lastArrival = 0.0;
+  int seq = 0;
+  double produced = 0.0, consumed = 0.0;
+  double fillStart = NAN, fillSum = 0.0;
+  int fillCount = 0;
+  double settled10 = -1.0, settled1 = -1.0;
+  double maxFillError[3] = { 0.0, 0.0, 0.0 };
+  double maxRateStep = 0.0, lastRate = SAMPLE_RATE;
+
+  for (long period = 0; (double)period * periodFrames / SAMPLE_RATE < duration; period++) {
+    double t = (double)period * periodFrames / SAMPLE_RATE;
+
+    // Deliver every packet that has arrived by now, in order
+    while (true) {
+      double arrival = nextPacketTime + jitter(rng);
+      if (arrival < lastArrival) arrival = lastArrival;
+      if (arrival > t) break;
+      lastArrival = arrival;
+      rateRatio = SAMPLE_RATE / requestedSrcRate;
+      syncer_onPacket(seq, packetFrames);
+      seq = (seq + 1) & 0xffff;
+      produced += packetFrames * rateRatio;
+      nextPacketTime += packetFrames / senderRate;
+    }
+
+    syncer_onAudio(periodFrames);
+    consumed += periodFrames;
+    if (atomic_load(&threadState) == 2) {
+      atomic_store(&threadState, 1);
+      onSample(rsAverage.load());
+    }
+
+    fillSum += produced - consumed;
+    if (++fillCount < windowPeriods) continue;
+    double fill = fillSum / fillCount;
+    fillSum = 0.0;
+    fillCount = 0;
+
+    if (isnan(fillStart) && t > 1.0) fillStart = fill;
+    for (int i = 0; i < 3; i++) {
+      if (!isnan(fillStart) && t > afterTimes[i] && fabs(fill - fillStart) > maxFillError[i]) {
+        maxFillError[i] = fabs(fill - fillStart);
+      }
+    }
+
+    double rate = requestedSrcRate;
+    double step = fabs(1000000.0 * (rate / lastRate - 1.0));
+    if (step > maxRateStep) maxRateStep = step;
+    lastRate = rate;
+
+    double clockError;
+    globals_get1ff(statsCh1Audio, clockError, &clockError);
+    double error = fabs(clockError - expectedClockError);
+    if (error >= 10.0) settled10 = -1.0;
+    else if (settled10 < 0.0) settled10 = t;
+    if (error >= 1.0) settled1 = -1.0;
+    else if (settled1 < 0.0) settled1 = t;
+  }
+
+  printf("%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+    ppm, jitterMs, settled10, settled1, maxFillError[0], maxFillError[1], maxFillError[2], maxRateStep);
+}
+
+static int parseDrifts (const char *str, double *drifts) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_DRIFTS) {
+    char *end;
+    double drift = strtod(pos, &end);
+    if (end == pos) return -1;
+    drifts[count++] = drift;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-receiver-sync [OPTIONS]\n"
+    " -d DRIFTS   Comma separated sender clock drifts in ppm (default %s)\n"
+    " -j MS       Mean exponential network jitter (default %.1f)\n"
+    " -t SECONDS  Simulated duration of each run (default %d)\n"
+    " -p FRAMES   Frames per packet (default %d)\n"
+    " -a FRAMES   Frames per audio device period (default %d)\n"
+    " -s SEED     Jitter random seed (default 1)\n"
+    "Settle times are -1 if the drift estimate never settled. Fill errors are in device frames.\n",
+    DEFAULT_DRIFTS, DEFAULT_JITTER_MS, DEFAULT_DURATION, DEFAULT_PACKET_FRAMES, DEFAULT_PERIOD_FRAMES
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *driftsStr = DEFAULT_DRIFTS;
+  double jitterMs = DEFAULT_JITTER_MS;
+  int duration = DEFAULT_DURATION;
+  int packetFrames = DEFAULT_PACKET_FRAMES;
+  int periodFrames = DEFAULT_PERIOD_FRAMES;
+  unsigned int seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:j:t:p:a:s:h")) != -1) {
+    switch (opt) {
+      case 'd': driftsStr = optarg; break;
+      case 'j': jitterMs = atof(optarg); break;
+      case 't': duration = atoi(optarg); break;
+      case 'p': packetFrames = atoi(optarg); break;
+      case 'a': periodFrames = atoi(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  double drifts[MAX_DRIFTS];
+  int driftCount = parseDrifts(driftsStr, drifts);
+  if (driftCount <= 0 || jitterMs <= 0.0 || duration <= 0 || packetFrames <= 0 || periodFrames <= 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  printf("drift_ppm,jitter_ms,settled_10ppm_s,settled_1ppm_s,max_fill_error_10s,max_fill_error_60s,max_fill_error_300s,max_rate_step_ppm\n");
+  fflush(stdout);
+
+  // The syncer keeps its state in statics, so each run gets a fresh copy of it in a child process
+  for (int i = 0; i < driftCount; i++) {
+    pid_t pid = fork();
+    if (pid < 0) return EXIT_FAILURE;
+    if (pid == 0) {
+      runDrift(drifts[i], jitterMs, duration, packetFrames, periodFrames, seed);
+      fflush(stdout);
+      _exit(EXIT_SUCCESS);
+    }
+    waitpid(pid, NULL, 0);
+  }
+
+  return EXIT_SUCCESS;
+}
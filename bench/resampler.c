@@ -0,0 +1,203 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// Resampler benchmark. For each pair of rates and each channel count it times resampler_process on device periods of
+// noise and reports the CPU used per channel in real time. For each pair of rates it also reports the passband error:
+// the largest difference between the resampled output and the exact sine, over several tones up to the passband edge,
+// relative to the sine amplitude. With the linear phase filter this is the whole resampler error (stopband leakage,
+// phase interpolation and rounding). It is not measured for minimum phase, which does not keep the waveform shape.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "globals.h"
+#include "resampler.h"
+
+#define DEFAULT_CHANNELS "1,2,8,16,64"
+#define DEFAULT_RATES "48000:48000,48000:48010,44100:48000,96000:48000,48000:96000"
+#define DEFAULT_PERIOD_FRAMES 128
+#define DEFAULT_DURATION 10 // seconds of input audio per run
+#define ERROR_TEST_DURATION 1 // seconds
+#define MAX_CHANNEL_COUNTS 32
+#define MAX_RATE_PAIRS 32
+#define PI 3.14159265358979323846
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+// returns: the largest error in dB relative to the sine amplitude, or a positive error code
+static double sineError (double srcRate, double dstRate, double freq, int periodFrames, double transitionBand) {
+  resampler_t resamp;
+  if (resampler_init(&resamp, srcRate, dstRate, 1, periodFrames, transitionBand, false) < 0) return 1.0;
+  sample_t *inBuf = (sample_t *)malloc(sizeof(sample_t) * periodFrames);
+  if (inBuf == NULL) return 2.0;
+
+  double maxError = 0.0;
+  long outPos = 0;
+  for (long inPos = 0; inPos < ERROR_TEST_DURATION * srcRate; inPos += periodFrames) {
+    for (int i = 0; i < periodFrames; i++) inBuf[i] = 0.5 * sin(2.0 * PI * freq / srcRate * (inPos + i));
+
+    sample_t *outBuf;
+    int outFrameCount = resampler_process(&resamp, inBuf, periodFrames, &outBuf);
+    for (int i = 0; i < outFrameCount; i++, outPos++) {
+      double t = outPos * srcRate / dstRate - resamp.latency; // in input frames
+      if (t < resamp.tapCount) continue; // skip the filter filling up from silence
+      double error = fabs(outBuf[i] - 0.5 * sin(2.0 * PI * freq / srcRate * t));
+      if (error > maxError) maxError = error;
+    }
+  }
+
+  resampler_deinit(&resamp);
+  free(inBuf);
+  return 20.0 * log10(maxError / 0.5);
+}
+
+static double passbandError (double srcRate, double dstRate, int periodFrames, double transitionBand) {
+  const double fractions[] = { 0.01, 0.1, 0.5, 0.9 };
+  double passbandEdge = 0.5 * (srcRate < dstRate ? srcRate : dstRate) * (1.0 - transitionBand / 100.0);
+  double maxError = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    double error = sineError(srcRate, dstRate, fractions[i] * passbandEdge, periodFrames, transitionBand);
+    if (error > maxError) maxError = error;
+  }
+  return maxError;
+}
+
+// returns: 0 on success or negative error code
+static int benchRates (double srcRate, double dstRate, int channelCount, int periodFrames, int duration, double transitionBand, bool minPhase, double errorDb, const char *kernelName) {
+  resampler_t resamp;
+  if (resampler_init(&resamp, srcRate, dstRate, channelCount, periodFrames, transitionBand, minPhase) < 0) return -1;
+  sample_t *inBuf = (sample_t *)malloc(sizeof(sample_t) * channelCount * periodFrames);
+  if (inBuf == NULL) return -2;
+  for (int i = 0; i < channelCount * periodFrames; i++) inBuf[i] = (sample_t)rand() / RAND_MAX - 0.5;
+
+  long periods = (long)(duration * srcRate / periodFrames);
+  long outFrames = 0;
+  volatile sample_t sink = 0;
+  int64_t startNs = getCurrentNs();
+  for (long p = 0; p < periods; p++) {
+    sample_t *outBuf;
+    int outFrameCount = resampler_process(&resamp, inBuf, periodFrames, &outBuf);
+    if (outFrameCount > 0) sink += outBuf[0];
+    outFrames += outFrameCount;
+  }
+  int64_t elapsedNs = getCurrentNs() - startNs;
+
+  double audioSeconds = (double)periods * periodFrames / srcRate;
+  printf("%s,%s,%.0f,%.0f,%s,%.1f,%d,%d,%.1f,%.2f,%.3f,%.1f\n",
+    SAMPLE_FORMAT_NAME, kernelName, srcRate, dstRate, minPhase ? "min" : "linear", transitionBand, resamp.tapCount, channelCount,
+    (double)elapsedNs / outFrames,
+    (double)elapsedNs / outFrames / channelCount,
+    100.0 * elapsedNs / (1000000000.0 * audioSeconds) / channelCount,
+    errorDb);
+
+  resampler_deinit(&resamp);
+  free(inBuf);
+  return 0;
+}
+
+static int parseChannelCounts (const char *str, int *channelCounts) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_CHANNEL_COUNTS) {
+    char *end;
+    long channelCount = strtol(pos, &end, 10);
+    if (end == pos || channelCount <= 0 || channelCount > MAX_AUDIO_CHANNELS) return -1;
+    channelCounts[count++] = channelCount;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+// str is a comma separated list of srcRate:dstRate
+static int parseRates (const char *str, double *srcRates, double *dstRates) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_RATE_PAIRS) {
+    char *end;
+    srcRates[count] = strtod(pos, &end);
+    if (end == pos || *end != ':' || srcRates[count] <= 0.0) return -1;
+    pos = end + 1;
+    dstRates[count] = strtod(pos, &end);
+    if (end == pos || dstRates[count] <= 0.0) return -1;
+    count++;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-resampler [OPTIONS]\n"
+    " -c CHANNELS  Comma separated channel counts (default %s)\n"
+    " -r RATES     Comma separated SRC:DST rate pairs (default %s)\n"
+    " -b PERCENT   Transition band (default %.1f)\n"
+    " -p FRAMES    Input frames per period (default %d)\n"
+    " -d SECONDS   Input audio per run (default %d)\n"
+    " -m           Minimum phase filter\n"
+    "cpu_pct_per_channel is the share of one core used per channel to keep up in real time.\n",
+    DEFAULT_CHANNELS, DEFAULT_RATES, SYNCER_TRANSITION_BAND, DEFAULT_PERIOD_FRAMES, DEFAULT_DURATION
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *channelsStr = DEFAULT_CHANNELS;
+  const char *ratesStr = DEFAULT_RATES;
+  double transitionBand = SYNCER_TRANSITION_BAND;
+  int periodFrames = DEFAULT_PERIOD_FRAMES;
+  int duration = DEFAULT_DURATION;
+  bool minPhase = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:r:b:p:d:mh")) != -1) {
+    switch (opt) {
+      case 'c': channelsStr = optarg; break;
+      case 'r': ratesStr = optarg; break;
+      case 'b': transitionBand = atof(optarg); break;
+      case 'p': periodFrames = atoi(optarg); break;
+      case 'd': duration = atoi(optarg); break;
+      case 'm': minPhase = true; break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int channelCounts[MAX_CHANNEL_COUNTS];
+  double srcRates[MAX_RATE_PAIRS], dstRates[MAX_RATE_PAIRS];
+  int channelCountCount = parseChannelCounts(channelsStr, channelCounts);
+  int rateCount = parseRates(ratesStr, srcRates, dstRates);
+  if (channelCountCount <= 0 || rateCount <= 0 || transitionBand < SYNCER_MIN_TRANSITION_BAND || transitionBand > SYNCER_MAX_TRANSITION_BAND || periodFrames <= 0 || duration <= 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  const char *kernelName = resampler_initKernels();
+  printf("format,kernels,src_rate,dst_rate,phase,transition_band,taps,channels,ns_per_frame,ns_per_sample,cpu_pct_per_channel,passband_error_db\n");
+
+  for (int r = 0; r < rateCount; r++) {
+    double errorDb = minPhase ? NAN : passbandError(srcRates[r], dstRates[r], periodFrames, transitionBand);
+    if (errorDb > 0.0) {
+      printf("Could not init resampler for %.0f:%.0f\n", srcRates[r], dstRates[r]);
+      return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < channelCountCount; i++) {
+      if (benchRates(srcRates[r], dstRates[r], channelCounts[i], periodFrames, duration, transitionBand, minPhase, errorDb, kernelName) < 0) {
+        printf("Could not init resampler for %.0f:%.0f\n", srcRates[r], dstRates[r]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// CPU and memory of the audio path for one sample format. The bench target builds this twice, as
+// bench-sample-format-f64 and bench-sample-format-f32, whatever SAMPLE_FORMAT is, so run both to compare.
+//
+// Each device period goes through the sender side of the path: s32 to sample_t, level metering, through an audioring,
+// resampled for clock drift, and back to s32. It reports the time per sample of each stage, the share of a core used
+// per channel in real time, and the memory that depends on the sample format: the filter bank (shared by every
+// resampler with the same design), the resampler history and the ring. The f32 build designs its filter for less
+// stopband attenuation (see RESAMPLER_ATTENUATION) so it also has fewer taps.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "globals.h"
+#include "sampleconv.h"
+#include "meter.h"
+#include "audio-ring.h"
+#include "resampler.h"
+
+#define DEFAULT_CHANNELS "1,2,8,16,64"
+#define DEFAULT_PERIOD_FRAMES 128
+#define DEFAULT_RING_CAPACITY 4096 // frames
+#define DEFAULT_DURATION 10 // seconds of audio per run
+#define SRC_RATE 48000.0
+#define DST_RATE 48001.0 // 21 ppm of clock drift
+#define MAX_CHANNEL_COUNTS 32
+
+enum { STAGE_TO_SAMPLE, STAGE_METER, STAGE_RING, STAGE_RESAMPLE, STAGE_FROM_SAMPLE, STAGE_COUNT };
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+// returns: 0 on success or negative error code
+static int benchChannelCount (int channelCount, int periodFrames, int ringCapacity, int duration) {
+  int32_t *inBuf = (int32_t *)malloc(sizeof(int32_t) * channelCount * periodFrames);
+  int32_t *outBuf = (int32_t *)malloc(sizeof(int32_t) * channelCount * 2 * periodFrames);
+  sample_t *sampleBuf = (sample_t *)malloc(sizeof(sample_t) * channelCount * periodFrames);
+  if (inBuf == NULL || outBuf == NULL || sampleBuf == NULL) return -1;
+  for (int i = 0; i < channelCount * periodFrames; i++) inBuf[i] = rand() - RAND_MAX / 2;
+
+  audioring_t ring;
+  resampler_t resamp;
+  if (audioring_init(&ring, channelCount, ringCapacity) < 0) return -2;
+  if (resampler_init(&resamp, SRC_RATE, DST_RATE, channelCount, periodFrames, SYNCER_TRANSITION_BAND, false) < 0) return -3;
+
+  int64_t stageNs[STAGE_COUNT] = { 0 };
+  long periods = (long)(duration * SRC_RATE / periodFrames);
+  for (long p = 0; p < periods; p++) {
+    int64_t t0 = getCurrentNs();
+    sampleconv_s32ToSample(inBuf, channelCount, sampleBuf, channelCount, periodFrames);
+    int64_t t1 = getCurrentNs();
+    meter_process(sampleBuf, channelCount, channelCount, periodFrames);
+    int64_t t2 = getCurrentNs();
+    audioring_enqueueFrames(&ring, sampleBuf, periodFrames);
+    audioring_dequeueFrames(&ring, sampleBuf, periodFrames);
+    int64_t t3 = getCurrentNs();
+    sample_t *resampled;
+    int outFrameCount = resampler_process(&resamp, sampleBuf, periodFrames, &resampled);
+    int64_t t4 = getCurrentNs();
+    sampleconv_sampleToS32(resampled, channelCount, outBuf, channelCount, outFrameCount);
+    int64_t t5 = getCurrentNs();
+
+    stageNs[STAGE_TO_SAMPLE] += t1 - t0;
+    stageNs[STAGE_METER] += t2 - t1;
+    stageNs[STAGE_RING] += t3 - t2;
+    stageNs[STAGE_RESAMPLE] += t4 - t3;
+    stageNs[STAGE_FROM_SAMPLE] += t5 - t4;
+  }
+
+  double sampleCount = (double)periods * periodFrames * channelCount;
+  int64_t totalNs = 0;
+  for (int i = 0; i < STAGE_COUNT; i++) totalNs += stageNs[i];
+
+  printf("%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f,%.1f\n",
+    SAMPLE_FORMAT_NAME, channelCount, resamp.tapCount,
+    stageNs[STAGE_TO_SAMPLE] / sampleCount,
+    stageNs[STAGE_METER] / sampleCount,
+    stageNs[STAGE_RING] / sampleCount,
+    stageNs[STAGE_RESAMPLE] / sampleCount,
+    stageNs[STAGE_FROM_SAMPLE] / sampleCount,
+    100.0 * totalNs / (1000000000.0 * periods * periodFrames / SRC_RATE) / channelCount,
+    sizeof(sample_t) * (RESAMPLER_PHASE_COUNT + 3) * resamp.tapCount / 1024.0,
+    sizeof(sample_t) * resamp.stride * (resamp.tapCount + periodFrames) / 1024.0,
+    sizeof(sample_t) * (ring.mask + 1) * channelCount / 1024.0);
+
+  resampler_deinit(&resamp);
+  audioring_deinit(&ring);
+  free(inBuf);
+  free(outBuf);
+  free(sampleBuf);
+  return 0;
+}
+
+static int parseChannelCounts (const char *str, int *channelCounts) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_CHANNEL_COUNTS) {
+    char *end;
+    long channelCount = strtol(pos, &end, 10);
+    if (end == pos || channelCount <= 0 || channelCount > MAX_AUDIO_CHANNELS) return -1;
+    channelCounts[count++] = channelCount;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-sample-format-" SAMPLE_FORMAT_NAME " [OPTIONS]\n"
+    " -c CHANNELS  Comma separated channel counts (default %s)\n"
+    " -p FRAMES    Frames per period (default %d)\n"
+    " -n FRAMES    Ring capacity (default %d)\n"
+    " -d SECONDS   Audio per run (default %d)\n"
+    "Stage times are in ns per sample. Memory is in KB.\n",
+    DEFAULT_CHANNELS, DEFAULT_PERIOD_FRAMES, DEFAULT_RING_CAPACITY, DEFAULT_DURATION
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *channelsStr = DEFAULT_CHANNELS;
+  int periodFrames = DEFAULT_PERIOD_FRAMES;
+  int ringCapacity = DEFAULT_RING_CAPACITY;
+  int duration = DEFAULT_DURATION;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:p:n:d:h")) != -1) {
+    switch (opt) {
+      case 'c': channelsStr = optarg; break;
+      case 'p': periodFrames = atoi(optarg); break;
+      case 'n': ringCapacity = atoi(optarg); break;
+      case 'd': duration = atoi(optarg); break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int channelCounts[MAX_CHANNEL_COUNTS];
+  int channelCountCount = parseChannelCounts(channelsStr, channelCounts);
+  if (channelCountCount <= 0 || periodFrames <= 0 || ringCapacity < periodFrames || duration <= 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stderr, "sampleconv %s, meter %s, resampler %s\n", sampleconv_init(), meter_init(), resampler_initKernels());
+  meter_setFilters();
+
+  printf("format,channels,taps,to_sample_ns,meter_ns,ring_ns,resample_ns,from_sample_ns,cpu_pct_per_channel,bank_kb,history_kb,ring_kb\n");
+  for (int i = 0; i < channelCountCount; i++) {
+    if (benchChannelCount(channelCounts[i], periodFrames, ringCapacity, duration) < 0) {
+      printf("Out of memory\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,292 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// sampleconv microbenchmark. For each conversion and channel count it converts device periods of noise, first with
+// the scalar code (copied below from sampleconv.c, not inlined, with sampleToS24Packed done per sample), then with the
+// public function using the kernels picked by sampleconv_init. It checks that both give bit-identical output, exiting
+// with an error if not, and reports ns per sample for each.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "globals.h"
+#include "sampleconv.h"
+
+#define DEFAULT_CHANNELS "1,2,8,64"
+#define DEFAULT_PERIOD_FRAMES 128
+#define DEFAULT_SAMPLES 100000000 // converted per conversion and channel count
+#define MAX_CHANNEL_COUNTS 32
+
+#define S16_POS 32767.0
+#define S16_NEG 32768.0
+#define S24_POS 8388607.0
+#define S24_NEG 8388608.0
+#define S32_POS 2147483647.0
+#define S32_NEG 2147483648.0
+
+/////////////////////
+// scalar code
+/////////////////////
+
+__attribute__ ((noinline)) static void s16ToSampleScalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  sample_t *out = (sample_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = in[i];
+    out[i] = sample > 0.0 ? sample/S16_POS : sample/S16_NEG;
+  }
+}
+
+__attribute__ ((noinline)) static void s24PackedToSampleScalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  sample_t *out = (sample_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    int32_t sampleInt = 0;
+    memcpy((uint8_t *)&sampleInt + 1, &in[3*i], 3);
+    sampleInt >>= 8;
+    out[i] = sampleInt > 0 ? sampleInt/S24_POS : sampleInt/S24_NEG;
+  }
+}
+
+__attribute__ ((noinline)) static void s32ToSampleScalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  sample_t *out = (sample_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = in[i];
+    out[i] = sample > 0.0 ? sample/S32_POS : sample/S32_NEG;
+  }
+}
+
+__attribute__ ((noinline)) static void f32ToSampleScalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const float *in = (const float *)inBuf;
+  sample_t *out = (sample_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) out[i] = in[i];
+}
+
+static inline double clampSample (double sample) {
+  if (sample < -1.0) return -1.0;
+  if (sample > 1.0) return 1.0;
+  return sample;
+}
+
+__attribute__ ((noinline)) static void sampleToS24Scalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const sample_t *in = (const sample_t *)inBuf;
+  int32_t *out = (int32_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = clampSample(in[i]);
+    out[i] = sample > 0.0 ? S24_POS*sample : S24_NEG*sample;
+  }
+}
+
+__attribute__ ((noinline)) static void sampleToS24PackedScalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const sample_t *in = (const sample_t *)inBuf;
+  uint8_t *out = (uint8_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = clampSample(in[i]);
+    int32_t sampleInt = sample > 0.0 ? S24_POS*sample : S24_NEG*sample;
+    memcpy(&out[3*i], &sampleInt, 3);
+  }
+}
+
+__attribute__ ((noinline)) static void sampleToS32Scalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const sample_t *in = (const sample_t *)inBuf;
+  int32_t *out = (int32_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = clampSample(in[i]);
+    out[i] = sample > 0.0 ? S32_POS*sample : S32_NEG*sample;
+  }
+}
+
+__attribute__ ((noinline)) static void sampleToF32Scalar (const void *inBuf, void *outBuf, int sampleCount) {
+  const sample_t *in = (const sample_t *)inBuf;
+  float *out = (float *)outBuf;
+  for (int i = 0; i < sampleCount; i++) out[i] = in[i];
+}
+
+/////////////////////
+// public functions with one signature
+/////////////////////
+
+static void s16ToSample (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_s16ToSample((const int16_t *)inBuf, channelCount, (sample_t *)outBuf, channelCount, frameCount);
+}
+
+static void s24PackedToSample (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_s24PackedToSample((const uint8_t *)inBuf, channelCount, (sample_t *)outBuf, channelCount, frameCount);
+}
+
+static void s32ToSample (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_s32ToSample((const int32_t *)inBuf, channelCount, (sample_t *)outBuf, channelCount, frameCount);
+}
+
+static void f32ToSample (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_f32ToSample((const float *)inBuf, channelCount, (sample_t *)outBuf, channelCount, frameCount);
+}
+
+static void sampleToS24 (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_sampleToS24((const sample_t *)inBuf, (int32_t *)outBuf, channelCount * frameCount);
+}
+
+static void sampleToS24Packed (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_sampleToS24Packed((const sample_t *)inBuf, (uint8_t *)outBuf, channelCount * frameCount);
+}
+
+static void sampleToS32 (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_sampleToS32((const sample_t *)inBuf, channelCount, (int32_t *)outBuf, channelCount, frameCount);
+}
+
+static void sampleToF32 (const void *inBuf, void *outBuf, int channelCount, int frameCount) {
+  sampleconv_sampleToF32((const sample_t *)inBuf, channelCount, (float *)outBuf, channelCount, frameCount);
+}
+
+typedef enum { INPUT_S16, INPUT_S24_PACKED, INPUT_S32, INPUT_F32, INPUT_SAMPLE } input_t;
+
+static const struct {
+  const char *name;
+  input_t input;
+  int inSampleBytes, outSampleBytes;
+  void (*scalar)(const void *inBuf, void *outBuf, int sampleCount);
+  void (*simd)(const void *inBuf, void *outBuf, int channelCount, int frameCount);
+} conversions[] = {
+  { "s16ToSample", INPUT_S16, 2, sizeof(sample_t), s16ToSampleScalar, s16ToSample },
+  { "s24PackedToSample", INPUT_S24_PACKED, 3, sizeof(sample_t), s24PackedToSampleScalar, s24PackedToSample },
+  { "s32ToSample", INPUT_S32, 4, sizeof(sample_t), s32ToSampleScalar, s32ToSample },
+  { "f32ToSample", INPUT_F32, 4, sizeof(sample_t), f32ToSampleScalar, f32ToSample },
+  { "sampleToS24", INPUT_SAMPLE, sizeof(sample_t), 4, sampleToS24Scalar, sampleToS24 },
+  { "sampleToS24Packed", INPUT_SAMPLE, sizeof(sample_t), 3, sampleToS24PackedScalar, sampleToS24Packed },
+  { "sampleToS32", INPUT_SAMPLE, sizeof(sample_t), 4, sampleToS32Scalar, sampleToS32 },
+  { "sampleToF32", INPUT_SAMPLE, sizeof(sample_t), 4, sampleToF32Scalar, sampleToF32 }
+};
+#define CONVERSION_COUNT (int)(sizeof(conversions) / sizeof(conversions[0]))
+
+/////////////////////
+// benchmark
+/////////////////////
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+// Noise covering the whole range of each format, including full scale and, for sample_t, a little past it to clamp
+static void fillInput (input_t input, void *buf, int sampleCount) {
+  for (int i = 0; i < sampleCount; i++) {
+    double x = 2.2 * rand() / RAND_MAX - 1.1;
+    if (i == 0) x = -1.0;
+    if (i == 1) x = 1.0;
+    switch (input) {
+      case INPUT_S16: ((int16_t *)buf)[i] = x < -1.0 ? -32768 : x > 1.0 ? 32767 : (int16_t)(32767.0 * x); break;
+      case INPUT_S24_PACKED: {
+        int32_t sampleInt = x < -1.0 ? -8388608 : x > 1.0 ? 8388607 : (int32_t)(8388607.0 * x);
+        memcpy(&((uint8_t *)buf)[3*i], &sampleInt, 3);
+        break;
+      }
+      case INPUT_S32: ((int32_t *)buf)[i] = x < -1.0 ? INT32_MIN : x > 1.0 ? INT32_MAX : (int32_t)(2147483647.0 * x); break;
+      case INPUT_F32: ((float *)buf)[i] = x; break;
+      case INPUT_SAMPLE: ((sample_t *)buf)[i] = x; break;
+    }
+  }
+}
+
+// returns: 0 on success, -1 if the outputs differ or negative error code
+static int benchConversion (int c, int channelCount, int periodFrames, long samples, const char *kernelName) {
+  int periodSamples = channelCount * periodFrames;
+  long periods = samples / periodSamples;
+  uint8_t *in = (uint8_t *)malloc(conversions[c].inSampleBytes * periodSamples);
+  uint8_t *scalarOut = (uint8_t *)malloc(conversions[c].outSampleBytes * periodSamples);
+  uint8_t *simdOut = (uint8_t *)malloc(conversions[c].outSampleBytes * periodSamples);
+  if (in == NULL || scalarOut == NULL || simdOut == NULL) return -2;
+  fillInput(conversions[c].input, in, periodSamples);
+
+  int64_t startNs = getCurrentNs();
+  for (long p = 0; p < periods; p++) conversions[c].scalar(in, scalarOut, periodSamples);
+  int64_t scalarNs = getCurrentNs() - startNs;
+
+  startNs = getCurrentNs();
+  for (long p = 0; p < periods; p++) conversions[c].simd(in, simdOut, channelCount, periodFrames);
+  int64_t simdNs = getCurrentNs() - startNs;
+
+  bool identical = memcmp(scalarOut, simdOut, conversions[c].outSampleBytes * periodSamples) == 0;
+  double sampleCount = (double)periods * periodSamples;
+  printf("%s,%s,%s,%d,%d,%.3f,%.3f,%.1f,%s\n",
+    SAMPLE_FORMAT_NAME, kernelName, conversions[c].name, channelCount, periodFrames,
+    scalarNs / sampleCount, simdNs / sampleCount, (double)scalarNs / simdNs, identical ? "yes" : "no");
+
+  free(in);
+  free(scalarOut);
+  free(simdOut);
+  return identical ? 0 : -1;
+}
+
+static int parseChannelCounts (const char *str, int *channelCounts) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_CHANNEL_COUNTS) {
+    char *end;
+    long channelCount = strtol(pos, &end, 10);
+    if (end == pos || channelCount <= 0 || channelCount > MAX_AUDIO_CHANNELS) return -1;
+    channelCounts[count++] = channelCount;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./bench-sampleconv [OPTIONS]\n"
+    " -c CHANNELS  Comma separated channel counts (default %s)\n"
+    " -p FRAMES    Frames per period (default %d)\n"
+    " -m SAMPLES   Samples to convert per conversion and channel count (default %d)\n"
+    "Exits with an error if any conversion does not match the scalar code bit for bit.\n",
+    DEFAULT_CHANNELS, DEFAULT_PERIOD_FRAMES, DEFAULT_SAMPLES
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *channelsStr = DEFAULT_CHANNELS;
+  int periodFrames = DEFAULT_PERIOD_FRAMES;
+  long samples = DEFAULT_SAMPLES;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:p:m:h")) != -1) {
+    switch (opt) {
+      case 'c': channelsStr = optarg; break;
+      case 'p': periodFrames = atoi(optarg); break;
+      case 'm': samples = atol(optarg); break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int channelCounts[MAX_CHANNEL_COUNTS];
+  int channelCountCount = parseChannelCounts(channelsStr, channelCounts);
+  if (channelCountCount <= 0 || periodFrames <= 0 || samples <= 0) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  const char *kernelName = sampleconv_init();
+  int mismatchCount = 0;
+  printf("format,kernels,conversion,channels,period_frames,scalar_ns,kernel_ns,speedup,identical\n");
+  for (int c = 0; c < CONVERSION_COUNT; c++) {
+    for (int i = 0; i < channelCountCount; i++) {
+      int err = benchConversion(c, channelCounts[i], periodFrames, samples, kernelName);
+      if (err == -1) mismatchCount++;
+      else if (err < 0) return EXIT_FAILURE;
+    }
+  }
+
+  if (mismatchCount > 0) {
+    fprintf(stderr, "%d conversions did not match the scalar code\n", mismatchCount);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,380 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// Load generator for the discovery server. Virtual peers are paired up (2k looks for 2k + 1 and
+// vice versa) and spread over several local UDP sockets. For each offered load step it reports
+// response latency percentiles, loss and how many responses had the wrong addr or port.
+//
+// The server's per source rate limiter sees every virtual peer as the same host, so run the
+// server with RATE_LIMIT=0 when benchmarking.
+
+#include <stdio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#define DEFAULT_SERVER_PORT 26172
+#define DEFAULT_PEER_COUNT 2000
+#define DEFAULT_SOCKET_COUNT 8
+#define DEFAULT_STEP_DURATION 5 // seconds
+#define DEFAULT_RATES "1000,5000,10000,20000,50000"
+#define MAX_SOCKETS 256
+#define MAX_STEPS 64
+#define SEND_INTERVAL_NS 1000000 // pace sends in 1 ms bursts
+#define STEP_GRACE_NS 200000000 // wait this long for stragglers after each step
+#define PEER_EXPIRY_WARN_NS 4000000000LL // server default expiry is 5 s
+
+typedef struct {
+  uint8_t pubKey[32];
+  int sockIndex;
+  int64_t lastSendNs; // -1 if no response is outstanding
+} virtual_peer_t;
+
+typedef struct {
+  int sentCount;
+  int recvCount;
+  int incorrectCount;
+  int unexpectedCount; // responses with no outstanding request, i.e. late or duplicated
+  int64_t *latenciesNs;
+  int latencyCount;
+} step_stats_t;
+
+static virtual_peer_t *peers = NULL;
+static int peerCount = DEFAULT_PEER_COUNT;
+static int socks[MAX_SOCKETS];
+static uint16_t sockPorts[MAX_SOCKETS]; // network byte order
+static struct pollfd pfds[MAX_SOCKETS];
+static int sockCount = DEFAULT_SOCKET_COUNT;
+static struct sockaddr_in serverAddr = { 0 };
+static uint32_t expectedAddr = 0; // network byte order, 0 until learned from the first response
+
+static int64_t getCurrentNs (void) {
+  struct timespec tsp = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &tsp);
+  return 1000000000LL * tsp.tv_sec + tsp.tv_nsec;
+}
+
+static void sleepNs (int64_t ns) {
+  struct timespec tsp;
+  tsp.tv_sec = ns / 1000000000LL;
+  tsp.tv_nsec = ns % 1000000000LL;
+  nanosleep(&tsp, NULL);
+}
+
+static int compareInt64 (const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int64_t percentile (const int64_t *sorted, int count, double p) {
+  if (count == 0) return 0;
+  int index = (int)(p * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+// Keys are random apart from the peer index stored in the last 4 bytes, which lets responses
+// be matched back to a peer without a lookup table. The server treats keys as opaque so they
+// don't need to be valid x25519 points.
+static int initPeers (void) {
+  peers = (virtual_peer_t *)calloc(peerCount, sizeof(virtual_peer_t));
+  if (peers == NULL) return -1;
+
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0) return -2;
+
+  for (int i = 0; i < peerCount; i++) {
+    if (read(fd, peers[i].pubKey, 28) != 28) {
+      close(fd);
+      return -3;
+    }
+    uint32_t index = i;
+    memcpy(&peers[i].pubKey[28], &index, 4);
+    peers[i].sockIndex = i % sockCount;
+    peers[i].lastSendNs = -1;
+  }
+
+  close(fd);
+  return 0;
+}
+
+static int initSockets (void) {
+  for (int i = 0; i < sockCount; i++) {
+    socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socks[i] < 0) return -1;
+
+    int flags = fcntl(socks[i], F_GETFL);
+    if (flags < 0 || fcntl(socks[i], F_SETFL, flags | O_NONBLOCK) < 0) return -2;
+
+    int bufSize = 4 * 1024 * 1024;
+    setsockopt(socks[i], SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+
+    struct sockaddr_in bindAddr = { 0 };
+    bindAddr.sin_family = AF_INET;
+    bindAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddr.sin_port = 0;
+    if (bind(socks[i], (const struct sockaddr *)&bindAddr, sizeof(bindAddr)) < 0) return -3;
+
+    socklen_t addrLen = sizeof(bindAddr);
+    if (getsockname(socks[i], (struct sockaddr *)&bindAddr, &addrLen) < 0) return -4;
+    sockPorts[i] = bindAddr.sin_port;
+
+    pfds[i].fd = socks[i];
+    pfds[i].events = POLLIN;
+  }
+
+  // a local server sees us as loopback, otherwise learn our public addr from the first response
+  if (serverAddr.sin_addr.s_addr == htonl(INADDR_LOOPBACK)) expectedAddr = htonl(INADDR_LOOPBACK);
+
+  return 0;
+}
+
+static void sendReq (int peerIndex, int64_t nowNs) {
+  uint8_t sendBuf[65];
+  virtual_peer_t *peer = &peers[peerIndex];
+
+  memcpy(&sendBuf[0], peer->pubKey, 32);
+  memcpy(&sendBuf[32], peers[peerIndex ^ 1].pubKey, 32);
+  sendBuf[64] = 0;
+
+  sendto(socks[peer->sockIndex], sendBuf, sizeof(sendBuf), 0, (const struct sockaddr *)&serverAddr, sizeof(serverAddr));
+  peer->lastSendNs = nowNs;
+}
+
+static void handleRes (const uint8_t *buf, ssize_t len, step_stats_t *stats) {
+  if (len != 38) {
+    if (stats != NULL) stats->incorrectCount++;
+    return;
+  }
+
+  // the response carries the remote key, the requester is its partner
+  uint32_t remoteIndex;
+  memcpy(&remoteIndex, &buf[28], 4);
+  if (remoteIndex >= (uint32_t)peerCount || memcmp(buf, peers[remoteIndex].pubKey, 32) != 0) {
+    if (stats != NULL) stats->incorrectCount++;
+    return;
+  }
+
+  virtual_peer_t *peer = &peers[remoteIndex ^ 1];
+  int64_t sentNs = peer->lastSendNs;
+  peer->lastSendNs = -1;
+  if (stats == NULL) return;
+
+  if (sentNs < 0) {
+    stats->unexpectedCount++;
+    return;
+  }
+
+  stats->recvCount++;
+  stats->latenciesNs[stats->latencyCount++] = getCurrentNs() - sentNs;
+
+  uint8_t addrPort[6];
+  for (int i = 0; i < 6; i++) {
+    addrPort[i] = buf[32 + i] ^ peer->pubKey[i];
+  }
+
+  uint32_t addr;
+  uint16_t port;
+  memcpy(&addr, &addrPort[0], 4);
+  memcpy(&port, &addrPort[4], 2);
+  if (expectedAddr == 0) expectedAddr = addr;
+  if (addr != expectedAddr || port != sockPorts[peers[remoteIndex].sockIndex]) stats->incorrectCount++;
+}
+
+static void drainSockets (step_stats_t *stats) {
+  uint8_t recvBuf[1500];
+  for (int i = 0; i < sockCount; i++) {
+    while (true) {
+      ssize_t len = recv(socks[i], recvBuf, sizeof(recvBuf), 0);
+      if (len < 0) break;
+      handleRes(recvBuf, len, stats);
+    }
+  }
+}
+
+// Send requests for every peer round-robin at rate requests per second for durationNs.
+// Returns the number of requests sent.
+static int runLoad (int rate, int64_t durationNs, step_stats_t *stats) {
+  int64_t startNs = getCurrentNs();
+  int64_t nextSendNs = startNs;
+  int sentCount = 0;
+  int peerIndex = 0;
+
+  while (true) {
+    int64_t nowNs = getCurrentNs();
+    if (nowNs - startNs >= durationNs) break;
+
+    // send everything that is due since the start of the step, so pacing errors don't accumulate
+    int64_t dueCount = (nowNs - startNs) * rate / 1000000000LL + 1;
+    while (sentCount < dueCount) {
+      sendReq(peerIndex, nowNs);
+      peerIndex = (peerIndex + 1) % peerCount;
+      sentCount++;
+    }
+
+    // wait for responses until the next burst is due, so they are timestamped as soon as they arrive
+    nextSendNs += SEND_INTERVAL_NS;
+    int64_t waitNs;
+    do {
+      drainSockets(stats);
+      waitNs = nextSendNs - getCurrentNs();
+    } while (waitNs > 0 && poll(pfds, sockCount, (waitNs + 999999) / 1000000) >= 0);
+  }
+
+  return sentCount;
+}
+
+static int parseRates (const char *str, int *rates) {
+  int count = 0;
+  const char *pos = str;
+  while (*pos != '\0' && count < MAX_STEPS) {
+    char *end;
+    long rate = strtol(pos, &end, 10);
+    if (end == pos || rate <= 0) return -1;
+    rates[count++] = rate;
+    pos = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void printUsage (void) {
+  printf(
+    "Usage: ./waterslide-ds-bench [OPTIONS]\n"
+    " -a ADDR     Discovery server IPv4 addr (default 127.0.0.1)\n"
+    " -p PORT     Discovery server port (default %d)\n"
+    " -n PEERS    Number of virtual peers, rounded up to even (default %d)\n"
+    " -s SOCKETS  Number of local UDP sockets (default %d, max %d)\n"
+    " -r RATES    Comma separated offered loads in requests per second (default %s)\n"
+    " -d SECONDS  Duration of each load step (default %d)\n"
+    " -o FILE     Write the CSV report to FILE instead of stdout\n"
+    "Run the server with RATE_LIMIT=0, as all virtual peers share one source addr.\n",
+    DEFAULT_SERVER_PORT, DEFAULT_PEER_COUNT, DEFAULT_SOCKET_COUNT, MAX_SOCKETS, DEFAULT_RATES, DEFAULT_STEP_DURATION
+  );
+}
+
+int main (int argc, char *argv[]) {
+  const char *addrStr = "127.0.0.1";
+  const char *ratesStr = DEFAULT_RATES;
+  const char *outPath = NULL;
+  int serverPort = DEFAULT_SERVER_PORT;
+  int stepDuration = DEFAULT_STEP_DURATION;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "a:p:n:s:r:d:o:h")) != -1) {
+    switch (opt) {
+      case 'a': addrStr = optarg; break;
+      case 'p': serverPort = atoi(optarg); break;
+      case 'n': peerCount = atoi(optarg); break;
+      case 's': sockCount = atoi(optarg); break;
+      case 'r': ratesStr = optarg; break;
+      case 'd': stepDuration = atoi(optarg); break;
+      case 'o': outPath = optarg; break;
+      default:
+        printUsage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  int rates[MAX_STEPS];
+  int stepCount = parseRates(ratesStr, rates);
+  peerCount += peerCount % 2;
+  if (
+    stepCount <= 0 || peerCount < 2 || sockCount < 1 || sockCount > MAX_SOCKETS ||
+    stepDuration <= 0 || serverPort <= 0 || serverPort > 65535
+  ) {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  serverAddr.sin_family = AF_INET;
+  serverAddr.sin_port = htons(serverPort);
+  if (inet_pton(AF_INET, addrStr, &serverAddr.sin_addr) != 1) {
+    printf("Invalid server addr %s\n", addrStr);
+    return EXIT_FAILURE;
+  }
+
+  if (initPeers() < 0 || initSockets() < 0) {
+    printf("Init failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  FILE *out = stdout;
+  if (outPath != NULL) {
+    out = fopen(outPath, "w");
+    if (out == NULL) {
+      printf("Could not open %s\n", outPath);
+      return EXIT_FAILURE;
+    }
+  }
+
+  fprintf(stderr, "%d virtual peers on %d sockets, server %s:%d\n", peerCount, sockCount, addrStr, serverPort);
+
+  // Warm up: register every peer twice so that both sides of each pair are known to the server
+  // before anything is measured.
+  int warmupRate = rates[0] > peerCount ? rates[0] : peerCount;
+  runLoad(warmupRate, 2000000000LL * peerCount / warmupRate + 1, NULL);
+  sleepNs(STEP_GRACE_NS);
+  drainSockets(NULL);
+  for (int i = 0; i < peerCount; i++) peers[i].lastSendNs = -1;
+
+  fprintf(out, "offered_rate,achieved_rate,sent,received,loss_pct,incorrect,unexpected,p50_us,p90_us,p99_us,p999_us,max_us\n");
+
+  for (int step = 0; step < stepCount; step++) {
+    int rate = rates[step];
+    if (1000000000LL * peerCount / rate > PEER_EXPIRY_WARN_NS) {
+      fprintf(stderr, "Warning: at %d req/s each peer only sends every %lld ms, peers may expire on the server\n",
+        rate, 1000LL * peerCount / rate);
+    }
+
+    step_stats_t stats = { 0 };
+    // one latency slot per request plus a margin for pacing overshoot
+    stats.latenciesNs = (int64_t *)calloc((size_t)rate * stepDuration + peerCount + 1024, sizeof(int64_t));
+    if (stats.latenciesNs == NULL) return EXIT_FAILURE;
+
+    fprintf(stderr, "Step %d: %d req/s for %d s\n", step + 1, rate, stepDuration);
+    int64_t startNs = getCurrentNs();
+    stats.sentCount = runLoad(rate, 1000000000LL * stepDuration, &stats);
+    double elapsedS = (getCurrentNs() - startNs) / 1e9;
+
+    // collect responses still in flight, anything later than this counts as lost
+    int64_t graceEndNs = getCurrentNs() + STEP_GRACE_NS;
+    while (getCurrentNs() < graceEndNs) {
+      drainSockets(&stats);
+      poll(pfds, sockCount, SEND_INTERVAL_NS / 1000000);
+    }
+    for (int i = 0; i < peerCount; i++) peers[i].lastSendNs = -1;
+
+    qsort(stats.latenciesNs, stats.latencyCount, sizeof(int64_t), compareInt64);
+    int lostCount = stats.sentCount - stats.recvCount;
+    fprintf(out, "%d,%.0f,%d,%d,%.3f,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+      rate,
+      stats.sentCount / elapsedS,
+      stats.sentCount,
+      stats.recvCount,
+      stats.sentCount > 0 ? 100.0 * lostCount / stats.sentCount : 0.0,
+      stats.incorrectCount,
+      stats.unexpectedCount,
+      percentile(stats.latenciesNs, stats.latencyCount, 0.5) / 1e3,
+      percentile(stats.latenciesNs, stats.latencyCount, 0.9) / 1e3,
+      percentile(stats.latenciesNs, stats.latencyCount, 0.99) / 1e3,
+      percentile(stats.latenciesNs, stats.latencyCount, 0.999) / 1e3,
+      stats.latencyCount > 0 ? stats.latenciesNs[stats.latencyCount - 1] / 1e3 : 0.0
+    );
+    fflush(out);
+
+    free(stats.latenciesNs);
+  }
+
+  if (out != stdout) fclose(out);
+  return EXIT_SUCCESS;
+}
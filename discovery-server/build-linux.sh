@@ -1,3 +1,4 @@
 #!/bin/bash
 
-clang -std=gnu17 -O3 -fstrict-aliasing -pedantic -pedantic-errors -Wall -Wextra main.c -o waterslide-ds-linux
+clang -std=gnu17 -O3 -fstrict-aliasing -pedantic -pedantic-errors -Wall -Wextra -pthread main.c -o waterslide-ds-linux
+clang -std=gnu17 -O3 -fstrict-aliasing -pedantic -pedantic-errors -Wall -Wextra bench.c -o waterslide-ds-bench-linux
@@ -3,15 +3,21 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at https://mozilla.org/MPL/2.0/.
 
+#if defined(__linux__)
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#endif
+
 #include <stdio.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <stdatomic.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <time.h>
 
 // Request format - length 65
@@ -20,27 +26,93 @@
 // 32     | remotePubKey
 // 64     | endpointIndex
 
-// Response format - length 38
+// Response format - length 38 for requests received over IPv4
 // offset | fieldName
 // 0      | remotePubKey
 // 32     | remoteAddr
 // 36     | remotePort
 
+// Response format - length 50 for requests received over IPv6
+// offset | fieldName
+// 0      | remotePubKey
+// 32     | remoteAddr
+// 48     | remotePort
+
+// The server binds a dual-stack socket. A request is answered with the remote peer's address
+// in the same family the request came in on.
+
+// Peers live in fixed pools split into shards. Each shard has an open-addressing hash table
+// keyed by public key that maps to pool indices, and a timer wheel that tracks when each peer
+// expires, so handling a request does not depend on how many peers are registered.
+// Worker threads each have their own SO_REUSEPORT socket and only ever hold one shard lock at a time.
+// Rate limit buckets are shared by all workers, sharded the same way, so a source address gets RATE_LIMIT requests
+// per second in total whichever workers the kernel spreads its requests over.
+
 #define SERVER_BIND_PORT 26172
-#define MAX_PEERS 1000
+#define PEER_CAPACITY 100000
 #define MAX_ENDPOINTS 5
 #define PEER_EXPIRY_TIME 5000000 // microseconds
 #define RECV_LOOP_IDLE_INTERVAL 1 // second
+#define WHEEL_TICK_MS 10
+#define WHEEL_SLOT_COUNT 1024 // must be a power of 2
+#define SHARD_COUNT 64 // must be a power of 2
+#define SWEEP_INTERVAL_MS 1000
+#define NO_PEER UINT32_MAX
+// Requests per second per source address, across all workers. 0 disables rate limiting. Each waterslide endpoint
+// sends one request per second per address family, so this leaves room for a few hundred peers behind one CGNAT address.
+#define RATE_LIMIT 1000
+#define RATE_BUCKET_COUNT 65536 // must be a power of 2
+#define RATE_SHARD_COUNT 64 // must be a power of 2
+#define BATCH_SIZE 64
+#define RECV_BUF_LEN 128 // anything longer than a request is dropped anyway
+#define MAX_RES_LEN 50
 
 typedef struct {
   uint8_t myPubKey[32];
   struct sockaddr_in myAddrs[MAX_ENDPOINTS];
-  int lastUpdatedUTime;
+  struct sockaddr_in6 myAddrs6[MAX_ENDPOINTS];
+  uint64_t expiryMs;
+  // timer wheel slot list, or the free list when the peer is not in use
+  uint32_t prev, next;
 } peer_t;
 
-static peer_t peerList[MAX_PEERS] = { 0 };
-static atomic_int serverSock = -1;
+typedef struct {
+  pthread_mutex_t lock;
+  peer_t *peers;
+  uint32_t freeList;
+  uint32_t *hashSlots; // peer index + 1, 0 is empty
+  uint32_t hashMask;
+  uint32_t wheel[WHEEL_SLOT_COUNT];
+  uint64_t wheelTick; // all slots before this tick have been expired
+} shard_t;
+
+// Token bucket. Tokens are in thousandths of a request so refill works at ms resolution.
+typedef struct {
+  uint64_t tag;
+  uint64_t lastRefillMs;
+  uint32_t tokens;
+} rate_bucket_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  rate_bucket_t *buckets; // RATE_BUCKET_COUNT / RATE_SHARD_COUNT
+} rate_shard_t;
+
+typedef struct {
+  int index;
+  int sock;
+  pthread_t thread;
+  uint64_t lastSweepMs;
+} worker_t;
+
+static shard_t shards[SHARD_COUNT];
+static rate_shard_t rateShards[RATE_SHARD_COUNT];
+static uint64_t hashSeed = 0;
+static worker_t *workers = NULL;
+static int workerCount = 1;
 static int peerExpiryTime = PEER_EXPIRY_TIME;
+static int peerCapacity = PEER_CAPACITY;
+static int rateLimit = RATE_LIMIT;
 
 void utils_usleep (unsigned int us) {
   #if defined(__linux__) || defined(__ANDROID__)
@@ -53,159 +125,565 @@ void utils_usleep (unsigned int us) {
   #endif
 }
 
-// rollover is 1000 seconds (< 2^30 microseconds)
-int utils_getCurrentUTime (void) {
+// Unlike the waterslide utils_getCurrentUTime, this does not roll over
+static uint64_t getCurrentMs (void) {
   struct timespec tsp = { 0 };
   // NOTE: CLOCK_MONOTONIC has been observed to jump backwards on macOS https://discussions.apple.com/thread/253778121
   clock_gettime(CLOCK_MONOTONIC_RAW, &tsp);
-  return 1000000 * (tsp.tv_sec % 1000) + (tsp.tv_nsec / 1000);
+  return 1000 * (uint64_t)tsp.tv_sec + tsp.tv_nsec / 1000000;
 }
 
-int utils_getElapsedUTime (int lastUTime) {
-  int intervalUTime = utils_getCurrentUTime() - lastUTime;
-  // handle overflow
-  return intervalUTime < 0 ? intervalUTime + 1000000000 : intervalUTime;
+static bool pubKeyMatch (const uint8_t *key1, const uint8_t *key2) {
+  return memcmp(key1, key2, 32) == 0;
 }
 
-static bool pubKeyMatch (const uint8_t *key1, const uint8_t *key2) {
-  for (int i = 0; i < 32; i++) {
-    if (key1[i] != key2[i]) return false;
+static int readEnvInt (const char *name, int defaultValue) {
+  char *str = getenv(name);
+  if (str == NULL) return defaultValue;
+
+  char *end;
+  int value = strtol(str, &end, 10);
+  return end == str ? defaultValue : value;
+}
+
+/////////////////////
+// hash table
+/////////////////////
+
+// Keys come straight off the network, so they are mixed with a random seed to stop a client
+// from choosing keys that all land in the same probe sequence.
+static uint64_t hashBytes (const uint8_t *buf, int len) {
+  uint64_t h = hashSeed;
+  for (int i = 0; i < len; i += 8) {
+    uint64_t word = 0;
+    memcpy(&word, &buf[i], len - i < 8 ? len - i : 8);
+    h = (h ^ word) * 0x9e3779b97f4a7c15;
+    h ^= h >> 32;
   }
-  return true;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9;
+  h ^= h >> 32;
+  return h;
 }
 
-static void sendRes (const struct sockaddr_in *yourAddr, const struct sockaddr_in *remoteAddr, const uint8_t *myPubKey, const uint8_t *remotePubKey) {
-  static uint8_t sendBuf[38];
+// The low bits pick the hash slot and the high bits pick the shard
+static uint32_t hashKey (const uint8_t *key) {
+  return (uint32_t)hashBytes(key, 32);
+}
 
-  memcpy(&sendBuf[0], remotePubKey, 32);
-  memcpy(&sendBuf[32], &remoteAddr->sin_addr.s_addr, 4);
-  memcpy(&sendBuf[36], &remoteAddr->sin_port, 2);
+static shard_t *getShard (const uint8_t *key) {
+  return &shards[(hashBytes(key, 32) >> 58) & (SHARD_COUNT - 1)];
+}
 
-  for (int i = 0; i < 6; i++) {
-    // XOR remoteAddr with myPubKey
-    sendBuf[32 + i] ^= myPubKey[i];
+static uint32_t hashFind (shard_t *shard, const uint8_t *key) {
+  for (uint32_t pos = hashKey(key) & shard->hashMask; shard->hashSlots[pos] != 0; pos = (pos + 1) & shard->hashMask) {
+    uint32_t peerIndex = shard->hashSlots[pos] - 1;
+    if (pubKeyMatch(key, shard->peers[peerIndex].myPubKey)) return peerIndex;
+  }
+  return NO_PEER;
+}
+
+// key must not already be in the table
+static void hashInsert (shard_t *shard, uint32_t peerIndex) {
+  uint32_t pos = hashKey(shard->peers[peerIndex].myPubKey) & shard->hashMask;
+  while (shard->hashSlots[pos] != 0) pos = (pos + 1) & shard->hashMask;
+  shard->hashSlots[pos] = peerIndex + 1;
+}
+
+static void hashRemove (shard_t *shard, uint32_t peerIndex) {
+  uint32_t mask = shard->hashMask;
+  uint32_t pos = hashKey(shard->peers[peerIndex].myPubKey) & mask;
+  while (shard->hashSlots[pos] != peerIndex + 1) pos = (pos + 1) & mask;
+
+  // Backward shift deletion: pull later entries of the probe sequence back into the gap
+  // so that lookups never need tombstones.
+  uint32_t gap = pos;
+  for (pos = (gap + 1) & mask; shard->hashSlots[pos] != 0; pos = (pos + 1) & mask) {
+    uint32_t home = hashKey(shard->peers[shard->hashSlots[pos] - 1].myPubKey) & mask;
+    // move the entry if its home slot is not cyclically within (gap, pos]
+    if (((pos - home) & mask) >= ((pos - gap) & mask)) {
+      shard->hashSlots[gap] = shard->hashSlots[pos];
+      gap = pos;
+    }
   }
+  shard->hashSlots[gap] = 0;
+}
+
+/////////////////////
+// timer wheel
+/////////////////////
+
+static void wheelUnlink (shard_t *shard, uint32_t peerIndex) {
+  peer_t *peer = &shard->peers[peerIndex];
+  if (peer->prev != NO_PEER) {
+    shard->peers[peer->prev].next = peer->next;
+  } else {
+    shard->wheel[(peer->expiryMs / WHEEL_TICK_MS) & (WHEEL_SLOT_COUNT - 1)] = peer->next;
+  }
+  if (peer->next != NO_PEER) shard->peers[peer->next].prev = peer->prev;
+}
 
-  sendto(serverSock, sendBuf, sizeof(sendBuf), 0, (struct sockaddr*)yourAddr, sizeof(struct sockaddr_in));
+static void wheelLink (shard_t *shard, uint32_t peerIndex) {
+  peer_t *peer = &shard->peers[peerIndex];
+  uint32_t *head = &shard->wheel[(peer->expiryMs / WHEEL_TICK_MS) & (WHEEL_SLOT_COUNT - 1)];
+  peer->prev = NO_PEER;
+  peer->next = *head;
+  if (*head != NO_PEER) shard->peers[*head].prev = peerIndex;
+  *head = peerIndex;
 }
 
-static void removePeerIfExpired (peer_t *peer) {
-  if (utils_getElapsedUTime(peer->lastUpdatedUTime) >= peerExpiryTime) {
-    // Zero out everything for a bit more safety.
-    memset(peer->myPubKey, 0, 32);
-    for (int j = 0; j < MAX_ENDPOINTS; j++) {
-      memset(&peer->myAddrs[j], 0, sizeof(struct sockaddr_in));
+static void removePeer (shard_t *shard, uint32_t peerIndex) {
+  peer_t *peer = &shard->peers[peerIndex];
+  wheelUnlink(shard, peerIndex);
+  hashRemove(shard, peerIndex);
+
+  // Zero out everything for a bit more safety.
+  memset(peer, 0, sizeof(peer_t));
+  peer->next = shard->freeList;
+  shard->freeList = peerIndex;
+}
+
+// Expire every peer in the slots that have fully passed since the last call. Slots are shared by
+// every expiry time that is a multiple of the wheel span apart, so each entry is checked before removal.
+// Caller must hold shard->lock.
+static void expirePeers (shard_t *shard, uint64_t nowMs) {
+  uint64_t nowTick = nowMs / WHEEL_TICK_MS;
+  if (nowTick <= shard->wheelTick) return;
+
+  // after a long idle period every slot is due, so one lap is enough
+  uint64_t firstTick = nowTick - shard->wheelTick > WHEEL_SLOT_COUNT ? nowTick - WHEEL_SLOT_COUNT : shard->wheelTick;
+  for (uint64_t tick = firstTick; tick < nowTick; tick++) {
+    uint32_t peerIndex = shard->wheel[tick & (WHEEL_SLOT_COUNT - 1)];
+    while (peerIndex != NO_PEER) {
+      uint32_t next = shard->peers[peerIndex].next;
+      if (shard->peers[peerIndex].expiryMs <= nowMs) removePeer(shard, peerIndex);
+      peerIndex = next;
     }
-    peer->lastUpdatedUTime = -1;
   }
+
+  shard->wheelTick = nowTick;
+}
+
+/////////////////////
+// requests
+/////////////////////
+
+// Requests over IPv4 arrive as v4-mapped addrs on the dual-stack socket. Returns true and fills
+// addr4Out if addr is IPv4.
+static bool toIPv4Addr (const struct sockaddr_storage *addr, struct sockaddr_in *addr4Out) {
+  if (addr->ss_family == AF_INET) {
+    memcpy(addr4Out, addr, sizeof(struct sockaddr_in));
+    return true;
+  }
+
+  const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr;
+  if (addr->ss_family != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr)) return false;
+
+  memset(addr4Out, 0, sizeof(struct sockaddr_in));
+  addr4Out->sin_family = AF_INET;
+  addr4Out->sin_port = addr6->sin6_port;
+  memcpy(&addr4Out->sin_addr.s_addr, &addr6->sin6_addr.s6_addr[12], 4);
+  return true;
 }
 
-static void handleReq (const uint8_t *buf, ssize_t bufLen, const struct sockaddr_in *addr) {
-  if (bufLen != 65) return;
-  if (addr->sin_family != AF_INET) return; // No IPv6 support yet.
+static socklen_t addrLen (const struct sockaddr_storage *addr) {
+  return addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+// Returns false if the source address has used up its tokens. Buckets are direct mapped, so two
+// sources that collide share a bucket until one of them evicts the other.
+static bool rateLimitAllow (const struct sockaddr_storage *addr, uint64_t nowMs) {
+  if (rateLimit <= 0) return true;
+
+  // key on the host only, a client can pick any source port it likes
+  uint64_t tag;
+  if (addr->ss_family == AF_INET6) {
+    tag = hashBytes(((const struct sockaddr_in6 *)addr)->sin6_addr.s6_addr, 16);
+  } else {
+    tag = hashBytes((const uint8_t *)&((const struct sockaddr_in *)addr)->sin_addr.s_addr, 4);
+  }
+
+  uint32_t maxTokens = 1000 * (uint32_t)rateLimit; // allow a burst of one second worth of requests
+  uint32_t bucketIndex = tag & (RATE_BUCKET_COUNT - 1);
+  rate_shard_t *rateShard = &rateShards[bucketIndex & (RATE_SHARD_COUNT - 1)];
+  pthread_mutex_lock(&rateShard->lock);
+
+  rate_bucket_t *bucket = &rateShard->buckets[bucketIndex / RATE_SHARD_COUNT];
+  if (bucket->tag != tag) {
+    bucket->tag = tag;
+    bucket->tokens = maxTokens;
+  } else {
+    // Workers read the clock before taking the lock, so nowMs can be a little behind lastRefillMs
+    uint64_t refill = nowMs > bucket->lastRefillMs ? (nowMs - bucket->lastRefillMs) * rateLimit : 0;
+    bucket->tokens = refill >= maxTokens - bucket->tokens ? maxTokens : bucket->tokens + refill;
+  }
+  if (nowMs > bucket->lastRefillMs) bucket->lastRefillMs = nowMs;
+
+  bool allow = bucket->tokens >= 1000;
+  if (allow) bucket->tokens -= 1000;
+  pthread_mutex_unlock(&rateShard->lock);
+  return allow;
+}
+
+static int buildRes (uint8_t *resBuf, const uint8_t *remoteAddr, int remoteAddrLen, uint16_t remotePort, const uint8_t *myPubKey, const uint8_t *remotePubKey) {
+  memcpy(&resBuf[0], remotePubKey, 32);
+  memcpy(&resBuf[32], remoteAddr, remoteAddrLen);
+  memcpy(&resBuf[32 + remoteAddrLen], &remotePort, 2);
+
+  for (int i = 0; i < remoteAddrLen + 2; i++) {
+    // XOR remoteAddr with myPubKey
+    resBuf[32 + i] ^= myPubKey[i];
+  }
+
+  return 32 + remoteAddrLen + 2;
+}
+
+// Writes the response to resBuf and returns its length, or returns 0 if there is nothing to send.
+static int handleReq (const uint8_t *buf, ssize_t bufLen, const struct sockaddr_storage *addr, uint64_t nowMs, uint8_t *resBuf) {
+  if (bufLen != 65) return 0;
+
+  struct sockaddr_in addr4;
+  bool isIPv4 = toIPv4Addr(addr, &addr4);
+  if (!isIPv4 && addr->ss_family != AF_INET6) return 0;
 
   const uint8_t *myPubKey = &buf[0];
   const uint8_t *remotePubKey = &buf[32];
   int endpointIndex = buf[64];
 
-  if (endpointIndex >= MAX_ENDPOINTS) return;
+  if (endpointIndex >= MAX_ENDPOINTS) return 0;
+
+  shard_t *shard = getShard(myPubKey);
+  pthread_mutex_lock(&shard->lock);
+  expirePeers(shard, nowMs);
+
+  uint32_t peerIndex = hashFind(shard, myPubKey);
+  if (peerIndex != NO_PEER) {
+    // myPubKey is already in the table, move its expiry
+    wheelUnlink(shard, peerIndex);
+  } else if (shard->freeList != NO_PEER) {
+    // Insert a new entry for myPubKey
+    peerIndex = shard->freeList;
+    shard->freeList = shard->peers[peerIndex].next;
+    memcpy(shard->peers[peerIndex].myPubKey, myPubKey, 32);
+    hashInsert(shard, peerIndex);
+  }
+
+  if (peerIndex != NO_PEER) {
+    // update its address and port
+    peer_t *peer = &shard->peers[peerIndex];
+    if (isIPv4) {
+      memcpy(&peer->myAddrs[endpointIndex], &addr4, sizeof(struct sockaddr_in));
+    } else {
+      memcpy(&peer->myAddrs6[endpointIndex], addr, sizeof(struct sockaddr_in6));
+    }
+    peer->expiryMs = nowMs + peerExpiryTime / 1000;
+    wheelLink(shard, peerIndex);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  int resLen = 0;
+  shard = getShard(remotePubKey);
+  pthread_mutex_lock(&shard->lock);
+  expirePeers(shard, nowMs);
+
+  uint32_t remoteIndex = hashFind(shard, remotePubKey);
+  if (remoteIndex != NO_PEER) {
+    // We found the remotePubKey the requester was looking for!
+    peer_t *remote = &shard->peers[remoteIndex];
+    if (isIPv4 && remote->myAddrs[endpointIndex].sin_family != 0) {
+      const struct sockaddr_in *remoteAddr = &remote->myAddrs[endpointIndex];
+      resLen = buildRes(resBuf, (const uint8_t *)&remoteAddr->sin_addr.s_addr, 4, remoteAddr->sin_port, myPubKey, remotePubKey);
+    } else if (!isIPv4 && remote->myAddrs6[endpointIndex].sin6_family != 0) {
+      const struct sockaddr_in6 *remoteAddr = &remote->myAddrs6[endpointIndex];
+      resLen = buildRes(resBuf, remoteAddr->sin6_addr.s6_addr, 16, remoteAddr->sin6_port, myPubKey, remotePubKey);
+    }
+  }
 
-  int insertIndex = -1;
-  bool entryUpdated = false;
-  for (int i = 0; i < MAX_PEERS; i++) {
-    peer_t *peer = &peerList[i];
+  pthread_mutex_unlock(&shard->lock);
+  return resLen;
+}
+
+// Shards are expired whenever a request touches them, this catches the ones that haven't been touched.
+static void sweepShards (worker_t *worker, uint64_t nowMs) {
+  if (nowMs - worker->lastSweepMs < SWEEP_INTERVAL_MS) return;
+  worker->lastSweepMs = nowMs;
+
+  for (int i = worker->index; i < SHARD_COUNT; i += workerCount) {
+    pthread_mutex_lock(&shards[i].lock);
+    expirePeers(&shards[i], nowMs);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+}
 
-    if (peer->lastUpdatedUTime == -1) {
-      insertIndex = i;
+/////////////////////
+// threads
+/////////////////////
+
+#if defined(__linux__)
+
+static void *workerLoop (void *arg) {
+  worker_t *worker = (worker_t *)arg;
+
+  // static would be shared between workers, and this is too big for the stack
+  struct {
+    struct mmsghdr recvMsgs[BATCH_SIZE], sendMsgs[BATCH_SIZE];
+    struct iovec recvIovs[BATCH_SIZE], sendIovs[BATCH_SIZE];
+    struct sockaddr_storage recvAddrs[BATCH_SIZE];
+    uint8_t recvBufs[BATCH_SIZE][RECV_BUF_LEN];
+    uint8_t sendBufs[BATCH_SIZE][MAX_RES_LEN];
+  } *batch = calloc(1, sizeof(*batch));
+  if (batch == NULL) return NULL;
+
+  for (int i = 0; i < BATCH_SIZE; i++) {
+    batch->recvIovs[i].iov_base = batch->recvBufs[i];
+    batch->recvIovs[i].iov_len = RECV_BUF_LEN;
+    batch->recvMsgs[i].msg_hdr.msg_iov = &batch->recvIovs[i];
+    batch->recvMsgs[i].msg_hdr.msg_iovlen = 1;
+    batch->recvMsgs[i].msg_hdr.msg_name = &batch->recvAddrs[i];
+    batch->sendIovs[i].iov_base = batch->sendBufs[i];
+    batch->sendMsgs[i].msg_hdr.msg_iov = &batch->sendIovs[i];
+    batch->sendMsgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (true) {
+    for (int i = 0; i < BATCH_SIZE; i++) {
+      batch->recvMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    // MSG_WAITFORONE: block for the first datagram, then take whatever else is already queued
+    int recvCount = recvmmsg(worker->sock, batch->recvMsgs, BATCH_SIZE, MSG_WAITFORONE, NULL);
+    uint64_t nowMs = getCurrentMs();
+
+    if (recvCount < 0) {
+      // If recv failed, ignore it but wait a bit first. On timeout, just do periodic cleanup.
+      if (errno != EAGAIN && errno != EWOULDBLOCK) utils_usleep(10000);
+      sweepShards(worker, nowMs);
       continue;
     }
 
-    if (pubKeyMatch(myPubKey, peer->myPubKey)) {
-      // myPubKey is already in the peerList, update its address and port
-      memcpy(&peer->myAddrs[endpointIndex], addr, sizeof(struct sockaddr_in));
-      peer->lastUpdatedUTime = utils_getCurrentUTime();
-      entryUpdated = true;
+    int sendCount = 0;
+    for (int i = 0; i < recvCount; i++) {
+      struct sockaddr_storage *recvAddr = &batch->recvAddrs[i];
+      if (batch->recvMsgs[i].msg_hdr.msg_namelen != addrLen(recvAddr)) continue;
+      if (!rateLimitAllow(recvAddr, nowMs)) continue;
+
+      int resLen = handleReq(batch->recvBufs[i], batch->recvMsgs[i].msg_len, recvAddr, nowMs, batch->sendBufs[sendCount]);
+      if (resLen == 0) continue;
+
+      batch->sendIovs[sendCount].iov_base = batch->sendBufs[sendCount];
+      batch->sendIovs[sendCount].iov_len = resLen;
+      batch->sendMsgs[sendCount].msg_hdr.msg_name = recvAddr;
+      batch->sendMsgs[sendCount].msg_hdr.msg_namelen = addrLen(recvAddr);
+      sendCount++;
     }
 
-    if (pubKeyMatch(remotePubKey, peer->myPubKey)) {
-      // We found the remotePubKey the requester was looking for!
-      if (peer->myAddrs[endpointIndex].sin_family != 0) {
-        sendRes(addr, &peer->myAddrs[endpointIndex], myPubKey, remotePubKey);
-      }
+    for (int sent = 0; sent < sendCount;) {
+      int result = sendmmsg(worker->sock, &batch->sendMsgs[sent], sendCount - sent, 0);
+      // skip the datagram that failed, the client will retry
+      sent += result > 0 ? result : 1;
     }
 
-    removePeerIfExpired(peer);
+    sweepShards(worker, nowMs);
   }
 
-  if (!entryUpdated && insertIndex != -1) {
-    // Insert a new entry for myPubKey
-    memcpy(peerList[insertIndex].myPubKey, myPubKey, 32);
-    memcpy(&peerList[insertIndex].myAddrs[endpointIndex], addr, sizeof(struct sockaddr_in));
-    peerList[insertIndex].lastUpdatedUTime = utils_getCurrentUTime();
+  return NULL;
+}
+
+#else
+
+// No recvmmsg, and SO_REUSEPORT does not load balance unicast outside Linux, so there is only one worker.
+static void *workerLoop (void *arg) {
+  worker_t *worker = (worker_t *)arg;
+  static uint8_t recvBuf[RECV_BUF_LEN] = { 0 };
+  static uint8_t sendBuf[MAX_RES_LEN] = { 0 };
+  static struct sockaddr_storage recvAddr = { 0 };
+
+  while (true) {
+    socklen_t recvAddrLen = sizeof(recvAddr);
+    ssize_t recvLen = recvfrom(worker->sock, recvBuf, sizeof(recvBuf), 0, (struct sockaddr*)&recvAddr, &recvAddrLen);
+    uint64_t nowMs = getCurrentMs();
+
+    if (recvLen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Timeout reached, do periodic cleanup
+      sweepShards(worker, nowMs);
+      continue;
+    }
+
+    // If recv failed, ignore it but wait a bit first
+    if (recvLen < 0 || recvAddrLen != addrLen(&recvAddr)) {
+      utils_usleep(10000);
+      continue;
+    }
+
+    if (rateLimitAllow(&recvAddr, nowMs)) {
+      int resLen = handleReq(recvBuf, recvLen, &recvAddr, nowMs, sendBuf);
+      if (resLen > 0) sendto(worker->sock, sendBuf, resLen, 0, (struct sockaddr*)&recvAddr, addrLen(&recvAddr));
+    }
+
+    sweepShards(worker, nowMs);
   }
+
+  return NULL;
 }
 
-int main (void) {
-  static uint8_t recvBuf[1500] = { 0 };
-  static struct sockaddr_in recvAddr = { 0 };
+#endif
+
+/////////////////////
+// init
+/////////////////////
+
+static int initPeerTable (void) {
+  int shardCapacity = (peerCapacity + SHARD_COUNT - 1) / SHARD_COUNT;
+
+  // keep the load factor at or below 0.5 so probe sequences stay short
+  uint32_t hashSlotCount = 1;
+  while (hashSlotCount < 2 * (uint32_t)shardCapacity) hashSlotCount <<= 1;
 
-  printf("Waterslide discovery server, build 4\n");
+  uint64_t nowMs = getCurrentMs();
+  for (int s = 0; s < SHARD_COUNT; s++) {
+    shard_t *shard = &shards[s];
+    if (pthread_mutex_init(&shard->lock, NULL) != 0) return -1;
 
-  char *peerExpiryTimeStr = getenv("PEER_EXPIRY_TIME");
-  if (peerExpiryTimeStr != NULL) {
-    char *end;
-    peerExpiryTime = strtol(peerExpiryTimeStr, &end, 10);
-    if (end == peerExpiryTimeStr) peerExpiryTime = PEER_EXPIRY_TIME;
+    shard->hashMask = hashSlotCount - 1;
+    shard->peers = (peer_t *)calloc(shardCapacity, sizeof(peer_t));
+    shard->hashSlots = (uint32_t *)calloc(hashSlotCount, sizeof(uint32_t));
+    if (shard->peers == NULL || shard->hashSlots == NULL) return -2;
+
+    for (int i = 0; i < shardCapacity; i++) {
+      shard->peers[i].next = i + 1 < shardCapacity ? (uint32_t)i + 1 : NO_PEER;
+    }
+    shard->freeList = 0;
+
+    for (int i = 0; i < WHEEL_SLOT_COUNT; i++) shard->wheel[i] = NO_PEER;
+    shard->wheelTick = nowMs / WHEEL_TICK_MS;
   }
 
-  printf("PEER_EXPIRY_TIME = %d\n", peerExpiryTime);
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0 || read(fd, &hashSeed, sizeof(hashSeed)) != sizeof(hashSeed)) {
+    hashSeed = nowMs ^ ((uint64_t)getpid() << 32);
+  }
+  if (fd >= 0) close(fd);
 
-  serverSock = socket(AF_INET, SOCK_DGRAM, 0);
-  if (serverSock < 0) {
-    printf("socket() failed.\n");
-    return EXIT_FAILURE;
+  return 0;
+}
+
+static int initRateShards (void) {
+  for (int s = 0; s < RATE_SHARD_COUNT; s++) {
+    rate_shard_t *rateShard = &rateShards[s];
+    if (pthread_mutex_init(&rateShard->lock, NULL) != 0) return -1;
+    rateShard->buckets = (rate_bucket_t *)calloc(RATE_BUCKET_COUNT / RATE_SHARD_COUNT, sizeof(rate_bucket_t));
+    if (rateShard->buckets == NULL) return -2;
+  }
+  return 0;
+}
+
+// Returns the socket, or -1 on failure. Falls back to IPv4 only if the host has no IPv6 support.
+static int openServerSocket (bool *dualStack) {
+  *dualStack = true;
+  int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+  if (sock >= 0) {
+    int v6Only = 0;
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only)) < 0) {
+      close(sock);
+      sock = -1;
+    }
+  }
+  if (sock < 0) {
+    *dualStack = false;
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+  }
+  if (sock < 0) return -1;
+
+  // every worker binds its own socket to the same port and the kernel spreads datagrams between them
+  int reusePort = 1;
+  if (workerCount > 1 && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) < 0) {
+    close(sock);
+    return -1;
   }
 
   // Set recv timeout so we can still remove expired peers when no packets are being received.
   struct timeval tv;
   tv.tv_sec = RECV_LOOP_IDLE_INTERVAL;
   tv.tv_usec = 0;
-  setsockopt(serverSock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+  struct sockaddr_storage bindAddr = { 0 };
+  if (*dualStack) {
+    struct sockaddr_in6 *bindAddr6 = (struct sockaddr_in6 *)&bindAddr;
+    bindAddr6->sin6_family = AF_INET6;
+    bindAddr6->sin6_addr = in6addr_any;
+    bindAddr6->sin6_port = htons(SERVER_BIND_PORT);
+  } else {
+    struct sockaddr_in *bindAddr4 = (struct sockaddr_in *)&bindAddr;
+    bindAddr4->sin_family = AF_INET;
+    bindAddr4->sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddr4->sin_port = htons(SERVER_BIND_PORT);
+  }
+
+  if (bind(sock, (const struct sockaddr*)&bindAddr, addrLen(&bindAddr)) < 0) {
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+int main (void) {
+  printf("Waterslide discovery server, build 7\n");
 
-  struct sockaddr_in bindAddr = { 0 };
-  bindAddr.sin_family = AF_INET;
-  bindAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  bindAddr.sin_port = htons(SERVER_BIND_PORT);
+  peerExpiryTime = readEnvInt("PEER_EXPIRY_TIME", PEER_EXPIRY_TIME);
+  peerCapacity = readEnvInt("PEER_CAPACITY", PEER_CAPACITY);
+  if (peerCapacity <= 0 || peerCapacity >= (1 << 30)) peerCapacity = PEER_CAPACITY;
+  rateLimit = readEnvInt("RATE_LIMIT", RATE_LIMIT);
+  if (rateLimit > 1000000) rateLimit = 1000000;
 
-  if (bind(serverSock, (const struct sockaddr*)&bindAddr, sizeof(bindAddr)) < 0) {
-    printf("bind() failed.\n");
+  #if defined(__linux__)
+  workerCount = readEnvInt("WORKER_THREADS", sysconf(_SC_NPROCESSORS_ONLN));
+  if (workerCount <= 0) workerCount = 1;
+  #endif
+
+  printf("PEER_EXPIRY_TIME = %d\n", peerExpiryTime);
+  printf("PEER_CAPACITY = %d\n", peerCapacity);
+  printf("RATE_LIMIT = %d\n", rateLimit);
+  printf("WORKER_THREADS = %d\n", workerCount);
+
+  if (initPeerTable() < 0) {
+    printf("Could not allocate peer table.\n");
     return EXIT_FAILURE;
   }
 
-  printf("Bound to port %d\n", SERVER_BIND_PORT);
+  if (initRateShards() < 0) {
+    printf("Could not allocate rate limit buckets.\n");
+    return EXIT_FAILURE;
+  }
 
-  for (int i = 0; i < MAX_PEERS; i++) peerList[i].lastUpdatedUTime = -1;
+  workers = (worker_t *)calloc(workerCount, sizeof(worker_t));
+  if (workers == NULL) return EXIT_FAILURE;
 
-  while (true) {
-    socklen_t recvAddrLen = sizeof(recvAddr);
-    ssize_t recvLen = recvfrom(serverSock, recvBuf, sizeof(recvBuf), 0, (struct sockaddr*)&recvAddr, &recvAddrLen);
+  bool dualStack = false;
+  for (int i = 0; i < workerCount; i++) {
+    worker_t *worker = &workers[i];
+    worker->index = i;
 
-    if (recvLen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-      // Timeout reached, do periodic cleanup
-      for (int i = 0; i < MAX_PEERS; i++) {
-        if (peerList[i].lastUpdatedUTime != -1) removePeerIfExpired(&peerList[i]);
-      }
-      continue;
+    worker->sock = openServerSocket(&dualStack);
+    if (worker->sock < 0) {
+      printf("Could not open socket on port %d.\n", SERVER_BIND_PORT);
+      return EXIT_FAILURE;
     }
+  }
 
-    // If recv failed, ignore it but wait a bit first
-    if (recvLen < 0 || recvAddrLen != sizeof(recvAddr)) {
-      utils_usleep(10000);
-      continue;
-    }
+  printf("Bound to port %d (%s)\n", SERVER_BIND_PORT, dualStack ? "IPv4 and IPv6" : "IPv4 only");
 
-    handleReq(recvBuf, recvLen, &recvAddr);
+  // worker 0 runs on the main thread
+  for (int i = 1; i < workerCount; i++) {
+    if (pthread_create(&workers[i].thread, NULL, workerLoop, &workers[i]) != 0) {
+      printf("pthread_create() failed.\n");
+      return EXIT_FAILURE;
+    }
   }
 
+  workerLoop(&workers[0]);
+
   return EXIT_SUCCESS;
 }
@@ -13,12 +13,15 @@ import os from 'os'
 import dns from 'dns'
 
 interface ConfigDiscovery {
-  serverAddr: number[] | string
+  serverAddr?: number[] | string
+  serverAddr6?: number[] | string
   serverPort: number
+  peerCacheFile?: string
 }
 
 interface ConfigEndpoint {
   interface: string
+  family?: 'IPV4' | 'IPV6' | 'DUAL'
 }
 
 interface ConfigMux {
@@ -68,7 +71,12 @@ if (process.argv.length != 4) {
 
 const encodeProtobuf = async (configObj: any): Promise<string> => {
   // protobufjs expects a Buffer instead of an array
-  configObj.discovery.serverAddr = Buffer.from(configObj.discovery.serverAddr)
+  if (configObj.discovery.serverAddr !== undefined) {
+    configObj.discovery.serverAddr = Buffer.from(configObj.discovery.serverAddr)
+  }
+  if (configObj.discovery.serverAddr6 !== undefined) {
+    configObj.discovery.serverAddr6 = Buffer.from(configObj.discovery.serverAddr6)
+  }
 
   const protobufPath = path.join(__dirname, '../../protobufs/init-config.proto')
   const initConfigProto = (await protobuf.load(protobufPath)).lookupType('InitConfigProto')
@@ -87,13 +95,28 @@ const startMonitorServer = (serverPort: number, wsPort: number) => {
   })
 }
 
-const lookupAddr = (addrStr: string): Promise<number[]> => {
+const ipv6ToBytes = (addr: string): number[] => {
+  const [head, tail] = addr.split('::')
+  const headGroups = head ? head.split(':') : []
+  const tailGroups = tail ? tail.split(':') : []
+  const groups = tail === undefined
+    ? headGroups
+    : [...headGroups, ...Array(8 - headGroups.length - tailGroups.length).fill('0'), ...tailGroups]
+  return groups.flatMap((group) => {
+    const value = parseInt(group, 16)
+    return [value >> 8, value & 0xff]
+  })
+}
+
+const lookupAddr = (addrStr: string, family: 4 | 6): Promise<number[]> => {
   return new Promise((resolve, reject) => {
     dns.lookup(addrStr, {
-      family: 4
+      family
     }, (err, addr) => {
       if (err) {
         reject(err)
+      } else if (family === 6) {
+        resolve(ipv6ToBytes(addr))
       } else {
         resolve(addr.split('.').map((octet) => parseInt(octet)))
       }
@@ -162,7 +185,10 @@ if (optionArg === '-f' || optionArg === '-e') {
 }
 
 if (typeof configObj.discovery.serverAddr === 'string') {
-  configObj.discovery.serverAddr = await lookupAddr(configObj.discovery.serverAddr)
+  configObj.discovery.serverAddr = await lookupAddr(configObj.discovery.serverAddr, 4)
+}
+if (typeof configObj.discovery.serverAddr6 === 'string') {
+  configObj.discovery.serverAddr6 = await lookupAddr(configObj.discovery.serverAddr6, 6)
 }
 
 if (optionArg === '-f' || optionArg === '-p') {
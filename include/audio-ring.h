@@ -0,0 +1,56 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _AUDIORING_H
+#define _AUDIORING_H
+
+#ifdef __cplusplus
+#include <atomic>
+using namespace std;
+#else
+#include <stdatomic.h>
+#include <stdalign.h>
+#endif
+#include "sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Single-producer single-consumer ring of interleaved audio frames between the audio thread and the syncer or
+// codec threads. Frames are copied in and out in bulk with memcpy, a whole frame at a time so the channels always
+// stay in order. writePos and readPos count frames and are free-running, each on its own cache line so the producer
+// and consumer don't invalidate each other's line on every write. The buffer is allocated to the next power of two
+// frames so positions wrap with a mask, but the ring never holds more than capacity frames.
+
+typedef struct {
+  alignas(64) atomic_uint writePos; // only written by the producer
+  alignas(64) atomic_uint readPos; // only written by the consumer
+  alignas(64) sample_t *buf;
+  int capacity; // in frames
+  unsigned int mask;
+  int channelCount;
+} audioring_t;
+
+int audioring_init (audioring_t *ring, int channelCount, int capacity);
+
+// returns: number of frames in ring, safe to call from either thread
+unsigned int audioring_size (const audioring_t *ring);
+
+// returns: 0 on success, -1 if there is not room for frameCount frames, in which case nothing is enqueued
+// NOTE: only call from the producer thread
+int audioring_enqueueFrames (audioring_t *ring, const sample_t *frames, int frameCount);
+
+// returns: 0 on success, -1 if ring holds fewer than frameCount frames, in which case nothing is dequeued
+// NOTE: only call from the consumer thread
+int audioring_dequeueFrames (audioring_t *ring, sample_t *frames, int frameCount);
+
+void audioring_deinit (audioring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,12 +6,12 @@
 #ifndef _AUDIO_H
 #define _AUDIO_H
 
+#include "audio-ring.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#include "ck/ck_ring.h"
-
 // call in this order:
 // stats_init
 // audio_init
@@ -22,7 +22,10 @@ extern "C" {
 
 int audio_init (bool receiver);
 double audio_getDeviceLatency (void); // in seconds
-int audio_start (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, unsigned int fullRingSize);
+// ring: sender enqueues to it, receiver dequeues from it. Its capacity is the full ring size for underrun handling.
+// onRingWrite: sender only (NULL for receiver). Called on the audio thread after each batch of frames is
+// enqueued onto ring, so it must be audio callback safe.
+int audio_start (audioring_t *ring, void (*onRingWrite)(void));
 int audio_deinit (void);
 
 #ifdef __cplusplus
@@ -26,6 +26,10 @@ void demux_deinit (void);
 // additional channels may be added after calling demux_readPacket
 int demux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbolsPerBlock, int symbolLen, void (*onData)(const uint8_t *, int));
 
+// The sender calls mux_flush after each write on this channel, so each block holds one piece of data and its
+// trailing zero padded source symbols are not sent. Call straight after demux_addChannel.
+int demux_setFlushedChannel (int chId);
+
 // call demux_readPacket from one thread only (RT network thread); the data is passed to other threads for decoding
 int demux_readPacket (const uint8_t *buf, size_t bufLen, int endpointIndex);
 
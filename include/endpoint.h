@@ -9,17 +9,35 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdatomic.h>
+#include <pthread.h>
+#include <netinet/in.h>
 
 // Discovery, GotPeerAddr: dataLoop has control of endpoint
 // Open, Close, WaitForReopen: openCloseLoop has control of endpoint
 enum endpoint_state { Open, Discovery, GotPeerAddr, Close, WaitForReopen };
 
+typedef union {
+  struct sockaddr sa;
+  struct sockaddr_in in;
+  struct sockaddr_in6 in6;
+} endpoint_addr_t;
+
 typedef struct {
   _Atomic enum endpoint_state state;
   int sock;
   char ifName[MAX_NET_IF_NAME_LEN + 1];
-  uint32_t peerAddr;
-  uint16_t peerPort;
+  int family; // ENDPOINT_FAMILY_*
+  endpoint_addr_t peerAddr; // in the form used by sock; IPv4 addrs are v4-mapped on dual-stack sockets
+  int headerLen; // IP and UDP header bytes for peerAddr
+  endpoint_addr_t serverAddrs[2]; // IPv4, IPv6 in the form used by sock, sa_family is 0 if not used
+  int discoverySentUTime[2];
+  endpoint_addr_t discoveredAddrs[2]; // dual-stack only, candidate peer addrs waiting for the other family
+  int discoveredRtts[2];
+  int dualStackWaitTickCounter;
+  endpoint_addr_t cachedPeerAddr; // last confirmed peer addr, IPv4 is never v4-mapped, sa_family is 0 if unknown
+  pthread_mutex_t cacheMutex; // guards cachedPeerAddr between dataLoop (writer) and openCloseLoop (reader)
+  bool awaitingPeer; // true while trying cachedPeerAddr, discovery keeps running until the peer or the server answers
+  atomic_bool cacheDirty; // set by dataLoop, cleared by openCloseLoop when the cache file is written
   int reopenTickCounter;
   int discoveryTickCounter;
   int lastPacketUTime;
@@ -20,44 +20,69 @@
 
 #define AUDIO_ENCODING_OPUS 0
 #define AUDIO_ENCODING_PCM 1
+#define AUDIO_ENCODING_LOSSLESS 2
 #define AUDIO_OPUS_SAMPLE_RATE 48000
-// Linearly change the mix this much for every audio frame e.g. 0.01 means it takes 100 frames or
-// ~2.1 ms @ 48 kHz for the sample rate to fully change.
-#define SYNCER_SWITCH_SPEED 0.01
-// While syncer is mixing between two resamplers to seamlessly change sample rate, their output frame
-// count may not match, in that case any overflow frames are stored in a buffer with length
-// SYNCER_AB_MIX_OVERFLOW_MAX_FRAMES. This buffer should never get very full because if the two
-// resamplers are getting significantly out of phase it will cause artifacts. To avoid this, only change
-// the sample rate by a small amount each time.
-#define SYNCER_AB_MIX_OVERFLOW_MAX_FRAMES 64
+#define AUDIO_RESAMPLER_PHASE_LINEAR 0
+#define AUDIO_RESAMPLER_PHASE_MINIMUM 1
 // In percent. For example: for 44100 Hz and 8% the transition frequency is (1 - 8/100) * (44100 / 2) = 20286 Hz
+// This is the default, it can be set with resamplerTransitionBand in the config.
 #define SYNCER_TRANSITION_BAND 8.0
-
-// In seconds. Store a sample of receiverSync in rsHistory every x seconds (with interleaving to reduce the effects of packet loss).
-#define RS_SAMPLE_INTERVAL 5
-// In RS_SAMPLE_INTERVAL units, 720 = 1 hour. If rsHistory is full, pop the oldest sample off the queue.
-#define RS_HISTORY_LENGTH 720
-// In RS_SAMPLE_INTERVAL units. Look back this far to decide if error measurement is stable enough to do a rate change. It will take at least this amount of time for a rate change to happen.
-#define RS_ERROR_VARIANCE_WINDOW 40
-// The variance over RS_ERROR_VARIANCE_WINDOW must be less than this in order for a rate change to happen.
-#define RS_ERROR_VARIANCE_TARGET 0.0001
-// In samples per second. The absolute value of the error must be higher than this in order for a rate change to happen.
-#define RS_ERROR_THRESHOLD 0.15
+// The range accepted by the config and resampler_init. Filter length goes up as the band narrows: at 1% it is about
+// 2400 taps and a 5 MB filter bank for f64, and the CPU use per channel is 8 times that of the default.
+#define SYNCER_MIN_TRANSITION_BAND 1.0
+#define SYNCER_MAX_TRANSITION_BAND 50.0
+
+// In seconds. receiverSync is averaged over each interval and fed to the drift filter.
+#define RS_SAMPLE_INTERVAL 0.5
+// In frames. Standard deviation of the averaged receiverSync around its trend, from packet and network jitter.
+#define RS_MEASUREMENT_NOISE 8.0
+// In frames per second per sqrt(second). How fast the real clock drift can wander, sets how quickly the filter
+// follows changes once it has converged.
+#define RS_DRIFT_NOISE 0.002
+// In standard deviations. Samples further than this from the prediction are ignored as network glitches.
+#define RS_OUTLIER_GATE 5.0
+// In RS_SAMPLE_INTERVAL units. After this many outliers in a row, accept the new receiverSync level as the target.
+#define RS_MAX_OUTLIERS 6
+// In seconds. The ring fill error is steered back to zero with this time constant...
+#define RS_FILL_TIME_CONSTANT 10.0
+// In PPM. ...but never changes the rate by more than this on top of the drift correction.
+#define RS_MAX_STEER_PPM 50.0
+// In PPM per RS_SAMPLE_INTERVAL. Largest rate change in one step, so that the pitch only ever glides.
+#define RS_MAX_RATE_STEP_PPM 100.0
 
 #define MAX_ENDPOINTS 16
 #define MAX_DEVICE_NAME_LEN 100
 #define MAX_NET_IF_NAME_LEN 20
+#define MAX_FILE_PATH_LEN 255
 #define MAX_AUDIO_CHANNELS 64
+#define MAX_OPUS_ENCODER_GROUPS 16
+#define MAX_REORDER_WINDOW 64
 
 // channel 0: config, channel 1: audio, channel 2: video
 #define MUX_CHANNEL_COUNT 3
 
+// CPU cores that the realtime threads are pinned to (Linux only). Core 0 is shared by the audio loop, the network and
+// mux packet threads and everything else. A thread whose core is not online is left unpinned (utils_checkCore), and the
+// Opus group workers go on the cores after the encode or decode thread (opusgroups_init).
+// Sender: DSP 1, encode 2, Opus workers 3 and up
+// Receiver: demux 1 and 2, decode 3, Opus workers 4 and up
+#define AUDIO_DSP_THREAD_CORE 1
+#define AUDIO_ENCODE_THREAD_CORE 2
+#define DEMUX_THREAD_FIRST_CORE 1 // one core per channel, the receiver has two
+#define AUDIO_DECODE_THREAD_CORE 3
+
 #define SEC_KEY_LENGTH 44 // Length of base 64 encoded key string in chars, not including null terminator.
 #define ENDPOINT_KEEP_ALIVE_MS 2000 // in milliseconds
 #define ENDPOINT_TICK_INTERVAL_US 100000 // in microseconds
 #define ENDPOINT_REOPEN_INTERVAL_MIN 30 // in ticks (1 tick = 100 ms)
 #define ENDPOINT_REOPEN_INTERVAL_MAX 50 // in ticks (1 tick = 100 ms)
 #define ENDPOINT_DISCOVERY_INTERVAL 10 // in ticks
+#define ENDPOINT_DUAL_STACK_WAIT 3 // in ticks. After discovery over one family, wait this long for the other family before picking a peer addr.
+
+// Must match Endpoint.Family in init-config.proto
+#define ENDPOINT_FAMILY_IPV4 0
+#define ENDPOINT_FAMILY_IPV6 1
+#define ENDPOINT_FAMILY_DUAL 2
 
 #define STATS_STREAM_METER_BINS 512
 #define STATS_BLOCK_TIMING_RING_LEN 512
@@ -66,11 +91,14 @@ globals_declare1i(root, mode)
 globals_declare1s(root, privateKey)
 globals_declare1s(root, peerPublicKey)
 
-globals_declare1ui(discovery, serverAddr)
+globals_declare1ui(discovery, serverAddr) // IPv4, 0 if not set
+globals_declare1uiv(discovery, serverAddr6) // IPv6 as 4 words in network byte order, all zero if not set
 globals_declare1i(discovery, serverPort)
+globals_declare1s(discovery, peerCacheFile) // Optional. Last known peer addresses are stored here so that we can reconnect without waiting for discovery.
 
 globals_declare1i(endpoints, endpointCount)
 globals_declare1sv(endpoints, interface)
+globals_declare1iv(endpoints, family) // ENDPOINT_FAMILY_*
 
 globals_declare1ui(mux, maxPacketSize)
 
@@ -79,13 +107,17 @@ globals_declare1i(audio, deviceChannelCount) // Number of audio channels support
 globals_declare1i(audio, networkSampleRate)
 globals_declare1ff(audio, deviceSampleRate) // This is changed dynamically for receiver sync
 globals_declare1i(audio, decodeRingLength) // In samples. Must be larger than frameSize (Opus or PCM). Affects receive latency.
+globals_declare1i(audio, reorderWindow) // In packets, receiver only. Adds this many frames of receive latency.
+globals_declare1ui(audio, resamplerPhase) // AUDIO_RESAMPLER_PHASE_*
+globals_declare1ff(audio, resamplerTransitionBand) // In percent
 globals_declare1s(audio, deviceName) // macOS only
 globals_declare1i(audio, cardId) // Linux only
 globals_declare1i(audio, deviceId) // Linux only
 globals_declare1i(audio, bitsPerSample) // Linux only
-globals_declare1i(audio, periodSize) // Linux only, in samples. Audio callback latency is periodSize*periodCount/2
-globals_declare1i(audio, periodCount) // Linux only, in samples. Setting this higher improves DMA pointer resolution on some systems. Set periodSize lower to compensate for this.
-globals_declare1i(audio, loopSleep) // Linux only. RT loop sleeps for this many microseconds after running the audio callback. Set low enough for no xruns, but high enough for reasonable CPU usage.
+globals_declare1i(audio, periodSize) // Linux only, in samples. The audio loop processes one period at a time. Device latency is periodSize for the sender and periodSize*min(2, periodCount-1) for the receiver.
+globals_declare1i(audio, periodCount) // Linux only, at least 2. Setting this higher gives the sender more room to catch up after a late wakeup, without adding latency.
+globals_declare1i(audio, loopSleep) // Linux only. The RT loop sleeps until the next period boundary, but polls every loopSleep microseconds if it wakes before the DMA pointer has crossed it.
+globals_declare1i(audio, schedDeadline) // Linux only. Run the RT loop with SCHED_DEADLINE instead of SCHED_FIFO where the kernel allows it.
 
 globals_declare1ff(audio, levelSlowAttack) // Meter filtering for monitor
 globals_declare1ff(audio, levelSlowRelease)
@@ -95,10 +127,17 @@ globals_declare1ui(audio, encoding)
 
 globals_declare1i(opus, bitrate) // In bits per second
 globals_declare1i(opus, frameSize) // Normally 240 samples = 5 ms @ 48 kHz
+globals_declare1i(opus, encoderGroups) // Channels are split into this many groups, each encoded/decoded on its own thread
+globals_declare1i(opus, streams) // Multistream layout, same as the opus_multistream_encoder_create arguments
+globals_declare1i(opus, coupledStreams)
+globals_declare1iv(opus, mapping) // One per network channel
+globals_declare1i(opus, maxConcealedFrames) // Receiver only. Max frames of packet loss concealment per sequence gap, 0 to disable.
 
 globals_declare1i(pcm, frameSize) // In samples. Packet size in bytes is 3 * channelCount * frameSize + 2
 globals_declare1i(pcm, sampleRate)
 
+globals_declare1i(lossless, frameSize) // In samples. Packets are variable length, at most channelCount * (3 * frameSize + 1) + 4 bytes
+
 globals_declare1iv(fec, symbolLen)
 globals_declare1iv(fec, sourceSymbolsPerBlock)
 globals_declare1iv(fec, repairSymbolsPerBlock)
@@ -117,6 +156,7 @@ globals_declare1uiv(statsMux, ringOverrunCount)
 globals_declare1uiv(statsDemux, ringOverrunCount)
 globals_declare1uiv(statsDemux, dupBlockCount)
 globals_declare1uiv(statsDemux, oooBlockCount)
+globals_declare1iv(statsDemux, fecDecodeTime) // In microseconds, per channel. Time to decode the last block.
 globals_declare1uiv(statsDemux, blockTimingRingPos) // NOTE: blockTimingRingPos must only be written to in one place by one thread
 globals_declare1uiv(statsDemux, blockTimingRing)
 
@@ -127,10 +167,28 @@ globals_declare1i(statsCh1Audio, streamBufferSize)
 globals_declare1uiv(statsCh1Audio, streamMeterBins)
 globals_declare1ui(statsCh1Audio, bufferOverrunCount)
 globals_declare1ui(statsCh1Audio, bufferUnderrunCount)
+globals_declare1ui(statsCh1Audio, lateFrameCount) // Receiver only. Arrived after the reorder window and dropped.
+globals_declare1ui(statsCh1Audio, reorderedFrameCount) // Receiver only. Arrived after a newer frame but within the reorder window.
+globals_declare1ui(statsCh1Audio, filledFrameCount) // Receiver only. Not received within the reorder window, concealed or replaced with silence.
+globals_declare1i(statsCh1Audio, decodeStageTime) // Receiver only, in microseconds. Codec decode and resampling time for the last frame.
+globals_declare1ui(statsCh1Audio, decodeQueueOverrunCount) // Receiver only. Packets dropped because the decode thread was not keeping up.
 globals_declare1ui(statsCh1Audio, encodeThreadJitterCount)
+globals_declare1i(statsCh1Audio, encodeWakeLatency) // Sender only, in microseconds. Time from the audio thread notifying the encode thread to the encode thread waking up.
+globals_declare1i(statsCh1Audio, encodeWakeLatencyMax)
+globals_declare1i(statsCh1Audio, dspTime) // Sender with Opus on Linux only, in microseconds. Resampling time for the last period, off the audio thread.
+globals_declare1ui(statsCh1Audio, dspOverrunCount) // Sender with Opus on Linux only. Periods dropped because the DSP thread was not keeping up.
 globals_declare1ui(statsCh1Audio, audioLoopXrunCount)
+globals_declare1i(statsCh1Audio, audioLoopLateness) // Linux only, in microseconds. How late the RT loop woke up after its timer deadline.
+globals_declare1i(statsCh1Audio, audioLoopLatenessMax)
+globals_declare1ui(statsCh1Audio, audioLoopEarlyWakeCount) // Linux only. Wakeups before the DMA pointer crossed a period boundary, each one costs an extra poll.
 globals_declare1ff(statsCh1Audio, clockError) // In PPM
+globals_declare1i(statsCh1Audio, rateChangeTime) // In microseconds. From the last syncer_changeRate call until the resampler was using the new rate.
+globals_declare1i(statsCh1Audio, resamplerLatency) // In microseconds. Group delay of the resampler filter at DC.
 globals_declare1ui(statsCh1AudioOpus, codecErrorCount)
+globals_declare1ui(statsCh1AudioOpus, concealedFrameCount) // Receiver only
+globals_declare1iv(statsCh1AudioOpus, groupCodecTime) // In microseconds, per encoder group. Encode time for sender, decode time for receiver.
 globals_declare1ui(statsCh1AudioPCM, crcFailCount)
+globals_declare1ui(statsCh1AudioLossless, crcFailCount)
+globals_declare1ff(statsCh1AudioLossless, compressionRatio) // Encoded size / PCM size, smoothed
 
 #endif
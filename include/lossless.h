@@ -0,0 +1,39 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _LOSSLESS_H
+#define _LOSSLESS_H
+
+#include <stdint.h>
+#include "sample.h"
+
+// Lossless 24-bit codec, bit-exact with pcm_encode/pcm_decode. One frame per packet, no state is carried
+// between frames (unlike PCM the CRC is not chained) so a lost packet only affects that frame.
+// Each channel is coded with the fixed polynomial predictor (order 0 to 4) that gives the smallest residual,
+// then the residuals are Rice coded with one parameter per channel per frame. If that is larger than the
+// raw samples, the channel is stored verbatim.
+// Packet layout, per channel (byte aligned):
+// | 1 byte: order << 5 | riceParam, or LOSSLESS_VERBATIM | order * 3 bytes: warm-up samples | Rice coded residuals |
+// followed by a 2 byte CRC like PCM.
+
+#define LOSSLESS_VERBATIM 0xff
+#define LOSSLESS_MAX_ORDER 4
+
+// Worst case encoded length (every channel verbatim)
+static inline int lossless_maxEncodedLen (int channelCount, int frameCount) {
+  return channelCount * (1 + 3 * frameCount) + 2;
+}
+
+// inSampleBuf: channelCount * frameCount interleaved
+// outData must be at least lossless_maxEncodedLen bytes
+// returns: encoded length
+int lossless_encode (const sample_t *inSampleBuf, int channelCount, int frameCount, uint8_t *outData);
+
+// samples is set to a 24-bit LE packed buffer containing channelCount * frameCount interleaved elements, the
+// same as pcm_decode. It must have room for 3 * channelCount * frameCount bytes.
+// returns: channelCount * frameCount or negative error code
+int lossless_decode (const uint8_t *inData, int inDataLen, int channelCount, int frameCount, uint8_t *samples);
+
+#endif
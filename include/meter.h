@@ -0,0 +1,37 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _METER_H
+#define _METER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "sample.h"
+
+// Audio level metering for the monitor: clippingCounts, levelsFast and levelsSlow in statsCh1Audio. The levels are
+// attack/release followers of |x| with the coefficients from the config, updated every sample. A whole buffer is
+// metered at once with SIMD kernels (AVX2 or SSE2 on x86, NEON on ARM64) that run the followers for several channels
+// side by side, keeping their state in registers for the whole buffer, then the results are published to the
+// globals once. The levels are the same as the scalar code gives metering one sample at a time.
+
+// Call once from the main thread before starting any audio threads. Returns the name of the kernels in use.
+const char *meter_init (void);
+
+// Read the attack and release coefficients from the audio globals, call before meter_process
+void meter_setFilters (void);
+
+// Meter the first channelCount channels of buf, which is interleaved with bufChannelCount channels per frame.
+// NOTES:
+// - This is audio callback safe (no syscalls or allocation).
+// - Only call from one thread at a time, the levels are read from and written back to the globals.
+void meter_process (const sample_t *buf, int bufChannelCount, int channelCount, int frameCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,7 @@ int mux_init (int (*onPacket)(const uint8_t *, size_t));
 void mux_deinit (void);
 
 // symbolLen must be: 64, 128, 256, 512 or 1024
+// sourceSymbolsPerBlock + repairSymbolsPerBlock must be <= 2^16
 // returns chId or negative error
 int mux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbolsPerBlock, int symbolLen);
 
@@ -54,4 +55,13 @@ int mux_setAnchorChannel (uint8_t chId);
 // bufLen must be <= maxDataLen for the corresponding chId
 int mux_writeData (uint8_t chId, const uint8_t *dataBuf, int dataBufLen);
 
+// Send the current block now instead of waiting for it to fill, for variable length data that must not wait for
+// the next write e.g. lossless audio. Call after each mux_writeData so that each block holds exactly one buf.
+// The rest of the block is zero padded, and the source symbols that only hold padding are not sent: the receiver
+// must call demux_setFlushedChannel for this channel so that it can recreate them. Every chunk of such a block carries
+// the number of source symbols sent in the top byte of its ESI, so the receiver can recreate them from any chunk. If
+// more than 255 source symbols hold data the whole block is sent.
+// call from the same thread as mux_writeData
+int mux_flush (uint8_t chId);
+
 #endif
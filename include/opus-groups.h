@@ -0,0 +1,42 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _OPUSGROUPS_H
+#define _OPUSGROUPS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The network channels are split into globals opus.encoderGroups contiguous groups, each with its own
+// OpusMSEncoder or OpusMSDecoder. Group 0 runs on the calling thread and the other groups run on worker
+// threads pinned to their own cores, so that high channel counts can be encoded within one frame duration.
+// Each group is CBR and its encoded data is at a fixed offset in the packet:
+// | group 0 | group 1 | ... | group G-1 |
+// with group g taking encodedLen * channelEnd(g) / channelCount - encodedLen * channelStart(g) / channelCount bytes.
+// The multistream layout in globals opus.streams, opus.coupledStreams and opus.mapping is split between the
+// groups, so a coupled stream must not have its channels in different groups.
+
+// encoder: true for sender, false for receiver
+// encodedLen: length of all groups' encoded data in bytes, not including the sequence number
+// callerCore: the core that the thread calling encode or decode is pinned to. It and the cores below it are taken by
+// the other realtime threads, so workers go on the cores after it. If there are not enough cores left for one each,
+// the workers are not pinned.
+int opusgroups_init (bool encoder, int encodedLen, int callerCore);
+
+// NOTE: encode and decode must only be called from one thread (not thread-safe).
+
+// samples: networkChannelCount * frameSize interleaved
+// outData: must have room for encodedLen bytes
+// returns: encodedLen or negative error code
+int opusgroups_encode (const float *samples, uint8_t *outData);
+
+// inData: NULL to decode one frame of packet loss concealment in place of a lost packet
+// samples: networkChannelCount * frameSize interleaved
+// returns: frameSize or negative error code
+int opusgroups_decode (const uint8_t *inData, int inDataLen, float *samples);
+
+void opusgroups_deinit (void);
+
+#endif
@@ -7,6 +7,7 @@
 #define _PCM_H
 
 #include <stdint.h>
+#include "sample.h"
 
 typedef struct {
   uint16_t crc;
@@ -14,7 +15,7 @@ typedef struct {
 
 // outData must be at least 3 * sampleCount + 2 bytes
 // sampleCount = channelCount * frameCount
-int pcm_encode (pcm_codec_t *codec, const double *inSampleBuf, int sampleCount, uint8_t *outData);
+int pcm_encode (pcm_codec_t *codec, const sample_t *inSampleBuf, int sampleCount, uint8_t *outData);
 
 // samples is set to a 24-bit LE packed buffer containing (inDataLen-2)/3 elements
 // inData and samples reference the same memory, there is no extra malloc
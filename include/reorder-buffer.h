@@ -0,0 +1,32 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _REORDERBUFFER_H
+#define _REORDERBUFFER_H
+
+#include <stdint.h>
+
+// Holds received audio packets in slots indexed by their 16-bit sequence number and releases them in order.
+// A missing packet is waited for until a packet window sequence numbers newer than it arrives (the deadline), then
+// it is released as a hole with data NULL so that the frames after it keep their time position. Packets that
+// arrive after their deadline are dropped. window 0 releases every packet as soon as it arrives, filling any
+// gap before it. A gap of more than maxFilledGap packets after the window is not filled: what is buffered is released
+// without its holes and the buffer starts again from the new packet.
+// Stats: statsCh1Audio lateFrameCount, reorderedFrameCount and filledFrameCount
+
+// data: NULL for a hole
+typedef void (*reorderbuffer_onRelease_t)(int seq, const uint8_t *data, int dataLen);
+
+// window: in packets, 0 to MAX_REORDER_WINDOW
+// maxFilledGap: in packets
+// maxDataLen: longer packets are dropped
+int reorderbuffer_init (int window, int maxFilledGap, int maxDataLen, reorderbuffer_onRelease_t onRelease);
+
+// NOTE: not thread-safe, only call from one thread. onRelease is called from push.
+void reorderbuffer_push (int seq, const uint8_t *data, int dataLen);
+
+void reorderbuffer_deinit (void);
+
+#endif
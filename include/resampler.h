@@ -0,0 +1,95 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _RESAMPLER_H
+#define _RESAMPLER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "sample.h"
+
+// Multichannel polyphase resampler. All channels share one filter bank and are filtered together from an
+// interleaved history buffer, so the SIMD kernels run across channels (4 doubles or 8 floats per vector with AVX2,
+// half that with SSE2 or NEON) rather than across taps. The filter is designed in double and stored as sample_t.
+// The filter is a Kaiser windowed sinc oversampled by RESAMPLER_PHASE_COUNT. The coefficients for each output frame
+// are cubic (Lagrange) interpolated between the four nearest phases, so any ratio works, not just rational ones. That
+// is done once per output frame and shared by every channel. With 256 phases the interpolation error stays below the
+// stopband attenuation; linear interpolation would need 16 times as many phases for the same error.
+// Quality is set by transitionBand, the same as r8brain's ReqTransBand: the passband ends transitionBand percent below
+// the lower of the two Nyquist frequencies and the stopband starts at it, with RESAMPLER_ATTENUATION dB of rejection.
+// transitionBand must be within SYNCER_MIN_TRANSITION_BAND and SYNCER_MAX_TRANSITION_BAND.
+// The filter is linear phase with a latency of tapCount / 2 input frames, or minimum phase which has the same magnitude
+// response and much less latency but does not keep the waveform shape near the transition band.
+
+#define RESAMPLER_PHASE_COUNT 256
+// In dB. The same as r8brain's CDSPResampler24 for double. Rounding in the float kernels limits the error to about
+// -122 dB whatever the filter, so the f32 build keeps a shorter filter that is still well below that.
+#ifdef W_SAMPLE_F32
+#define RESAMPLER_ATTENUATION 140.0
+#else
+#define RESAMPLER_ATTENUATION 180.0
+#endif
+// resampler_setRatio accepts ratios within this fraction of the ratio passed to resampler_init. The filter
+// is designed for the initial ratio, which is fine for clock drift correction.
+#define RESAMPLER_MAX_RATIO_DEVIATION 0.01
+
+typedef struct {
+  int channelCount;
+  int stride; // channelCount rounded up to the SIMD width, in samples per history frame
+  int tapCount; // in input frames
+  double latency; // group delay at DC, in input frames
+  double initRatio; // dstRate / srcRate passed to resampler_init
+  double step; // input frames per output frame, 1.0 / ratio
+  const sample_t *bank; // (RESAMPLER_PHASE_COUNT + 3) phases of tapCount coefficients, each phase reversed. Shared, see acquireBank.
+  sample_t *kernel; // tapCount coefficients for the current output frame
+  sample_t *history; // (tapCount + maxInFrames) frames of stride samples
+  int historyLen; // in frames
+  int pos; // index in history of the newest frame used by the next output frame
+  double frac; // fractional input position of the next output frame, [0.0, 1.0)
+  sample_t *outBuf; // maxOutFrames frames of channelCount samples, interleaved
+  int maxInFrames, maxOutFrames;
+} resampler_t;
+
+// Call once from the main thread before calling resampler_init. Returns the name of the kernels in use.
+const char *resampler_initKernels (void);
+
+// This allocates, and designs the filter unless a resampler with the same filter has been initialised before, so it
+// is not audio callback safe. It is thread-safe. Designing a minimum phase filter takes tens of milliseconds, or a
+// quarter of a second at SYNCER_MIN_TRANSITION_BAND.
+// returns: 0 for success or negative error code
+int resampler_init (resampler_t *resamp, double srcRate, double dstRate, int channelCount, int maxInFrames, double transitionBand, bool minPhase);
+
+// NOTES:
+// - This is audio callback safe (no syscalls or allocation).
+// - inFrameCount must be <= maxInFrames, it is not bounds checked.
+// - outBuf is set to memory owned by resamp, which is valid until the next call to resampler_process. It can be modified.
+// inBuf and outBuf are interleaved with channelCount channels.
+// returns: number of frames in outBuf
+int resampler_process (resampler_t *resamp, const sample_t *inBuf, int inFrameCount, sample_t **outBuf);
+
+// NOTES:
+// - This is audio callback safe. Call it from the same thread as resampler_process.
+// - The new ratio applies from the next output frame. The phase carries on from where it was so there is no discontinuity.
+// ratio: dstRate / srcRate
+// returns: 0 for success or -1 if ratio is out of range
+int resampler_setRatio (resampler_t *resamp, double ratio);
+
+static inline bool resampler_isRatioInRange (const resampler_t *resamp, double ratio) {
+  double deviation = ratio / resamp->initRatio - 1.0;
+  return deviation >= -RESAMPLER_MAX_RATIO_DEVIATION && deviation <= RESAMPLER_MAX_RATIO_DEVIATION;
+}
+
+// Safe to call on a resampler that was never initialised (zeroed) or has already been deinitialised.
+// The filter bank stays cached for the next resampler_init with the same parameters.
+void resampler_deinit (resampler_t *resamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
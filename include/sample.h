@@ -0,0 +1,22 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+// The type of audio samples between the device and the codecs: the rings, syncer buffers, resampler and sample
+// conversions. Build with SAMPLE_FORMAT=f32 (make clean first) for float, which halves the memory traffic and cache
+// footprint of the audio path. float has 24 bits of precision so it is still enough for 24-bit audio. The resampler error goes from about -180 dB to about -122 dB.
+// Rates, clock drift and level metering are always double.
+
+#ifdef W_SAMPLE_F32
+typedef float sample_t;
+#define SAMPLE_FORMAT_NAME "f32"
+#else
+typedef double sample_t;
+#define SAMPLE_FORMAT_NAME "f64"
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef _SAMPLECONV_H
+#define _SAMPLECONV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "sample.h"
+
+// Sample format conversion to and from sample_t, with SIMD kernels (AVX2 or SSE4.1 on x86, NEON on ARM64) picked at runtime.
+// All kernels give bit-identical results to the scalar code, which works in double:
+// - int to sample: x > 0 ? x / (2^(n-1) - 1) : x / 2^(n-1), rounded once to sample_t
+// - sample to int: clamp to [-1.0, 1.0], then x > 0 ? x * (2^(n-1) - 1) : x * 2^(n-1), truncated
+// http://blog.bjornroche.com/2009/12/int-float-int-its-jungle-out-there.html
+// NOTES:
+// - All of these are audio callback safe (no syscalls or allocation).
+// - Interleaved functions take the channel count of both buffers. Only the first min(inChannelCount, outChannelCount)
+//   channels of each frame are converted, the other channels in outBuf are not written to.
+
+// Call once from the main thread before starting any audio threads. Returns the name of the kernels in use.
+const char *sampleconv_init (void);
+
+// interleaved to interleaved sample_t
+void sampleconv_s16ToSample (const int16_t *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount);
+void sampleconv_s24PackedToSample (const uint8_t *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount);
+void sampleconv_s32ToSample (const int32_t *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount);
+void sampleconv_f32ToSample (const float *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount);
+
+// interleaved sample_t to interleaved, with clamping (except float which is not clamped)
+void sampleconv_sampleToS32 (const sample_t *inBuf, int inChannelCount, int32_t *outBuf, int outChannelCount, int frameCount);
+void sampleconv_sampleToF32 (const sample_t *inBuf, int inChannelCount, float *outBuf, int outChannelCount, int frameCount);
+// sampleCount = channelCount * frameCount. S24 is sign extended in an int32.
+void sampleconv_sampleToS24 (const sample_t *inBuf, int32_t *outBuf, int sampleCount);
+void sampleconv_sampleToS24Packed (const sample_t *inBuf, uint8_t *outBuf, int sampleCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
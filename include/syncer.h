@@ -6,21 +6,24 @@
 #ifndef _SYNCER_H
 #define _SYNCER_H
 
+#include "audio-ring.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdint.h>
-#include "ck/ck_ring.h"
+#include "sample.h"
 
 /////////////////////
 // private
 /////////////////////
 
 int _syncer_initResampState (double srcRate, double dstRate, int maxInBufFrames);
-int _syncer_initReceiverSync (double srcRate);
-int _syncer_enqueueSamples (double **samples, int frameCount, bool setStats);
-int _syncer_stepResampState (double **samples, int frameCount, bool setStats, int offset);
+int _syncer_initReceiverSync (double srcRate, double dstRate);
+// samples are interleaved with networkChannelCount channels
+int _syncer_enqueueSamples (const sample_t *samples, int frameCount, bool setStats);
+int _syncer_resample (const sample_t *samples, int frameCount, bool setStats);
 void _syncer_deinitResampState (void);
 void _syncer_deinitReceiverSync (void);
 
@@ -28,10 +31,10 @@ void _syncer_deinitReceiverSync (void);
 // public
 /////////////////////
 
-int syncer_init (double srcRate, double dstRate, int maxInBufFrames, ck_ring_t *ring, ck_ring_buffer_t *ringBuf, int fullRingSize);
+int syncer_init (double srcRate, double dstRate, int maxInBufFrames, audioring_t *ring);
 
 // NOTES:
-// - This returns the new ratio when the rate change has completed, not immediately after calling syncer_changeRate
+// - This returns the new ratio once the audio thread has applied it (the next call to syncer_enqueueBuf), not immediately after calling syncer_changeRate
 // - This is thread-safe, happy days!
 double syncer_getRateRatio (void);
 
@@ -40,10 +43,9 @@ void syncer_onPacket (int seq, int audioFrameSize);
 
 // NOTES:
 // - This function is thread-safe (call it from anywhere).
-// - This function is asynchronous and returns immediately but the actual rate change takes a while to complete.
-// - The rate change could take > 100 ms due to constructing a new resampler which is expensive.
-// - Changing the srcRate will cause a smooth blip on the waveform lasting a few ms, but it should not cause a click. I'm not sure if it's very audible.
-// - Try to keep each rate change within +/- 10 Hz.
+// - This function is asynchronous and returns immediately, the rate change is applied at the start of the next call to syncer_enqueueBuf.
+// - The resampler keeps its phase across the change so there is no blip on the waveform, and it can be called as often as needed.
+// - returns -1 if srcRate is more than RESAMPLER_MAX_RATIO_DEVIATION from the srcRate passed to syncer_init, otherwise 0.
 // - Decreasing srcRate = receiverSync slopes up (increasing) = ring more full
 // - Increasing srcRate = receiverSync slopes down (decreasing) = ring less full
 int syncer_changeRate (double srcRate);
@@ -55,10 +57,6 @@ int syncer_changeRate (double srcRate);
 // returns: number of audio frames enqueued onto ring (after resampling), or negative error code
 // errors:
 // -1: ring buffer overrun, no frames were enqueued onto ring
-// -2: mixResamps: The resampler with more output samples was not the one we expected. This is very bad!
-// -3: mixResamps: overflow in abMixOverflowLen, rate change was too much (fromOverflows)
-// -4: mixResamps: overflow in abMixOverflowLen, rate change was too much (toOverflows)
-// -5: stepResampState was called while in StoppingManager state. This is very bad!
 int syncer_enqueueBufS16 (const int16_t *inBuf, int inFrameCount, int inChannelCount, bool setStats); // for Android
 int syncer_enqueueBufS24Packed (const uint8_t *inBuf, int inFrameCount, int inChannelCount, bool setStats); // for PCM
 int syncer_enqueueBufS32 (const int32_t *inBuf, int inFrameCount, int inChannelCount, bool setStats); // for Android
@@ -12,16 +12,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
-#include "ck/ck_ring.h"
-
-// wrapper functions for ck_ring that work on both 32-bit and 64-bit architectures
-// size is the number of doubles ring can hold
-int utils_ringInit (ck_ring_t *ring, ck_ring_buffer_t **ringBuf, int size);
-unsigned int utils_ringSize (const ck_ring_t *ring);
-// NOTE: enqueue and dequeue have no bounds checking, call ringSize first!
-double utils_ringDequeueSample (ck_ring_t *ring, ck_ring_buffer_t *ringBuf);
-void utils_ringEnqueueSample (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, double x);
-void utils_ringDeinit (ck_ring_t *ring, ck_ring_buffer_t *ringBuf);
+#include "sample.h"
 
 // NOTE: us must be < 1000000 (1 second)
 void utils_usleep (unsigned int us);
@@ -30,19 +21,19 @@ int utils_getCurrentUTime (void);
 // return value is in microseconds, intervals of > 500_000_000 us may return an incorrect value
 int utils_getElapsedUTime (int lastUTime);
 
+// core: the CPU core to pin the caller to (Linux only), or -1 to leave it free to run on any core
 int utils_setCallerThreadRealtime (int priority, int core);
+// returns: core if it is online, otherwise -1 so that utils_setCallerThreadRealtime leaves the thread unpinned
+int utils_checkCore (int core);
+// Linux only. Runs the caller with SCHED_DEADLINE: the kernel reserves runtimeNs of CPU time in every periodNs, to be
+// used within deadlineNs of the start of the period. The thread can't be pinned to a core while it is a deadline task.
+// returns: 0 on success, < 0 if the kernel or libc doesn't support it or we lack permission
+int utils_setCallerThreadDeadline (uint64_t runtimeNs, uint64_t deadlineNs, uint64_t periodNs);
 
 uint16_t utils_readU16LE (const uint8_t *buf);
 int utils_writeU16LE (uint8_t *buf, uint16_t val);
 
-// call utils_setAudioLevelFilters before using utils_setAudioStats
-void utils_setAudioLevelFilters (void);
-void utils_setAudioStats (double sample, int channel);
-
-double utils_s16ToDouble (const int16_t *inBuf, int index);
-// 24-bit index, i.e. 1 unit in index equals 3 bytes in inBuf
-double utils_s24ToDouble (const uint8_t *inBuf, int index);
-double utils_s32ToDouble (const int32_t *inBuf, int index);
+void utils_setLosslessStats (int encodedLen, int sampleCount);
 
 // min is inclusive, max is not inclusive
 // call srand() first
@@ -58,6 +49,8 @@ uint8_t *utils_base64Decode (const uint8_t *src, size_t len, size_t *out_len);
 // returns 0 for success or a negative error code
 int utils_x25519Base64ToBuf (uint8_t *keyBuf, const char *keyStr);
 
+// Call once from the main thread before starting any other threads. Returns the name of the CRC kernel in use.
+const char *utils_crcInit (void);
 uint32_t utils_crc32 (uint32_t crc, const uint8_t *buf, int bufLen);
 uint16_t utils_crc16 (uint16_t crc, const uint8_t *buf, int bufLen);
 
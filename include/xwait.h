@@ -11,6 +11,7 @@
 #else
 #define _GNU_SOURCE
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdatomic.h>
 #include <linux/futex.h>
 #include <sys/syscall.h>
@@ -28,7 +29,11 @@
 #ifdef __APPLE__
   typedef dispatch_semaphore_t xwait_t;
 #else
+  // The low 31 bits are the notify count, the top bit is set while a waiter is (about to be) asleep in
+  // FUTEX_WAIT. xwait_notify only does the FUTEX_WAKE syscall if that bit is set, so notifying a thread
+  // that is busy (not waiting) costs a single atomic add.
   typedef _Atomic uint32_t xwait_t;
+  #define XWAIT_SLEEPING 0x80000000u
 #endif
 
 static inline void xwait_init (xwait_t *handle) {
@@ -43,14 +48,22 @@ static inline void xwait_wait (xwait_t *handle) {
 #ifdef __APPLE__
   dispatch_semaphore_wait(*handle, DISPATCH_TIME_FOREVER);
 #else
-  // no need for syscall if xwait_notify was called more than once since the last call to xwait_wait
-  while (atomic_load(handle) == 0) {
-    // wait iff *handle == 0
-    syscall(SYS_futex, handle, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
-    // if *handle == 0 here, there was a spurious wake-up, wait again
-  }
+  uint32_t val = atomic_load(handle);
+  while (true) {
+    if ((val & ~XWAIT_SLEEPING) != 0) {
+      // no need for syscall if xwait_notify was called since the last call to xwait_wait
+      if (atomic_compare_exchange_weak(handle, &val, val - 1)) return;
+      continue;
+    }
+
+    // Count is zero, flag that we are going to sleep. If this fails, val has been updated, try again.
+    if ((val & XWAIT_SLEEPING) == 0 && !atomic_compare_exchange_weak(handle, &val, XWAIT_SLEEPING)) continue;
 
-  atomic_fetch_sub(handle, 1);
+    // wait iff *handle == XWAIT_SLEEPING
+    syscall(SYS_futex, handle, FUTEX_WAIT_PRIVATE, XWAIT_SLEEPING, NULL, NULL, 0);
+    // if the count is still zero here, there was a spurious wake-up, wait again
+    val = atomic_load(handle);
+  }
 #endif
 }
 
@@ -58,8 +71,12 @@ static inline void xwait_notify (xwait_t *handle) {
 #ifdef __APPLE__
   dispatch_semaphore_signal(*handle);
 #else
-  atomic_fetch_add(handle, 1);
-  syscall(SYS_futex, handle, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  if ((atomic_fetch_add(handle, 1) & XWAIT_SLEEPING) == 0) return;
+
+  // Clear the flag before waking so the next notify doesn't do a syscall. Wake all waiters because any
+  // others that are still asleep have lost their flag; they will set it again if they need to go back to sleep.
+  atomic_fetch_and(handle, ~XWAIT_SLEEPING);
+  syscall(SYS_futex, handle, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
 #endif
 }
 
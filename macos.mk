@@ -20,23 +20,28 @@ PROTOCFLAGS = --cpp_out=.
 # LIBS = -g3 -fno-omit-frame-pointer -fsanitize=address
 CFLAGS = -std=c17 -O3 -flto -fstrict-aliasing -pedantic -pedantic-errors -Wall -Wextra -I./include -I./include/deps -I./include/deps/ck -I$(OPENSSL_PATH)/include
 CPPFLAGS = -std=c++20 -O3 -flto -fstrict-aliasing -Wno-gnu-anonymous-struct -Wno-nested-anon-types -Wno-gcc-compat -pedantic -pedantic-errors -Wall -Wextra -I./include -I./include/deps -I./include/deps/ck -I$(OPENSSL_PATH)/include
+# make SAMPLE_FORMAT=f32 for a float audio pipeline instead of double, see include/sample.h
+ifeq ($(SAMPLE_FORMAT), f32)
+CFLAGS += -DW_SAMPLE_F32
+CPPFLAGS += -DW_SAMPLE_F32
+endif
 LDFLAGS = -Llib/$(ARCH) -L$(OPENSSL_PATH)/lib -pthread -flto
-LIBS = -lstdc++ -lm -lz -lopus -lportaudio -lr8brain -lraptorq -lck -lssl -lcrypto -luwebsockets -lprotobuf-lite -lboringtun -framework CoreAudio -framework AudioUnit -framework AudioToolbox -framework CoreServices -framework Security
+LIBS = -lstdc++ -lm -lz -lopus -lportaudio -lraptorq -lck -lssl -lcrypto -luwebsockets -lprotobuf-lite -lboringtun -framework CoreAudio -framework AudioUnit -framework AudioToolbox -framework CoreServices -framework Security
 
 TARGET = waterslide-$(ARCH)
 PROTOBUFS = init-config.proto monitor.proto
-SRCSC = main.c sender.c receiver.c globals.c utils.c mux.c demux.c endpoint.c audio-macos.c pcm.c event-recorder.c
+SRCSC = main.c sender.c receiver.c globals.c utils.c mux.c demux.c endpoint.c audio-macos.c pcm.c event-recorder.c opus-groups.c lossless.c sampleconv.c reorder-buffer.c resampler.c audio-ring.c meter.c
 SRCSCPP = syncer/enqueue.cpp syncer/resamp-state.cpp syncer/receiver-sync.cpp config.cpp monitor.cpp $(subst .proto,.pb.cpp,$(addprefix protobufs/,$(PROTOBUFS)))
 OBJS = $(subst .c,.o,$(addprefix src/,$(SRCSC))) $(subst .cpp,.o,$(addprefix src/,$(SRCSCPP)))
 
-.PHONY: setup
+.PHONY: setup bench
 
 all: setup protobufs bin/$(TARGET)
 
 protobufs: $(PROTOBUFS)
 
 setup:
-	mkdir -p obj/protobufs obj/syncer include/protobufs src/protobufs
+	mkdir -p bin obj/protobufs obj/syncer include/protobufs src/protobufs
 
 %.proto:
 	$(PROTOC) $(PROTOCFLAGS) protobufs/$@
@@ -52,9 +57,43 @@ bin/$(TARGET): $(OBJS)
 .cpp.o:
 	$(CPP) $(CPPFLAGS) -c $< -o $(subst src,obj,$@)
 
+# Benchmarks and simulations, see bench/. Not part of all, build them with the bench target.
+BENCHES = receiver-sync audio-ring resampler sample-format-f64 sample-format-f32 sampleconv crc opus
+
+bench: setup $(addprefix bin/bench-,$(BENCHES))
+
+bin/bench-receiver-sync: bench/receiver-sync.cpp src/globals.o
+	$(CPP) $(CPPFLAGS) $(LDFLAGS) -o $@ $< obj/globals.o -lstdc++ -lm
+
+bin/bench-audio-ring: bench/audio-ring.c src/audio-ring.o src/utils.o src/globals.o
+	$(CC) $(CFLAGS) $(LDFLAGS) -o $@ $< obj/audio-ring.o obj/utils.o obj/globals.o $(LIBS)
+
+bin/bench-resampler: bench/resampler.c src/resampler.o
+	$(CC) $(CFLAGS) $(LDFLAGS) -o $@ $< obj/resampler.o -lm
+
+# Built for both sample formats whatever SAMPLE_FORMAT is, so the sources are compiled here rather than taken from obj/
+SAMPLE_FORMAT_BENCH_SRCS = src/sampleconv.c src/meter.c src/audio-ring.c src/resampler.c src/utils.c src/globals.c
+
+bin/bench-sample-format-f64: bench/sample-format.c $(SAMPLE_FORMAT_BENCH_SRCS)
+	$(CC) $(CFLAGS) -UW_SAMPLE_F32 $(LDFLAGS) -o $@ $^ $(LIBS)
+
+bin/bench-sample-format-f32: bench/sample-format.c $(SAMPLE_FORMAT_BENCH_SRCS)
+	$(CC) $(CFLAGS) -DW_SAMPLE_F32 $(LDFLAGS) -o $@ $^ $(LIBS)
+
+bin/bench-sampleconv: bench/sampleconv.c src/sampleconv.o
+	$(CC) $(CFLAGS) $(LDFLAGS) -o $@ $< obj/sampleconv.o
+
+# Includes src/utils.c for its static CRC kernels
+bin/bench-crc: bench/crc.c src/utils.c src/globals.o
+	$(CC) $(CFLAGS) $(LDFLAGS) -o $@ $< obj/globals.o $(LIBS)
+
+bin/bench-opus: bench/opus.c
+	$(CC) $(CFLAGS) $(LDFLAGS) -o $@ $< -lopus -lm
+
 clean:
 	rm -f \
 		$(subst src,obj,$(OBJS)) \
 		$(subst .proto,.pb.cpp,$(addprefix src/protobufs/,$(PROTOBUFS))) \
 		$(subst .proto,.pb.h,$(addprefix include/protobufs/,$(PROTOBUFS))) \
 		bin/$(TARGET) \
+		$(addprefix bin/bench-,$(BENCHES))
@@ -12,23 +12,45 @@ namespace App {
 
   interface OpusStats {
     codecErrorCount?: number
+    groupCodecTime?: number[]
+    concealedFrameCount?: number
   }
 
   interface PCMStats {
     crcFailCount?: number
   }
 
+  interface LosslessStats {
+    crcFailCount?: number
+    compressionRatio?: number
+  }
+
   interface AudioStats {
     audioChannel?: AudioChannel[]
     streamBufferSize?: number
     streamMeterBins?: Uint8Array
     bufferOverrunCount?: number
     bufferUnderrunCount?: number
+    lateFrameCount?: number
+    reorderedFrameCount?: number
+    filledFrameCount?: number
+    decodeStageTime?: number
+    decodeQueueOverrunCount?: number
+    dspTime?: number
+    dspOverrunCount?: number
+    rateChangeTime?: number
+    resamplerLatency?: number
     encodeThreadJitterCount?: number
     audioLoopXrunCount?: number
+    audioLoopLateness?: number
+    audioLoopLatenessMax?: number
+    audioLoopEarlyWakeCount?: number
     clockError?: number
     opusStats?: OpusStats
     pcmStats?: PCMStats
+    losslessStats?: LosslessStats
+    encodeWakeLatency?: number
+    encodeWakeLatencyMax?: number
   }
 
   interface EndpointStats {
@@ -43,6 +65,7 @@ namespace App {
   interface MonitorData {
     dupBlockCount?: number
     oooBlockCount?: number
+    fecDecodeTime?: number
     blockTiming?: Uint8Array
     endpoint?: EndpointStats[]
     audioStats?: AudioStats
@@ -5,32 +5,70 @@
 
 #include "xwait.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <time.h>
 #include <semaphore.h>
 #include "tinyalsa/pcm.h"
+#include "ck/ck_ring.h"
 #include "globals.h"
 #include "utils.h"
 #include "syncer.h"
+#include "sampleconv.h"
+#include "meter.h"
 #include "audio.h"
 
-static ck_ring_t *_ring;
-static ck_ring_buffer_t *_ringBuf;
-static unsigned int _fullRingSize;
+static audioring_t *_ring;
+static void (*_onRingWrite)(void);
 static bool _receiver;
 static unsigned int bytesPerSample, networkChannelCount, deviceChannelCount, audioEncoding;
+static sample_t *convertBuf = NULL; // networkChannelCount * periodSize, interleaved
+
+// Sender with Opus: dmaBufRead only copies the raw DMA data into a free slot and passes it to the DSP thread, which
+// does the resampling and metering (syncer_enqueueBuf) so that the audio thread has a small fixed cost per period.
+// Slots go around in a loop: freeRawRing -> dmaBufRead -> rawRing -> startDspThread -> freeRawRing
+#define RAW_RING_LEN 32 // In periods
+static uint8_t *rawSlots[RAW_RING_LEN] = { NULL };
+static unsigned int rawSlotFrameCount;
+static ck_ring_t rawRing, freeRawRing;
+static ck_ring_buffer_t rawRingBuf[2 * RAW_RING_LEN], freeRawRingBuf[2 * RAW_RING_LEN]; // ck rings hold one less than their size
+static pthread_t dspThread;
+static xwait_t dspWaitHandle;
+static atomic_bool dspThreadRunning = false;
 static pthread_t audioLoopThread;
 static xwait_t audioLoopInitWait;
 static atomic_int audioLoopStatus = 0;
 
+// The audio loop processes the DMA buffer a period at a time. Capture reads each period as soon as the DMA pointer has
+// passed it, and has until the pointer comes around again (periodCount - 1 periods) to catch up if it is late.
+// Playback writes each period AUDIO_PLAYBACK_LEAD periods ahead of the pointer, so latency doesn't grow with
+// periodCount.
+// The loop sleeps until the DMA pointer is predicted to cross the next period boundary, using the timestamp of the
+// last pointer read. It wakes a little after the boundary so that one wakeup per period is usually enough; if the
+// pointer hasn't crossed yet it polls every loopSleep.
+#define AUDIO_PLAYBACK_LEAD 2 // In periods, limited to periodCount - 1
+#define AUDIO_LOOP_WAKE_MARGIN 0.25 // In periods
+#define AUDIO_LOOP_DEADLINE_RUNTIME 0.5 // With SCHED_DEADLINE, the fraction of each period reserved for the loop
+
+static inline int64_t timespecToNs (const struct timespec *tsp) {
+  return 1000000000LL * tsp->tv_sec + tsp->tv_nsec;
+}
+
+static unsigned int getPlaybackLead (void) {
+  unsigned int periodCount = globals_get1i(audio, periodCount);
+  return periodCount - 1 < AUDIO_PLAYBACK_LEAD ? periodCount - 1 : AUDIO_PLAYBACK_LEAD;
+}
+
 // This is on the RT thread for receiver
 static void dmaBufWrite (uint8_t *dmaBuf, unsigned int frameCount) {
   static bool ringUnderrun = true; // let ring fill to half before we start dequeuing
-  unsigned int ringCurrentSize = utils_ringSize(_ring);
+  unsigned int ringCurrentSize = audioring_size(_ring);
+  unsigned int fullRingSize = _ring->capacity;
 
   memset(dmaBuf, 0, bytesPerSample * deviceChannelCount * frameCount);
 
@@ -38,78 +76,127 @@ static void dmaBufWrite (uint8_t *dmaBuf, unsigned int frameCount) {
 
   if (ringUnderrun) {
     // Let the ring fill up to about half-way before pulling from it again, while outputting silence.
-    if (ringCurrentSize < _fullRingSize / 2) {
+    if (ringCurrentSize < fullRingSize / 2) {
       return;
     } else {
       ringUnderrun = false;
     }
   }
 
-  globals_add1uiv(statsCh1Audio, streamMeterBins, (STATS_STREAM_METER_BINS-1) * ringCurrentSize / _fullRingSize, 1);
+  globals_add1uiv(statsCh1Audio, streamMeterBins, (STATS_STREAM_METER_BINS-1) * ringCurrentSize / fullRingSize, 1);
 
-  // Don't ever let the ring empty completely, that way the channels stay in order
-  if (ringCurrentSize < networkChannelCount * frameCount) {
+  if (audioring_dequeueFrames(_ring, convertBuf, frameCount) < 0) {
     ringUnderrun = true;
     globals_add1ui(statsCh1Audio, bufferUnderrunCount, 1);
     return;
   }
 
-  for (unsigned int i = 0; i < frameCount; i++) {
-    for (unsigned int j = 0; j < networkChannelCount; j++) {
-      // If networkChannelCount > networkChannelCount, dequeue the sample then discard it.
-      // If networkChannelCount < deviceChannelCount, don't write to the remaining channels in outBuf,
-      // they are already set to zero above.
-      // NOTE: audio-linux and audio-macos have different behaviour when deviceChannelCount < networkChannelCount:
-      // - audio-linux: output the first deviceChannelCount channels and discard the rest
-      // - audio-macos: don't proceed, return an error from audio_init
-      double outSampleDouble = utils_ringDequeueSample(_ring, _ringBuf);
-      if (j >= deviceChannelCount) continue;
-      if (outSampleDouble < -1.0) outSampleDouble = -1.0;
-      else if (outSampleDouble > 1.0) outSampleDouble = 1.0;
-      // NOTE: Only bytesPerSample = 4 is implemented
-      // http://blog.bjornroche.com/2009/12/int-float-int-its-jungle-out-there.html
-      int32_t sampleInt = outSampleDouble > 0.0 ? 2147483647.0*outSampleDouble : 2147483648.0*outSampleDouble;
-      memcpy(&dmaBuf[4 * (deviceChannelCount*i + j)], &sampleInt, 4);
-      utils_setAudioStats(outSampleDouble, j);
-    }
-  }
+  // If networkChannelCount > deviceChannelCount, the remaining samples are discarded.
+  // If networkChannelCount < deviceChannelCount, don't write to the remaining channels in dmaBuf,
+  // they are already set to zero above.
+  // NOTE: audio-linux and audio-macos have different behaviour when deviceChannelCount < networkChannelCount:
+  // - audio-linux: output the first deviceChannelCount channels and discard the rest
+  // - audio-macos: don't proceed, return an error from audio_init
+  unsigned int channelCount = networkChannelCount < deviceChannelCount ? networkChannelCount : deviceChannelCount;
+  meter_process(convertBuf, networkChannelCount, channelCount, frameCount);
+
+  // NOTE: Only bytesPerSample = 4 is implemented
+  sampleconv_sampleToS32(convertBuf, networkChannelCount, (int32_t *)dmaBuf, deviceChannelCount, frameCount);
 }
 
 // This is on the RT thread for sender
 static void dmaBufRead (const uint8_t *dmaBuf, unsigned int frameCount) {
   switch (audioEncoding) {
-    case AUDIO_ENCODING_OPUS:
+    case AUDIO_ENCODING_OPUS: {
+      uint8_t *slot;
+      if (!ck_ring_dequeue_spsc(&freeRawRing, freeRawRingBuf, (void*)&slot)) {
+        // The DSP thread is not keeping up
+        globals_add1ui(statsCh1Audio, dspOverrunCount, 1);
+        return;
+      }
+      memcpy(slot, dmaBuf, bytesPerSample * deviceChannelCount * frameCount);
+      ck_ring_enqueue_spsc(&rawRing, rawRingBuf, slot);
+      xwait_notify(&dspWaitHandle);
+      return; // the DSP thread calls _onRingWrite
+    }
+
+    case AUDIO_ENCODING_PCM:
+    case AUDIO_ENCODING_LOSSLESS:
+      // No clipping is required as we are converting from int to float
       if (bytesPerSample == 4) {
-        syncer_enqueueBufS32((int32_t *)dmaBuf, frameCount, deviceChannelCount, true);
+        sampleconv_s32ToSample((const int32_t *)dmaBuf, deviceChannelCount, convertBuf, networkChannelCount, frameCount);
       } else { // bytesPerSample == 2
-        syncer_enqueueBufS16((int16_t *)dmaBuf, frameCount, deviceChannelCount, true);
+        sampleconv_s16ToSample((const int16_t *)dmaBuf, deviceChannelCount, convertBuf, networkChannelCount, frameCount);
       }
-      break;
 
-    case AUDIO_ENCODING_PCM:
-      for (unsigned int i = 0; i < frameCount; i++) {
-        for (unsigned int j = 0; j < networkChannelCount; j++) {
-          double inSampleDouble;
-
-          // No clipping is required as we are converting from int to float
-          // https://gist.github.com/shafik/848ae25ee209f698763cffee272a58f8#how-do-we-type-pun-correctly
-          if (bytesPerSample == 4) {
-            int32_t sampleInt;
-            memcpy(&sampleInt, &dmaBuf[4 * (deviceChannelCount*i + j)], 4);
-            inSampleDouble = sampleInt > 0 ? sampleInt/2147483647.0 : sampleInt/2147483648.0;
-          } else { // bytesPerSample == 2
-            int16_t sampleInt;
-            memcpy(&sampleInt, &dmaBuf[2 * (deviceChannelCount*i + j)], 2);
-            inSampleDouble = sampleInt > 0 ? sampleInt/32767.0 : sampleInt/32768.0;
-          }
-
-          // DEBUG: I think we need to check for overrun here before enqueuing. We are doing it above for AUDIO_ENCODING_OPUS when we call syncer_enqueueBuf
-          utils_ringEnqueueSample(_ring, _ringBuf, inSampleDouble);
-          utils_setAudioStats(inSampleDouble, j);
-        }
+      if (audioring_enqueueFrames(_ring, convertBuf, frameCount) < 0) {
+        // The encode thread is not keeping up, drop the whole period so the channels stay in order
+        globals_add1ui(statsCh1Audio, bufferOverrunCount, 1);
+        break;
       }
+      meter_process(convertBuf, networkChannelCount, networkChannelCount, frameCount);
       break;
   }
+
+  _onRingWrite();
+}
+
+static void *startDspThread (UNUSED void *arg) {
+  utils_setCallerThreadRealtime(98, utils_checkCore(AUDIO_DSP_THREAD_CORE));
+
+  while (atomic_load(&dspThreadRunning)) {
+    xwait_wait(&dspWaitHandle);
+
+    uint8_t *slot;
+    while (ck_ring_dequeue_spsc(&rawRing, rawRingBuf, (void*)&slot)) {
+      int startUTime = utils_getCurrentUTime();
+      if (bytesPerSample == 4) {
+        syncer_enqueueBufS32((int32_t *)slot, rawSlotFrameCount, deviceChannelCount, true);
+      } else { // bytesPerSample == 2
+        syncer_enqueueBufS16((int16_t *)slot, rawSlotFrameCount, deviceChannelCount, true);
+      }
+      ck_ring_enqueue_spsc(&freeRawRing, freeRawRingBuf, slot);
+      globals_set1i(statsCh1Audio, dspTime, utils_getElapsedUTime(startUTime));
+
+      _onRingWrite();
+    }
+  }
+
+  return NULL;
+}
+
+static int initDsp (void) {
+  rawSlotFrameCount = globals_get1i(audio, periodSize);
+  ck_ring_init(&rawRing, 2 * RAW_RING_LEN);
+  ck_ring_init(&freeRawRing, 2 * RAW_RING_LEN);
+  for (int i = 0; i < RAW_RING_LEN; i++) {
+    rawSlots[i] = (uint8_t *)malloc(bytesPerSample * deviceChannelCount * rawSlotFrameCount);
+    if (rawSlots[i] == NULL) return -1;
+    ck_ring_enqueue_spsc(&freeRawRing, freeRawRingBuf, rawSlots[i]);
+  }
+
+  xwait_init(&dspWaitHandle);
+  atomic_store(&dspThreadRunning, true);
+  if (pthread_create(&dspThread, NULL, startDspThread, NULL) != 0) {
+    atomic_store(&dspThreadRunning, false);
+    return -2;
+  }
+
+  return 0;
+}
+
+static void deinitDsp (void) {
+  if (atomic_load(&dspThreadRunning)) {
+    atomic_store(&dspThreadRunning, false);
+    xwait_notify(&dspWaitHandle);
+    pthread_join(dspThread, NULL);
+    xwait_destroy(&dspWaitHandle);
+  }
+
+  for (int i = 0; i < RAW_RING_LEN; i++) {
+    free(rawSlots[i]);
+    rawSlots[i] = NULL;
+  }
 }
 
 static inline void setAudioLoopStatus (int status) {
@@ -160,25 +247,28 @@ static void *startAudioLoop (UNUSED void *arg) {
   int err = 0;
 
   if (!_receiver && audioEncoding == AUDIO_ENCODING_OPUS) {
-    int framesPerCallbackBuffer = dmaBufLen / 2;
-    err = syncer_init(deviceSampleRate, networkSampleRate, framesPerCallbackBuffer, _ring, _ringBuf, _fullRingSize);
+    int framesPerCallbackBuffer = periodSize;
+    err = syncer_init(deviceSampleRate, networkSampleRate, framesPerCallbackBuffer, _ring);
   } else if (_receiver) {
     int framesPerCallbackBuffer;
     if (audioEncoding == AUDIO_ENCODING_OPUS) {
       framesPerCallbackBuffer = globals_get1i(opus, frameSize);
+    } else if (audioEncoding == AUDIO_ENCODING_LOSSLESS) {
+      framesPerCallbackBuffer = globals_get1i(lossless, frameSize);
     } else {
       framesPerCallbackBuffer = globals_get1i(pcm, frameSize);
     }
-    err = syncer_init(networkSampleRate, deviceSampleRate, framesPerCallbackBuffer, _ring, _ringBuf, _fullRingSize);
+    err = syncer_init(networkSampleRate, deviceSampleRate, framesPerCallbackBuffer, _ring);
   } else {
-    // PCM sender uses deviceSampleRate, no syncer required.
+    // PCM and lossless sender uses deviceSampleRate, no syncer required.
   }
   if (err < 0) {
     setAudioLoopStatus(err - 1);
     return NULL;
   }
 
-  unsigned int flags = (_receiver ? PCM_OUT : PCM_IN) | PCM_MMAP | PCM_NOIRQ;
+  // PCM_MONOTONIC: timestamp the DMA pointer with CLOCK_MONOTONIC so we can sleep until a predicted time
+  unsigned int flags = (_receiver ? PCM_OUT : PCM_IN) | PCM_MMAP | PCM_NOIRQ | PCM_MONOTONIC;
   struct pcm *pcm = pcm_open(cardId, deviceId, flags, &config);
   if (pcm == NULL) {
     setAudioLoopStatus(-3);
@@ -215,18 +305,36 @@ static void *startAudioLoop (UNUSED void *arg) {
     return NULL;
   }
 
-  err = utils_setCallerThreadRealtime(99, 0);
-  if (err < 0) {
-    setAudioLoopStatus(err - 7);
-    return NULL;
-  }
+  unsigned int playbackLead = getPlaybackLead();
+  unsigned int periodBytes = bytesPerSample * deviceChannelCount * periodSize;
+  int64_t periodNs = 1e9 * periodSize / deviceSampleRate;
+  int64_t wakeMarginNs = AUDIO_LOOP_WAKE_MARGIN * periodNs;
+  int64_t pollNs = 1000LL * globals_get1i(audio, loopSleep);
 
-  struct timespec loopSleep, tsp; // tsp is unused
-  loopSleep.tv_nsec = 1000 * globals_get1i(audio, loopSleep);
-  loopSleep.tv_sec = 0;
-
-  unsigned int hwPos = 0, lastHwPos = 0; // DEBUG: overflow at approx. 25 hours at 48 kHz on 32-bit arch
-  bool lastBufHalf = false;
+  bool schedDeadline = false;
+  if (globals_get1i(audio, schedDeadline)) {
+    schedDeadline = utils_setCallerThreadDeadline(AUDIO_LOOP_DEADLINE_RUNTIME * periodNs, periodNs, periodNs) == 0;
+    if (!schedDeadline) printf("SCHED_DEADLINE is not available, falling back to SCHED_FIFO\n");
+  }
+  if (!schedDeadline) {
+    err = utils_setCallerThreadRealtime(99, 0);
+    if (err < 0) {
+      setAudioLoopStatus(err - 7);
+      return NULL;
+    }
+  }
+  printf("Audio loop scheduling: %s\n", schedDeadline ? "SCHED_DEADLINE" : "SCHED_FIFO");
+
+  struct timespec hwTime, now;
+  // hwPos wraps, either at the ALSA boundary or at 2^32 where tinyalsa truncates it, so the loop keeps its own 64-bit
+  // count of frames since the stream started (streamPos) and advances it by the distance the pointer moved. The
+  // boundary is a multiple of the buffer size, so streamPos % dmaBufLen is still the pointer's place in the buffer.
+  unsigned long boundary = config.stop_threshold;
+  unsigned int hwPos = 0, lastHwPos = 0;
+  uint64_t streamPos = 0;
+  // Period indices count up from the start of the stream, nextPeriod is the next one to read (capture) or write (playback)
+  uint64_t nextPeriod = 0;
+  bool started = false;
 
   // Wait a bit, otherwise pcm_mmap_get_hw_ptr will error out due to the timestamp being 0
   utils_usleep(50000);
@@ -234,33 +342,72 @@ static void *startAudioLoop (UNUSED void *arg) {
   // successfully initialised, tell the main thread
   setAudioLoopStatus(1);
   while (audioLoopStatus == 1) {
-    if (pcm_mmap_get_hw_ptr(pcm, &hwPos, &tsp) < 0) {
+    if (pcm_mmap_get_hw_ptr(pcm, &hwPos, &hwTime) < 0) {
       pcm_close(pcm);
       audioLoopStatus = -10; // don't xwait_notify in the loop, the other thread is not waiting anymore
       return NULL;
     }
 
-    bool bufHalf = (hwPos % dmaBufLen) >= (dmaBufLen / 2);
-    if (bufHalf != lastBufHalf) {
-      if (bufHalf && _receiver) {
-        dmaBufWrite(dmaBuf, dmaBufLen / 2);
-      } else if (bufHalf && !_receiver) {
-        dmaBufRead(dmaBuf, dmaBufLen / 2);
-      } else if (!bufHalf && _receiver) {
-        dmaBufWrite(&dmaBuf[bytesPerSample * deviceChannelCount * dmaBufLen / 2], dmaBufLen / 2);
-      } else { // !bufHalf && !_receiver
-        dmaBufRead(&dmaBuf[bytesPerSample * deviceChannelCount * dmaBufLen / 2], dmaBufLen / 2);
+    if (!started) {
+      streamPos = hwPos;
+    } else if (boundary <= UINT_MAX) {
+      streamPos += hwPos >= lastHwPos ? hwPos - lastHwPos : hwPos + (boundary - lastHwPos);
+    } else {
+      streamPos += hwPos - lastHwPos; // unsigned, wraps at 2^32 like hwPos
+    }
+    lastHwPos = hwPos;
+
+    // The DMA pointer is in hwPeriod, all periods before it have been captured or played
+    uint64_t hwPeriod = streamPos / periodSize;
+    if (!started) {
+      // The DMA buffer is all silence for playback, start writing after the period being played
+      nextPeriod = _receiver ? hwPeriod + 1 : hwPeriod;
+      started = true;
+    }
+
+    // Periods before endPeriod can be processed now
+    uint64_t endPeriod = _receiver ? hwPeriod + playbackLead + 1 : hwPeriod;
+    if (endPeriod <= nextPeriod) {
+      globals_add1ui(statsCh1Audio, audioLoopEarlyWakeCount, 1);
+    } else {
+      // Capture: periods more than periodCount - 1 behind the pointer have been overwritten.
+      // Playback: periods up to the pointer have already been played.
+      if (_receiver ? nextPeriod <= hwPeriod : hwPeriod - nextPeriod >= periodCount) {
+        // DEBUG: will this throw off receiver sync?
+        globals_add1ui(statsCh1Audio, audioLoopXrunCount, 1);
+        nextPeriod = _receiver ? hwPeriod + 1 : hwPeriod + 1 - periodCount;
+      }
+
+      for (; nextPeriod < endPeriod; nextPeriod++) {
+        uint8_t *periodBuf = &dmaBuf[periodBytes * (nextPeriod % periodCount)];
+        if (_receiver) {
+          dmaBufWrite(periodBuf, periodSize);
+        } else {
+          dmaBufRead(periodBuf, periodSize);
+        }
       }
-      lastBufHalf = bufHalf;
     }
 
-    if (lastHwPos != 0 && hwPos - lastHwPos > periodSize * periodCount / 2) {
-      // DEBUG: will this throw off receiver sync?
-      globals_add1ui(statsCh1Audio, audioLoopXrunCount, 1);
+    // hwTime is when the kernel read hwPos, predict the next boundary from there at the nominal rate.
+    // If the prediction is already in the past (the pointer is late to cross, or the timestamp is stale) poll instead.
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t nowNs = timespecToNs(&now);
+    int64_t wakeTime = timespecToNs(&hwTime) + (int64_t)(1e9 * (periodSize - streamPos % periodSize) / deviceSampleRate) + wakeMarginNs;
+    if (wakeTime <= nowNs) {
+      wakeTime = nowNs + pollNs;
+    } else if (wakeTime > nowNs + periodNs + wakeMarginNs) {
+      wakeTime = nowNs + periodNs + wakeMarginNs;
     }
-    lastHwPos = hwPos;
 
-    clock_nanosleep(CLOCK_MONOTONIC, 0, &loopSleep, NULL);
+    struct timespec wakeSpec = { .tv_sec = wakeTime / 1000000000LL, .tv_nsec = wakeTime % 1000000000LL };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeSpec, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int lateness = (timespecToNs(&now) - wakeTime) / 1000;
+    globals_set1i(statsCh1Audio, audioLoopLateness, lateness);
+    if (lateness > globals_get1i(statsCh1Audio, audioLoopLatenessMax)) {
+      globals_set1i(statsCh1Audio, audioLoopLatenessMax, lateness);
+    }
   }
 
   pcm_close(pcm);
@@ -274,28 +421,43 @@ int audio_init (bool receiver) {
   deviceChannelCount = globals_get1i(audio, deviceChannelCount);
   audioEncoding = globals_get1ui(audio, encoding);
 
-  utils_setAudioLevelFilters();
+  meter_setFilters();
 
   if (!receiver && deviceChannelCount < networkChannelCount) {
     printf("Device does not have enough output channels.\n");
     return -1;
   }
 
+  // The audio loop needs at least one period between the DMA pointer and the one it is processing
+  if (globals_get1i(audio, periodCount) < 2) {
+    printf("periodCount must be at least 2.\n");
+    return -1;
+  }
+
+  // dmaBufRead and dmaBufWrite are called with one period
+  convertBuf = (sample_t *)malloc(sizeof(sample_t) * networkChannelCount * globals_get1i(audio, periodSize));
+  if (convertBuf == NULL) return -2;
+
+  if (!receiver && audioEncoding == AUDIO_ENCODING_OPUS) {
+    int err = initDsp();
+    if (err < 0) return err - 2;
+  }
+
   return 0;
 }
 
 double audio_getDeviceLatency (void) {
+  // Capture reads each period once the DMA pointer has passed it, playback writes each period playbackLead periods
+  // before it is played
   int periodSize = globals_get1i(audio, periodSize);
-  int periodCount = globals_get1i(audio, periodCount);
   double deviceSampleRate;
   globals_get1ff(audio, deviceSampleRate, &deviceSampleRate);
-  return (double)(periodSize * periodCount / 2) / deviceSampleRate;
+  return (double)(periodSize * (_receiver ? getPlaybackLead() : 1)) / deviceSampleRate;
 }
 
-int audio_start (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, unsigned int fullRingSize) {
+int audio_start (audioring_t *ring, void (*onRingWrite)(void)) {
   _ring = ring;
-  _ringBuf = ringBuf;
-  _fullRingSize = fullRingSize;
+  _onRingWrite = onRingWrite;
 
   xwait_init(&audioLoopInitWait);
   if (pthread_create(&audioLoopThread, NULL, startAudioLoop, NULL) != 0) return -2;
@@ -312,12 +474,21 @@ int audio_start (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, unsigned int fullRi
 }
 
 int audio_deinit (void) {
+  int err = 0;
   if (audioLoopStatus != 0) {
-    if (audioLoopStatus < 0) return audioLoopStatus; // audioLoopThread has already errored out
-    audioLoopStatus = 0;
-    pthread_join(audioLoopThread, NULL);
-    xwait_destroy(&audioLoopInitWait);
+    if (audioLoopStatus < 0) {
+      err = audioLoopStatus; // audioLoopThread has already errored out
+    } else {
+      audioLoopStatus = 0;
+      pthread_join(audioLoopThread, NULL);
+      xwait_destroy(&audioLoopInitWait);
+    }
   }
 
-  return 0;
+  // The audio thread has stopped so nothing else is written to rawRing
+  deinitDsp();
+  free(convertBuf);
+  convertBuf = NULL;
+
+  return err;
 }
@@ -4,17 +4,21 @@
 // file, You can obtain one at https://mozilla.org/MPL/2.0/.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include "portaudio/portaudio.h"
 #include "globals.h"
 #include "utils.h"
 #include "syncer.h"
+#include "sampleconv.h"
+#include "meter.h"
 #include "audio.h"
 
 static PaStream *stream = NULL;
-static ck_ring_t *_ring;
-static ck_ring_buffer_t *_ringBuf;
-static int _fullRingSize;
+static audioring_t *_ring;
+static sample_t *convertBuf = NULL; // networkChannelCount * convertBufFrameCount, interleaved
+static int convertBufFrameCount = 0;
+static void (*_onRingWrite)(void);
 static bool _receiver;
 static int networkChannelCount, deviceChannelCount;
 static unsigned int audioEncoding;
@@ -30,11 +34,11 @@ static double deviceLatency = 0.0;
 static int playCallback (UNUSED const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer, UNUSED const PaStreamCallbackTimeInfo* timeInfo, UNUSED PaStreamCallbackFlags statusFlags, UNUSED void *userData) {
   static bool ringUnderrun = true; // let ring fill to half before we start dequeuing
   float *outBufFloat = (float *)outputBuffer;
-  int ringCurrentSize = utils_ringSize(_ring);
-  // This condition is ensured in audio_init: outBufFloatCount >= ringFloatCount
+  int ringCurrentSize = audioring_size(_ring);
+  int fullRingSize = _ring->capacity;
+  // This condition is ensured in audio_init: deviceChannelCount >= networkChannelCount
   int outBufFrameCount = (int)framesPerBuffer;
   int outBufFloatCount = deviceChannelCount * outBufFrameCount;
-  int ringFloatCount = networkChannelCount * outBufFrameCount;
 
   memset(outBufFloat, 0, 4 * outBufFloatCount);
 
@@ -42,32 +46,26 @@ static int playCallback (UNUSED const void *inputBuffer, void *outputBuffer, uns
 
   if (ringUnderrun) {
     // Let the ring fill up to about half-way before pulling from it again, while outputting silence.
-    if (ringCurrentSize < _fullRingSize / 2) {
+    if (ringCurrentSize < fullRingSize / 2) {
       return paContinue;
     } else {
       ringUnderrun = false;
     }
   }
 
-  globals_add1uiv(statsCh1Audio, streamMeterBins, (STATS_STREAM_METER_BINS-1) * ringCurrentSize / _fullRingSize, 1);
+  globals_add1uiv(statsCh1Audio, streamMeterBins, (STATS_STREAM_METER_BINS-1) * ringCurrentSize / fullRingSize, 1);
 
-  // Don't ever let the ring empty completely, that way the channels stay in order
-  if (ringCurrentSize < ringFloatCount) {
+  if (outBufFrameCount > convertBufFrameCount || audioring_dequeueFrames(_ring, convertBuf, outBufFrameCount) < 0) {
     ringUnderrun = true;
     globals_add1ui(statsCh1Audio, bufferUnderrunCount, 1);
     return paContinue;
   }
 
-  for (int i = 0; i < outBufFrameCount; i++) {
-    for (int j = 0; j < networkChannelCount; j++) {
-      // If networkChannelCount < deviceChannelCount, don't write to the remaining channels in outBufFloat,
-      // they are already set to zero above.
-      double outSampleDouble = utils_ringDequeueSample(_ring, _ringBuf);
-      // Setting stats here instead of in syncer_enqueueBuf allows us to see silence from underruns on the audio level monitor.
-      outBufFloat[deviceChannelCount*i + j] = outSampleDouble;
-      utils_setAudioStats(outSampleDouble, j);
-    }
-  }
+  // If networkChannelCount < deviceChannelCount, don't write to the remaining channels in outBufFloat,
+  // they are already set to zero above.
+  sampleconv_sampleToF32(convertBuf, networkChannelCount, outBufFloat, deviceChannelCount, outBufFrameCount);
+  // Setting stats here instead of in syncer_enqueueBuf allows us to see silence from underruns on the audio level monitor.
+  meter_process(convertBuf, networkChannelCount, networkChannelCount, outBufFrameCount);
 
   return paContinue;
 }
@@ -82,16 +80,22 @@ static int recordCallback (const void *inputBuffer, UNUSED void *outputBuffer, u
       break;
 
     case AUDIO_ENCODING_PCM:
-      for (unsigned long i = 0; i < framesPerBuffer; i++) {
-        for (int j = 0; j < networkChannelCount; j++) {
-          double inSampleDouble = inBufFloat[deviceChannelCount*i + j];
-          utils_ringEnqueueSample(_ring, _ringBuf, inSampleDouble);
-          utils_setAudioStats(inSampleDouble, j);
-        }
+    case AUDIO_ENCODING_LOSSLESS:
+      if ((int)framesPerBuffer > convertBufFrameCount) {
+        globals_add1ui(statsCh1Audio, bufferOverrunCount, 1);
+        return paContinue;
+      }
+      sampleconv_f32ToSample(inBufFloat, deviceChannelCount, convertBuf, networkChannelCount, framesPerBuffer);
+      if (audioring_enqueueFrames(_ring, convertBuf, framesPerBuffer) < 0) {
+        // The encode thread is not keeping up, drop the whole buffer so the channels stay in order
+        globals_add1ui(statsCh1Audio, bufferOverrunCount, 1);
+        break;
       }
+      meter_process(convertBuf, networkChannelCount, networkChannelCount, framesPerBuffer);
       break;
   }
 
+  _onRingWrite();
   return paContinue;
 }
 
@@ -105,7 +109,7 @@ int audio_init (bool receiver) {
   networkChannelCount = globals_get1i(audio, networkChannelCount);
   audioEncoding = globals_get1ui(audio, encoding);
 
-  utils_setAudioLevelFilters();
+  meter_setFilters();
 
   if (Pa_Initialize() != paNoError) return -2;
 
@@ -159,6 +163,8 @@ int audio_init (bool receiver) {
       framesPerCallbackBuffer = globals_get1i(opus, frameSize);
     } else if (audioEncoding == AUDIO_ENCODING_PCM) {
       framesPerCallbackBuffer = globals_get1i(pcm, frameSize);
+    } else if (audioEncoding == AUDIO_ENCODING_LOSSLESS) {
+      framesPerCallbackBuffer = globals_get1i(lossless, frameSize);
     } else {
       return -7;
     }
@@ -188,8 +194,8 @@ int audio_init (bool receiver) {
   deviceLatency = receiver ? streamInfo->outputLatency : streamInfo->inputLatency; // seconds
   double actualDeviceSampleRate = streamInfo->sampleRate; // Hz
 
-  if (audioEncoding == AUDIO_ENCODING_PCM && !receiver && requestedDeviceSampleRate != actualDeviceSampleRate) {
-    printf("We requested %f Hz but the device requires %f Hz. This is only an issue when using PCM encoding.\n", requestedDeviceSampleRate, actualDeviceSampleRate);
+  if (audioEncoding != AUDIO_ENCODING_OPUS && !receiver && requestedDeviceSampleRate != actualDeviceSampleRate) {
+    printf("We requested %f Hz but the device requires %f Hz. This is only an issue when using PCM or lossless encoding.\n", requestedDeviceSampleRate, actualDeviceSampleRate);
     return -9;
   }
 
@@ -206,12 +212,11 @@ double audio_getDeviceLatency (void) {
   return deviceLatency;
 }
 
-int audio_start (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, unsigned int fullRingSize) {
+int audio_start (audioring_t *ring, void (*onRingWrite)(void)) {
   if (stream == NULL) return -1;
 
   _ring = ring;
-  _ringBuf = ringBuf;
-  _fullRingSize = fullRingSize;
+  _onRingWrite = onRingWrite;
 
   int err = 0;
   double networkSampleRate = globals_get1i(audio, networkSampleRate);
@@ -221,20 +226,30 @@ int audio_start (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, unsigned int fullRi
   if (!_receiver && audioEncoding == AUDIO_ENCODING_OPUS) {
     // Calculate the maximum value that framesPerBuffer could be in recordCallback, leaving plenty of spare room.
     int framesPerCallbackBuffer = 3.0 * deviceLatency * deviceSampleRate;
-    err = syncer_init(deviceSampleRate, networkSampleRate, framesPerCallbackBuffer, ring, ringBuf, fullRingSize);
+    err = syncer_init(deviceSampleRate, networkSampleRate, framesPerCallbackBuffer, ring);
   } else if (_receiver) {
     int framesPerCallbackBuffer;
     if (audioEncoding == AUDIO_ENCODING_OPUS) {
       framesPerCallbackBuffer = globals_get1i(opus, frameSize);
+    } else if (audioEncoding == AUDIO_ENCODING_LOSSLESS) {
+      framesPerCallbackBuffer = globals_get1i(lossless, frameSize);
     } else {
       framesPerCallbackBuffer = globals_get1i(pcm, frameSize);
     }
-    err = syncer_init(networkSampleRate, deviceSampleRate, framesPerCallbackBuffer, ring, ringBuf, fullRingSize);
+    convertBufFrameCount = framesPerCallbackBuffer;
+    err = syncer_init(networkSampleRate, deviceSampleRate, framesPerCallbackBuffer, ring);
   } else {
-    // PCM sender uses deviceSampleRate, no syncer required.
+    // PCM and lossless sender uses deviceSampleRate, no syncer required.
+    // Calculate the maximum value that framesPerBuffer could be in recordCallback, leaving plenty of spare room.
+    convertBufFrameCount = 3.0 * deviceLatency * deviceSampleRate;
   }
   if (err < 0) return err - 1;
 
+  if (convertBufFrameCount > 0) {
+    convertBuf = (sample_t *)malloc(sizeof(sample_t) * networkChannelCount * convertBufFrameCount);
+    if (convertBuf == NULL) return -4;
+  }
+
   if (Pa_StartStream(stream) != paNoError) return -3;
 
   return 0;
@@ -0,0 +1,74 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "audio-ring.h"
+
+// Copy frameCount frames between linear and the ring buffer starting at frame pos, in at most two pieces
+static void copyIn (audioring_t *ring, unsigned int pos, const sample_t *linear, int frameCount) {
+  unsigned int start = pos & ring->mask;
+  unsigned int firstCount = ring->mask + 1 - start;
+  if (firstCount > (unsigned int)frameCount) firstCount = frameCount;
+  memcpy(&ring->buf[start * ring->channelCount], linear, sizeof(sample_t) * ring->channelCount * firstCount);
+  memcpy(ring->buf, &linear[firstCount * ring->channelCount], sizeof(sample_t) * ring->channelCount * (frameCount - firstCount));
+}
+
+static void copyOut (const audioring_t *ring, unsigned int pos, sample_t *linear, int frameCount) {
+  unsigned int start = pos & ring->mask;
+  unsigned int firstCount = ring->mask + 1 - start;
+  if (firstCount > (unsigned int)frameCount) firstCount = frameCount;
+  memcpy(linear, &ring->buf[start * ring->channelCount], sizeof(sample_t) * ring->channelCount * firstCount);
+  memcpy(&linear[firstCount * ring->channelCount], ring->buf, sizeof(sample_t) * ring->channelCount * (frameCount - firstCount));
+}
+
+int audioring_init (audioring_t *ring, int channelCount, int capacity) {
+  if (channelCount <= 0 || capacity <= 0) return -1;
+
+  int allocFrames = utils_roundUpPowerOfTwo(capacity);
+  ring->buf = (sample_t *)calloc((size_t)allocFrames * channelCount, sizeof(sample_t));
+  if (ring->buf == NULL) return -2;
+
+  ring->capacity = capacity;
+  ring->mask = allocFrames - 1;
+  ring->channelCount = channelCount;
+  atomic_store_explicit(&ring->writePos, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->readPos, 0, memory_order_relaxed);
+  return 0;
+}
+
+unsigned int audioring_size (const audioring_t *ring) {
+  // Load readPos first so that the result can't go below zero if the consumer moves between the loads
+  unsigned int readPos = atomic_load_explicit(&ring->readPos, memory_order_acquire);
+  unsigned int writePos = atomic_load_explicit(&ring->writePos, memory_order_acquire);
+  return writePos - readPos;
+}
+
+int audioring_enqueueFrames (audioring_t *ring, const sample_t *frames, int frameCount) {
+  unsigned int writePos = atomic_load_explicit(&ring->writePos, memory_order_relaxed);
+  // acquire so that the consumer has finished copying out of the slots before we overwrite them
+  unsigned int readPos = atomic_load_explicit(&ring->readPos, memory_order_acquire);
+  if (writePos - readPos + frameCount > (unsigned int)ring->capacity) return -1;
+
+  copyIn(ring, writePos, frames, frameCount);
+  atomic_store_explicit(&ring->writePos, writePos + frameCount, memory_order_release);
+  return 0;
+}
+
+int audioring_dequeueFrames (audioring_t *ring, sample_t *frames, int frameCount) {
+  unsigned int readPos = atomic_load_explicit(&ring->readPos, memory_order_relaxed);
+  unsigned int writePos = atomic_load_explicit(&ring->writePos, memory_order_acquire);
+  if (writePos - readPos < (unsigned int)frameCount) return -1;
+
+  copyOut(ring, readPos, frames, frameCount);
+  atomic_store_explicit(&ring->readPos, readPos + frameCount, memory_order_release);
+  return 0;
+}
+
+void audioring_deinit (audioring_t *ring) {
+  free(ring->buf);
+  ring->buf = NULL;
+}
@@ -108,19 +108,61 @@ static int applyMixerConfig (unsigned int cardId, const google::protobuf::Repeat
 }
 #endif
 
-static int parseAddr (const std::string &addrStr, uint32_t *addrValOut) {
-  const uint8_t *buf = (const uint8_t*)addrStr.c_str();
+// addrOut must have room for 16 bytes. Returns 4 for IPv4 or 16 for IPv6.
+static int parseAddr (const std::string &addrStr, uint8_t *addrOut) {
   size_t bufLen = addrStr.length();
-  if (bufLen == 4) {
-    memcpy(addrValOut, buf, 4);
-    return 4;
-  } else if (bufLen == 16) {
-    // IPv6
-    printf("Init config: IPv6 is not implemented!\n");
-    return -1;
-  } else {
+  if (bufLen != 4 && bufLen != 16) return -1;
+  memcpy(addrOut, addrStr.c_str(), bufLen);
+  return bufLen;
+}
+
+static int parseOpusLayout (int networkChannelCount, const Audio_Opus &opus) {
+  int streams = opus.streams();
+  int coupledStreams = opus.coupledstreams();
+
+  if (streams == 0) {
+    // Default: every channel is its own mono stream
+    if (coupledStreams != 0 || opus.mapping_size() != 0) {
+      printf("Init config: audio: opus: streams required with coupledStreams and mapping.\n");
+      return -1;
+    }
+    globals_set1i(opus, streams, networkChannelCount);
+    globals_set1i(opus, coupledStreams, 0);
+    for (int i = 0; i < networkChannelCount; i++) globals_set1iv(opus, mapping, i, i);
+    return 0;
+  }
+
+  // Same limits as opus_multistream_encoder_create
+  if (streams < 0 || coupledStreams < 0 || coupledStreams > streams || streams + coupledStreams > 255) {
+    printf("Init config: audio: opus: invalid streams or coupledStreams.\n");
     return -2;
   }
+  if (opus.mapping_size() != networkChannelCount) {
+    printf("Init config: audio: opus: mapping must have networkChannelCount entries.\n");
+    return -3;
+  }
+
+  // Every channel of every stream must be mapped, otherwise the encoder won't accept the layout.
+  bool mapped[255] = { false };
+  for (int i = 0; i < networkChannelCount; i++) {
+    int mappingVal = opus.mapping(i);
+    if (mappingVal != 255 && (mappingVal < 0 || mappingVal >= streams + coupledStreams)) {
+      printf("Init config: audio: opus: mapping[%d] out of range.\n", i);
+      return -4;
+    }
+    if (mappingVal != 255) mapped[mappingVal] = true;
+    globals_set1iv(opus, mapping, i, mappingVal);
+  }
+  for (int i = 0; i < streams + coupledStreams; i++) {
+    if (!mapped[i]) {
+      printf("Init config: audio: opus: mapping has no channel for stream input %d.\n", i);
+      return -5;
+    }
+  }
+
+  globals_set1i(opus, streams, streams);
+  globals_set1i(opus, coupledStreams, coupledStreams);
+  return 0;
 }
 
 static int parseAudio (int mode, const Audio &audio, const Audio_SenderReceiver &senderReceiver) {
@@ -139,6 +181,23 @@ static int parseAudio (int mode, const Audio &audio, const Audio_SenderReceiver
     globals_set1ui(audio, encoding, AUDIO_ENCODING_OPUS);
     globals_set1i(opus, bitrate, audio.opus().bitrate());
     globals_set1i(opus, frameSize, audio.opus().framesize());
+
+    int encoderGroups = audio.opus().encodergroups();
+    if (encoderGroups == 0) encoderGroups = 1;
+    if (encoderGroups < 0 || encoderGroups > MAX_OPUS_ENCODER_GROUPS || encoderGroups > networkChannelCount) {
+      printf("Init config: audio: opus: encoderGroups must be between 1 and min(%d, networkChannelCount).\n", MAX_OPUS_ENCODER_GROUPS);
+      return -16;
+    }
+    globals_set1i(opus, encoderGroups, encoderGroups);
+
+    int err = parseOpusLayout(networkChannelCount, audio.opus());
+    if (err < 0) return err - 16;
+
+    if (audio.opus().maxconcealedframes() < 0) {
+      printf("Init config: audio: opus: maxConcealedFrames must not be negative.\n");
+      return -22;
+    }
+    globals_set1i(opus, maxConcealedFrames, audio.opus().maxconcealedframes());
     globals_set1i(audio, networkSampleRate, 48000);
   } else if (audio.has_pcm()) {
     globals_set1ui(audio, encoding, AUDIO_ENCODING_PCM);
@@ -150,14 +209,39 @@ static int parseAudio (int mode, const Audio &audio, const Audio_SenderReceiver
     } else { // sender, set networkSampleRate to deviceSampleRate
       globals_set1i(audio, networkSampleRate, senderReceiver.devicesamplerate());
     }
+  } else if (audio.has_lossless()) {
+    globals_set1ui(audio, encoding, AUDIO_ENCODING_LOSSLESS);
+    globals_set1i(lossless, frameSize, audio.lossless().framesize());
+
+    int networkSampleRate = audio.lossless().networksamplerate();
+    if (mode == 0) { // receiver
+      if (networkSampleRate > 0) globals_set1i(audio, networkSampleRate, networkSampleRate);
+    } else { // sender, set networkSampleRate to deviceSampleRate
+      globals_set1i(audio, networkSampleRate, senderReceiver.devicesamplerate());
+    }
   } else {
-    printf("Init config: audio: opus or pcm field required.\n");
+    printf("Init config: audio: opus, pcm or lossless field required.\n");
     return -3;
   }
 
   globals_set1ff(audio, deviceSampleRate, senderReceiver.devicesamplerate());
   globals_set1i(audio, decodeRingLength, senderReceiver.decoderinglength());
 
+  if (senderReceiver.reorderwindow() < 0 || senderReceiver.reorderwindow() > MAX_REORDER_WINDOW) {
+    printf("Init config: audio: reorderWindow must be between 0 and %d.\n", MAX_REORDER_WINDOW);
+    return -23;
+  }
+  globals_set1i(audio, reorderWindow, senderReceiver.reorderwindow());
+
+  globals_set1ui(audio, resamplerPhase, senderReceiver.resamplerphase() == Audio_SenderReceiver_ResamplerPhase_MINIMUM ? AUDIO_RESAMPLER_PHASE_MINIMUM : AUDIO_RESAMPLER_PHASE_LINEAR);
+  double transitionBand = senderReceiver.resamplertransitionband();
+  if (transitionBand == 0.0) transitionBand = SYNCER_TRANSITION_BAND;
+  if (!(transitionBand >= SYNCER_MIN_TRANSITION_BAND && transitionBand <= SYNCER_MAX_TRANSITION_BAND)) {
+    printf("Init config: audio: resamplerTransitionBand must be between %.0f and %.0f.\n", SYNCER_MIN_TRANSITION_BAND, SYNCER_MAX_TRANSITION_BAND);
+    return -24;
+  }
+  globals_set1ff(audio, resamplerTransitionBand, transitionBand);
+
   #if defined(__linux__) || defined(__ANDROID__)
   if (!senderReceiver.has_linux()) {
     printf("Init config: audio: linux field required.\n");
@@ -176,6 +260,7 @@ static int parseAudio (int mode, const Audio &audio, const Audio_SenderReceiver
   globals_set1i(audio, periodSize, linux.periodsize());
   globals_set1i(audio, periodCount, linux.periodcount());
   globals_set1i(audio, loopSleep, linux.loopsleep());
+  globals_set1i(audio, schedDeadline, linux.scheddeadline());
   #else
   if (!senderReceiver.has_macos()) {
     printf("Init config: audio: macos field required.\n");
@@ -204,12 +289,32 @@ int config_parseBuf (const uint8_t *buf, size_t bufLen) {
   globals_set1i(root, mode, mode);
 
   int err;
-  uint32_t serverAddr = 0;
   if (initConfig.has_discovery()) {
+    uint32_t serverAddr[4] = { 0 };
     globals_set1i(discovery, serverPort, initConfig.discovery().serverport());
-    err = parseAddr(initConfig.discovery().serveraddr(), &serverAddr);
-    if (err < 0) return err - 2;
-    globals_set1ui(discovery, serverAddr, serverAddr);
+    // serverAddr may be left out if serverAddr6 is set
+    if (initConfig.discovery().serveraddr().length() > 0 || initConfig.discovery().serveraddr6().length() == 0) {
+      err = parseAddr(initConfig.discovery().serveraddr(), (uint8_t *)serverAddr);
+      if (err < 0) return -3;
+      if (err == 4) {
+        globals_set1ui(discovery, serverAddr, serverAddr[0]);
+      } else {
+        for (int i = 0; i < 4; i++) globals_set1uiv(discovery, serverAddr6, i, serverAddr[i]);
+      }
+    }
+
+    if (initConfig.discovery().serveraddr6().length() > 0) {
+      err = parseAddr(initConfig.discovery().serveraddr6(), (uint8_t *)serverAddr);
+      if (err != 16) {
+        printf("Init config: discovery: serverAddr6 must be an IPv6 address.\n");
+        return -4;
+      }
+      for (int i = 0; i < 4; i++) globals_set1uiv(discovery, serverAddr6, i, serverAddr[i]);
+    }
+
+    if (globals_set1s(discovery, peerCacheFile, initConfig.discovery().peercachefile().c_str()) < 0) {
+      printf("Init config: discovery: peerCacheFile path is too long, peer cache disabled.\n");
+    }
   }
 
   int endpointCount = initConfig.endpoints_size();
@@ -221,6 +326,7 @@ int config_parseBuf (const uint8_t *buf, size_t bufLen) {
     for (int i = 0; i < endpointCount; i++) {
       auto endpoint = initConfig.endpoints(i);
       globals_set1sv(endpoints, interface, i, endpoint.interface().c_str());
+      globals_set1iv(endpoints, family, i, endpoint.family());
     }
     globals_set1i(endpoints, endpointCount, endpointCount);
   }
@@ -254,7 +360,7 @@ int config_parseBuf (const uint8_t *buf, size_t bufLen) {
   int fecCount = initConfig.fec_size();
   if (fecCount == 0) {
     printf("Init config: fec field required\n");
-    return -22;
+    return -28;
   }
   for (int i = 0; i < fecCount; i++) {
     auto fec = initConfig.fec(i);
@@ -265,14 +371,14 @@ int config_parseBuf (const uint8_t *buf, size_t bufLen) {
 
   // monitor field is only for initial config
   if (initConfig.has_monitor()) {
-    uint32_t udpAddr = 0;
+    uint32_t udpAddr[4] = { 0 };
     int wsPort = initConfig.monitor().wsport();
     int udpPort = initConfig.monitor().udpport();
-    err = parseAddr(initConfig.monitor().udpaddr(), &udpAddr);
+    err = parseAddr(initConfig.monitor().udpaddr(), (uint8_t *)udpAddr);
 
     if (udpPort > 0) { // monitor UDP mode
-      if (err < 0) return err - 22; // failed to parse udpAddr
-      globals_set1ui(monitor, udpAddr, udpAddr);
+      if (err != 4) return -29; // failed to parse udpAddr, only IPv4 is supported
+      globals_set1ui(monitor, udpAddr, udpAddr[0]);
       globals_set1i(monitor, udpPort, udpPort);
     }
 
@@ -25,7 +25,10 @@ typedef struct {
   uint8_t *chunkBuf; // used to pass the chunks between the ring and the rust code
   int maxDataLen, dataBufPos, sbnLast;
   size_t chunkLen, chunkLenWords, chunkRingLenWords;
-  int blockBufLen;
+  int blockBufLen, symbolLen, sourceSymbolsPerBlock;
+  atomic_bool flushed; // see mux_flush
+  int sbnPadded; // the last block that padding symbols were added for, if flushed
+  uint8_t *padChunkBuf;
   pthread_t decodeThread;
   xwait_t waitHandle;
   void *raptorqHandle;
@@ -47,6 +50,7 @@ void demux_deinit (void) {
     free(channels[i].blockBuf);
     free(channels[i].dataBuf);
     free(channels[i].chunkBuf);
+    free(channels[i].padChunkBuf);
   }
 
   atomic_store(&chCount, 0);
@@ -111,7 +115,8 @@ static int decodeBlock (int sbn, demux_channel_t *chan) {
 
   while (true) {
     memcpy(&dataLen, &chan->blockBuf[blockPos], 4);
-    if (dataLen <= 0) return -6;
+    if (dataLen == 0) return 2; // the rest is padding from mux_flush
+    if (dataLen < 0) return -6;
     blockPos += 4;
 
     int leftoverLen = chan->blockBufLen - blockPos;
@@ -132,14 +137,38 @@ static int decodeBlock (int sbn, demux_channel_t *chan) {
   }
 }
 
+// For a flushed channel, the sender only sends the source symbols that hold data, and every chunk of such a block
+// carries the count sent in the top byte of its ESI (see mux_flush). Clear it before decoding, and on the first chunk of
+// each block feed the decoder the zero padded source symbols that were not sent, so that any chunk arriving is enough
+// and only the lost chunks count against the repair symbols.
+// returns: the decoded block length if the padding completed the block, otherwise 0
+static int addPaddingSymbols (demux_channel_t *chan) {
+  uint8_t *chunk = chan->chunkBuf;
+  int sbn = chunk[0];
+  int sourceSymbolsSent = chunk[1];
+  chunk[1] = 0;
+  if (sourceSymbolsSent == 0 || sourceSymbolsSent >= chan->sourceSymbolsPerBlock || sbn == chan->sbnPadded) return 0;
+  chan->sbnPadded = sbn;
+
+  uint8_t *padChunk = chan->padChunkBuf; // symbol is all zeros
+  padChunk[0] = sbn;
+  for (int padEsi = sourceSymbolsSent; padEsi < chan->sourceSymbolsPerBlock; padEsi++) {
+    padChunk[1] = padEsi >> 16;
+    padChunk[2] = padEsi >> 8;
+    padChunk[3] = padEsi;
+    int result = raptorq_decodePacket(chan->raptorqHandle, padChunk, chan->blockBuf);
+    if (result == chan->blockBufLen) return result;
+  }
+  return 0;
+}
+
 // this is a realtime thread where all FEC and audio/video decoding happens
 static void *startDecodeThread (void *arg) {
   intptr_t chId = (intptr_t)arg;
   demux_channel_t *chan = &channels[chId];
 
   // pin each channel decode thread to a different core, leaving core 0 for other stuff (Linux only)
-  // DEBUG: check the CPU core count before calling this
-  utils_setCallerThreadRealtime(98, chId + 1);
+  utils_setCallerThreadRealtime(98, utils_checkCore(DEMUX_THREAD_FIRST_CORE + chId));
 
   while (atomic_load(&threadsRunning)) {
     xwait_wait(&chan->waitHandle);
@@ -152,8 +181,13 @@ static void *startDecodeThread (void *arg) {
       memcpy(&chan->chunkBuf[4*i], &chunkWord, 4);
     }
 
-    int result = raptorq_decodePacket(chan->raptorqHandle, chan->chunkBuf, chan->blockBuf);
-    if (result == chan->blockBufLen) decodeBlock(chan->chunkBuf[0], chan);
+    int startUTime = utils_getCurrentUTime();
+    int result = atomic_load(&chan->flushed) ? addPaddingSymbols(chan) : 0;
+    if (result != chan->blockBufLen) result = raptorq_decodePacket(chan->raptorqHandle, chan->chunkBuf, chan->blockBuf);
+    if (result == chan->blockBufLen) {
+      decodeBlock(chan->chunkBuf[0], chan);
+      globals_set1iv(statsDemux, fecDecodeTime, chId, utils_getElapsedUTime(startUTime));
+    }
   }
 
   return NULL;
@@ -197,6 +231,13 @@ int demux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbo
 
   chan->chunkBuf = (uint8_t *)malloc(chan->chunkLen);
   if (chan->chunkBuf == NULL) return -5;
+  chan->padChunkBuf = (uint8_t *)calloc(chan->chunkLen, 1);
+  if (chan->padChunkBuf == NULL) return -5;
+
+  chan->symbolLen = symbolLen;
+  chan->sourceSymbolsPerBlock = sourceSymbolsPerBlock;
+  atomic_store(&chan->flushed, false);
+  chan->sbnPadded = -1;
 
   chan->sbnLast = -1;
   chan->chId = chCountLocal;
@@ -210,6 +251,12 @@ int demux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbo
   return (int)atomic_fetch_add(&chCount, 1);
 }
 
+int demux_setFlushedChannel (int chId) {
+  if (chId < 0 || chId >= atomic_load(&chCount)) return -1;
+  atomic_store(&channels[chId].flushed, true);
+  return 0;
+}
+
 // this is called by a single realtime priority network thread
 int demux_readPacket (const uint8_t *buf, size_t bufLen, int endpointIndex) {
   uint8_t chCountLocal = atomic_load(&chCount);
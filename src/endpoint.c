@@ -26,6 +26,12 @@
 #endif
 
 #define WG_READ_BUF_LEN 1500
+// Enough for "[IPv6 addr]:port"
+#define ADDR_STRING_LEN 64
+
+// Indices into serverAddrs, discoverySentUTime, etc.
+#define DISCOVERY_IPV4 0
+#define DISCOVERY_IPV6 1
 
 static endpoint_t *endpoints = NULL;
 static pthread_t dataThread, openCloseThread;
@@ -34,22 +40,102 @@ static uint8_t myPubKey[32], peerPubKey[32];
 static struct wireguard_tunnel *tunnel = NULL;
 static atomic_bool tunnelUp = false;
 static atomic_bool threadsRunning = true;
+static atomic_bool handshakeRequested = false;
+static char peerCacheFile[MAX_FILE_PATH_LEN + 1] = { 0 };
+static char peerPubKeyStr[SEC_KEY_LENGTH + 1] = { 0 };
+static int initUTime = 0;
 static int (*_onPacket)(const uint8_t*, size_t, int) = NULL;
 
 /////////////////////
 // private
 /////////////////////
 
+static socklen_t addrLen (const endpoint_addr_t *addr) {
+  return addr->sa.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+static bool addrIsIPv4 (const endpoint_addr_t *addr) {
+  return addr->sa.sa_family == AF_INET || IN6_IS_ADDR_V4MAPPED(&addr->in6.sin6_addr);
+}
+
+// Accounts for IP and UDP headers
+static int addrHeaderLen (const endpoint_addr_t *addr) {
+  return addrIsIPv4(addr) ? 28 : 48;
+}
+
+static bool addrHostEqual (const endpoint_addr_t *a, const endpoint_addr_t *b) {
+  if (a->sa.sa_family != b->sa.sa_family) return false;
+  if (a->sa.sa_family == AF_INET) return a->in.sin_addr.s_addr == b->in.sin_addr.s_addr;
+  return memcmp(&a->in6.sin6_addr, &b->in6.sin6_addr, sizeof(struct in6_addr)) == 0;
+}
+
+static bool addrEqual (const endpoint_addr_t *a, const endpoint_addr_t *b) {
+  if (!addrHostEqual(a, b)) return false;
+  if (a->sa.sa_family == AF_INET) return a->in.sin_port == b->in.sin_port;
+  return a->in6.sin6_port == b->in6.sin6_port;
+}
+
+// Convert addr to the form used by ep->sock: IPv4 addrs are v4-mapped on dual-stack sockets.
+// Returns false if addr can't be reached from ep->sock.
+static bool toSockAddr (const endpoint_t *ep, const endpoint_addr_t *addr, endpoint_addr_t *out) {
+  memset(out, 0, sizeof(endpoint_addr_t));
+
+  if (addr->sa.sa_family == AF_INET) {
+    if (ep->family == ENDPOINT_FAMILY_IPV4) {
+      *out = *addr;
+      return true;
+    }
+    if (ep->family == ENDPOINT_FAMILY_IPV6) return false;
+
+    out->in6.sin6_family = AF_INET6;
+    out->in6.sin6_port = addr->in.sin_port;
+    out->in6.sin6_addr.s6_addr[10] = 0xff;
+    out->in6.sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&out->in6.sin6_addr.s6_addr[12], &addr->in.sin_addr.s_addr, 4);
+    return true;
+  }
+
+  if (addr->sa.sa_family == AF_INET6) {
+    if (ep->family == ENDPOINT_FAMILY_IPV4) return false;
+    *out = *addr;
+    return true;
+  }
+
+  return false;
+}
+
+// Inverse of toSockAddr
+static void toCanonicalAddr (const endpoint_addr_t *addr, endpoint_addr_t *out) {
+  if (addr->sa.sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&addr->in6.sin6_addr)) {
+    memset(out, 0, sizeof(endpoint_addr_t));
+    out->in.sin_family = AF_INET;
+    out->in.sin_port = addr->in6.sin6_port;
+    memcpy(&out->in.sin_addr.s_addr, &addr->in6.sin6_addr.s6_addr[12], 4);
+  } else {
+    *out = *addr;
+  }
+}
+
+static void addrToString (const endpoint_addr_t *addr, char *str, size_t strLen) {
+  endpoint_addr_t canonical;
+  toCanonicalAddr(addr, &canonical);
+
+  char hostString[INET6_ADDRSTRLEN] = { 0 };
+  if (canonical.sa.sa_family == AF_INET) {
+    inet_ntop(AF_INET, &canonical.in.sin_addr, hostString, sizeof(hostString));
+    snprintf(str, strLen, "%s:%d", hostString, ntohs(canonical.in.sin_port));
+  } else {
+    inet_ntop(AF_INET6, &canonical.in6.sin6_addr, hostString, sizeof(hostString));
+    snprintf(str, strLen, "[%s]:%d", hostString, ntohs(canonical.in6.sin6_port));
+  }
+}
+
 static void sendBufToAll (const uint8_t *buf, int bufLen) {
   for (int i = 0; i < endpointCount; i++) {
     endpoint_t *ep = &endpoints[i];
     if (ep->state != GotPeerAddr) continue;
 
-    struct sockaddr_in peerAddr = { 0 };
-    peerAddr.sin_family = AF_INET;
-    peerAddr.sin_addr.s_addr = ep->peerAddr;
-    peerAddr.sin_port = ep->peerPort;
-    ssize_t sendLen = sendto(ep->sock, buf, bufLen, 0, (struct sockaddr*)&peerAddr, sizeof(peerAddr));
+    ssize_t sendLen = sendto(ep->sock, buf, bufLen, 0, &ep->peerAddr.sa, addrLen(&ep->peerAddr));
     if (sendLen < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         globals_add1uiv(statsEndpoints, sendCongestion, i, 1);
@@ -58,9 +144,7 @@ static void sendBufToAll (const uint8_t *buf, int bufLen) {
         ep->state = Close;
       }
     } else {
-      // Accounts for IP and UDP headers
-      // TODO: This assumes IPv4
-      globals_add1uiv(statsEndpoints, bytesOut, i, bufLen + 28);
+      globals_add1uiv(statsEndpoints, bytesOut, i, bufLen + ep->headerLen);
     }
   }
 }
@@ -73,14 +157,19 @@ static void tickDiscovery (int epIndex) {
 
   ep->discoveryTickCounter = ENDPOINT_DISCOVERY_INTERVAL;
 
-  struct sockaddr_in serverAddr = { 0 };
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(globals_get1i(discovery, serverPort));
-  serverAddr.sin_addr.s_addr = globals_get1ui(discovery, serverAddr);
   memcpy(&sendBuf[0], myPubKey, 32);
   memcpy(&sendBuf[32], peerPubKey, 32);
   sendBuf[64] = epIndex;
-  sendto(ep->sock, sendBuf, sizeof(sendBuf), 0, (struct sockaddr*)&serverAddr, sizeof(serverAddr));
+
+  // The server responds over the same family the request came in on, so a dual-stack endpoint
+  // learns both the IPv4 and IPv6 addrs of the peer.
+  for (int f = DISCOVERY_IPV4; f <= DISCOVERY_IPV6; f++) {
+    endpoint_addr_t *serverAddr = &ep->serverAddrs[f];
+    if (serverAddr->sa.sa_family == 0) continue;
+
+    ep->discoverySentUTime[f] = utils_getCurrentUTime();
+    sendto(ep->sock, sendBuf, sizeof(sendBuf), 0, &serverAddr->sa, addrLen(serverAddr));
+  }
 }
 
 static void tickTunnel (void) {
@@ -90,6 +179,8 @@ static void tickTunnel (void) {
     struct stats tunnelStats = wireguard_stats(tunnel);
     if (tunnelStats.time_since_last_handshake >= 0) {
       tunnelUp = true;
+      // DEBUG: log
+      printf("Endpoint: tunnel up %d ms after start\n", utils_getElapsedUTime(initUTime) / 1000);
     }
   }
 
@@ -97,13 +188,135 @@ static void tickTunnel (void) {
   if (result.op == WRITE_TO_NETWORK) sendBufToAll(tickBuf, result.size);
 }
 
+// Send a handshake initiation as soon as we have a peer addr instead of waiting for wireguard_tick to do it
+static void forceHandshake (void) {
+  static uint8_t handshakeBuf[1500] = { 0 };
+
+  if (tunnelUp) return;
+
+  struct wireguard_result result = wireguard_force_handshake(tunnel, handshakeBuf, sizeof(handshakeBuf));
+  if (result.op == WRITE_TO_NETWORK) sendBufToAll(handshakeBuf, result.size);
+}
+
+// Cache file format is the peer public key on the first line, followed by one line per endpoint:
+// <interface> <peer addr> <peer port>
+// Endpoints are matched by interface name so that reordering endpoints in the config does not invalidate the cache.
+static void loadPeerCache (void) {
+  if (peerCacheFile[0] == '\0') return;
+
+  FILE *file = fopen(peerCacheFile, "r");
+  if (file == NULL) return;
+
+  char keyStr[SEC_KEY_LENGTH + 1] = { 0 };
+  if (fscanf(file, "%44s", keyStr) != 1 || strcmp(keyStr, peerPubKeyStr) != 0) {
+    // DEBUG: log
+    printf("Endpoint: peer cache is for a different peer, ignoring\n");
+    fclose(file);
+    return;
+  }
+
+  char ifName[MAX_NET_IF_NAME_LEN + 1] = { 0 };
+  char hostString[INET6_ADDRSTRLEN] = { 0 };
+  int port;
+  while (fscanf(file, "%20s %45s %d", ifName, hostString, &port) == 3) {
+    if (port <= 0 || port > 65535) continue;
+
+    endpoint_addr_t addr = { 0 };
+    if (inet_pton(AF_INET, hostString, &addr.in.sin_addr) == 1) {
+      addr.in.sin_family = AF_INET;
+      addr.in.sin_port = htons(port);
+    } else if (inet_pton(AF_INET6, hostString, &addr.in6.sin6_addr) == 1) {
+      addr.in6.sin6_family = AF_INET6;
+      addr.in6.sin6_port = htons(port);
+    } else {
+      continue;
+    }
+
+    for (int i = 0; i < endpointCount; i++) {
+      if (strcmp(endpoints[i].ifName, ifName) != 0) continue;
+      endpoints[i].cachedPeerAddr = addr;
+    }
+  }
+
+  fclose(file);
+}
+
+// Called from openCloseLoop only, so file IO never happens on the realtime thread
+static void savePeerCache (void) {
+  char tmpPath[MAX_FILE_PATH_LEN + 5] = { 0 };
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", peerCacheFile);
+
+  FILE *file = fopen(tmpPath, "w");
+  if (file == NULL) {
+    printf("Endpoint: could not write peer cache %s\n", tmpPath);
+    return;
+  }
+
+  fprintf(file, "%s\n", peerPubKeyStr);
+  for (int i = 0; i < endpointCount; i++) {
+    endpoint_t *ep = &endpoints[i];
+    char hostString[INET6_ADDRSTRLEN] = { 0 };
+
+    pthread_mutex_lock(&ep->cacheMutex);
+    endpoint_addr_t addr = ep->cachedPeerAddr;
+    pthread_mutex_unlock(&ep->cacheMutex);
+
+    if (addr.sa.sa_family == AF_INET) {
+      inet_ntop(AF_INET, &addr.in.sin_addr, hostString, sizeof(hostString));
+      fprintf(file, "%s %s %d\n", ep->ifName, hostString, ntohs(addr.in.sin_port));
+    } else if (addr.sa.sa_family == AF_INET6) {
+      inet_ntop(AF_INET6, &addr.in6.sin6_addr, hostString, sizeof(hostString));
+      fprintf(file, "%s %s %d\n", ep->ifName, hostString, ntohs(addr.in6.sin6_port));
+    }
+  }
+
+  fclose(file);
+  // rename is atomic so a crash while writing won't leave a corrupt cache behind
+  if (rename(tmpPath, peerCacheFile) < 0) {
+    printf("Endpoint: could not write peer cache %s\n", peerCacheFile);
+  }
+}
+
+static void setServerAddrs (endpoint_t *ep) {
+  endpoint_addr_t addr;
+  memset(ep->serverAddrs, 0, sizeof(ep->serverAddrs));
+
+  uint32_t serverAddr = globals_get1ui(discovery, serverAddr);
+  if (serverAddr != 0) {
+    memset(&addr, 0, sizeof(addr));
+    addr.in.sin_family = AF_INET;
+    addr.in.sin_port = htons(globals_get1i(discovery, serverPort));
+    addr.in.sin_addr.s_addr = serverAddr;
+    // leaves sa_family as 0 if this endpoint is IPv6 only
+    toSockAddr(ep, &addr, &ep->serverAddrs[DISCOVERY_IPV4]);
+  }
+
+  uint32_t serverAddr6[4];
+  bool haveServerAddr6 = false;
+  for (int i = 0; i < 4; i++) {
+    serverAddr6[i] = globals_get1uiv(discovery, serverAddr6, i);
+    if (serverAddr6[i] != 0) haveServerAddr6 = true;
+  }
+  if (haveServerAddr6) {
+    memset(&addr, 0, sizeof(addr));
+    addr.in6.sin6_family = AF_INET6;
+    addr.in6.sin6_port = htons(globals_get1i(discovery, serverPort));
+    memcpy(&addr.in6.sin6_addr, serverAddr6, 16);
+    // leaves sa_family as 0 if this endpoint is IPv4 only
+    toSockAddr(ep, &addr, &ep->serverAddrs[DISCOVERY_IPV6]);
+  }
+}
+
 static int openEndpoint (int epIndex) {
   endpoint_t *ep = &endpoints[epIndex];
-  ep->peerAddr = 0;
-  ep->peerPort = 0;
+  memset(&ep->peerAddr, 0, sizeof(ep->peerAddr));
+  ep->headerLen = 0;
   ep->lastPacketUTime = -1;
+  ep->dualStackWaitTickCounter = 0;
+  memset(ep->discoveredAddrs, 0, sizeof(ep->discoveredAddrs));
 
-  ep->sock = socket(AF_INET, SOCK_DGRAM, 0);
+  int sockFamily = ep->family == ENDPOINT_FAMILY_IPV4 ? AF_INET : AF_INET6;
+  ep->sock = socket(sockFamily, SOCK_DGRAM, 0);
   if (ep->sock < 0) return -1;
 
   int flags = fcntl(ep->sock, F_GETFL);
@@ -111,6 +324,13 @@ static int openEndpoint (int epIndex) {
   if (fcntl(ep->sock, F_SETFL, flags | O_NONBLOCK) < 0) return -3;
 
   int err;
+  if (sockFamily == AF_INET6) {
+    // dual-stack sockets send and receive IPv4 as v4-mapped addrs
+    int v6Only = ep->family == ENDPOINT_FAMILY_IPV6;
+    err = setsockopt(ep->sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only));
+    if (err < 0) return -8;
+  }
+
   // bind socket to interface
   #if defined(__ANDROID__) || defined(__linux__)
   err = setsockopt(ep->sock, SOL_SOCKET, SO_BINDTODEVICE, ep->ifName, strlen(ep->ifName));
@@ -118,7 +338,11 @@ static int openEndpoint (int epIndex) {
   #elif defined(__APPLE__)
   int ifIndex = if_nametoindex(ep->ifName);
   if (ifIndex == 0) return -5;
-  err = setsockopt(ep->sock, IPPROTO_IP, IP_BOUND_IF, &ifIndex, sizeof(ifIndex));
+  if (sockFamily == AF_INET6) {
+    err = setsockopt(ep->sock, IPPROTO_IPV6, IPV6_BOUND_IF, &ifIndex, sizeof(ifIndex));
+  } else {
+    err = setsockopt(ep->sock, IPPROTO_IP, IP_BOUND_IF, &ifIndex, sizeof(ifIndex));
+  }
   if (err < 0) return -6;
   #endif
 
@@ -127,16 +351,25 @@ static int openEndpoint (int epIndex) {
   // sender and receiver can run as two separate processes without port conflict
   // these ports may need to be forwarded if you're on a restrictive NAT with no IPv6
   int bindPort = 26173 + 2*epIndex + globals_get1i(root, mode);
-  struct sockaddr_in bindAddr = { 0 };
-  bindAddr.sin_family = AF_INET;
-  bindAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  bindAddr.sin_port = htons(bindPort);
-  if (bind(ep->sock, (const struct sockaddr*)&bindAddr, sizeof(bindAddr)) < 0) {
+  endpoint_addr_t bindAddr = { 0 };
+  if (sockFamily == AF_INET6) {
+    bindAddr.in6.sin6_family = AF_INET6;
+    bindAddr.in6.sin6_addr = in6addr_any;
+    bindAddr.in6.sin6_port = htons(bindPort);
+  } else {
+    bindAddr.in.sin_family = AF_INET;
+    bindAddr.in.sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddr.in.sin_port = htons(bindPort);
+  }
+  if (bind(ep->sock, &bindAddr.sa, addrLen(&bindAddr)) < 0) {
     return -7;
   }
 
+  setServerAddrs(ep);
+
   // DEBUG: log
-  printf("epIndex %d bound to interface %s on UDP port %d\n", epIndex, ep->ifName, bindPort);
+  const char *familyNames[] = { "IPv4", "IPv6", "dual-stack" };
+  printf("epIndex %d bound to interface %s on UDP port %d (%s)\n", epIndex, ep->ifName, bindPort, familyNames[ep->family]);
 
   return 0;
 }
@@ -177,45 +410,146 @@ static int onPeerPacket (const uint8_t *buf, int bufLen, int epIndex) {
   return 0;
 }
 
-static void handleRes (int epIndex, uint8_t *buf, ssize_t len) {
+static void setDiscoveredPeerAddr (int epIndex, const endpoint_addr_t *peerAddr, int rtt) {
   endpoint_t *ep = &endpoints[epIndex];
+  char addrString[ADDR_STRING_LEN] = { 0 };
+  addrToString(peerAddr, addrString, sizeof(addrString));
 
-  // Accounts for IP and UDP headers
-  // TODO: This assumes IPv4
-  globals_add1uiv(statsEndpoints, bytesIn, epIndex, len + 28);
+  if (ep->state == GotPeerAddr && addrEqual(peerAddr, &ep->peerAddr)) {
+    printf("(epIndex %d) discovery confirmed cached peer addr %s\n", epIndex, addrString);
+    return;
+  }
 
-  switch (atomic_load(&ep->state)) {
-    case Discovery:
-      if (len != 38) return;
+  ep->peerAddr = *peerAddr;
+  ep->headerLen = addrHeaderLen(peerAddr);
+  ep->state = GotPeerAddr;
+  globals_set1uiv(statsEndpoints, open, epIndex, 1);
+  handshakeRequested = true;
 
-      for (int i = 0; i < 32; i++) {
-        if (buf[i] != peerPubKey[i]) return;
-      }
+  printf("(epIndex %d) got peer addr %s, discovery RTT %d us\n", epIndex, addrString, rtt);
+}
 
-      for (int i = 0; i < 6; i++) {
-        // TODO: secure discovery
-        // XOR remote addr and port with myPubKey
-        buf[32 + i] ^= myPubKey[i];
-      }
+// Dual-stack only. Pick the family that had the lower discovery RTT out of the ones that answered.
+static void pickDiscoveredPeerAddr (int epIndex) {
+  endpoint_t *ep = &endpoints[epIndex];
+  int f = DISCOVERY_IPV4;
+
+  if (ep->discoveredAddrs[DISCOVERY_IPV4].sa.sa_family == 0) {
+    f = DISCOVERY_IPV6;
+  } else if (
+    ep->discoveredAddrs[DISCOVERY_IPV6].sa.sa_family != 0 &&
+    ep->discoveredRtts[DISCOVERY_IPV6] <= ep->discoveredRtts[DISCOVERY_IPV4]
+  ) {
+    f = DISCOVERY_IPV6;
+  }
 
-      memcpy(&ep->peerAddr, &buf[32], 4);
-      memcpy(&ep->peerPort, &buf[36], 2);
-      ep->state = GotPeerAddr;
-      ep->lastPacketUTime = utils_getCurrentUTime();
-      globals_set1uiv(statsEndpoints, open, epIndex, 1);
+  ep->dualStackWaitTickCounter = 0;
+  setDiscoveredPeerAddr(epIndex, &ep->discoveredAddrs[f], ep->discoveredRtts[f]);
+}
+
+static void tickDualStackWait (int epIndex) {
+  endpoint_t *ep = &endpoints[epIndex];
+  if (ep->dualStackWaitTickCounter == 0) return;
+  if (--ep->dualStackWaitTickCounter == 0) pickDiscoveredPeerAddr(epIndex);
+}
+
+// Response format
+// IPv4 (length 38): remotePubKey, remoteAddr (4 bytes), remotePort
+// IPv6 (length 50): remotePubKey, remoteAddr (16 bytes), remotePort
+static void handleDiscoveryRes (int epIndex, int f, uint8_t *buf, ssize_t len) {
+  endpoint_t *ep = &endpoints[epIndex];
+  enum endpoint_state state = atomic_load(&ep->state);
+
+  // While trying a cached peer addr we are still in discovery, whichever of the peer or the server answers first wins
+  if (state != Discovery && !(state == GotPeerAddr && ep->awaitingPeer)) return;
+
+  int hostLen = f == DISCOVERY_IPV4 ? 4 : 16;
+  if (len != 32 + hostLen + 2) return;
+
+  for (int i = 0; i < 32; i++) {
+    if (buf[i] != peerPubKey[i]) return;
+  }
+
+  for (int i = 0; i < hostLen + 2; i++) {
+    // TODO: secure discovery
+    // XOR remote addr and port with myPubKey
+    buf[32 + i] ^= myPubKey[i];
+  }
+
+  endpoint_addr_t addr = { 0 };
+  if (f == DISCOVERY_IPV4) {
+    addr.in.sin_family = AF_INET;
+    memcpy(&addr.in.sin_addr.s_addr, &buf[32], 4);
+    memcpy(&addr.in.sin_port, &buf[36], 2);
+  } else {
+    addr.in6.sin6_family = AF_INET6;
+    memcpy(&addr.in6.sin6_addr, &buf[32], 16);
+    memcpy(&addr.in6.sin6_port, &buf[48], 2);
+  }
+
+  endpoint_addr_t peerAddr;
+  if (!toSockAddr(ep, &addr, &peerAddr)) return;
+
+  int rtt = utils_getElapsedUTime(ep->discoverySentUTime[f]);
+
+  if (ep->family == ENDPOINT_FAMILY_DUAL && state == Discovery) {
+    ep->discoveredAddrs[f] = peerAddr;
+    ep->discoveredRtts[f] = rtt;
+    if (ep->discoveredAddrs[1 - f].sa.sa_family != 0) {
+      pickDiscoveredPeerAddr(epIndex);
+    } else if (ep->dualStackWaitTickCounter == 0) {
+      // give the other family a chance to answer
+      ep->dualStackWaitTickCounter = ENDPOINT_DUAL_STACK_WAIT;
+    }
+    return;
+  }
+
+  ep->awaitingPeer = false;
+  setDiscoveredPeerAddr(epIndex, &peerAddr, rtt);
+}
 
-      char addrString[16] = { 0 };
-      inet_ntop(AF_INET, &ep->peerAddr, addrString, sizeof(addrString));
-      printf("(epIndex %d) got peer addr %s:%d\n", epIndex, addrString, ntohs(ep->peerPort));
-      break;
+static void handleRes (int epIndex, uint8_t *buf, ssize_t len, const endpoint_addr_t *recvAddr) {
+  endpoint_t *ep = &endpoints[epIndex];
 
-    case GotPeerAddr:
-      onPeerPacket(buf, len, epIndex);
-      break;
+  globals_add1uiv(statsEndpoints, bytesIn, epIndex, len + addrHeaderLen(recvAddr));
 
-    default:
-      break;
+  for (int f = DISCOVERY_IPV4; f <= DISCOVERY_IPV6; f++) {
+    if (ep->serverAddrs[f].sa.sa_family != 0 && addrEqual(recvAddr, &ep->serverAddrs[f])) {
+      handleDiscoveryRes(epIndex, f, buf, len);
+      return;
+    }
   }
+
+  if (atomic_load(&ep->state) != GotPeerAddr) return;
+
+  // this line is required if the peer has symmetric NAT, as
+  // moving from the discovery server to the peer counts as
+  // a new mapping
+  if (recvAddr->sa.sa_family == AF_INET) {
+    ep->peerAddr.in.sin_port = recvAddr->in.sin_port;
+  } else {
+    ep->peerAddr.in6.sin6_port = recvAddr->in6.sin6_port;
+  }
+
+  if (addrHostEqual(recvAddr, &ep->peerAddr)) {
+    if (ep->awaitingPeer) {
+      ep->awaitingPeer = false;
+      // DEBUG: log
+      printf("(epIndex %d) peer answered on cached addr\n", epIndex);
+    }
+
+    endpoint_addr_t canonical;
+    toCanonicalAddr(&ep->peerAddr, &canonical);
+    // dataLoop is the only writer so the unlocked compare is safe. Never block the realtime thread on
+    // openCloseLoop: if the lock is busy the next packet from the peer will try again.
+    if (!addrEqual(&canonical, &ep->cachedPeerAddr) && pthread_mutex_trylock(&ep->cacheMutex) == 0) {
+      ep->cachedPeerAddr = canonical;
+      pthread_mutex_unlock(&ep->cacheMutex);
+      atomic_store(&ep->cacheDirty, true);
+    }
+  }
+
+  onPeerPacket(buf, len, epIndex);
 }
 
 /////////////////////
@@ -247,11 +581,31 @@ static void *openCloseLoop (UNUSED void *arg) {
       endpoint_t *ep = &endpoints[epIndex];
 
       if (ep->state == Open) {
+        pthread_mutex_lock(&ep->cacheMutex);
+        endpoint_addr_t cachedPeerAddr = ep->cachedPeerAddr;
+        pthread_mutex_unlock(&ep->cacheMutex);
+
         int err = openEndpoint(epIndex);
         if (err < 0) {
           ep->state = Close;
+        } else if (toSockAddr(ep, &cachedPeerAddr, &ep->peerAddr)) {
+          // Try the handshake against the last known peer addr straight away. Discovery keeps running
+          // in dataLoop until either the peer or the server answers.
+          ep->discoveryTickCounter = 1;
+          ep->headerLen = addrHeaderLen(&ep->peerAddr);
+          ep->awaitingPeer = true;
+          ep->lastPacketUTime = utils_getCurrentUTime();
+          globals_set1uiv(statsEndpoints, open, epIndex, 1);
+
+          char addrString[ADDR_STRING_LEN] = { 0 };
+          addrToString(&ep->peerAddr, addrString, sizeof(addrString));
+          printf("(epIndex %d) trying cached peer addr %s\n", epIndex, addrString);
+
+          ep->state = GotPeerAddr;
+          handshakeRequested = true;
         } else {
-          ep->discoveryTickCounter = ENDPOINT_DISCOVERY_INTERVAL;
+          // send the first discovery request on the next tick
+          ep->discoveryTickCounter = 1;
           ep->state = Discovery;
         }
       } else if (ep->state == Close) {
@@ -266,6 +620,14 @@ static void *openCloseLoop (UNUSED void *arg) {
       }
     }
 
+    if (peerCacheFile[0] != '\0') {
+      bool cacheDirty = false;
+      for (int epIndex = 0; epIndex < endpointCount; epIndex++) {
+        if (atomic_exchange(&endpoints[epIndex].cacheDirty, false)) cacheDirty = true;
+      }
+      if (cacheDirty) savePeerCache();
+    }
+
     utils_usleep(ENDPOINT_TICK_INTERVAL_US);
   }
 
@@ -274,11 +636,11 @@ static void *openCloseLoop (UNUSED void *arg) {
 
 static void *dataLoop (UNUSED void *arg) {
   uint8_t recvBuf[1500] = { 0 };
-  struct sockaddr_in recvAddr = { 0 };
+  endpoint_addr_t recvAddr = { 0 };
   struct pollfd pfds[endpointCount];
   int lastTickUTime = utils_getCurrentUTime();
 
-  // dividing by 2 means the max possible time between handleTick calls will be 
+  // dividing by 2 means the max possible time between handleTick calls will be
   // 1.5 * ENDPOINT_TICK_INTERVAL_US instead of 2 * ENDPOINT_TICK_INTERVAL_US
   int tickTimeoutUs = ENDPOINT_TICK_INTERVAL_US / 2;
   int tickTimeoutMs = tickTimeoutUs / 1000;
@@ -296,6 +658,8 @@ static void *dataLoop (UNUSED void *arg) {
       tick = true;
     }
 
+    if (atomic_exchange(&handshakeRequested, false)) forceHandshake();
+
     bool allClosed = true;
     for (int i = 0; i < endpointCount; i++) {
       if (tick &&
@@ -312,9 +676,17 @@ static void *dataLoop (UNUSED void *arg) {
       }
 
       switch (atomic_load(&endpoints[i].state)) {
+        case GotPeerAddr:
+          if (tick && endpoints[i].awaitingPeer) tickDiscovery(i);
+          pfds[i].fd = endpoints[i].sock;
+          pfds[i].events = POLLIN;
+          allClosed = false;
+          break;
         case Discovery:
-          if (tick) tickDiscovery(i);
-        case GotPeerAddr: // intentional fall-through
+          if (tick) {
+            tickDualStackWait(i);
+            tickDiscovery(i);
+          }
           pfds[i].fd = endpoints[i].sock;
           pfds[i].events = POLLIN;
           allClosed = false;
@@ -348,22 +720,17 @@ static void *dataLoop (UNUSED void *arg) {
       }
 
       socklen_t recvAddrLen = sizeof(recvAddr);
-      ssize_t recvLen = recvfrom(ep->sock, recvBuf, sizeof(recvBuf), 0, (struct sockaddr*)&recvAddr, &recvAddrLen);
+      ssize_t recvLen = recvfrom(ep->sock, recvBuf, sizeof(recvBuf), 0, &recvAddr.sa, &recvAddrLen);
 
-      if (recvLen < 0 || recvAddrLen != sizeof(recvAddr)) {
+      if (recvLen < 0 || recvAddrLen != addrLen(&recvAddr)) {
         ep->state = Close;
         continue;
       }
 
-      // this line is required if the peer has symmetric NAT, as 
-      // moving from the discovery server to the peer counts as
-      // a new mapping
-      ep->peerPort = recvAddr.sin_port;
-
       ep->lastPacketUTime = utils_getCurrentUTime();
 
       // this is where all the magic happens for receiver
-      handleRes(i, recvBuf, recvLen);
+      handleRes(i, recvBuf, recvLen, &recvAddr);
     }
   }
 
@@ -382,12 +749,12 @@ int endpoint_init (int (*onPacket)(const uint8_t*, size_t, int)) {
   }
 
   int err;
+  initUTime = utils_getCurrentUTime();
   _onPacket = onPacket;
   endpoints = (endpoint_t *)malloc(sizeof(endpoint_t) * endpointCount);
   memset(endpoints, 0, sizeof(endpoint_t) * endpointCount);
 
   char privKeyStr[SEC_KEY_LENGTH + 1] = { 0 };
-  char peerPubKeyStr[SEC_KEY_LENGTH + 1] = { 0 };
   globals_get1s(root, privateKey, privKeyStr, sizeof(privKeyStr));
   globals_get1s(root, peerPublicKey, peerPubKeyStr, sizeof(peerPubKeyStr));
 
@@ -400,16 +767,38 @@ int endpoint_init (int (*onPacket)(const uint8_t*, size_t, int)) {
   struct x25519_key myPubKeyStruct = x25519_public_key(myPrivKeyStruct);
   memcpy(myPubKey, myPubKeyStruct.key, 32);
 
+  bool haveServerAddr = globals_get1ui(discovery, serverAddr) != 0;
+  bool haveServerAddr6 = false;
+  for (int i = 0; i < 4; i++) {
+    if (globals_get1uiv(discovery, serverAddr6, i) != 0) haveServerAddr6 = true;
+  }
+
   char ifName[MAX_NET_IF_NAME_LEN + 1] = { 0 };
   for (int i = 0; i < endpointCount; i++) {
     int ifLen = globals_get1sv(endpoints, interface, i, ifName, sizeof(ifName));
     if (ifLen <= 0) return -4;
 
+    int family = globals_get1iv(endpoints, family, i);
+    if (
+      family < ENDPOINT_FAMILY_IPV4 || family > ENDPOINT_FAMILY_DUAL ||
+      (family == ENDPOINT_FAMILY_IPV4 && !haveServerAddr) ||
+      (family == ENDPOINT_FAMILY_IPV6 && !haveServerAddr6) ||
+      (family == ENDPOINT_FAMILY_DUAL && !haveServerAddr && !haveServerAddr6)
+    ) {
+      printf("Endpoint: %s has no discovery server addr for its address family\n", ifName);
+      return -4;
+    }
+
     memcpy(endpoints[i].ifName, ifName, ifLen + 1);
+    endpoints[i].family = family;
     endpoints[i].state = Open;
     endpoints[i].lastPacketUTime = -1;
+    if (pthread_mutex_init(&endpoints[i].cacheMutex, NULL) != 0) return -8;
   }
 
+  globals_get1s(discovery, peerCacheFile, peerCacheFile, sizeof(peerCacheFile));
+  loadPeerCache();
+
   // Preshared keys are optional: https://www.procustodibus.com/blog/2021/09/wireguard-key-rotation/#preshared-keys
   tunnel = new_tunnel(privKeyStr, peerPubKeyStr, NULL, ENDPOINT_KEEP_ALIVE_MS, 0);
   if (tunnel == NULL) return -5;
@@ -432,6 +821,7 @@ void endpoint_deinit (void) {
   pthread_join(openCloseThread, NULL);
   for (int i = 0; i < endpointCount; i++) {
     close(endpoints[i].sock);
+    pthread_mutex_destroy(&endpoints[i].cacheMutex);
   }
 
   free(endpoints);
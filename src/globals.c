@@ -10,10 +10,13 @@ globals_define1s(root, privateKey, SEC_KEY_LENGTH)
 globals_define1s(root, peerPublicKey, SEC_KEY_LENGTH)
 
 globals_define1ui(discovery, serverAddr)
+globals_define1uiv(discovery, serverAddr6, 4)
 globals_define1i(discovery, serverPort)
+globals_define1s(discovery, peerCacheFile, MAX_FILE_PATH_LEN)
 
 globals_define1i(endpoints, endpointCount)
 globals_define1sv(endpoints, interface, MAX_ENDPOINTS, MAX_NET_IF_NAME_LEN)
+globals_define1iv(endpoints, family, MAX_ENDPOINTS)
 
 globals_define1ui(mux, maxPacketSize)
 
@@ -22,6 +25,9 @@ globals_define1i(audio, deviceChannelCount)
 globals_define1i(audio, networkSampleRate)
 globals_define1ff(audio, deviceSampleRate)
 globals_define1i(audio, decodeRingLength)
+globals_define1i(audio, reorderWindow)
+globals_define1ui(audio, resamplerPhase)
+globals_define1ff(audio, resamplerTransitionBand)
 globals_define1s(audio, deviceName, MAX_DEVICE_NAME_LEN)
 globals_define1i(audio, cardId)
 globals_define1i(audio, deviceId)
@@ -29,6 +35,7 @@ globals_define1i(audio, bitsPerSample)
 globals_define1i(audio, periodSize)
 globals_define1i(audio, periodCount)
 globals_define1i(audio, loopSleep)
+globals_define1i(audio, schedDeadline)
 
 globals_define1ff(audio, levelSlowAttack)
 globals_define1ff(audio, levelSlowRelease)
@@ -38,10 +45,17 @@ globals_define1ui(audio, encoding)
 
 globals_define1i(opus, bitrate)
 globals_define1i(opus, frameSize)
+globals_define1i(opus, encoderGroups)
+globals_define1i(opus, streams)
+globals_define1i(opus, coupledStreams)
+globals_define1iv(opus, mapping, MAX_AUDIO_CHANNELS)
+globals_define1i(opus, maxConcealedFrames)
 
 globals_define1i(pcm, frameSize)
 globals_define1i(pcm, sampleRate)
 
+globals_define1i(lossless, frameSize)
+
 globals_define1iv(fec, symbolLen, MUX_CHANNEL_COUNT)
 globals_define1iv(fec, sourceSymbolsPerBlock, MUX_CHANNEL_COUNT)
 globals_define1iv(fec, repairSymbolsPerBlock, MUX_CHANNEL_COUNT)
@@ -60,6 +74,7 @@ globals_define1uiv(statsMux, ringOverrunCount, MUX_CHANNEL_COUNT)
 globals_define1uiv(statsDemux, ringOverrunCount, MUX_CHANNEL_COUNT)
 globals_define1uiv(statsDemux, dupBlockCount, MUX_CHANNEL_COUNT)
 globals_define1uiv(statsDemux, oooBlockCount, MUX_CHANNEL_COUNT)
+globals_define1iv(statsDemux, fecDecodeTime, MUX_CHANNEL_COUNT)
 globals_define1uiv(statsDemux, blockTimingRingPos, MUX_CHANNEL_COUNT)
 globals_define1uiv(statsDemux, blockTimingRing, MUX_CHANNEL_COUNT * STATS_BLOCK_TIMING_RING_LEN)
 
@@ -70,8 +85,26 @@ globals_define1i(statsCh1Audio, streamBufferSize)
 globals_define1uiv(statsCh1Audio, streamMeterBins, STATS_STREAM_METER_BINS)
 globals_define1ui(statsCh1Audio, bufferOverrunCount)
 globals_define1ui(statsCh1Audio, bufferUnderrunCount)
+globals_define1ui(statsCh1Audio, lateFrameCount)
+globals_define1ui(statsCh1Audio, reorderedFrameCount)
+globals_define1ui(statsCh1Audio, filledFrameCount)
+globals_define1i(statsCh1Audio, decodeStageTime)
+globals_define1ui(statsCh1Audio, decodeQueueOverrunCount)
 globals_define1ui(statsCh1Audio, encodeThreadJitterCount)
+globals_define1i(statsCh1Audio, encodeWakeLatency)
+globals_define1i(statsCh1Audio, encodeWakeLatencyMax)
+globals_define1i(statsCh1Audio, dspTime)
+globals_define1ui(statsCh1Audio, dspOverrunCount)
 globals_define1ui(statsCh1Audio, audioLoopXrunCount)
+globals_define1i(statsCh1Audio, audioLoopLateness)
+globals_define1i(statsCh1Audio, audioLoopLatenessMax)
+globals_define1ui(statsCh1Audio, audioLoopEarlyWakeCount)
 globals_define1ff(statsCh1Audio, clockError)
+globals_define1i(statsCh1Audio, rateChangeTime)
+globals_define1i(statsCh1Audio, resamplerLatency)
 globals_define1ui(statsCh1AudioOpus, codecErrorCount)
+globals_define1ui(statsCh1AudioOpus, concealedFrameCount)
+globals_define1iv(statsCh1AudioOpus, groupCodecTime, MAX_OPUS_ENCODER_GROUPS)
 globals_define1ui(statsCh1AudioPCM, crcFailCount)
+globals_define1ui(statsCh1AudioLossless, crcFailCount)
+globals_define1ff(statsCh1AudioLossless, compressionRatio)
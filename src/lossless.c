@@ -0,0 +1,228 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include <string.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "sampleconv.h"
+#include "lossless.h"
+
+typedef struct {
+  uint8_t *buf;
+  int pos;
+  uint64_t acc;
+  int accBits;
+} bit_writer_t;
+
+typedef struct {
+  const uint8_t *buf;
+  int len, pos;
+  uint64_t acc;
+  int accBits;
+} bit_reader_t;
+
+// n <= 32
+static inline void writeBits (bit_writer_t *w, uint32_t value, int n) {
+  w->acc = (w->acc << n) | value;
+  w->accBits += n;
+  while (w->accBits >= 8) {
+    w->accBits -= 8;
+    w->buf[w->pos++] = w->acc >> w->accBits;
+  }
+}
+
+static inline void writeRice (bit_writer_t *w, uint32_t u, int k) {
+  uint32_t q = u >> k;
+  while (q >= 32) {
+    writeBits(w, 0, 32);
+    q -= 32;
+  }
+  writeBits(w, 1, q + 1); // q zeros then a one
+  if (k > 0) writeBits(w, u & ((1u << k) - 1), k);
+}
+
+// pad to the next byte
+static inline void flushBits (bit_writer_t *w) {
+  if (w->accBits > 0) writeBits(w, 0, 8 - w->accBits);
+}
+
+// n <= 32, returns false if we ran out of data
+static inline bool readBits (bit_reader_t *r, int n, uint32_t *value) {
+  while (r->accBits < n) {
+    if (r->pos == r->len) return false;
+    r->acc = (r->acc << 8) | r->buf[r->pos++];
+    r->accBits += 8;
+  }
+  r->accBits -= n;
+  *value = (r->acc >> r->accBits) & (n == 32 ? 0xffffffff : (1u << n) - 1);
+  return true;
+}
+
+static inline bool readRice (bit_reader_t *r, int k, uint32_t *u) {
+  uint32_t q = 0, bit = 0, rem = 0;
+  while (true) {
+    if (!readBits(r, 1, &bit)) return false;
+    if (bit) break;
+    q++;
+  }
+  if (k > 0 && !readBits(r, k, &rem)) return false;
+  *u = (q << k) | rem;
+  return true;
+}
+
+// skip to the next byte
+static inline void alignBits (bit_reader_t *r) {
+  r->accBits -= r->accBits % 8;
+}
+
+static inline int32_t predict (const int32_t *x, int i, int order) {
+  switch (order) {
+    case 1: return x[i-1];
+    case 2: return 2*x[i-1] - x[i-2];
+    case 3: return 3*x[i-1] - 3*x[i-2] + x[i-3];
+    case 4: return 4*x[i-1] - 6*x[i-2] + 4*x[i-3] - x[i-4];
+    default: return 0;
+  }
+}
+
+static inline uint32_t zigzag (int32_t r) {
+  return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static inline int32_t unzigzag (uint32_t u) {
+  return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+// Pick the fixed predictor order with the smallest sum of absolute residuals (like FLAC)
+static int pickOrder (const int32_t *x, int frameCount) {
+  uint64_t errSums[LOSSLESS_MAX_ORDER + 1] = { 0 };
+  for (int i = LOSSLESS_MAX_ORDER; i < frameCount; i++) {
+    int32_t e0 = x[i];
+    int32_t e1 = e0 - x[i-1];
+    int32_t e2 = e1 - (x[i-1] - x[i-2]);
+    int32_t e3 = e2 - (x[i-1] - 2*x[i-2] + x[i-3]);
+    int32_t e4 = e3 - (x[i-1] - 3*x[i-2] + 3*x[i-3] - x[i-4]);
+    errSums[0] += e0 < 0 ? -(int64_t)e0 : e0;
+    errSums[1] += e1 < 0 ? -(int64_t)e1 : e1;
+    errSums[2] += e2 < 0 ? -(int64_t)e2 : e2;
+    errSums[3] += e3 < 0 ? -(int64_t)e3 : e3;
+    errSums[4] += e4 < 0 ? -(int64_t)e4 : e4;
+  }
+
+  int order = 0;
+  for (int i = 1; i <= LOSSLESS_MAX_ORDER; i++) {
+    if (errSums[i] < errSums[order]) order = i;
+  }
+  return order;
+}
+
+static uint64_t riceBits (const uint32_t *u, int count, int k) {
+  uint64_t bits = (uint64_t)count * (k + 1);
+  for (int i = 0; i < count; i++) bits += u[i] >> k;
+  return bits;
+}
+
+// Returns the Rice parameter and sets *bits to the number of bits needed for the residuals
+static int pickRiceParam (const uint32_t *u, int count, uint64_t *bits) {
+  uint64_t sum = 0;
+  for (int i = 0; i < count; i++) sum += u[i];
+
+  // The optimal parameter is close to log2 of the mean, check either side of that.
+  int kEst = 0;
+  while (kEst < 30 && ((uint64_t)count << (kEst + 1)) <= sum) kEst++;
+
+  int bestK = kEst;
+  *bits = riceBits(u, count, kEst);
+  for (int k = kEst > 0 ? kEst - 1 : 0; k <= kEst + 1; k++) {
+    if (k == kEst) continue;
+    uint64_t kBits = riceBits(u, count, k);
+    if (kBits < *bits) {
+      *bits = kBits;
+      bestK = k;
+    }
+  }
+  return bestK;
+}
+
+static void encodeChannel (bit_writer_t *w, const int32_t *x, int frameCount) {
+  uint32_t residuals[frameCount];
+  int order = 0, k = 0;
+  uint64_t bits = UINT64_MAX;
+
+  if (frameCount > LOSSLESS_MAX_ORDER) {
+    order = pickOrder(x, frameCount);
+    for (int i = order; i < frameCount; i++) residuals[i - order] = zigzag(x[i] - predict(x, i, order));
+    k = pickRiceParam(residuals, frameCount - order, &bits);
+    bits += 24 * order;
+  }
+
+  if (bits >= 24 * (uint64_t)frameCount) {
+    writeBits(w, LOSSLESS_VERBATIM, 8);
+    for (int i = 0; i < frameCount; i++) writeBits(w, (uint32_t)x[i] & 0xffffff, 24);
+    return;
+  }
+
+  writeBits(w, order << 5 | k, 8);
+  for (int i = 0; i < order; i++) writeBits(w, (uint32_t)x[i] & 0xffffff, 24);
+  for (int i = 0; i < frameCount - order; i++) writeRice(w, residuals[i], k);
+  flushBits(w);
+}
+
+static int decodeChannel (bit_reader_t *r, int32_t *x, int frameCount) {
+  uint32_t header = 0, value = 0;
+  if (!readBits(r, 8, &header)) return -1;
+
+  int order = header == LOSSLESS_VERBATIM ? frameCount : (int)(header >> 5);
+  int k = header & 0x1f;
+  if (order > frameCount || (header != LOSSLESS_VERBATIM && order > LOSSLESS_MAX_ORDER)) return -2;
+
+  for (int i = 0; i < order; i++) {
+    if (!readBits(r, 24, &value)) return -3;
+    x[i] = (int32_t)(value << 8) >> 8; // sign extend
+  }
+  for (int i = order; i < frameCount; i++) {
+    if (!readRice(r, k, &value)) return -4;
+    x[i] = unzigzag(value) + predict(x, i, order);
+  }
+
+  alignBits(r);
+  return 0;
+}
+
+int lossless_encode (const sample_t *inSampleBuf, int channelCount, int frameCount, uint8_t *outData) {
+  bit_writer_t w = { .buf = outData, .pos = 0, .acc = 0, .accBits = 0 };
+  int32_t samples[channelCount * frameCount];
+  int32_t x[frameCount];
+
+  // Same conversion as pcm_encode
+  sampleconv_sampleToS24(inSampleBuf, samples, channelCount * frameCount);
+
+  for (int j = 0; j < channelCount; j++) {
+    for (int i = 0; i < frameCount; i++) x[i] = samples[channelCount*i + j];
+    encodeChannel(&w, x, frameCount);
+  }
+
+  utils_writeU16LE(&outData[w.pos], utils_crc16(0, outData, w.pos));
+
+  return w.pos + 2;
+}
+
+int lossless_decode (const uint8_t *inData, int inDataLen, int channelCount, int frameCount, uint8_t *samples) {
+  inDataLen -= 2; // exclude 2 byte CRC at the end
+  if (inDataLen < channelCount) return -1; // at least a header per channel
+
+  if (utils_crc16(0, inData, inDataLen) != utils_readU16LE(&inData[inDataLen])) return -3;
+
+  bit_reader_t r = { .buf = inData, .len = inDataLen, .pos = 0, .acc = 0, .accBits = 0 };
+  int32_t x[frameCount];
+
+  for (int j = 0; j < channelCount; j++) {
+    if (decodeChannel(&r, x, frameCount) < 0) return -4;
+    for (int i = 0; i < frameCount; i++) memcpy(&samples[3 * (channelCount*i + j)], &x[i], 3);
+  }
+
+  if (r.pos != inDataLen || r.accBits != 0) return -5;
+  return channelCount * frameCount;
+}
@@ -17,6 +17,9 @@
 #include "monitor.h"
 #include "audio.h"
 #include "utils.h"
+#include "sampleconv.h"
+#include "resampler.h"
+#include "meter.h"
 
 static bool archChecks (void) {
   // We are going to use macros to test for pointer size, so make sure they are consistent with our runtime test.
@@ -52,6 +55,11 @@ int main (int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  printf("Sample conversion: %s, %s samples\n", sampleconv_init(), SAMPLE_FORMAT_NAME);
+  printf("CRC: %s\n", utils_crcInit());
+  printf("Resampler: %s\n", resampler_initKernels());
+  printf("Meter: %s\n", meter_init());
+
   srand(utils_getCurrentUTime());
 
   int err = 0;
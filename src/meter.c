@@ -0,0 +1,293 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include <stdint.h>
+#include <math.h>
+#include "globals.h"
+#include "meter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define METER_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define METER_NEON
+#include <arm_neon.h>
+#endif
+
+// Follow the first channelCount channels of buf for frameCount frames, starting from and updating levelsFast and
+// levelsSlow, and add the number of clipped samples to clipCounts. The arrays are indexed by channel.
+typedef void (*meterKernel_t)(const sample_t *buf, int bufChannelCount, int channelCount, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts);
+
+static double levelFastAttack = 0.0, levelFastRelease = 0.0, levelSlowAttack = 0.0, levelSlowRelease = 0.0;
+
+/////////////////////
+// scalar kernel
+/////////////////////
+
+static void meterScalar (const sample_t *buf, int bufChannelCount, int channelCount, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  for (int ch = 0; ch < channelCount; ch++) {
+    double levelFast = levelsFast[ch], levelSlow = levelsSlow[ch];
+    unsigned int clipCount = 0;
+
+    for (int i = 0; i < frameCount; i++) {
+      double sample = buf[bufChannelCount * i + ch];
+      if (sample >= 1.0 || sample <= -1.0) clipCount++;
+
+      double levelFastDiff = fabs(sample) - levelFast;
+      double levelSlowDiff = fabs(sample) - levelSlow;
+      levelFast += (levelFastDiff > 0 ? levelFastAttack : levelFastRelease) * levelFastDiff;
+      levelSlow += (levelSlowDiff > 0 ? levelSlowAttack : levelSlowRelease) * levelSlowDiff;
+    }
+
+    levelsFast[ch] = levelFast;
+    levelsSlow[ch] = levelSlow;
+    clipCounts[ch] += clipCount;
+  }
+}
+
+/////////////////////
+// x86 kernels
+/////////////////////
+
+#ifdef METER_X86
+
+#define AVX2 __attribute__((target("avx2")))
+#define SSE2 __attribute__((target("sse2")))
+
+// 2 samples to 2 x double
+SSE2 static inline __m128d load2Sse2 (const sample_t *samples) {
+#ifndef W_SAMPLE_F32
+  return _mm_loadu_pd(samples);
+#else
+  return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)samples)));
+#endif
+}
+
+// One step of an attack/release follower, in the same order of operations as the scalar kernel
+SSE2 static inline __m128d followSse2 (__m128d level, __m128d absSample, __m128d attack, __m128d release) {
+  __m128d diff = _mm_sub_pd(absSample, level);
+  __m128d isAttack = _mm_cmpgt_pd(diff, _mm_setzero_pd());
+  __m128d coef = _mm_or_pd(_mm_and_pd(isAttack, attack), _mm_andnot_pd(isAttack, release));
+  return _mm_add_pd(level, _mm_mul_pd(coef, diff));
+}
+
+// Two channels starting at ch
+SSE2 static void meterPairSse2 (const sample_t *buf, int bufChannelCount, int ch, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  const __m128d signMask = _mm_set1_pd(-0.0), one = _mm_set1_pd(1.0);
+  const __m128d fastAttack = _mm_set1_pd(levelFastAttack), fastRelease = _mm_set1_pd(levelFastRelease);
+  const __m128d slowAttack = _mm_set1_pd(levelSlowAttack), slowRelease = _mm_set1_pd(levelSlowRelease);
+  __m128d levelFast = _mm_loadu_pd(&levelsFast[ch]), levelSlow = _mm_loadu_pd(&levelsSlow[ch]);
+  __m128i clips = _mm_setzero_si128();
+
+  for (int i = 0; i < frameCount; i++) {
+    __m128d absSample = _mm_andnot_pd(signMask, load2Sse2(&buf[bufChannelCount * i + ch]));
+    // Compare masks are all ones (-1) in clipped lanes
+    clips = _mm_sub_epi64(clips, _mm_castpd_si128(_mm_cmpge_pd(absSample, one)));
+    levelFast = followSse2(levelFast, absSample, fastAttack, fastRelease);
+    levelSlow = followSse2(levelSlow, absSample, slowAttack, slowRelease);
+  }
+
+  _mm_storeu_pd(&levelsFast[ch], levelFast);
+  _mm_storeu_pd(&levelsSlow[ch], levelSlow);
+  int64_t clipLanes[2];
+  _mm_storeu_si128((__m128i *)clipLanes, clips);
+  clipCounts[ch] += clipLanes[0];
+  clipCounts[ch + 1] += clipLanes[1];
+}
+
+SSE2 static void meterSse2 (const sample_t *buf, int bufChannelCount, int channelCount, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  int ch = 0;
+  for (; ch + 2 <= channelCount; ch += 2) meterPairSse2(buf, bufChannelCount, ch, frameCount, levelsFast, levelsSlow, clipCounts);
+  meterScalar(&buf[ch], bufChannelCount, channelCount - ch, frameCount, &levelsFast[ch], &levelsSlow[ch], &clipCounts[ch]);
+}
+
+// 4 samples to 4 x double
+AVX2 static inline __m256d load4Avx2 (const sample_t *samples) {
+#ifndef W_SAMPLE_F32
+  return _mm256_loadu_pd(samples);
+#else
+  return _mm256_cvtps_pd(_mm_loadu_ps(samples));
+#endif
+}
+
+AVX2 static inline __m256d followAvx2 (__m256d level, __m256d absSample, __m256d attack, __m256d release) {
+  __m256d diff = _mm256_sub_pd(absSample, level);
+  __m256d coef = _mm256_blendv_pd(release, attack, _mm256_cmp_pd(diff, _mm256_setzero_pd(), _CMP_GT_OQ));
+  return _mm256_add_pd(level, _mm256_mul_pd(coef, diff));
+}
+
+// Add the clip counts in the 4 lanes of clips to clipCounts
+AVX2 static inline void addClipsAvx2 (unsigned int *clipCounts, __m256i clips) {
+  int64_t clipLanes[4];
+  _mm256_storeu_si256((__m256i *)clipLanes, clips);
+  for (int j = 0; j < 4; j++) clipCounts[j] += clipLanes[j];
+}
+
+// Eight channels starting at ch, as two groups of four so there are four independent follower chains to hide the
+// add and multiply latency
+AVX2 static void meterOctAvx2 (const sample_t *buf, int bufChannelCount, int ch, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  const __m256d signMask = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0);
+  const __m256d fastAttack = _mm256_set1_pd(levelFastAttack), fastRelease = _mm256_set1_pd(levelFastRelease);
+  const __m256d slowAttack = _mm256_set1_pd(levelSlowAttack), slowRelease = _mm256_set1_pd(levelSlowRelease);
+  __m256d levelFast0 = _mm256_loadu_pd(&levelsFast[ch]), levelFast1 = _mm256_loadu_pd(&levelsFast[ch + 4]);
+  __m256d levelSlow0 = _mm256_loadu_pd(&levelsSlow[ch]), levelSlow1 = _mm256_loadu_pd(&levelsSlow[ch + 4]);
+  __m256i clips0 = _mm256_setzero_si256(), clips1 = _mm256_setzero_si256();
+
+  for (int i = 0; i < frameCount; i++) {
+    const sample_t *frame = &buf[bufChannelCount * i + ch];
+    __m256d absSample0 = _mm256_andnot_pd(signMask, load4Avx2(&frame[0]));
+    __m256d absSample1 = _mm256_andnot_pd(signMask, load4Avx2(&frame[4]));
+    // Compare masks are all ones (-1) in clipped lanes
+    clips0 = _mm256_sub_epi64(clips0, _mm256_castpd_si256(_mm256_cmp_pd(absSample0, one, _CMP_GE_OQ)));
+    clips1 = _mm256_sub_epi64(clips1, _mm256_castpd_si256(_mm256_cmp_pd(absSample1, one, _CMP_GE_OQ)));
+    levelFast0 = followAvx2(levelFast0, absSample0, fastAttack, fastRelease);
+    levelFast1 = followAvx2(levelFast1, absSample1, fastAttack, fastRelease);
+    levelSlow0 = followAvx2(levelSlow0, absSample0, slowAttack, slowRelease);
+    levelSlow1 = followAvx2(levelSlow1, absSample1, slowAttack, slowRelease);
+  }
+
+  _mm256_storeu_pd(&levelsFast[ch], levelFast0);
+  _mm256_storeu_pd(&levelsFast[ch + 4], levelFast1);
+  _mm256_storeu_pd(&levelsSlow[ch], levelSlow0);
+  _mm256_storeu_pd(&levelsSlow[ch + 4], levelSlow1);
+  addClipsAvx2(&clipCounts[ch], clips0);
+  addClipsAvx2(&clipCounts[ch + 4], clips1);
+}
+
+// Four channels starting at ch
+AVX2 static void meterQuadAvx2 (const sample_t *buf, int bufChannelCount, int ch, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  const __m256d signMask = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0);
+  const __m256d fastAttack = _mm256_set1_pd(levelFastAttack), fastRelease = _mm256_set1_pd(levelFastRelease);
+  const __m256d slowAttack = _mm256_set1_pd(levelSlowAttack), slowRelease = _mm256_set1_pd(levelSlowRelease);
+  __m256d levelFast = _mm256_loadu_pd(&levelsFast[ch]), levelSlow = _mm256_loadu_pd(&levelsSlow[ch]);
+  __m256i clips = _mm256_setzero_si256();
+
+  for (int i = 0; i < frameCount; i++) {
+    __m256d absSample = _mm256_andnot_pd(signMask, load4Avx2(&buf[bufChannelCount * i + ch]));
+    clips = _mm256_sub_epi64(clips, _mm256_castpd_si256(_mm256_cmp_pd(absSample, one, _CMP_GE_OQ)));
+    levelFast = followAvx2(levelFast, absSample, fastAttack, fastRelease);
+    levelSlow = followAvx2(levelSlow, absSample, slowAttack, slowRelease);
+  }
+
+  _mm256_storeu_pd(&levelsFast[ch], levelFast);
+  _mm256_storeu_pd(&levelsSlow[ch], levelSlow);
+  addClipsAvx2(&clipCounts[ch], clips);
+}
+
+AVX2 static void meterAvx2 (const sample_t *buf, int bufChannelCount, int channelCount, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  int ch = 0;
+  for (; ch + 8 <= channelCount; ch += 8) meterOctAvx2(buf, bufChannelCount, ch, frameCount, levelsFast, levelsSlow, clipCounts);
+  if (ch + 4 <= channelCount) {
+    meterQuadAvx2(buf, bufChannelCount, ch, frameCount, levelsFast, levelsSlow, clipCounts);
+    ch += 4;
+  }
+  if (ch + 2 <= channelCount) {
+    meterPairSse2(buf, bufChannelCount, ch, frameCount, levelsFast, levelsSlow, clipCounts);
+    ch += 2;
+  }
+  meterScalar(&buf[ch], bufChannelCount, channelCount - ch, frameCount, &levelsFast[ch], &levelsSlow[ch], &clipCounts[ch]);
+}
+
+#endif
+
+/////////////////////
+// NEON kernel
+/////////////////////
+
+#ifdef METER_NEON
+
+// 2 samples to 2 x double
+static inline float64x2_t load2Neon (const sample_t *samples) {
+#ifndef W_SAMPLE_F32
+  return vld1q_f64(samples);
+#else
+  return vcvt_f64_f32(vld1_f32(samples));
+#endif
+}
+
+static inline float64x2_t followNeon (float64x2_t level, float64x2_t absSample, float64x2_t attack, float64x2_t release) {
+  float64x2_t diff = vsubq_f64(absSample, level);
+  float64x2_t coef = vbslq_f64(vcgtq_f64(diff, vdupq_n_f64(0.0)), attack, release);
+  // Separate multiply and add (not vfmaq) to round the same as the scalar kernel
+  return vaddq_f64(level, vmulq_f64(coef, diff));
+}
+
+static void meterNeon (const sample_t *buf, int bufChannelCount, int channelCount, int frameCount, double *levelsFast, double *levelsSlow, unsigned int *clipCounts) {
+  const float64x2_t one = vdupq_n_f64(1.0);
+  const float64x2_t fastAttack = vdupq_n_f64(levelFastAttack), fastRelease = vdupq_n_f64(levelFastRelease);
+  const float64x2_t slowAttack = vdupq_n_f64(levelSlowAttack), slowRelease = vdupq_n_f64(levelSlowRelease);
+  int ch = 0;
+
+  for (; ch + 2 <= channelCount; ch += 2) {
+    float64x2_t levelFast = vld1q_f64(&levelsFast[ch]), levelSlow = vld1q_f64(&levelsSlow[ch]);
+    uint64x2_t clips = vdupq_n_u64(0);
+
+    for (int i = 0; i < frameCount; i++) {
+      float64x2_t absSample = vabsq_f64(load2Neon(&buf[bufChannelCount * i + ch]));
+      // Compare masks are all ones in clipped lanes
+      clips = vsubq_u64(clips, vcgeq_f64(absSample, one));
+      levelFast = followNeon(levelFast, absSample, fastAttack, fastRelease);
+      levelSlow = followNeon(levelSlow, absSample, slowAttack, slowRelease);
+    }
+
+    vst1q_f64(&levelsFast[ch], levelFast);
+    vst1q_f64(&levelsSlow[ch], levelSlow);
+    clipCounts[ch] += vgetq_lane_u64(clips, 0);
+    clipCounts[ch + 1] += vgetq_lane_u64(clips, 1);
+  }
+
+  meterScalar(&buf[ch], bufChannelCount, channelCount - ch, frameCount, &levelsFast[ch], &levelsSlow[ch], &clipCounts[ch]);
+}
+
+#endif
+
+static meterKernel_t meterKernel = meterScalar;
+
+/////////////////////
+// public
+/////////////////////
+
+const char *meter_init (void) {
+#if defined(METER_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    meterKernel = meterAvx2;
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    meterKernel = meterSse2;
+    return "sse2";
+  }
+#elif defined(METER_NEON)
+  meterKernel = meterNeon;
+  return "neon";
+#endif
+  return "scalar";
+}
+
+void meter_setFilters (void) {
+  globals_get1ff(audio, levelFastAttack, &levelFastAttack);
+  globals_get1ff(audio, levelFastRelease, &levelFastRelease);
+  globals_get1ff(audio, levelSlowAttack, &levelSlowAttack);
+  globals_get1ff(audio, levelSlowRelease, &levelSlowRelease);
+}
+
+void meter_process (const sample_t *buf, int bufChannelCount, int channelCount, int frameCount) {
+  double levelsFast[MAX_AUDIO_CHANNELS], levelsSlow[MAX_AUDIO_CHANNELS];
+  unsigned int clipCounts[MAX_AUDIO_CHANNELS] = { 0 };
+
+  for (int ch = 0; ch < channelCount; ch++) {
+    globals_get1ffv(statsCh1Audio, levelsFast, ch, &levelsFast[ch]);
+    globals_get1ffv(statsCh1Audio, levelsSlow, ch, &levelsSlow[ch]);
+  }
+
+  meterKernel(buf, bufChannelCount, channelCount, frameCount, levelsFast, levelsSlow, clipCounts);
+
+  for (int ch = 0; ch < channelCount; ch++) {
+    globals_set1ffv(statsCh1Audio, levelsFast, ch, levelsFast[ch]);
+    globals_set1ffv(statsCh1Audio, levelsSlow, ch, levelsSlow[ch]);
+    if (clipCounts[ch] > 0) globals_add1uiv(statsCh1Audio, clippingCounts, ch, clipCounts[ch]);
+  }
+}
@@ -144,6 +144,7 @@ static void *statsLoop (UNUSED void *arg) {
 
     protoCh1->set_dupblockcount(globals_get1uiv(statsDemux, dupBlockCount, chId));
     protoCh1->set_oooblockcount(globals_get1uiv(statsDemux, oooBlockCount, chId));
+    protoCh1->set_fecdecodetime(globals_get1iv(statsDemux, fecDecodeTime, chId));
     mapBlockTimingRing(blockTimingRingMapped, chId);
     protoCh1->set_blocktiming(blockTimingRingMapped, 4 * (STATS_BLOCK_TIMING_RING_LEN-1));
 
@@ -161,8 +162,22 @@ static void *statsLoop (UNUSED void *arg) {
     protoCh1->mutable_audiostats()->set_streambuffersize(globals_get1i(statsCh1Audio, streamBufferSize));
     protoCh1->mutable_audiostats()->set_bufferoverruncount(globals_get1ui(statsCh1Audio, bufferOverrunCount));
     protoCh1->mutable_audiostats()->set_bufferunderruncount(globals_get1ui(statsCh1Audio, bufferUnderrunCount));
+    protoCh1->mutable_audiostats()->set_lateframecount(globals_get1ui(statsCh1Audio, lateFrameCount));
+    protoCh1->mutable_audiostats()->set_reorderedframecount(globals_get1ui(statsCh1Audio, reorderedFrameCount));
+    protoCh1->mutable_audiostats()->set_filledframecount(globals_get1ui(statsCh1Audio, filledFrameCount));
+    protoCh1->mutable_audiostats()->set_decodestagetime(globals_get1i(statsCh1Audio, decodeStageTime));
+    protoCh1->mutable_audiostats()->set_decodequeueoverruncount(globals_get1ui(statsCh1Audio, decodeQueueOverrunCount));
+    protoCh1->mutable_audiostats()->set_dsptime(globals_get1i(statsCh1Audio, dspTime));
+    protoCh1->mutable_audiostats()->set_dspoverruncount(globals_get1ui(statsCh1Audio, dspOverrunCount));
+    protoCh1->mutable_audiostats()->set_ratechangetime(globals_get1i(statsCh1Audio, rateChangeTime));
+    protoCh1->mutable_audiostats()->set_resamplerlatency(globals_get1i(statsCh1Audio, resamplerLatency));
     protoCh1->mutable_audiostats()->set_encodethreadjittercount(globals_get1ui(statsCh1Audio, encodeThreadJitterCount));
+    protoCh1->mutable_audiostats()->set_encodewakelatency(globals_get1i(statsCh1Audio, encodeWakeLatency));
+    protoCh1->mutable_audiostats()->set_encodewakelatencymax(globals_get1i(statsCh1Audio, encodeWakeLatencyMax));
     protoCh1->mutable_audiostats()->set_audioloopxruncount(globals_get1ui(statsCh1Audio, audioLoopXrunCount));
+    protoCh1->mutable_audiostats()->set_audiolooplateness(globals_get1i(statsCh1Audio, audioLoopLateness));
+    protoCh1->mutable_audiostats()->set_audiolooplatenessmax(globals_get1i(statsCh1Audio, audioLoopLatenessMax));
+    protoCh1->mutable_audiostats()->set_audioloopearlywakecount(globals_get1ui(statsCh1Audio, audioLoopEarlyWakeCount));
     double clockError;
     globals_get1ff(statsCh1Audio, clockError, &clockError);
     protoCh1->mutable_audiostats()->set_clockerror(clockError);
@@ -173,10 +188,22 @@ static void *statsLoop (UNUSED void *arg) {
     switch (globals_get1ui(audio, encoding)) {
       case AUDIO_ENCODING_OPUS:
         protoCh1->mutable_audiostats()->mutable_opusstats()->set_codecerrorcount(globals_get1ui(statsCh1AudioOpus, codecErrorCount));
+        protoCh1->mutable_audiostats()->mutable_opusstats()->set_concealedframecount(globals_get1ui(statsCh1AudioOpus, concealedFrameCount));
+        protoCh1->mutable_audiostats()->mutable_opusstats()->clear_groupcodectime();
+        for (int i = 0; i < globals_get1i(opus, encoderGroups); i++) {
+          protoCh1->mutable_audiostats()->mutable_opusstats()->add_groupcodectime(globals_get1iv(statsCh1AudioOpus, groupCodecTime, i));
+        }
         break;
       case AUDIO_ENCODING_PCM:
         protoCh1->mutable_audiostats()->mutable_pcmstats()->set_crcfailcount(globals_get1ui(statsCh1AudioPCM, crcFailCount));
         break;
+      case AUDIO_ENCODING_LOSSLESS: {
+        double compressionRatio;
+        globals_get1ff(statsCh1AudioLossless, compressionRatio, &compressionRatio);
+        protoCh1->mutable_audiostats()->mutable_losslessstats()->set_crcfailcount(globals_get1ui(statsCh1AudioLossless, crcFailCount));
+        protoCh1->mutable_audiostats()->mutable_losslessstats()->set_compressionratio(compressionRatio);
+        break;
+      }
     }
 
     std::string protoData;
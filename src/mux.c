@@ -9,16 +9,22 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "raptorq/raptorq.h"
+#include "ck/ck_ring.h"
 #include "utils.h"
 #include "globals.h"
 #include "mux.h"
 
+// A flushed block puts its count of source symbols sent in the top byte of every ESI (see mux_flush), which is free as
+// long as there are at most 2^16 symbols per block
+#define MAX_CHUNKS_PER_BLOCK 65536
+#define MAX_FLUSHED_SOURCE_SYMBOLS 255
+
 typedef struct {
   uint8_t chId, sbn;
   ck_ring_t chunkRing;
   ck_ring_buffer_t *chunkRingBuf; // encoded block made of chunks
   uint8_t *blockBuf, *encodedBlockBuf;
-  int blockBufPos, blockBufLen, maxDataLen;
+  int blockBufPos, blockBufLen, maxDataLen, symbolLen, sourceSymbolsPerBlock;
   size_t chunkLen, chunkLenWords, chunkRingLenWords, chunksPerBlock, encodedBlockBufLen;
   void *raptorqHandle;
 } mux_channel_t;
@@ -126,6 +132,7 @@ int mux_setAnchorChannel (uint8_t chId) {
 int mux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbolsPerBlock, int symbolLen) {
   if (chCount == MUX_CHANNEL_COUNT) return -1;
   if (maxDataLen > symbolLen * sourceSymbolsPerBlock - 8) return -2;
+  if (sourceSymbolsPerBlock + repairSymbolsPerBlock > MAX_CHUNKS_PER_BLOCK) return -6;
 
   mux_channel_t *chan = &channels[chCount];
 
@@ -153,6 +160,8 @@ int mux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbols
   chan->chId = chCount;
   chan->sbn = 0;
   chan->maxDataLen = maxDataLen;
+  chan->symbolLen = symbolLen;
+  chan->sourceSymbolsPerBlock = sourceSymbolsPerBlock;
   chan->blockBufPos = 0;
   chan->blockBufLen = symbolLen * sourceSymbolsPerBlock;
   chan->blockBuf = (uint8_t *)malloc(chan->blockBufLen);
@@ -165,7 +174,9 @@ int mux_addChannel (int maxDataLen, int sourceSymbolsPerBlock, int repairSymbols
   return chCount++;
 }
 
-static int encodeAndEnqueueBlock (uint8_t chId) {
+// Source symbols from sourceSymbolsToSend onwards are not sent (see mux_flush), repair symbols are always sent.
+// If any are left out, every chunk sent carries sourceSymbolsToSend in the top byte of its ESI.
+static int encodeAndEnqueueBlock (uint8_t chId, int sourceSymbolsToSend) {
   mux_channel_t *chan = &channels[chId];
   chan->blockBufPos = 0;
 
@@ -184,11 +195,18 @@ static int encodeAndEnqueueBlock (uint8_t chId) {
     return -2;
   }
 
-  // chan->chunkRingLenWords/2 == chan->encodedBlockBufLen in words
-  for (size_t i = 0; i < chan->chunkRingLenWords/2; i++) {
-    intptr_t chunkWord = 0;
-    memcpy(&chunkWord, &chan->encodedBlockBuf[4*i], 4);
-    ck_ring_enqueue_spsc(&chan->chunkRing, chan->chunkRingBuf, (void*)chunkWord);
+  for (size_t c = 0; c < chan->chunksPerBlock; c++) {
+    uint8_t *chunk = &chan->encodedBlockBuf[c * chan->chunkLen];
+    // Payload ID: 1 byte SBN, 3 byte ESI big endian. ESIs below sourceSymbolsPerBlock are source symbols.
+    int esi = (chunk[1] << 16) | (chunk[2] << 8) | chunk[3];
+    if (esi >= sourceSymbolsToSend && esi < chan->sourceSymbolsPerBlock) continue;
+    if (sourceSymbolsToSend < chan->sourceSymbolsPerBlock) chunk[1] = sourceSymbolsToSend;
+
+    for (size_t i = 0; i < chan->chunkLenWords; i++) {
+      intptr_t chunkWord = 0;
+      memcpy(&chunkWord, &chunk[4*i], 4);
+      ck_ring_enqueue_spsc(&chan->chunkRing, chan->chunkRingBuf, (void*)chunkWord);
+    }
   }
 
   if (chId == anchorChId) xwait_notify(&waitHandle);
@@ -210,7 +228,7 @@ int mux_writeData (uint8_t chId, const uint8_t *dataBuf, int dataBufLen) {
   if (leftoverLen < 5) {
     // all of dataBuf goes at the start of the next block
     memset(&chan->blockBuf[chan->blockBufPos], 0, leftoverLen); // padding
-    err = encodeAndEnqueueBlock(chId); // sets blockBufPos to 0
+    err = encodeAndEnqueueBlock(chId, chan->sourceSymbolsPerBlock); // sets blockBufPos to 0
     if (err < 0) return err - 2;
     memset(chan->blockBuf, 0, 4); // no partial data
     dataLenField = dataBufLen;
@@ -227,7 +245,7 @@ int mux_writeData (uint8_t chId, const uint8_t *dataBuf, int dataBufLen) {
   if (leftoverLen < 4 + dataBufLen) {
     // dataBuf is split between current and next block
     memcpy(&chan->blockBuf[chan->blockBufPos], dataBuf, leftoverLen - 4);
-    err = encodeAndEnqueueBlock(chId); // sets blockBufPos to 0
+    err = encodeAndEnqueueBlock(chId, chan->sourceSymbolsPerBlock); // sets blockBufPos to 0
     if (err < 0) return err - 4;
     dataLenField = 4 + dataBufLen - leftoverLen;
     memcpy(chan->blockBuf, &dataLenField, 4);
@@ -241,3 +259,22 @@ int mux_writeData (uint8_t chId, const uint8_t *dataBuf, int dataBufLen) {
   chan->blockBufPos += dataBufLen;
   return 2;
 }
+
+int mux_flush (uint8_t chId) {
+  mux_channel_t *chan = &channels[chId];
+
+  if (anchorChId < 0) return -1;
+  if (chan->blockBufPos <= 4) return 0; // nothing after the partial data field
+
+  // Only the source symbols holding data are sent, demux recreates the zero padded ones (demux_setFlushedChannel).
+  // The count must fit in the top byte of the ESI, otherwise send them all.
+  int sourceSymbolsToSend = (chan->blockBufPos + chan->symbolLen - 1) / chan->symbolLen;
+  if (sourceSymbolsToSend > MAX_FLUSHED_SOURCE_SYMBOLS) sourceSymbolsToSend = chan->sourceSymbolsPerBlock;
+  memset(&chan->blockBuf[chan->blockBufPos], 0, chan->blockBufLen - chan->blockBufPos);
+  int err = encodeAndEnqueueBlock(chId, sourceSymbolsToSend); // sets blockBufPos to 0
+  if (err < 0) return err - 1;
+
+  memset(chan->blockBuf, 0, 4); // no partial data
+  chan->blockBufPos = 4;
+  return 0;
+}
@@ -0,0 +1,282 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include "xwait.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "opus/opus_multistream.h"
+#include "globals.h"
+#include "utils.h"
+#include "opus-groups.h"
+
+typedef struct {
+  int index;
+  int core; // for the worker thread, -1 if not pinned
+  int channelStart, channelCount;
+  int encodedStart, encodedLen;
+  OpusMSEncoder *encoder;
+  OpusMSDecoder *decoder;
+  float *sampleBuf; // only this group's channels, interleaved
+  int result;
+  pthread_t thread;
+  xwait_t startWaitHandle;
+} group_t;
+
+static group_t *groups = NULL;
+static int groupCount = 0, workerCount = 0; // groups 1 to workerCount have a running worker thread
+static int networkChannelCount, frameSize;
+static bool _encoder;
+static atomic_bool threadsRunning = false;
+static atomic_int pendingGroupCount;
+static xwait_t doneWaitHandle;
+
+// The current job, set by opusgroups_encode or opusgroups_decode before the workers are woken.
+static const float *jobSamplesIn;
+static float *jobSamplesOut;
+static const uint8_t *jobDataIn;
+static uint8_t *jobDataOut;
+
+static void encodeGroup (group_t *group) {
+  for (int i = 0; i < frameSize; i++) {
+    for (int j = 0; j < group->channelCount; j++) {
+      group->sampleBuf[group->channelCount*i + j] = jobSamplesIn[networkChannelCount*i + group->channelStart + j];
+    }
+  }
+
+  int encodedLen = opus_multistream_encode_float(group->encoder, group->sampleBuf, frameSize, &jobDataOut[group->encodedStart], group->encodedLen);
+  group->result = encodedLen == group->encodedLen ? 0 : -1;
+}
+
+static void decodeGroup (group_t *group) {
+  // NULL data tells the decoder to conceal a lost packet
+  const uint8_t *data = jobDataIn == NULL ? NULL : &jobDataIn[group->encodedStart];
+  int result = opus_multistream_decode_float(group->decoder, data, data == NULL ? 0 : group->encodedLen, group->sampleBuf, frameSize, 0);
+  if (result != frameSize) {
+    group->result = -1;
+    return;
+  }
+
+  for (int i = 0; i < frameSize; i++) {
+    for (int j = 0; j < group->channelCount; j++) {
+      jobSamplesOut[networkChannelCount*i + group->channelStart + j] = group->sampleBuf[group->channelCount*i + j];
+    }
+  }
+  group->result = 0;
+}
+
+static void runGroup (group_t *group) {
+  int startUTime = utils_getCurrentUTime();
+
+  if (_encoder) {
+    encodeGroup(group);
+  } else {
+    decodeGroup(group);
+  }
+
+  globals_set1iv(statsCh1AudioOpus, groupCodecTime, group->index, utils_getElapsedUTime(startUTime));
+}
+
+static void *startWorker (void *arg) {
+  group_t *group = (group_t *)arg;
+
+  utils_setCallerThreadRealtime(98, group->core);
+
+  while (true) {
+    xwait_wait(&group->startWaitHandle);
+    if (!threadsRunning) break;
+
+    runGroup(group);
+    if (atomic_fetch_sub(&pendingGroupCount, 1) == 1) xwait_notify(&doneWaitHandle);
+  }
+
+  return NULL;
+}
+
+// Run every group and wait for them all to complete. Returns the number of groups that failed.
+static int runAllGroups (void) {
+  atomic_store(&pendingGroupCount, groupCount - 1);
+  for (int i = 1; i < groupCount; i++) xwait_notify(&groups[i].startWaitHandle);
+
+  runGroup(&groups[0]);
+  if (groupCount > 1) xwait_wait(&doneWaitHandle);
+
+  int failCount = 0;
+  for (int i = 0; i < groupCount; i++) {
+    if (groups[i].result < 0) failCount++;
+  }
+  return failCount;
+}
+
+// Opus mapping values: 255 is silence, [0, 2*coupledStreams) are the left and right channels of the coupled
+// streams, the rest are mono streams.
+static inline int mappingToStream (int mappingVal, int coupledStreams) {
+  return mappingVal < 2 * coupledStreams ? mappingVal / 2 : mappingVal - coupledStreams;
+}
+
+// Translate the global layout (globals opus.streams, opus.coupledStreams, opus.mapping) into a layout that
+// only covers the streams used by this group's channels. Every stream must belong to exactly one group.
+// streamOwners: indexed by global stream, the group that uses it or -1
+static int initGroupLayout (const group_t *group, int *streamOwners, int *streamCount, int *coupledStreamCount, unsigned char *mapping) {
+  const int coupledStreams = globals_get1i(opus, coupledStreams);
+  int localStreams[255];
+  int localCount = 0;
+
+  // Local coupled streams must come before local mono streams
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < group->channelCount; i++) {
+      int mappingVal = globals_get1iv(opus, mapping, group->channelStart + i);
+      if (mappingVal == 255) continue;
+      if ((pass == 0) != (mappingVal < 2 * coupledStreams)) continue;
+
+      int stream = mappingToStream(mappingVal, coupledStreams);
+      if (streamOwners[stream] == -1) {
+        streamOwners[stream] = group->index;
+        localStreams[stream] = localCount++;
+      } else if (streamOwners[stream] != group->index) {
+        printf("Error: Opus stream %d is split between encoder groups %d and %d. Change encoderGroups or the mapping.\n", stream, streamOwners[stream], group->index);
+        return -1;
+      }
+    }
+    if (pass == 0) *coupledStreamCount = localCount;
+  }
+  *streamCount = localCount;
+
+  for (int i = 0; i < group->channelCount; i++) {
+    int mappingVal = globals_get1iv(opus, mapping, group->channelStart + i);
+    if (mappingVal == 255) {
+      mapping[i] = 255;
+    } else if (mappingVal < 2 * coupledStreams) {
+      mapping[i] = 2 * localStreams[mappingVal / 2] + mappingVal % 2;
+    } else {
+      mapping[i] = *coupledStreamCount + localStreams[mappingToStream(mappingVal, coupledStreams)];
+    }
+  }
+
+  return 0;
+}
+
+static int initGroupCodec (group_t *group, int *streamOwners, int bitrate) {
+  unsigned char mapping[group->channelCount];
+  int streamCount, coupledStreamCount;
+  if (initGroupLayout(group, streamOwners, &streamCount, &coupledStreamCount, mapping) < 0) return -1;
+
+  int err;
+  if (_encoder) {
+    group->encoder = opus_multistream_encoder_create(AUDIO_OPUS_SAMPLE_RATE, group->channelCount, streamCount, coupledStreamCount, mapping, OPUS_APPLICATION_AUDIO, &err);
+    if (err < 0) {
+      printf("Error: opus_multistream_encoder_create failed: %s\n", opus_strerror(err));
+      return -2;
+    }
+
+    int err1 = opus_multistream_encoder_ctl(group->encoder, OPUS_SET_BITRATE(bitrate));
+    int err2 = opus_multistream_encoder_ctl(group->encoder, OPUS_SET_VBR(0));
+    if (err1 < 0 || err2 < 0) {
+      printf("Error: opus_multistream_encoder_ctl failed\n");
+      return -3;
+    }
+  } else {
+    group->decoder = opus_multistream_decoder_create(AUDIO_OPUS_SAMPLE_RATE, group->channelCount, streamCount, coupledStreamCount, mapping, &err);
+    if (err < 0) return -4;
+  }
+
+  return 0;
+}
+
+/////////////////////
+// public
+/////////////////////
+
+int opusgroups_init (bool encoder, int encodedLen, int callerCore) {
+  _encoder = encoder;
+  networkChannelCount = globals_get1i(audio, networkChannelCount);
+  frameSize = globals_get1i(opus, frameSize);
+  groupCount = globals_get1i(opus, encoderGroups);
+  if (groupCount < 1 || groupCount > networkChannelCount) return -1;
+
+  groups = (group_t *)calloc(groupCount, sizeof(group_t));
+  if (groups == NULL) return -2;
+  xwait_init(&doneWaitHandle);
+
+  int streamOwners[255];
+  for (int i = 0; i < 255; i++) streamOwners[i] = -1;
+
+  for (int i = 0; i < groupCount; i++) {
+    group_t *group = &groups[i];
+    int channelEnd = networkChannelCount * (i + 1) / groupCount;
+    group->index = i;
+    group->channelStart = networkChannelCount * i / groupCount;
+    group->channelCount = channelEnd - group->channelStart;
+    // Share encodedLen between the groups in proportion to their channel count. The group lengths always
+    // add up to exactly encodedLen.
+    group->encodedStart = encodedLen * group->channelStart / networkChannelCount;
+    group->encodedLen = encodedLen * channelEnd / networkChannelCount - group->encodedStart;
+
+    group->sampleBuf = (float *)malloc(sizeof(float) * group->channelCount * frameSize);
+    if (group->sampleBuf == NULL) return -3;
+
+    // CBR: this bitrate gives exactly encodedLen bytes per frame
+    int err = initGroupCodec(group, streamOwners, 8 * AUDIO_OPUS_SAMPLE_RATE * group->encodedLen / frameSize);
+    if (err < 0) return err - 3;
+  }
+
+  // The calling thread runs group 0 on callerCore, and the cores up to it are taken by the other realtime threads.
+  // Put each worker on its own core after callerCore, or leave them all unpinned rather than share a taken core.
+  int coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+  bool pinWorkers = callerCore + groupCount <= coreCount;
+  if (!pinWorkers && groupCount > 1) {
+    printf("Only %d CPU cores for %d Opus groups, not pinning the worker threads\n", coreCount, groupCount);
+  }
+  for (int i = 0; i < groupCount; i++) groups[i].core = pinWorkers ? callerCore + i : -1;
+
+  threadsRunning = true;
+  for (int i = 1; i < groupCount; i++) {
+    xwait_init(&groups[i].startWaitHandle);
+    if (pthread_create(&groups[i].thread, NULL, startWorker, &groups[i]) != 0) return -8;
+    workerCount++;
+  }
+
+  return 0;
+}
+
+int opusgroups_encode (const float *samples, uint8_t *outData) {
+  jobSamplesIn = samples;
+  jobDataOut = outData;
+  if (runAllGroups() > 0) return -1;
+  return groups[groupCount-1].encodedStart + groups[groupCount-1].encodedLen;
+}
+
+int opusgroups_decode (const uint8_t *inData, int inDataLen, float *samples) {
+  if (inData != NULL && inDataLen != groups[groupCount-1].encodedStart + groups[groupCount-1].encodedLen) return -1;
+  jobDataIn = inData;
+  jobSamplesOut = samples;
+  if (runAllGroups() > 0) return -2;
+  return frameSize;
+}
+
+void opusgroups_deinit (void) {
+  if (groups == NULL) return;
+
+  threadsRunning = false;
+  for (int i = 1; i <= workerCount; i++) {
+    xwait_notify(&groups[i].startWaitHandle);
+    pthread_join(groups[i].thread, NULL);
+    xwait_destroy(&groups[i].startWaitHandle);
+  }
+  xwait_destroy(&doneWaitHandle);
+
+  for (int i = 0; i < groupCount; i++) {
+    if (groups[i].encoder != NULL) opus_multistream_encoder_destroy(groups[i].encoder);
+    if (groups[i].decoder != NULL) opus_multistream_decoder_destroy(groups[i].decoder);
+    free(groups[i].sampleBuf);
+  }
+
+  free(groups);
+  groups = NULL;
+  groupCount = workerCount = 0;
+}
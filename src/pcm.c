@@ -5,19 +5,13 @@
 
 #include <string.h>
 #include "utils.h"
+#include "sampleconv.h"
 #include "pcm.h"
 
-int pcm_encode (pcm_codec_t *codec, const double *inSampleBuf, int sampleCount, uint8_t *outData) {
-  for (int i = 0; i < sampleCount; i++) {
-    double sampleDouble = inSampleBuf[i];
-    if (sampleDouble < -1.0) sampleDouble = -1.0;
-    else if (sampleDouble > 1.0) sampleDouble = 1.0;
-    // Convert double samples to 24-bit signed int
-    // http://blog.bjornroche.com/2009/12/int-float-int-its-jungle-out-there.html
-    // TODO: I don't think dithering is necessary here but I'm not 100% sure. I need to measure the waveform to check.
-    int32_t sampleInt = sampleDouble > 0.0 ? 8388607.0 * sampleDouble : 8388608.0 * sampleDouble;
-    memcpy(&outData[3*i], &sampleInt, 3);
-  }
+int pcm_encode (pcm_codec_t *codec, const sample_t *inSampleBuf, int sampleCount, uint8_t *outData) {
+  // Convert samples to 24-bit signed int
+  // TODO: I don't think dithering is necessary here but I'm not 100% sure. I need to measure the waveform to check.
+  sampleconv_sampleToS24Packed(inSampleBuf, outData, sampleCount);
 
   codec->crc = utils_crc16(codec->crc, outData, 3 * sampleCount);
   utils_writeU16LE(&outData[3*sampleCount], codec->crc);
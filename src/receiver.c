@@ -6,29 +6,51 @@
 #include "xwait.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include "opus/opus_multistream.h"
+#include <pthread.h>
+#include <unistd.h>
+#include "ck/ck_ring.h"
 #include "globals.h"
 #include "demux.h"
 #include "syncer.h"
 #include "audio.h"
 #include "utils.h"
 #include "pcm.h"
+#include "lossless.h"
+#include "opus-groups.h"
+#include "reorder-buffer.h"
 #include "endpoint.h"
 #include "config.h"
 #include "receiver.h"
 
-static OpusMSDecoder *decoder = NULL;
 static pcm_codec_t pcmDecoder = { 0 };
-static ck_ring_t decodeRing;
-static ck_ring_buffer_t *decodeRingBuf;
+static audioring_t decodeRing;
 static xwait_t configWaitHandle;
 static uint8_t *receivedConfigData = NULL;
 static int receivedConfigDataLen = 0;
 
 static unsigned int audioEncoding;
 static int networkChannelCount;
-static int encodedPacketSize, audioFrameSize, decodeRingMaxSize;
+static int encodedPacketSize, audioFrameSize, decodeRingMaxSize, maxConcealedFrames;
 static float *sampleBufFloat;
+static uint8_t *sampleBufS24; // For lossless, and silence for PCM
+static int initUTime;
+
+// Encoded audio packets are passed from the demux decode thread (FEC) to our own decode thread (codec and
+// resampling) so that the two overlap on different cores. Packet buffers go around in a loop:
+// freePacketRing -> onDataAudioChannel -> packetRing -> startDecodeThread -> freePacketRing
+#define PACKET_QUEUE_LEN 32
+
+typedef struct {
+  int len;
+  uint8_t *data;
+} packet_t;
+
+static packet_t packets[PACKET_QUEUE_LEN];
+static ck_ring_t packetRing, freePacketRing;
+static ck_ring_buffer_t *packetRingBuf = NULL, *freePacketRingBuf = NULL;
+static xwait_t decodeWaitHandle;
+static pthread_t decodeThread;
+static atomic_bool decodeThreadRunning = false;
 
 void onDataConfigChannel (const uint8_t *data, int dataLen) {
   // here we are in the realtime decode thread created by demux_addChannel, one thread per channel
@@ -43,29 +65,47 @@ void onDataConfigChannel (const uint8_t *data, int dataLen) {
   xwait_notify(&configWaitHandle);
 }
 
-void onDataAudioChannel (const uint8_t *buf, int len) {
-  // static is OK here because onDataAudioChannel is only called from a single thread
+static void decodeAudioFrame (int seq, const uint8_t *buf, int len) {
+  // static is OK here because the reorder buffer is only pushed to from a single thread
   static bool overrun = false;
+  static bool gotFirstAudio = false;
+  static int concealedRun = 0;
 
-  if (len != encodedPacketSize) return;
-
-  int seq = utils_readU16LE(buf);
-  buf += 2;
-  len -= 2;
-
-  // update receiver sync
-  syncer_onPacket(seq, audioFrameSize);
-
-  int ringCurrentSize = utils_ringSize(&decodeRing);
-  const uint8_t *pcmSamples;
+  int ringCurrentSize = audioring_size(&decodeRing);
+  const uint8_t *pcmSamples = sampleBufS24;
   int result;
 
+  if (buf != NULL) {
+    // update receiver sync
+    syncer_onPacket(seq, audioFrameSize);
+  }
+
   if (audioEncoding == AUDIO_ENCODING_OPUS) {
-    result = opus_multistream_decode_float(decoder, buf, len, sampleBufFloat, audioFrameSize, 0);
-    if (result != audioFrameSize) {
-      globals_add1ui(statsCh1AudioOpus, codecErrorCount, 1);
+    if (buf == NULL && concealedRun >= maxConcealedFrames) {
+      memset(sampleBufFloat, 0, sizeof(float) * networkChannelCount * audioFrameSize);
+    } else {
+      // With buf NULL the decoder conceals the lost packet, the decoder must see it before the next packet.
+      result = opusgroups_decode(buf, len, sampleBufFloat);
+      if (result != audioFrameSize) {
+        globals_add1ui(statsCh1AudioOpus, codecErrorCount, 1);
+        return;
+      }
+      if (buf == NULL) {
+        concealedRun++;
+        globals_add1ui(statsCh1AudioOpus, concealedFrameCount, 1);
+      } else {
+        concealedRun = 0;
+      }
+    }
+  } else if (buf == NULL) { // audioEncoding == AUDIO_ENCODING_PCM or AUDIO_ENCODING_LOSSLESS
+    memset(sampleBufS24, 0, 3 * networkChannelCount * audioFrameSize);
+  } else if (audioEncoding == AUDIO_ENCODING_LOSSLESS) {
+    result = lossless_decode(buf, len, networkChannelCount, audioFrameSize, sampleBufS24);
+    if (result != networkChannelCount * audioFrameSize) {
+      if (result == -3) globals_add1ui(statsCh1AudioLossless, crcFailCount, 1);
       return;
     }
+    utils_setLosslessStats(len, networkChannelCount * audioFrameSize);
   } else { // audioEncoding == AUDIO_ENCODING_PCM
     result = pcm_decode(&pcmDecoder, buf, len, &pcmSamples);
     if (result != networkChannelCount * audioFrameSize) {
@@ -85,14 +125,100 @@ void onDataAudioChannel (const uint8_t *buf, int len) {
 
   if (audioEncoding == AUDIO_ENCODING_OPUS) {
     result = syncer_enqueueBufF32(sampleBufFloat, audioFrameSize, networkChannelCount, false);
-  } else { // audioEncoding == AUDIO_ENCODING_PCM
+  } else { // audioEncoding == AUDIO_ENCODING_PCM or AUDIO_ENCODING_LOSSLESS
     result = syncer_enqueueBufS24Packed(pcmSamples, audioFrameSize, networkChannelCount, false);
   }
 
   if (result == -1) {
     globals_add1ui(statsCh1Audio, bufferOverrunCount, 1);
     overrun = true;
+  } else if (!gotFirstAudio) {
+    gotFirstAudio = true;
+    // DEBUG: log
+    printf("Receiver: first audio %d ms after start\n", utils_getElapsedUTime(initUTime) / 1000);
+  }
+}
+
+// Called by the reorder buffer in sequence order. buf is NULL for a lost packet.
+static void onAudioFrame (int seq, const uint8_t *buf, int len) {
+  int startUTime = utils_getCurrentUTime();
+  decodeAudioFrame(seq, buf, len);
+  globals_set1i(statsCh1Audio, decodeStageTime, utils_getElapsedUTime(startUTime));
+}
+
+static void *startDecodeThread (UNUSED void *arg) {
+  utils_setCallerThreadRealtime(98, utils_checkCore(AUDIO_DECODE_THREAD_CORE));
+
+  while (atomic_load(&decodeThreadRunning)) {
+    xwait_wait(&decodeWaitHandle);
+
+    packet_t *packet;
+    while (ck_ring_dequeue_spsc(&packetRing, packetRingBuf, (void*)&packet)) {
+      reorderbuffer_push(utils_readU16LE(packet->data), &packet->data[2], packet->len - 2);
+      ck_ring_enqueue_spsc(&freePacketRing, freePacketRingBuf, packet);
+    }
   }
+
+  return NULL;
+}
+
+static int initPacketQueue (void) {
+  // ck rings hold one less than their size
+  packetRingBuf = (ck_ring_buffer_t *)calloc(2 * PACKET_QUEUE_LEN, sizeof(ck_ring_buffer_t));
+  freePacketRingBuf = (ck_ring_buffer_t *)calloc(2 * PACKET_QUEUE_LEN, sizeof(ck_ring_buffer_t));
+  if (packetRingBuf == NULL || freePacketRingBuf == NULL) return -1;
+  ck_ring_init(&packetRing, 2 * PACKET_QUEUE_LEN);
+  ck_ring_init(&freePacketRing, 2 * PACKET_QUEUE_LEN);
+
+  for (int i = 0; i < PACKET_QUEUE_LEN; i++) {
+    packets[i].data = (uint8_t *)malloc(encodedPacketSize);
+    if (packets[i].data == NULL) return -2;
+    ck_ring_enqueue_spsc(&freePacketRing, freePacketRingBuf, &packets[i]);
+  }
+
+  xwait_init(&decodeWaitHandle);
+  atomic_store(&decodeThreadRunning, true);
+  if (pthread_create(&decodeThread, NULL, startDecodeThread, NULL) != 0) {
+    atomic_store(&decodeThreadRunning, false);
+    return -3;
+  }
+
+  return 0;
+}
+
+static void deinitPacketQueue (void) {
+  if (atomic_load(&decodeThreadRunning)) {
+    atomic_store(&decodeThreadRunning, false);
+    xwait_notify(&decodeWaitHandle);
+    pthread_join(decodeThread, NULL);
+    xwait_destroy(&decodeWaitHandle);
+  }
+
+  for (int i = 0; i < PACKET_QUEUE_LEN; i++) free(packets[i].data);
+  free(packetRingBuf);
+  free(freePacketRingBuf);
+}
+
+void onDataAudioChannel (const uint8_t *buf, int len) {
+  // here we are in the realtime decode thread created by demux_addChannel
+
+  // Lossless packets are variable length, encodedPacketSize is the maximum and the minimum is
+  // seq + one header byte per channel + CRC
+  if (audioEncoding == AUDIO_ENCODING_LOSSLESS) {
+    if (len < 2 + networkChannelCount + 2 || len > encodedPacketSize) return;
+  } else if (len != encodedPacketSize) return;
+
+  packet_t *packet;
+  if (!ck_ring_dequeue_spsc(&freePacketRing, freePacketRingBuf, (void*)&packet)) {
+    // The decode thread is not keeping up
+    globals_add1ui(statsCh1Audio, decodeQueueOverrunCount, 1);
+    return;
+  }
+
+  memcpy(packet->data, buf, len);
+  packet->len = len;
+  ck_ring_enqueue_spsc(&packetRing, packetRingBuf, packet);
+  xwait_notify(&decodeWaitHandle);
 }
 
 int receiver_waitForConfig (void) {
@@ -108,16 +234,15 @@ int receiver_waitForConfig (void) {
   networkChannelCount = globals_get1i(audio, networkChannelCount);
   audioEncoding = globals_get1ui(audio, encoding);
 
-  unsigned char mapping[networkChannelCount]; // only for opus but can't put this inside switch case
   switch (audioEncoding) {
     case AUDIO_ENCODING_OPUS:
       audioFrameSize = globals_get1i(opus, frameSize);
       // CBR + 2 bytes for sequence number
       encodedPacketSize = globals_get1i(opus, bitrate) * globals_get1i(opus, frameSize) / (8 * AUDIO_OPUS_SAMPLE_RATE) + 2;
 
-      for (int i = 0; i < networkChannelCount; i++) mapping[i] = i;
-      decoder = opus_multistream_decoder_create(AUDIO_OPUS_SAMPLE_RATE, networkChannelCount, networkChannelCount, 0, mapping, &err);
+      err = opusgroups_init(false, encodedPacketSize - 2, AUDIO_DECODE_THREAD_CORE);
       if (err < 0) return -2;
+      maxConcealedFrames = globals_get1i(opus, maxConcealedFrames);
       break;
 
     case AUDIO_ENCODING_PCM:
@@ -126,26 +251,39 @@ int receiver_waitForConfig (void) {
       encodedPacketSize = 3 * networkChannelCount * audioFrameSize + 4;
       break;
 
+    case AUDIO_ENCODING_LOSSLESS:
+      audioFrameSize = globals_get1i(lossless, frameSize);
+      // Worst case + 2 bytes for sequence number
+      encodedPacketSize = lossless_maxEncodedLen(networkChannelCount, audioFrameSize) + 2;
+      break;
+
     default:
       printf("Error: Audio encoding %d not implemented.\n", audioEncoding);
       return -3;
   }
 
   int decodeRingLength = globals_get1i(audio, decodeRingLength);
-  decodeRingMaxSize = networkChannelCount * decodeRingLength;
+  decodeRingMaxSize = decodeRingLength;
   globals_set1i(statsCh1Audio, streamBufferSize, decodeRingLength);
 
   sampleBufFloat = (float *)malloc(4 * networkChannelCount * audioFrameSize);
-  if (sampleBufFloat == NULL) return -4;
+  sampleBufS24 = (uint8_t *)malloc(3 * networkChannelCount * audioFrameSize);
+  if (sampleBufFloat == NULL || sampleBufS24 == NULL) return -4;
 
-  if (utils_ringInit(&decodeRing, &decodeRingBuf, decodeRingMaxSize) < 0) return -5;
+  if (audioring_init(&decodeRing, networkChannelCount, decodeRingMaxSize) < 0) return -5;
+  // Filling a gap pushes all of its frames at once, so a gap longer than the ring would overrun it. Don't fill those.
+  double deviceSampleRate;
+  globals_get1ff(audio, deviceSampleRate, &deviceSampleRate);
+  int maxFilledGap = decodeRingMaxSize * globals_get1i(audio, networkSampleRate) / deviceSampleRate / audioFrameSize;
+  if (reorderbuffer_init(globals_get1i(audio, reorderWindow), maxFilledGap, encodedPacketSize - 2, onAudioFrame) < 0) return -6;
+  if (initPacketQueue() < 0) return -7;
 
   err = audio_init(true);
-  if (err < 0) return err - 5;
+  if (err < 0) return err - 7;
 
   // start audio before demux_addChannel so that we don't call syncer_enqueueBuf before
   // audio module has called syncer_init
-  err = audio_start(&decodeRing, decodeRingBuf, decodeRingMaxSize);
+  err = audio_start(&decodeRing, NULL);
   if (err < 0) return err - 100;
 
   err = demux_addChannel(
@@ -156,11 +294,14 @@ int receiver_waitForConfig (void) {
     onDataAudioChannel
   );
   if (err < 0) return -200;
+  // Lossless packets are sent one per block (mux_flush)
+  if (audioEncoding == AUDIO_ENCODING_LOSSLESS && demux_setFlushedChannel(err) < 0) return -201;
 
   return 0;
 }
 
 int receiver_init (void) {
+  initUTime = utils_getCurrentUTime();
   xwait_init(&configWaitHandle);
 
   int err = demux_addChannel(
@@ -192,6 +333,11 @@ int receiver_init (void) {
 int receiver_deinit (void) {
   xwait_destroy(&configWaitHandle);
   demux_deinit();
+  deinitPacketQueue();
+  opusgroups_deinit();
+  reorderbuffer_deinit();
   if (receivedConfigData != NULL) free(receivedConfigData);
-  return audio_deinit();
+  int err = audio_deinit();
+  audioring_deinit(&decodeRing);
+  return err;
 }
@@ -0,0 +1,120 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "globals.h"
+#include "reorder-buffer.h"
+
+// A packet this far behind is taken as the sender having restarted rather than being late, we start again from it.
+#define RESYNC_SEQ_DIFF 1024
+
+typedef struct {
+  bool filled;
+  int dataLen;
+  uint8_t *data;
+} slot_t;
+
+static slot_t *slots = NULL;
+static int slotCount = 0; // power of two, larger than window
+static int _window, _maxDataLen, _maxFilledGap;
+static reorderbuffer_onRelease_t _onRelease;
+static int nextSeq = -1, highestSeq = -1;
+
+// seq - base in the range -32768 to 32767
+static inline int getSeqDiff (int seq, int base) {
+  int diff = (seq - base) & 0xffff;
+  return diff >= 32768 ? diff - 65536 : diff;
+}
+
+static inline slot_t *getSlot (int seq) {
+  return &slots[seq & (slotCount - 1)];
+}
+
+// Release nextSeq then move on to the next one
+static void releaseNext (bool fillHole) {
+  slot_t *slot = getSlot(nextSeq);
+  if (slot->filled) {
+    _onRelease(nextSeq, slot->data, slot->dataLen);
+    slot->filled = false;
+  } else if (fillHole) {
+    _onRelease(nextSeq, NULL, 0);
+    globals_add1ui(statsCh1Audio, filledFrameCount, 1);
+  }
+  nextSeq = (nextSeq + 1) & 0xffff;
+}
+
+int reorderbuffer_init (int window, int maxFilledGap, int maxDataLen, reorderbuffer_onRelease_t onRelease) {
+  if (window < 0 || window > MAX_REORDER_WINDOW || maxFilledGap < 0) return -1;
+
+  _window = window;
+  _maxFilledGap = maxFilledGap;
+  _maxDataLen = maxDataLen;
+  _onRelease = onRelease;
+  nextSeq = -1;
+  highestSeq = -1;
+
+  slotCount = 1;
+  while (slotCount <= window) slotCount *= 2;
+
+  slots = (slot_t *)calloc(slotCount, sizeof(slot_t));
+  if (slots == NULL) return -2;
+  for (int i = 0; i < slotCount; i++) {
+    slots[i].data = (uint8_t *)malloc(maxDataLen);
+    if (slots[i].data == NULL) return -3;
+  }
+
+  return 0;
+}
+
+void reorderbuffer_push (int seq, const uint8_t *data, int dataLen) {
+  if (dataLen > _maxDataLen) return;
+
+  if (nextSeq < 0) {
+    nextSeq = seq;
+    highestSeq = seq;
+  }
+
+  int seqDiff = getSeqDiff(seq, nextSeq);
+  if (seqDiff > _window + _maxFilledGap || seqDiff < -RESYNC_SEQ_DIFF) {
+    // Flush what we have in order without filling the holes, then start again from seq.
+    for (int i = 0; i < slotCount; i++) releaseNext(false);
+    nextSeq = seq;
+    highestSeq = seq;
+    seqDiff = 0;
+  }
+
+  if (seqDiff < 0) {
+    // Already released or filled
+    globals_add1ui(statsCh1Audio, lateFrameCount, 1);
+    return;
+  }
+
+  if (getSeqDiff(seq, highestSeq) < 0) {
+    globals_add1ui(statsCh1Audio, reorderedFrameCount, 1);
+  } else {
+    highestSeq = seq;
+  }
+
+  // The deadline has passed for everything more than window older than seq. This also makes sure that seq's
+  // slot is free.
+  while (getSeqDiff(seq, nextSeq) > _window) releaseNext(true);
+
+  slot_t *slot = getSlot(seq);
+  if (slot->filled) return; // duplicate
+  slot->filled = true;
+  slot->dataLen = dataLen;
+  memcpy(slot->data, data, dataLen);
+
+  while (getSlot(nextSeq)->filled) releaseNext(true);
+}
+
+void reorderbuffer_deinit (void) {
+  if (slots == NULL) return;
+  for (int i = 0; i < slotCount; i++) free(slots[i].data);
+  free(slots);
+  slots = NULL;
+}
@@ -0,0 +1,845 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "globals.h"
+#include "resampler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLER_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define RESAMPLER_NEON
+#include <arm_neon.h>
+#endif
+
+#define PI 3.14159265358979323846
+// Cubic interpolation between phases needs one extra phase on each side
+#define BANK_PHASE_COUNT (RESAMPLER_PHASE_COUNT + 3)
+#define BANK_CACHE_LEN 8
+// The filter bandwidth is rounded to this many steps per cycle, so that small changes in the rates (like a drifting
+// device clock) reuse the same bank
+#define BANDWIDTH_STEPS 100000.0
+#define MIN_PHASE_OVERSAMPLE 16 // samples per input frame for the minimum phase cepstrum, see designMinPhase
+#define MIN_PHASE_INTERP_HALF_WIDTH 8 // in samples at MIN_PHASE_OVERSAMPLE
+
+// kernel: the interpolated filter, the sum of weights[j] * phases[tapCount * j + i] for j in [0, 4)
+typedef void (*interpolateKernel_t)(const sample_t *phases, const sample_t *weights, sample_t *kernel, int tapCount);
+// outFrame[ch] = sum of kernel[i] * history[stride * i + ch] for i in [0, tapCount)
+typedef void (*filterKernel_t)(const sample_t *history, const sample_t *kernel, int tapCount, int stride, sample_t *outFrame, int channelCount);
+
+/////////////////////
+// scalar kernels
+/////////////////////
+
+static void interpolateScalar (const sample_t *phases, const sample_t *weights, sample_t *kernel, int tapCount) {
+  for (int i = 0; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+static void filterScalar (const sample_t *history, const sample_t *kernel, int tapCount, int stride, sample_t *outFrame, int channelCount) {
+  sample_t acc[MAX_AUDIO_CHANNELS] = { 0.0 };
+  for (int i = 0; i < tapCount; i++) {
+    const sample_t *frame = &history[stride * i];
+    for (int ch = 0; ch < channelCount; ch++) acc[ch] += kernel[i] * frame[ch];
+  }
+  memcpy(outFrame, acc, sizeof(sample_t) * channelCount);
+}
+
+/////////////////////
+// x86 kernels
+/////////////////////
+
+#ifdef RESAMPLER_X86
+
+#define AVX2 __attribute__((target("avx2,fma")))
+#define SSE2 __attribute__((target("sse2")))
+
+#ifndef W_SAMPLE_F32
+
+// Store the channels of acc that are below channelCount
+AVX2 static inline void storeFrameAvx2 (double *outFrame, int ch, int channelCount, __m256d acc) {
+  if (ch + 4 <= channelCount) {
+    _mm256_storeu_pd(&outFrame[ch], acc);
+    return;
+  }
+  double tail[4];
+  _mm256_storeu_pd(tail, acc);
+  for (int j = 0; ch + j < channelCount; j++) outFrame[ch + j] = tail[j];
+}
+
+AVX2 static void interpolateAvx2 (const double *phases, const double *weights, double *kernel, int tapCount) {
+  const __m256d w0 = _mm256_set1_pd(weights[0]), w1 = _mm256_set1_pd(weights[1]);
+  const __m256d w2 = _mm256_set1_pd(weights[2]), w3 = _mm256_set1_pd(weights[3]);
+  int i = 0;
+  for (; i + 4 <= tapCount; i += 4) {
+    __m256d k = _mm256_mul_pd(w0, _mm256_loadu_pd(&phases[i]));
+    k = _mm256_fmadd_pd(w1, _mm256_loadu_pd(&phases[tapCount + i]), k);
+    k = _mm256_fmadd_pd(w2, _mm256_loadu_pd(&phases[2 * tapCount + i]), k);
+    k = _mm256_fmadd_pd(w3, _mm256_loadu_pd(&phases[3 * tapCount + i]), k);
+    _mm256_storeu_pd(&kernel[i], k);
+  }
+  for (; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+AVX2 static void filterAvx2 (const double *history, const double *kernel, int tapCount, int stride, double *outFrame, int channelCount) {
+  int ch = 0;
+  // 16 channels at a time so each tap reads two whole cache lines of history
+  for (; ch + 16 <= stride; ch += 16) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd(), acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+    for (int i = 0; i < tapCount; i++) {
+      const double *frame = &history[stride * i + ch];
+      __m256d k = _mm256_broadcast_sd(&kernel[i]);
+      acc0 = _mm256_fmadd_pd(k, _mm256_loadu_pd(&frame[0]), acc0);
+      acc1 = _mm256_fmadd_pd(k, _mm256_loadu_pd(&frame[4]), acc1);
+      acc2 = _mm256_fmadd_pd(k, _mm256_loadu_pd(&frame[8]), acc2);
+      acc3 = _mm256_fmadd_pd(k, _mm256_loadu_pd(&frame[12]), acc3);
+    }
+    storeFrameAvx2(outFrame, ch, channelCount, acc0);
+    storeFrameAvx2(outFrame, ch + 4, channelCount, acc1);
+    storeFrameAvx2(outFrame, ch + 8, channelCount, acc2);
+    storeFrameAvx2(outFrame, ch + 12, channelCount, acc3);
+  }
+  for (; ch < stride; ch += 4) {
+    // Two accumulators to hide the FMA latency
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= tapCount; i += 2) {
+      acc0 = _mm256_fmadd_pd(_mm256_broadcast_sd(&kernel[i]), _mm256_loadu_pd(&history[stride * i + ch]), acc0);
+      acc1 = _mm256_fmadd_pd(_mm256_broadcast_sd(&kernel[i + 1]), _mm256_loadu_pd(&history[stride * (i + 1) + ch]), acc1);
+    }
+    if (i < tapCount) acc0 = _mm256_fmadd_pd(_mm256_broadcast_sd(&kernel[i]), _mm256_loadu_pd(&history[stride * i + ch]), acc0);
+    storeFrameAvx2(outFrame, ch, channelCount, _mm256_add_pd(acc0, acc1));
+  }
+}
+
+SSE2 static inline void storeFrameSse2 (double *outFrame, int ch, int channelCount, __m128d acc) {
+  if (ch + 2 <= channelCount) {
+    _mm_storeu_pd(&outFrame[ch], acc);
+  } else {
+    _mm_store_sd(&outFrame[ch], acc);
+  }
+}
+
+SSE2 static void interpolateSse2 (const double *phases, const double *weights, double *kernel, int tapCount) {
+  const __m128d w0 = _mm_set1_pd(weights[0]), w1 = _mm_set1_pd(weights[1]);
+  const __m128d w2 = _mm_set1_pd(weights[2]), w3 = _mm_set1_pd(weights[3]);
+  int i = 0;
+  for (; i + 2 <= tapCount; i += 2) {
+    __m128d k = _mm_mul_pd(w0, _mm_loadu_pd(&phases[i]));
+    k = _mm_add_pd(k, _mm_mul_pd(w1, _mm_loadu_pd(&phases[tapCount + i])));
+    k = _mm_add_pd(k, _mm_mul_pd(w2, _mm_loadu_pd(&phases[2 * tapCount + i])));
+    k = _mm_add_pd(k, _mm_mul_pd(w3, _mm_loadu_pd(&phases[3 * tapCount + i])));
+    _mm_storeu_pd(&kernel[i], k);
+  }
+  for (; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+SSE2 static void filterSse2 (const double *history, const double *kernel, int tapCount, int stride, double *outFrame, int channelCount) {
+  int ch = 0;
+  for (; ch + 8 <= stride; ch += 8) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd(), acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd();
+    for (int i = 0; i < tapCount; i++) {
+      const double *frame = &history[stride * i + ch];
+      __m128d k = _mm_set1_pd(kernel[i]);
+      acc0 = _mm_add_pd(acc0, _mm_mul_pd(k, _mm_loadu_pd(&frame[0])));
+      acc1 = _mm_add_pd(acc1, _mm_mul_pd(k, _mm_loadu_pd(&frame[2])));
+      acc2 = _mm_add_pd(acc2, _mm_mul_pd(k, _mm_loadu_pd(&frame[4])));
+      acc3 = _mm_add_pd(acc3, _mm_mul_pd(k, _mm_loadu_pd(&frame[6])));
+    }
+    storeFrameSse2(outFrame, ch, channelCount, acc0);
+    storeFrameSse2(outFrame, ch + 2, channelCount, acc1);
+    storeFrameSse2(outFrame, ch + 4, channelCount, acc2);
+    storeFrameSse2(outFrame, ch + 6, channelCount, acc3);
+  }
+  for (; ch < stride; ch += 2) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= tapCount; i += 2) {
+      acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_set1_pd(kernel[i]), _mm_loadu_pd(&history[stride * i + ch])));
+      acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_set1_pd(kernel[i + 1]), _mm_loadu_pd(&history[stride * (i + 1) + ch])));
+    }
+    if (i < tapCount) acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_set1_pd(kernel[i]), _mm_loadu_pd(&history[stride * i + ch])));
+    storeFrameSse2(outFrame, ch, channelCount, _mm_add_pd(acc0, acc1));
+  }
+}
+
+#else
+
+// Store the channels of acc that are below channelCount
+AVX2 static inline void storeFrameAvx2 (float *outFrame, int ch, int channelCount, __m256 acc) {
+  if (ch + 8 <= channelCount) {
+    _mm256_storeu_ps(&outFrame[ch], acc);
+    return;
+  }
+  float tail[8];
+  _mm256_storeu_ps(tail, acc);
+  for (int j = 0; ch + j < channelCount; j++) outFrame[ch + j] = tail[j];
+}
+
+AVX2 static void interpolateAvx2 (const float *phases, const float *weights, float *kernel, int tapCount) {
+  const __m256 w0 = _mm256_set1_ps(weights[0]), w1 = _mm256_set1_ps(weights[1]);
+  const __m256 w2 = _mm256_set1_ps(weights[2]), w3 = _mm256_set1_ps(weights[3]);
+  int i = 0;
+  for (; i + 8 <= tapCount; i += 8) {
+    __m256 k = _mm256_mul_ps(w0, _mm256_loadu_ps(&phases[i]));
+    k = _mm256_fmadd_ps(w1, _mm256_loadu_ps(&phases[tapCount + i]), k);
+    k = _mm256_fmadd_ps(w2, _mm256_loadu_ps(&phases[2 * tapCount + i]), k);
+    k = _mm256_fmadd_ps(w3, _mm256_loadu_ps(&phases[3 * tapCount + i]), k);
+    _mm256_storeu_ps(&kernel[i], k);
+  }
+  for (; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+AVX2 static void filterAvx2 (const float *history, const float *kernel, int tapCount, int stride, float *outFrame, int channelCount) {
+  int ch = 0;
+  // 32 channels at a time so each tap reads two whole cache lines of history
+  for (; ch + 32 <= stride; ch += 32) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    for (int i = 0; i < tapCount; i++) {
+      const float *frame = &history[stride * i + ch];
+      __m256 k = _mm256_broadcast_ss(&kernel[i]);
+      acc0 = _mm256_fmadd_ps(k, _mm256_loadu_ps(&frame[0]), acc0);
+      acc1 = _mm256_fmadd_ps(k, _mm256_loadu_ps(&frame[8]), acc1);
+      acc2 = _mm256_fmadd_ps(k, _mm256_loadu_ps(&frame[16]), acc2);
+      acc3 = _mm256_fmadd_ps(k, _mm256_loadu_ps(&frame[24]), acc3);
+    }
+    storeFrameAvx2(outFrame, ch, channelCount, acc0);
+    storeFrameAvx2(outFrame, ch + 8, channelCount, acc1);
+    storeFrameAvx2(outFrame, ch + 16, channelCount, acc2);
+    storeFrameAvx2(outFrame, ch + 24, channelCount, acc3);
+  }
+  for (; ch < stride; ch += 8) {
+    // Two accumulators to hide the FMA latency
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 2 <= tapCount; i += 2) {
+      acc0 = _mm256_fmadd_ps(_mm256_broadcast_ss(&kernel[i]), _mm256_loadu_ps(&history[stride * i + ch]), acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_broadcast_ss(&kernel[i + 1]), _mm256_loadu_ps(&history[stride * (i + 1) + ch]), acc1);
+    }
+    if (i < tapCount) acc0 = _mm256_fmadd_ps(_mm256_broadcast_ss(&kernel[i]), _mm256_loadu_ps(&history[stride * i + ch]), acc0);
+    storeFrameAvx2(outFrame, ch, channelCount, _mm256_add_ps(acc0, acc1));
+  }
+}
+
+SSE2 static inline void storeFrameSse2 (float *outFrame, int ch, int channelCount, __m128 acc) {
+  if (ch + 4 <= channelCount) {
+    _mm_storeu_ps(&outFrame[ch], acc);
+    return;
+  }
+  float tail[4];
+  _mm_storeu_ps(tail, acc);
+  for (int j = 0; ch + j < channelCount; j++) outFrame[ch + j] = tail[j];
+}
+
+SSE2 static void interpolateSse2 (const float *phases, const float *weights, float *kernel, int tapCount) {
+  const __m128 w0 = _mm_set1_ps(weights[0]), w1 = _mm_set1_ps(weights[1]);
+  const __m128 w2 = _mm_set1_ps(weights[2]), w3 = _mm_set1_ps(weights[3]);
+  int i = 0;
+  for (; i + 4 <= tapCount; i += 4) {
+    __m128 k = _mm_mul_ps(w0, _mm_loadu_ps(&phases[i]));
+    k = _mm_add_ps(k, _mm_mul_ps(w1, _mm_loadu_ps(&phases[tapCount + i])));
+    k = _mm_add_ps(k, _mm_mul_ps(w2, _mm_loadu_ps(&phases[2 * tapCount + i])));
+    k = _mm_add_ps(k, _mm_mul_ps(w3, _mm_loadu_ps(&phases[3 * tapCount + i])));
+    _mm_storeu_ps(&kernel[i], k);
+  }
+  for (; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+SSE2 static void filterSse2 (const float *history, const float *kernel, int tapCount, int stride, float *outFrame, int channelCount) {
+  int ch = 0;
+  for (; ch + 16 <= stride; ch += 16) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    for (int i = 0; i < tapCount; i++) {
+      const float *frame = &history[stride * i + ch];
+      __m128 k = _mm_set1_ps(kernel[i]);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(k, _mm_loadu_ps(&frame[0])));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(k, _mm_loadu_ps(&frame[4])));
+      acc2 = _mm_add_ps(acc2, _mm_mul_ps(k, _mm_loadu_ps(&frame[8])));
+      acc3 = _mm_add_ps(acc3, _mm_mul_ps(k, _mm_loadu_ps(&frame[12])));
+    }
+    storeFrameSse2(outFrame, ch, channelCount, acc0);
+    storeFrameSse2(outFrame, ch + 4, channelCount, acc1);
+    storeFrameSse2(outFrame, ch + 8, channelCount, acc2);
+    storeFrameSse2(outFrame, ch + 12, channelCount, acc3);
+  }
+  for (; ch < stride; ch += 4) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 2 <= tapCount; i += 2) {
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_set1_ps(kernel[i]), _mm_loadu_ps(&history[stride * i + ch])));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_set1_ps(kernel[i + 1]), _mm_loadu_ps(&history[stride * (i + 1) + ch])));
+    }
+    if (i < tapCount) acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_set1_ps(kernel[i]), _mm_loadu_ps(&history[stride * i + ch])));
+    storeFrameSse2(outFrame, ch, channelCount, _mm_add_ps(acc0, acc1));
+  }
+}
+
+
+#endif
+
+#endif
+
+/////////////////////
+// NEON kernels
+/////////////////////
+
+#ifdef RESAMPLER_NEON
+
+#ifndef W_SAMPLE_F32
+
+static inline void storeFrameNeon (double *outFrame, int ch, int channelCount, float64x2_t acc) {
+  if (ch + 2 <= channelCount) {
+    vst1q_f64(&outFrame[ch], acc);
+  } else {
+    vst1q_lane_f64(&outFrame[ch], acc, 0);
+  }
+}
+
+static void interpolateNeon (const double *phases, const double *weights, double *kernel, int tapCount) {
+  int i = 0;
+  for (; i + 2 <= tapCount; i += 2) {
+    float64x2_t k = vmulq_n_f64(vld1q_f64(&phases[i]), weights[0]);
+    k = vfmaq_n_f64(k, vld1q_f64(&phases[tapCount + i]), weights[1]);
+    k = vfmaq_n_f64(k, vld1q_f64(&phases[2 * tapCount + i]), weights[2]);
+    k = vfmaq_n_f64(k, vld1q_f64(&phases[3 * tapCount + i]), weights[3]);
+    vst1q_f64(&kernel[i], k);
+  }
+  for (; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+static void filterNeon (const double *history, const double *kernel, int tapCount, int stride, double *outFrame, int channelCount) {
+  int ch = 0;
+  for (; ch + 8 <= stride; ch += 8) {
+    float64x2_t acc0 = vdupq_n_f64(0.0), acc1 = vdupq_n_f64(0.0), acc2 = vdupq_n_f64(0.0), acc3 = vdupq_n_f64(0.0);
+    for (int i = 0; i < tapCount; i++) {
+      const double *frame = &history[stride * i + ch];
+      float64x2_t k = vdupq_n_f64(kernel[i]);
+      acc0 = vfmaq_f64(acc0, k, vld1q_f64(&frame[0]));
+      acc1 = vfmaq_f64(acc1, k, vld1q_f64(&frame[2]));
+      acc2 = vfmaq_f64(acc2, k, vld1q_f64(&frame[4]));
+      acc3 = vfmaq_f64(acc3, k, vld1q_f64(&frame[6]));
+    }
+    storeFrameNeon(outFrame, ch, channelCount, acc0);
+    storeFrameNeon(outFrame, ch + 2, channelCount, acc1);
+    storeFrameNeon(outFrame, ch + 4, channelCount, acc2);
+    storeFrameNeon(outFrame, ch + 6, channelCount, acc3);
+  }
+  for (; ch < stride; ch += 2) {
+    float64x2_t acc0 = vdupq_n_f64(0.0), acc1 = vdupq_n_f64(0.0);
+    int i = 0;
+    for (; i + 2 <= tapCount; i += 2) {
+      acc0 = vfmaq_f64(acc0, vdupq_n_f64(kernel[i]), vld1q_f64(&history[stride * i + ch]));
+      acc1 = vfmaq_f64(acc1, vdupq_n_f64(kernel[i + 1]), vld1q_f64(&history[stride * (i + 1) + ch]));
+    }
+    if (i < tapCount) acc0 = vfmaq_f64(acc0, vdupq_n_f64(kernel[i]), vld1q_f64(&history[stride * i + ch]));
+    storeFrameNeon(outFrame, ch, channelCount, vaddq_f64(acc0, acc1));
+  }
+}
+
+#else
+
+static inline void storeFrameNeon (float *outFrame, int ch, int channelCount, float32x4_t acc) {
+  if (ch + 4 <= channelCount) {
+    vst1q_f32(&outFrame[ch], acc);
+    return;
+  }
+  float tail[4];
+  vst1q_f32(tail, acc);
+  for (int j = 0; ch + j < channelCount; j++) outFrame[ch + j] = tail[j];
+}
+
+static void interpolateNeon (const float *phases, const float *weights, float *kernel, int tapCount) {
+  int i = 0;
+  for (; i + 4 <= tapCount; i += 4) {
+    float32x4_t k = vmulq_n_f32(vld1q_f32(&phases[i]), weights[0]);
+    k = vfmaq_n_f32(k, vld1q_f32(&phases[tapCount + i]), weights[1]);
+    k = vfmaq_n_f32(k, vld1q_f32(&phases[2 * tapCount + i]), weights[2]);
+    k = vfmaq_n_f32(k, vld1q_f32(&phases[3 * tapCount + i]), weights[3]);
+    vst1q_f32(&kernel[i], k);
+  }
+  for (; i < tapCount; i++) {
+    kernel[i] = weights[0] * phases[i] + weights[1] * phases[tapCount + i] + weights[2] * phases[2 * tapCount + i] + weights[3] * phases[3 * tapCount + i];
+  }
+}
+
+static void filterNeon (const float *history, const float *kernel, int tapCount, int stride, float *outFrame, int channelCount) {
+  int ch = 0;
+  for (; ch + 16 <= stride; ch += 16) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f), acc2 = vdupq_n_f32(0.0f), acc3 = vdupq_n_f32(0.0f);
+    for (int i = 0; i < tapCount; i++) {
+      const float *frame = &history[stride * i + ch];
+      float32x4_t k = vdupq_n_f32(kernel[i]);
+      acc0 = vfmaq_f32(acc0, k, vld1q_f32(&frame[0]));
+      acc1 = vfmaq_f32(acc1, k, vld1q_f32(&frame[4]));
+      acc2 = vfmaq_f32(acc2, k, vld1q_f32(&frame[8]));
+      acc3 = vfmaq_f32(acc3, k, vld1q_f32(&frame[12]));
+    }
+    storeFrameNeon(outFrame, ch, channelCount, acc0);
+    storeFrameNeon(outFrame, ch + 4, channelCount, acc1);
+    storeFrameNeon(outFrame, ch + 8, channelCount, acc2);
+    storeFrameNeon(outFrame, ch + 12, channelCount, acc3);
+  }
+  for (; ch < stride; ch += 4) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 2 <= tapCount; i += 2) {
+      acc0 = vfmaq_f32(acc0, vdupq_n_f32(kernel[i]), vld1q_f32(&history[stride * i + ch]));
+      acc1 = vfmaq_f32(acc1, vdupq_n_f32(kernel[i + 1]), vld1q_f32(&history[stride * (i + 1) + ch]));
+    }
+    if (i < tapCount) acc0 = vfmaq_f32(acc0, vdupq_n_f32(kernel[i]), vld1q_f32(&history[stride * i + ch]));
+    storeFrameNeon(outFrame, ch, channelCount, vaddq_f32(acc0, acc1));
+  }
+}
+
+
+#endif
+
+#endif
+
+/////////////////////
+// dispatch
+/////////////////////
+
+static struct {
+  int vectorWidth; // history frames are padded to a multiple of this many samples
+  interpolateKernel_t interpolate;
+  filterKernel_t filter;
+} kernels = { 1, interpolateScalar, filterScalar };
+
+/////////////////////
+// filter design
+/////////////////////
+
+// Banks are shared by every resampler with the same design and kept after their last user is deinitialised, so a
+// resampler is only designed the first time its parameters are seen. Entries with refCount == 0 can be evicted.
+static struct {
+  double bandwidth, transitionBand; // key
+  bool minPhase; // key
+  int tapCount;
+  double latency;
+  sample_t *bank;
+  int refCount;
+} bankCache[BANK_CACHE_LEN] = { 0 };
+static pthread_mutex_t bankCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Modified Bessel function of the first kind, order 0
+static double besselI0 (double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 200; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < 1e-17 * sum) break;
+  }
+  return sum;
+}
+
+// In-place radix-2 complex FFT, n must be a power of two. The inverse is not scaled.
+// twiddleRe and twiddleIm hold cos and -sin of 2 * PI * k / n for k in [0, n / 2).
+static void fft (double *re, double *im, int n, const double *twiddleRe, const double *twiddleIm, bool inverse) {
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      double t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  for (int len = 2; len <= n; len <<= 1) {
+    int twiddleStep = n / len;
+    for (int i = 0; i < n; i += len) {
+      for (int j = 0; j < len / 2; j++) {
+        double wRe = twiddleRe[twiddleStep * j];
+        double wIm = inverse ? -twiddleIm[twiddleStep * j] : twiddleIm[twiddleStep * j];
+        int a = i + j, b = i + j + len / 2;
+        double bRe = re[b] * wRe - im[b] * wIm;
+        double bIm = re[b] * wIm + im[b] * wRe;
+        re[b] = re[a] - bRe;
+        im[b] = im[a] - bIm;
+        re[a] += bRe;
+        im[a] += bIm;
+      }
+    }
+  }
+}
+
+// Replace filter with the minimum phase filter that has the same magnitude response, using the real cepstrum
+// (homomorphic) method. The FFT is 8 times longer than the filter to keep cepstral aliasing below the stopband.
+// returns: 0 for success or -1 if out of memory
+static int makeMinPhase (double *filter, int len) {
+  int n = 1;
+  while (n < 8 * len) n <<= 1;
+
+  // One block for re, im and the two halves of the twiddles
+  double *re = (double *)calloc(3 * (size_t)n, sizeof(double));
+  if (re == NULL) return -1;
+  double *im = re + n;
+  double *twiddleRe = im + n;
+  double *twiddleIm = twiddleRe + n / 2;
+
+  for (int k = 0; k < n / 2; k++) {
+    twiddleRe[k] = cos(2.0 * PI * k / n);
+    twiddleIm[k] = -sin(2.0 * PI * k / n);
+  }
+
+  memcpy(re, filter, sizeof(double) * len);
+  fft(re, im, n, twiddleRe, twiddleIm, false);
+
+  // Log magnitude, with a floor well below the stopband so that the zeros don't go to -inf
+  double peak = 0.0;
+  for (int i = 0; i < n; i++) {
+    double mag = sqrt(re[i] * re[i] + im[i] * im[i]);
+    re[i] = mag;
+    if (mag > peak) peak = mag;
+  }
+  for (int i = 0; i < n; i++) {
+    re[i] = log(re[i] > 1e-12 * peak ? re[i] : 1e-12 * peak);
+    im[i] = 0.0;
+  }
+
+  // Real cepstrum, then fold the anti-causal part onto the causal part
+  fft(re, im, n, twiddleRe, twiddleIm, true);
+  for (int i = 0; i < n; i++) {
+    re[i] /= n;
+    im[i] = 0.0;
+    if (i > 0 && i < n / 2) {
+      re[i] *= 2.0;
+    } else if (i > n / 2) {
+      re[i] = 0.0;
+    }
+  }
+
+  // Back to the spectrum and exponentiate to get the minimum phase response
+  fft(re, im, n, twiddleRe, twiddleIm, false);
+  for (int i = 0; i < n; i++) {
+    double mag = exp(re[i]);
+    re[i] = mag * cos(im[i]);
+    im[i] = mag * sin(im[i]);
+  }
+  fft(re, im, n, twiddleRe, twiddleIm, true);
+
+  for (int i = 0; i < len; i++) filter[i] = re[i] / n;
+
+  free(re);
+  return 0;
+}
+
+// The Kaiser windowed sinc at t input frames from the start of a window tapCount frames long
+static double kaiserSinc (double t, int tapCount, double cutoff, double beta, double i0Beta) {
+  double x = t - 0.5 * tapCount; // distance from the centre
+  double sinc = x == 0.0 ? 2.0 * cutoff : sin(2.0 * PI * cutoff * x) / (PI * x);
+  double w = 2.0 * t / tapCount - 1.0;
+  w = 1.0 - w * w;
+  return sinc * besselI0(beta * sqrt(w > 0.0 ? w : 0.0)) / i0Beta;
+}
+
+// Fill proto (protoLen samples, RESAMPLER_PHASE_COUNT per input frame) with the minimum phase version of the prototype.
+// The cepstrum is taken of the prototype sampled only MIN_PHASE_OVERSAMPLE times per input frame, which keeps the FFTs
+// 16 times shorter, then that is upsampled to RESAMPLER_PHASE_COUNT with a Kaiser windowed sinc interpolator. The filter
+// has nothing above cutoff but stopband, so the interpolator only has to pass up to 1 / (2 * MIN_PHASE_OVERSAMPLE) and
+// reject from 1 - 1 / (2 * MIN_PHASE_OVERSAMPLE) cycles per sample, which takes 2 * MIN_PHASE_INTERP_HALF_WIDTH taps.
+// returns: 0 for success or -1 if out of memory
+static int designMinPhase (double *proto, int protoLen, int tapCount, double cutoff, double beta, double i0Beta) {
+  const int upsample = RESAMPLER_PHASE_COUNT / MIN_PHASE_OVERSAMPLE;
+  const int halfWidth = MIN_PHASE_INTERP_HALF_WIDTH;
+
+  int shortLen = tapCount * MIN_PHASE_OVERSAMPLE + 1;
+  double *shortProto = (double *)malloc(sizeof(double) * shortLen);
+  double *interp = (double *)malloc(sizeof(double) * upsample * 2 * halfWidth);
+  if (shortProto == NULL || interp == NULL) {
+    free(shortProto);
+    free(interp);
+    return -1;
+  }
+
+  for (int k = 0; k < shortLen; k++) {
+    shortProto[k] = kaiserSinc((double)k / MIN_PHASE_OVERSAMPLE, tapCount, cutoff, beta, i0Beta);
+  }
+  if (makeMinPhase(shortProto, shortLen) < 0) {
+    free(shortProto);
+    free(interp);
+    return -1;
+  }
+
+  // interp[r][j] weights shortProto[k + j - halfWidth + 1] for proto[k * upsample + r]. The sinc is zero at every
+  // other short sample, so r = 0 copies.
+  for (int r = 0; r < upsample; r++) {
+    for (int j = 0; j < 2 * halfWidth; j++) {
+      double t = (double)r / upsample - (j - halfWidth + 1) + halfWidth;
+      interp[2 * halfWidth * r + j] = kaiserSinc(t, 2 * halfWidth, 0.5, beta, i0Beta);
+    }
+  }
+
+  for (int m = 0; m < protoLen; m++) {
+    int k = m / upsample, r = m % upsample;
+    const double *weights = &interp[2 * halfWidth * r];
+    double sum = 0.0;
+    for (int j = 0; j < 2 * halfWidth; j++) {
+      int index = k + j - halfWidth + 1;
+      if (index >= 0 && index < shortLen) sum += weights[j] * shortProto[index];
+    }
+    proto[m] = sum;
+  }
+
+  free(shortProto);
+  free(interp);
+  return 0;
+}
+
+// Fill bank with BANK_PHASE_COUNT phases of a Kaiser windowed sinc, for p in [-1, RESAMPLER_PHASE_COUNT + 1].
+// Phase p holds the filter at t = tapCount - 1 - i + p / RESAMPLER_PHASE_COUNT for i in [0, tapCount), so it is
+// stored reversed and lines up with the oldest to newest frames of history. Each phase is normalised to unity gain at DC.
+// cutoff is the -6 dB point in cycles per input frame.
+// returns: the group delay at DC in input frames, or -1.0 if out of memory
+static double designBank (sample_t *bank, int tapCount, double cutoff, bool minPhase) {
+  const double beta = 0.1102 * (RESAMPLER_ATTENUATION - 8.7);
+  const double i0Beta = besselI0(beta);
+
+  // The prototype filter, sampled RESAMPLER_PHASE_COUNT times per input frame
+  int protoLen = tapCount * RESAMPLER_PHASE_COUNT + 1;
+  double *proto = (double *)malloc(sizeof(double) * protoLen);
+  if (proto == NULL) return -1.0;
+
+  if (minPhase) {
+    if (designMinPhase(proto, protoLen, tapCount, cutoff, beta, i0Beta) < 0) {
+      free(proto);
+      return -1.0;
+    }
+  } else {
+    for (int m = 0; m < protoLen; m++) {
+      proto[m] = kaiserSinc((double)m / RESAMPLER_PHASE_COUNT, tapCount, cutoff, beta, i0Beta);
+    }
+  }
+
+  double moment = 0.0, sum = 0.0;
+  for (int m = 0; m < protoLen; m++) {
+    moment += proto[m] * m;
+    sum += proto[m];
+  }
+
+  for (int p = -1; p <= RESAMPLER_PHASE_COUNT + 1; p++) {
+    sample_t *phase = &bank[tapCount * (p + 1)];
+    double phaseSum = 0.0;
+
+    for (int i = 0; i < tapCount; i++) {
+      int m = (tapCount - 1 - i) * RESAMPLER_PHASE_COUNT + p;
+      if (m >= 0 && m < protoLen) phaseSum += proto[m]; // zero outside the window
+    }
+
+    for (int i = 0; i < tapCount; i++) {
+      int m = (tapCount - 1 - i) * RESAMPLER_PHASE_COUNT + p;
+      phase[i] = m < 0 || m >= protoLen ? 0.0 : proto[m] / phaseSum;
+    }
+  }
+
+  free(proto);
+  return moment / sum / RESAMPLER_PHASE_COUNT;
+}
+
+// latency is set to the group delay at DC in input frames
+// returns: a bank of BANK_PHASE_COUNT * tapCount coefficients or NULL if out of memory or every cache entry is in use
+static const sample_t *acquireBank (double bandwidth, double transitionBand, bool minPhase, int tapCount, double *latency) {
+  pthread_mutex_lock(&bankCacheMutex);
+
+  int freeIndex = -1;
+  for (int i = 0; i < BANK_CACHE_LEN; i++) {
+    if (
+      bankCache[i].bank != NULL &&
+      bankCache[i].bandwidth == bandwidth &&
+      bankCache[i].transitionBand == transitionBand &&
+      bankCache[i].minPhase == minPhase
+    ) {
+      bankCache[i].refCount++;
+      *latency = bankCache[i].latency;
+      pthread_mutex_unlock(&bankCacheMutex);
+      return bankCache[i].bank;
+    }
+    // Prefer an empty entry over evicting an unused bank
+    if (bankCache[i].refCount == 0 && (freeIndex < 0 || bankCache[i].bank == NULL)) freeIndex = i;
+  }
+
+  if (freeIndex < 0) {
+    pthread_mutex_unlock(&bankCacheMutex);
+    return NULL;
+  }
+
+  free(bankCache[freeIndex].bank);
+  bankCache[freeIndex].bank = (sample_t *)malloc(sizeof(sample_t) * tapCount * BANK_PHASE_COUNT);
+  if (bankCache[freeIndex].bank == NULL) {
+    pthread_mutex_unlock(&bankCacheMutex);
+    return NULL;
+  }
+
+  double transitionWidth = bandwidth * transitionBand / 100.0;
+  *latency = designBank(bankCache[freeIndex].bank, tapCount, bandwidth - 0.5 * transitionWidth, minPhase);
+  if (*latency < 0.0) {
+    free(bankCache[freeIndex].bank);
+    bankCache[freeIndex].bank = NULL;
+    pthread_mutex_unlock(&bankCacheMutex);
+    return NULL;
+  }
+
+  bankCache[freeIndex].bandwidth = bandwidth;
+  bankCache[freeIndex].transitionBand = transitionBand;
+  bankCache[freeIndex].minPhase = minPhase;
+  bankCache[freeIndex].tapCount = tapCount;
+  bankCache[freeIndex].latency = *latency;
+  bankCache[freeIndex].refCount = 1;
+
+  pthread_mutex_unlock(&bankCacheMutex);
+  return bankCache[freeIndex].bank;
+}
+
+static void releaseBank (const sample_t *bank) {
+  pthread_mutex_lock(&bankCacheMutex);
+  for (int i = 0; i < BANK_CACHE_LEN; i++) {
+    if (bankCache[i].bank == bank) {
+      bankCache[i].refCount--;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&bankCacheMutex);
+}
+
+/////////////////////
+// public
+/////////////////////
+
+const char *resampler_initKernels (void) {
+#if defined(RESAMPLER_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kernels.vectorWidth = 32 / sizeof(sample_t);
+    kernels.interpolate = interpolateAvx2;
+    kernels.filter = filterAvx2;
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    kernels.vectorWidth = 16 / sizeof(sample_t);
+    kernels.interpolate = interpolateSse2;
+    kernels.filter = filterSse2;
+    return "sse2";
+  }
+#elif defined(RESAMPLER_NEON)
+  kernels.vectorWidth = 16 / sizeof(sample_t);
+  kernels.interpolate = interpolateNeon;
+  kernels.filter = filterNeon;
+  return "neon";
+#endif
+  return "scalar";
+}
+
+int resampler_init (resampler_t *resamp, double srcRate, double dstRate, int channelCount, int maxInFrames, double transitionBand, bool minPhase) {
+  memset(resamp, 0, sizeof(resampler_t));
+  if (srcRate <= 0.0 || dstRate <= 0.0 || channelCount < 1 || channelCount > MAX_AUDIO_CHANNELS || maxInFrames < 1) return -1;
+  if (!(transitionBand >= SYNCER_MIN_TRANSITION_BAND && transitionBand <= SYNCER_MAX_TRANSITION_BAND)) return -1;
+
+  // When downsampling the filter has to cut off below the output Nyquist frequency instead of the input
+  double ratio = dstRate / srcRate;
+  double bandwidth = round(BANDWIDTH_STEPS * 0.5 * (ratio < 1.0 ? ratio : 1.0)) / BANDWIDTH_STEPS; // in cycles per input frame
+  double transitionWidth = bandwidth * transitionBand / 100.0;
+
+  // Kaiser's formula for the filter length, the window shape is set in acquireBank
+  resamp->tapCount = ceil((RESAMPLER_ATTENUATION - 7.95) / (14.36 * transitionWidth));
+  resamp->tapCount += resamp->tapCount & 1; // even, so that phase 0 has a tap on the centre
+
+  resamp->channelCount = channelCount;
+  resamp->stride = (channelCount + kernels.vectorWidth - 1) / kernels.vectorWidth * kernels.vectorWidth;
+  resamp->initRatio = ratio;
+  resamp->step = srcRate / dstRate;
+  resamp->maxInFrames = maxInFrames;
+  resamp->maxOutFrames = ceil(maxInFrames * ratio * (1.0 + RESAMPLER_MAX_RATIO_DEVIATION)) + 2;
+
+  resamp->bank = acquireBank(bandwidth, transitionBand, minPhase, resamp->tapCount, &resamp->latency);
+  resamp->kernel = (sample_t *)malloc(sizeof(sample_t) * resamp->tapCount);
+  // calloc so the history starts as silence and the padding channels are always zero
+  resamp->history = (sample_t *)calloc((size_t)resamp->stride * (resamp->tapCount + maxInFrames), sizeof(sample_t));
+  resamp->outBuf = (sample_t *)malloc(sizeof(sample_t) * channelCount * resamp->maxOutFrames);
+  if (resamp->bank == NULL || resamp->kernel == NULL || resamp->history == NULL || resamp->outBuf == NULL) {
+    resampler_deinit(resamp);
+    return -2;
+  }
+
+  resamp->historyLen = resamp->tapCount - 1;
+  resamp->pos = resamp->tapCount - 1;
+  resamp->frac = 0.0;
+
+  return 0;
+}
+
+int resampler_process (resampler_t *resamp, const sample_t *inBuf, int inFrameCount, sample_t **outBuf) {
+  const int channelCount = resamp->channelCount, stride = resamp->stride, tapCount = resamp->tapCount;
+  sample_t *history = resamp->history;
+
+  for (int i = 0; i < inFrameCount; i++) {
+    memcpy(&history[stride * (resamp->historyLen + i)], &inBuf[channelCount * i], sizeof(sample_t) * channelCount);
+  }
+  resamp->historyLen += inFrameCount;
+
+  int outFrameCount = 0;
+  while (resamp->pos < resamp->historyLen && outFrameCount < resamp->maxOutFrames) {
+    double phase = resamp->frac * RESAMPLER_PHASE_COUNT;
+    int phaseIndex = phase;
+    double f = phase - phaseIndex;
+    // Lagrange weights for phases phaseIndex - 1 to phaseIndex + 2, which start at bank row phaseIndex
+    sample_t weights[4] = {
+      -f * (f - 1.0) * (f - 2.0) / 6.0,
+      (f + 1.0) * (f - 1.0) * (f - 2.0) / 2.0,
+      -(f + 1.0) * f * (f - 2.0) / 2.0,
+      (f + 1.0) * f * (f - 1.0) / 6.0
+    };
+    kernels.interpolate(&resamp->bank[tapCount * phaseIndex], weights, resamp->kernel, tapCount);
+    kernels.filter(&history[stride * (resamp->pos - tapCount + 1)], resamp->kernel, tapCount, stride, &resamp->outBuf[channelCount * outFrameCount], channelCount);
+    outFrameCount++;
+
+    resamp->frac += resamp->step;
+    int advance = resamp->frac;
+    resamp->pos += advance;
+    resamp->frac -= advance;
+  }
+
+  // Only keep the frames needed by the next output frame
+  int dropCount = resamp->pos - (tapCount - 1);
+  if (dropCount > resamp->historyLen) dropCount = resamp->historyLen;
+  if (dropCount > 0) {
+    memmove(history, &history[stride * dropCount], sizeof(sample_t) * stride * (resamp->historyLen - dropCount));
+    resamp->historyLen -= dropCount;
+    resamp->pos -= dropCount;
+  }
+
+  *outBuf = resamp->outBuf;
+  return outFrameCount;
+}
+
+int resampler_setRatio (resampler_t *resamp, double ratio) {
+  if (!resampler_isRatioInRange(resamp, ratio)) return -1;
+  resamp->step = 1.0 / ratio;
+  return 0;
+}
+
+void resampler_deinit (resampler_t *resamp) {
+  if (resamp->bank != NULL) releaseBank(resamp->bank);
+  free(resamp->kernel);
+  free(resamp->history);
+  free(resamp->outBuf);
+  resamp->bank = NULL;
+  resamp->kernel = resamp->history = resamp->outBuf = NULL;
+}
@@ -0,0 +1,656 @@
+// Copyright 2023 Sam Johnson
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#include <string.h>
+#include "sampleconv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SAMPLECONV_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define SAMPLECONV_NEON
+#include <arm_neon.h>
+#endif
+
+// Size of the scratch buffers on the stack, in samples
+#define BLOCK_LEN 1024
+
+#define S16_POS 32767.0
+#define S16_NEG 32768.0
+#define S24_POS 8388607.0
+#define S24_NEG 8388608.0
+#define S32_POS 2147483647.0
+#define S32_NEG 2147483648.0
+
+// Kernels convert sampleCount contiguous samples
+typedef void (*toSampleKernel_t)(const void *inBuf, sample_t *outBuf, int sampleCount);
+typedef void (*fromSampleKernel_t)(const sample_t *inBuf, void *outBuf, int sampleCount);
+
+/////////////////////
+// scalar kernels
+/////////////////////
+
+static void s16ToSampleScalar (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = in[i];
+    outBuf[i] = sample > 0.0 ? sample/S16_POS : sample/S16_NEG;
+  }
+}
+
+static void s24PackedToSampleScalar (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    int32_t sampleInt = 0;
+    // Leave the least significant byte of sampleInt empty and then shift back into it to sign extend.
+    memcpy((uint8_t *)&sampleInt + 1, &in[3*i], 3);
+    sampleInt >>= 8;
+    outBuf[i] = sampleInt > 0 ? sampleInt/S24_POS : sampleInt/S24_NEG;
+  }
+}
+
+static void s32ToSampleScalar (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = in[i];
+    outBuf[i] = sample > 0.0 ? sample/S32_POS : sample/S32_NEG;
+  }
+}
+
+static void f32ToSampleScalar (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const float *in = (const float *)inBuf;
+  for (int i = 0; i < sampleCount; i++) outBuf[i] = in[i];
+}
+
+static inline double clampSample (double sample) {
+  if (sample < -1.0) return -1.0;
+  if (sample > 1.0) return 1.0;
+  return sample;
+}
+
+static void sampleToS24Scalar (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = clampSample(inBuf[i]);
+    out[i] = sample > 0.0 ? S24_POS*sample : S24_NEG*sample;
+  }
+}
+
+static void sampleToS32Scalar (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  for (int i = 0; i < sampleCount; i++) {
+    double sample = clampSample(inBuf[i]);
+    out[i] = sample > 0.0 ? S32_POS*sample : S32_NEG*sample;
+  }
+}
+
+static void sampleToF32Scalar (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  float *out = (float *)outBuf;
+  for (int i = 0; i < sampleCount; i++) out[i] = inBuf[i];
+}
+
+/////////////////////
+// x86 kernels
+/////////////////////
+
+#ifdef SAMPLECONV_X86
+
+#define AVX2 __attribute__((target("avx2")))
+#define SSE41 __attribute__((target("sse4.1")))
+
+// 4 x int32 to 4 x double, divided by pos or neg depending on sign
+AVX2 static inline __m256d scaleToDoubleAvx2 (__m128i samples, double pos, double neg) {
+  __m256d x = _mm256_cvtepi32_pd(samples);
+  __m256d isPos = _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ);
+  return _mm256_div_pd(x, _mm256_blendv_pd(_mm256_set1_pd(neg), _mm256_set1_pd(pos), isPos));
+}
+
+// 4 x double to 4 x int32, clamped then multiplied by pos or neg depending on sign
+AVX2 static inline __m128i scaleFromDoubleAvx2 (__m256d x, double pos, double neg) {
+  x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-1.0)), _mm256_set1_pd(1.0));
+  __m256d isPos = _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ);
+  return _mm256_cvttpd_epi32(_mm256_mul_pd(x, _mm256_blendv_pd(_mm256_set1_pd(neg), _mm256_set1_pd(pos), isPos)));
+}
+
+#ifndef W_SAMPLE_F32
+
+AVX2 static void s16ToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    __m128i samples = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)&in[i]));
+    _mm256_storeu_pd(&outBuf[i], scaleToDoubleAvx2(samples, S16_POS, S16_NEG));
+  }
+  s16ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void s24PackedToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  // Move each 3 byte sample to the top of a 32-bit lane, then shift back down to sign extend
+  const __m128i shuffle = _mm_setr_epi8(-128, 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11);
+  int i = 0;
+  // 16 byte loads, stop while there are at least 16 bytes left
+  for (; i + 6 <= sampleCount; i += 4) {
+    __m128i samples = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&in[3*i]), shuffle), 8);
+    _mm256_storeu_pd(&outBuf[i], scaleToDoubleAvx2(samples, S24_POS, S24_NEG));
+  }
+  s24PackedToSampleScalar(&in[3*i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void s32ToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    __m128i samples = _mm_loadu_si128((const __m128i *)&in[i]);
+    _mm256_storeu_pd(&outBuf[i], scaleToDoubleAvx2(samples, S32_POS, S32_NEG));
+  }
+  s32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void f32ToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const float *in = (const float *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) _mm256_storeu_pd(&outBuf[i], _mm256_cvtps_pd(_mm_loadu_ps(&in[i])));
+  f32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void sampleToS24Avx2 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    _mm_storeu_si128((__m128i *)&out[i], scaleFromDoubleAvx2(_mm256_loadu_pd(&inBuf[i]), S24_POS, S24_NEG));
+  }
+  sampleToS24Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+AVX2 static void sampleToS32Avx2 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    _mm_storeu_si128((__m128i *)&out[i], scaleFromDoubleAvx2(_mm256_loadu_pd(&inBuf[i]), S32_POS, S32_NEG));
+  }
+  sampleToS32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+AVX2 static void sampleToF32Avx2 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  float *out = (float *)outBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) _mm_storeu_ps(&out[i], _mm256_cvtpd_ps(_mm256_loadu_pd(&inBuf[i])));
+  sampleToF32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+#else
+
+// 8 x int32 to 8 x float, divided by pos or neg depending on sign. Only for 16 and 24-bit samples which convert to
+// float exactly, so the result is the same as dividing in double then rounding.
+AVX2 static inline __m256 scaleToFloatAvx2 (__m256i samples, float pos, float neg) {
+  __m256 x = _mm256_cvtepi32_ps(samples);
+  __m256 isPos = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+  return _mm256_div_ps(x, _mm256_blendv_ps(_mm256_set1_ps(neg), _mm256_set1_ps(pos), isPos));
+}
+
+AVX2 static void s16ToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  int i = 0;
+  for (; i + 8 <= sampleCount; i += 8) {
+    __m256i samples = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&in[i]));
+    _mm256_storeu_ps(&outBuf[i], scaleToFloatAvx2(samples, S16_POS, S16_NEG));
+  }
+  s16ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void s24PackedToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  const __m128i shuffle = _mm_setr_epi8(-128, 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11);
+  int i = 0;
+  // Two 16 byte loads 12 bytes apart, stop while there are at least 28 bytes left
+  for (; i + 10 <= sampleCount; i += 8) {
+    __m128i lo = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&in[3*i]), shuffle), 8);
+    __m128i hi = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&in[3*i + 12]), shuffle), 8);
+    _mm256_storeu_ps(&outBuf[i], scaleToFloatAvx2(_mm256_set_m128i(hi, lo), S24_POS, S24_NEG));
+  }
+  s24PackedToSampleScalar(&in[3*i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void s32ToSampleAvx2 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  int i = 0;
+  // 32-bit samples don't fit in a float, so scale in double and round once
+  for (; i + 4 <= sampleCount; i += 4) {
+    __m128i samples = _mm_loadu_si128((const __m128i *)&in[i]);
+    _mm_storeu_ps(&outBuf[i], _mm256_cvtpd_ps(scaleToDoubleAvx2(samples, S32_POS, S32_NEG)));
+  }
+  s32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+AVX2 static void sampleToS24Avx2 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    _mm_storeu_si128((__m128i *)&out[i], scaleFromDoubleAvx2(_mm256_cvtps_pd(_mm_loadu_ps(&inBuf[i])), S24_POS, S24_NEG));
+  }
+  sampleToS24Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+AVX2 static void sampleToS32Avx2 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    _mm_storeu_si128((__m128i *)&out[i], scaleFromDoubleAvx2(_mm256_cvtps_pd(_mm_loadu_ps(&inBuf[i])), S32_POS, S32_NEG));
+  }
+  sampleToS32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+#endif
+
+// 4 x int32 to 4 x double in two halves
+SSE41 static inline void storeScaledSse41 (double *outBuf, __m128i samples, double pos, double neg) {
+  const __m128d posScale = _mm_set1_pd(pos), negScale = _mm_set1_pd(neg), zero = _mm_setzero_pd();
+  __m128d lo = _mm_cvtepi32_pd(samples);
+  __m128d hi = _mm_cvtepi32_pd(_mm_unpackhi_epi64(samples, samples));
+  _mm_storeu_pd(&outBuf[0], _mm_div_pd(lo, _mm_blendv_pd(negScale, posScale, _mm_cmpgt_pd(lo, zero))));
+  _mm_storeu_pd(&outBuf[2], _mm_div_pd(hi, _mm_blendv_pd(negScale, posScale, _mm_cmpgt_pd(hi, zero))));
+}
+
+// 2 x double to 2 x int32 in the low half
+SSE41 static inline __m128i scaleFromDoubleSse41 (__m128d x, double pos, double neg) {
+  x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(-1.0)), _mm_set1_pd(1.0));
+  __m128d isPos = _mm_cmpgt_pd(x, _mm_setzero_pd());
+  return _mm_cvttpd_epi32(_mm_mul_pd(x, _mm_blendv_pd(_mm_set1_pd(neg), _mm_set1_pd(pos), isPos)));
+}
+
+#ifndef W_SAMPLE_F32
+
+SSE41 static void s16ToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    storeScaledSse41(&outBuf[i], _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)&in[i])), S16_POS, S16_NEG);
+  }
+  s16ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void s24PackedToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  const __m128i shuffle = _mm_setr_epi8(-128, 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11);
+  int i = 0;
+  for (; i + 6 <= sampleCount; i += 4) {
+    __m128i samples = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&in[3*i]), shuffle), 8);
+    storeScaledSse41(&outBuf[i], samples, S24_POS, S24_NEG);
+  }
+  s24PackedToSampleScalar(&in[3*i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void s32ToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    storeScaledSse41(&outBuf[i], _mm_loadu_si128((const __m128i *)&in[i]), S32_POS, S32_NEG);
+  }
+  s32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void f32ToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const float *in = (const float *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    __m128 samples = _mm_loadu_ps(&in[i]);
+    _mm_storeu_pd(&outBuf[i], _mm_cvtps_pd(samples));
+    _mm_storeu_pd(&outBuf[i+2], _mm_cvtps_pd(_mm_movehl_ps(samples, samples)));
+  }
+  f32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void sampleToS24Sse41 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) {
+    _mm_storel_epi64((__m128i *)&out[i], scaleFromDoubleSse41(_mm_loadu_pd(&inBuf[i]), S24_POS, S24_NEG));
+  }
+  sampleToS24Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+SSE41 static void sampleToS32Sse41 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) {
+    _mm_storel_epi64((__m128i *)&out[i], scaleFromDoubleSse41(_mm_loadu_pd(&inBuf[i]), S32_POS, S32_NEG));
+  }
+  sampleToS32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+SSE41 static void sampleToF32Sse41 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  float *out = (float *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) {
+    _mm_storel_epi64((__m128i *)&out[i], _mm_castps_si128(_mm_cvtpd_ps(_mm_loadu_pd(&inBuf[i]))));
+  }
+  sampleToF32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+#else
+
+// 4 x int32 to 4 x float, divided by pos or neg depending on sign. Only for 16 and 24-bit samples, see scaleToFloatAvx2.
+SSE41 static inline __m128 scaleToFloatSse41 (__m128i samples, float pos, float neg) {
+  __m128 x = _mm_cvtepi32_ps(samples);
+  __m128 isPos = _mm_cmpgt_ps(x, _mm_setzero_ps());
+  return _mm_div_ps(x, _mm_blendv_ps(_mm_set1_ps(neg), _mm_set1_ps(pos), isPos));
+}
+
+SSE41 static void s16ToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) {
+    _mm_storeu_ps(&outBuf[i], scaleToFloatSse41(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)&in[i])), S16_POS, S16_NEG));
+  }
+  s16ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void s24PackedToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  const __m128i shuffle = _mm_setr_epi8(-128, 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11);
+  int i = 0;
+  for (; i + 6 <= sampleCount; i += 4) {
+    __m128i samples = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&in[3*i]), shuffle), 8);
+    _mm_storeu_ps(&outBuf[i], scaleToFloatSse41(samples, S24_POS, S24_NEG));
+  }
+  s24PackedToSampleScalar(&in[3*i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void s32ToSampleSse41 (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  int i = 0;
+  // 32-bit samples don't fit in a float, so scale in double and round once
+  for (; i + 4 <= sampleCount; i += 4) {
+    double scaled[4];
+    storeScaledSse41(scaled, _mm_loadu_si128((const __m128i *)&in[i]), S32_POS, S32_NEG);
+    _mm_storeu_ps(&outBuf[i], _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(&scaled[0])), _mm_cvtpd_ps(_mm_loadu_pd(&scaled[2]))));
+  }
+  s32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+SSE41 static void sampleToS24Sse41 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) {
+    __m128d x = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)&inBuf[i])));
+    _mm_storel_epi64((__m128i *)&out[i], scaleFromDoubleSse41(x, S24_POS, S24_NEG));
+  }
+  sampleToS24Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+SSE41 static void sampleToS32Sse41 (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) {
+    __m128d x = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)&inBuf[i])));
+    _mm_storel_epi64((__m128i *)&out[i], scaleFromDoubleSse41(x, S32_POS, S32_NEG));
+  }
+  sampleToS32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+#endif
+
+#endif
+
+/////////////////////
+// ARM64 kernels
+/////////////////////
+
+#ifdef SAMPLECONV_NEON
+
+// 4 x int32 to 4 x double, divided by pos or neg depending on sign
+static inline void storeScaledNeon (double *outBuf, int32x4_t samples, double pos, double neg) {
+  const float64x2_t posScale = vdupq_n_f64(pos), negScale = vdupq_n_f64(neg), zero = vdupq_n_f64(0.0);
+  float64x2_t lo = vcvtq_f64_s64(vmovl_s32(vget_low_s32(samples)));
+  float64x2_t hi = vcvtq_f64_s64(vmovl_s32(vget_high_s32(samples)));
+  vst1q_f64(&outBuf[0], vdivq_f64(lo, vbslq_f64(vcgtq_f64(lo, zero), posScale, negScale)));
+  vst1q_f64(&outBuf[2], vdivq_f64(hi, vbslq_f64(vcgtq_f64(hi, zero), posScale, negScale)));
+}
+
+// 2 x double to 2 x int32, clamped then multiplied by pos or neg depending on sign
+static inline int32x2_t scaleFromDoubleNeon (float64x2_t x, double pos, double neg) {
+  x = vminq_f64(vmaxq_f64(x, vdupq_n_f64(-1.0)), vdupq_n_f64(1.0));
+  float64x2_t scale = vbslq_f64(vcgtq_f64(x, vdupq_n_f64(0.0)), vdupq_n_f64(pos), vdupq_n_f64(neg));
+  return vmovn_s64(vcvtq_s64_f64(vmulq_f64(x, scale))); // vcvtq_s64_f64 truncates
+}
+
+#ifndef W_SAMPLE_F32
+
+static void s16ToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) storeScaledNeon(&outBuf[i], vmovl_s16(vld1_s16(&in[i])), S16_POS, S16_NEG);
+  s16ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+static void s24PackedToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  int i = 0;
+  for (; i + 8 <= sampleCount; i += 8) {
+    // Deinterleave the 3 bytes of 8 samples, then build each sample in the top 24 bits of a 32-bit lane
+    uint8x8x3_t bytes = vld3_u8(&in[3*i]);
+    uint16x8_t b0 = vmovl_u8(bytes.val[0]), b1 = vmovl_u8(bytes.val[1]), b2 = vmovl_u8(bytes.val[2]);
+    uint32x4_t lo = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_low_u16(b0)), 8), vshlq_n_u32(vmovl_u16(vget_low_u16(b1)), 16)), vshlq_n_u32(vmovl_u16(vget_low_u16(b2)), 24));
+    uint32x4_t hi = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_high_u16(b0)), 8), vshlq_n_u32(vmovl_u16(vget_high_u16(b1)), 16)), vshlq_n_u32(vmovl_u16(vget_high_u16(b2)), 24));
+    storeScaledNeon(&outBuf[i], vshrq_n_s32(vreinterpretq_s32_u32(lo), 8), S24_POS, S24_NEG);
+    storeScaledNeon(&outBuf[i+4], vshrq_n_s32(vreinterpretq_s32_u32(hi), 8), S24_POS, S24_NEG);
+  }
+  s24PackedToSampleScalar(&in[3*i], &outBuf[i], sampleCount - i);
+}
+
+static void s32ToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) storeScaledNeon(&outBuf[i], vld1q_s32(&in[i]), S32_POS, S32_NEG);
+  s32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+static void f32ToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const float *in = (const float *)inBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) vst1q_f64(&outBuf[i], vcvt_f64_f32(vld1_f32(&in[i])));
+  f32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+static void sampleToS24Neon (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) vst1_s32(&out[i], scaleFromDoubleNeon(vld1q_f64(&inBuf[i]), S24_POS, S24_NEG));
+  sampleToS24Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+static void sampleToS32Neon (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) vst1_s32(&out[i], scaleFromDoubleNeon(vld1q_f64(&inBuf[i]), S32_POS, S32_NEG));
+  sampleToS32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+static void sampleToF32Neon (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  float *out = (float *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) vst1_f32(&out[i], vcvt_f32_f64(vld1q_f64(&inBuf[i])));
+  sampleToF32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+#else
+
+// 4 x int32 to 4 x float, divided by pos or neg depending on sign. Only for 16 and 24-bit samples which convert to
+// float exactly, so the result is the same as dividing in double then rounding.
+static inline void storeScaledFloatNeon (sample_t *outBuf, int32x4_t samples, float pos, float neg) {
+  float32x4_t x = vcvtq_f32_s32(samples);
+  vst1q_f32(outBuf, vdivq_f32(x, vbslq_f32(vcgtq_f32(x, vdupq_n_f32(0.0f)), vdupq_n_f32(pos), vdupq_n_f32(neg))));
+}
+
+static void s16ToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int16_t *in = (const int16_t *)inBuf;
+  int i = 0;
+  for (; i + 4 <= sampleCount; i += 4) storeScaledFloatNeon(&outBuf[i], vmovl_s16(vld1_s16(&in[i])), S16_POS, S16_NEG);
+  s16ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+static void s24PackedToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const uint8_t *in = (const uint8_t *)inBuf;
+  int i = 0;
+  for (; i + 8 <= sampleCount; i += 8) {
+    uint8x8x3_t bytes = vld3_u8(&in[3*i]);
+    uint16x8_t b0 = vmovl_u8(bytes.val[0]), b1 = vmovl_u8(bytes.val[1]), b2 = vmovl_u8(bytes.val[2]);
+    uint32x4_t lo = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_low_u16(b0)), 8), vshlq_n_u32(vmovl_u16(vget_low_u16(b1)), 16)), vshlq_n_u32(vmovl_u16(vget_low_u16(b2)), 24));
+    uint32x4_t hi = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_high_u16(b0)), 8), vshlq_n_u32(vmovl_u16(vget_high_u16(b1)), 16)), vshlq_n_u32(vmovl_u16(vget_high_u16(b2)), 24));
+    storeScaledFloatNeon(&outBuf[i], vshrq_n_s32(vreinterpretq_s32_u32(lo), 8), S24_POS, S24_NEG);
+    storeScaledFloatNeon(&outBuf[i+4], vshrq_n_s32(vreinterpretq_s32_u32(hi), 8), S24_POS, S24_NEG);
+  }
+  s24PackedToSampleScalar(&in[3*i], &outBuf[i], sampleCount - i);
+}
+
+static void s32ToSampleNeon (const void *inBuf, sample_t *outBuf, int sampleCount) {
+  const int32_t *in = (const int32_t *)inBuf;
+  int i = 0;
+  // 32-bit samples don't fit in a float, so scale in double and round once
+  for (; i + 4 <= sampleCount; i += 4) {
+    double scaled[4];
+    storeScaledNeon(scaled, vld1q_s32(&in[i]), S32_POS, S32_NEG);
+    vst1q_f32(&outBuf[i], vcombine_f32(vcvt_f32_f64(vld1q_f64(&scaled[0])), vcvt_f32_f64(vld1q_f64(&scaled[2]))));
+  }
+  s32ToSampleScalar(&in[i], &outBuf[i], sampleCount - i);
+}
+
+static void sampleToS24Neon (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) vst1_s32(&out[i], scaleFromDoubleNeon(vcvt_f64_f32(vld1_f32(&inBuf[i])), S24_POS, S24_NEG));
+  sampleToS24Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+static void sampleToS32Neon (const sample_t *inBuf, void *outBuf, int sampleCount) {
+  int32_t *out = (int32_t *)outBuf;
+  int i = 0;
+  for (; i + 2 <= sampleCount; i += 2) vst1_s32(&out[i], scaleFromDoubleNeon(vcvt_f64_f32(vld1_f32(&inBuf[i])), S32_POS, S32_NEG));
+  sampleToS32Scalar(&inBuf[i], &out[i], sampleCount - i);
+}
+
+#endif
+
+#endif
+
+/////////////////////
+// dispatch
+/////////////////////
+
+static struct {
+  toSampleKernel_t s16ToSample, s24PackedToSample, s32ToSample, f32ToSample;
+  fromSampleKernel_t sampleToS24, sampleToS32, sampleToF32;
+} kernels = {
+  s16ToSampleScalar, s24PackedToSampleScalar, s32ToSampleScalar, f32ToSampleScalar,
+  sampleToS24Scalar, sampleToS32Scalar, sampleToF32Scalar
+};
+
+static void toSample (toSampleKernel_t kernel, const uint8_t *inBuf, int inSampleBytes, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount) {
+  int channelCount = inChannelCount < outChannelCount ? inChannelCount : outChannelCount;
+  if (inChannelCount == outChannelCount) {
+    kernel(inBuf, outBuf, channelCount * frameCount);
+    return;
+  }
+
+  for (int i = 0; i < frameCount; i++) {
+    kernel(&inBuf[inSampleBytes * inChannelCount * i], &outBuf[outChannelCount * i], channelCount);
+  }
+}
+
+static void fromSample (fromSampleKernel_t kernel, const sample_t *inBuf, int inChannelCount, uint8_t *outBuf, int outSampleBytes, int outChannelCount, int frameCount) {
+  int channelCount = inChannelCount < outChannelCount ? inChannelCount : outChannelCount;
+  if (inChannelCount == outChannelCount) {
+    kernel(inBuf, outBuf, channelCount * frameCount);
+    return;
+  }
+
+  for (int i = 0; i < frameCount; i++) {
+    kernel(&inBuf[inChannelCount * i], &outBuf[outSampleBytes * outChannelCount * i], channelCount);
+  }
+}
+
+/////////////////////
+// public
+/////////////////////
+
+const char *sampleconv_init (void) {
+#if defined(SAMPLECONV_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.s16ToSample = s16ToSampleAvx2;
+    kernels.s24PackedToSample = s24PackedToSampleAvx2;
+    kernels.s32ToSample = s32ToSampleAvx2;
+    kernels.sampleToS24 = sampleToS24Avx2;
+    kernels.sampleToS32 = sampleToS32Avx2;
+    #ifndef W_SAMPLE_F32
+    kernels.f32ToSample = f32ToSampleAvx2;
+    kernels.sampleToF32 = sampleToF32Avx2;
+    #endif
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    kernels.s16ToSample = s16ToSampleSse41;
+    kernels.s24PackedToSample = s24PackedToSampleSse41;
+    kernels.s32ToSample = s32ToSampleSse41;
+    kernels.sampleToS24 = sampleToS24Sse41;
+    kernels.sampleToS32 = sampleToS32Sse41;
+    #ifndef W_SAMPLE_F32
+    kernels.f32ToSample = f32ToSampleSse41;
+    kernels.sampleToF32 = sampleToF32Sse41;
+    #endif
+    return "sse4.1";
+  }
+#elif defined(SAMPLECONV_NEON)
+  kernels.s16ToSample = s16ToSampleNeon;
+  kernels.s24PackedToSample = s24PackedToSampleNeon;
+  kernels.s32ToSample = s32ToSampleNeon;
+  kernels.sampleToS24 = sampleToS24Neon;
+  kernels.sampleToS32 = sampleToS32Neon;
+  #ifndef W_SAMPLE_F32
+  kernels.f32ToSample = f32ToSampleNeon;
+  kernels.sampleToF32 = sampleToF32Neon;
+  #endif
+  return "neon";
+#endif
+  return "scalar";
+}
+
+void sampleconv_s16ToSample (const int16_t *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount) {
+  toSample(kernels.s16ToSample, (const uint8_t *)inBuf, 2, inChannelCount, outBuf, outChannelCount, frameCount);
+}
+
+void sampleconv_s24PackedToSample (const uint8_t *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount) {
+  toSample(kernels.s24PackedToSample, inBuf, 3, inChannelCount, outBuf, outChannelCount, frameCount);
+}
+
+void sampleconv_s32ToSample (const int32_t *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount) {
+  toSample(kernels.s32ToSample, (const uint8_t *)inBuf, 4, inChannelCount, outBuf, outChannelCount, frameCount);
+}
+
+void sampleconv_f32ToSample (const float *inBuf, int inChannelCount, sample_t *outBuf, int outChannelCount, int frameCount) {
+  toSample(kernels.f32ToSample, (const uint8_t *)inBuf, 4, inChannelCount, outBuf, outChannelCount, frameCount);
+}
+
+void sampleconv_sampleToS32 (const sample_t *inBuf, int inChannelCount, int32_t *outBuf, int outChannelCount, int frameCount) {
+  fromSample(kernels.sampleToS32, inBuf, inChannelCount, (uint8_t *)outBuf, 4, outChannelCount, frameCount);
+}
+
+void sampleconv_sampleToF32 (const sample_t *inBuf, int inChannelCount, float *outBuf, int outChannelCount, int frameCount) {
+  fromSample(kernels.sampleToF32, inBuf, inChannelCount, (uint8_t *)outBuf, 4, outChannelCount, frameCount);
+}
+
+void sampleconv_sampleToS24 (const sample_t *inBuf, int32_t *outBuf, int sampleCount) {
+  kernels.sampleToS24(inBuf, outBuf, sampleCount);
+}
+
+void sampleconv_sampleToS24Packed (const sample_t *inBuf, uint8_t *outBuf, int sampleCount) {
+  int32_t block[BLOCK_LEN];
+  for (int start = 0; start < sampleCount; start += BLOCK_LEN) {
+    int count = sampleCount - start < BLOCK_LEN ? sampleCount - start : BLOCK_LEN;
+    kernels.sampleToS24(&inBuf[start], block, count);
+    for (int i = 0; i < count; i++) memcpy(&outBuf[3 * (start + i)], &block[i], 3);
+  }
+}
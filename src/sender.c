@@ -3,6 +3,7 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at https://mozilla.org/MPL/2.0/.
 
+#include "xwait.h"
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -11,18 +12,19 @@
 #include <unistd.h>
 #include <time.h>
 #include "utils.h"
-#include "opus/opus_multistream.h"
 #include "globals.h"
 #include "endpoint.h"
 #include "mux.h"
 #include "pcm.h"
+#include "lossless.h"
+#include "opus-groups.h"
+#include "sampleconv.h"
 #include "audio.h"
 #include "config.h"
 #include "sender.h"
 
-static ck_ring_t encodeRing;
-static ck_ring_buffer_t *encodeRingBuf;
-static int targetEncodeRingSize, encodeRingMaxSize;
+static audioring_t encodeRing;
+static int targetEncodeRingSize, encodeRingMaxSize; // in frames
 static int audioFrameSize;
 static int encodedPacketSize;
 static uint8_t chIdConfig, chIdAudio;
@@ -30,106 +32,98 @@ static uint8_t *receiverConfigBuf = NULL;
 static int receiverConfigBufLen = 0;
 
 static atomic_bool threadsRunning;
+static xwait_t encodeWaitHandle;
+static atomic_bool encodeWaitNotified = false; // true from when the audio thread notifies until the encode thread wakes
+static atomic_int encodeWaitNotifyUTime = 0;
 static pthread_t audioLoopThread, configLoopThread;
-static OpusMSEncoder *opusEncoder = NULL;
 static pcm_codec_t pcmEncoder = { 0 };
 float *sampleBufFloat; // For Opus
-double *sampleBufDouble; // For PCM
+sample_t *sampleBuf;
 uint8_t *audioEncodedBuf;
 
-static int initOpusEncoder (OpusMSEncoder **encoder) {
-  const int networkChannelCount = globals_get1i(audio, networkChannelCount);
-  unsigned char mapping[networkChannelCount];
-  for (int i = 0; i < networkChannelCount; i++) mapping[i] = i;
-
-  int err1, err2;
-  *encoder = opus_multistream_encoder_create(AUDIO_OPUS_SAMPLE_RATE, networkChannelCount, networkChannelCount, 0, mapping, OPUS_APPLICATION_AUDIO, &err1);
-  if (err1 < 0) {
-    printf("Error: opus_multistream_encoder_create failed: %s\n", opus_strerror(err1));
-    return -1;
-  }
-
-  err1 = opus_multistream_encoder_ctl(*encoder, OPUS_SET_BITRATE(globals_get1i(opus, bitrate)));
-  err2 = opus_multistream_encoder_ctl(*encoder, OPUS_SET_VBR(0));
-  if (err1 < 0 || err2 < 0) {
-    printf("Error: opus_multistream_encoder_ctl failed\n");
-    return -2;
-  }
-
-  return 0;
-}
-
 static int initAudioLoop (void) {
   const int networkChannelCount = globals_get1i(audio, networkChannelCount);
   const unsigned int audioEncoding = globals_get1ui(audio, encoding);
 
   sampleBufFloat = (float*)malloc(4 * networkChannelCount * audioFrameSize); // For Opus
-  sampleBufDouble = (double*)malloc(8 * networkChannelCount * audioFrameSize); // For PCM
+  sampleBuf = (sample_t*)malloc(sizeof(sample_t) * networkChannelCount * audioFrameSize);
   audioEncodedBuf = (uint8_t*)malloc(encodedPacketSize);
 
-  if (sampleBufFloat == NULL || sampleBufDouble == NULL || audioEncodedBuf == NULL) return -1;
-  if (audioEncoding == AUDIO_ENCODING_OPUS && initOpusEncoder(&opusEncoder) < 0) return -2;
+  if (sampleBufFloat == NULL || sampleBuf == NULL || audioEncodedBuf == NULL) return -1;
+  if (audioEncoding == AUDIO_ENCODING_OPUS && opusgroups_init(true, encodedPacketSize - 2, AUDIO_ENCODE_THREAD_CORE) < 0) return -2;
 
   return 0;
 }
 
+// This is on the audio thread, or the audio DSP thread for Opus on Linux
+static void onAudioRingWrite (void) {
+  if (audioring_size(&encodeRing) < (unsigned int)audioFrameSize) return;
+  // Only notify once per wake-up of the encode thread. The encode thread drains every full frame each time it wakes.
+  if (atomic_exchange(&encodeWaitNotified, true)) return;
+  encodeWaitNotifyUTime = utils_getCurrentUTime();
+  xwait_notify(&encodeWaitHandle);
+}
+
 static void *startAudioLoop (UNUSED void *arg) {
   const int networkChannelCount = globals_get1i(audio, networkChannelCount);
-  const double networkSampleRate = globals_get1i(audio, networkSampleRate); // Hz
   const unsigned int audioEncoding = globals_get1ui(audio, encoding);
   uint16_t audioPacketSeq = 0;
 
-  // Sleep for 30% of our desired interval time to make sure encodeRingSize doesn't get too full despite OS jitter.
-  double targetSizeNs = 300000000.0 * targetEncodeRingSize / (double)(networkChannelCount * networkSampleRate);
-  struct timespec loopSleep;
-  loopSleep.tv_nsec = targetSizeNs;
-  loopSleep.tv_sec = 0;
+  utils_setCallerThreadRealtime(98, utils_checkCore(AUDIO_ENCODE_THREAD_CORE));
 
-  // pin each channel encode thread to a different core, leaving core 0 for other stuff (Linux only)
-  // DEBUG: check the CPU core count before calling this
-  utils_setCallerThreadRealtime(98, 2);
+  while (true) {
+    xwait_wait(&encodeWaitHandle);
+    if (!threadsRunning) break;
 
-  while (threadsRunning) {
-    int encodeRingSize = utils_ringSize(&encodeRing);
-    int encodeRingSizeFrames = encodeRingSize / networkChannelCount;
-    globals_add1uiv(statsCh1Audio, streamMeterBins, STATS_STREAM_METER_BINS * encodeRingSize / encodeRingMaxSize, 1);
-
-    // TODO: do xwait_notify from audio thread instead of nanosleeping here; I'm pretty sure xwait_notify doesn't do a syscall
-    if (encodeRingSizeFrames < audioFrameSize) {
-      nanosleep(&loopSleep, NULL);
-      continue;
+    // Clear this before draining encodeRing so that a frame completed while we are encoding causes another wake-up.
+    encodeWaitNotified = false;
+    int wakeLatency = utils_getElapsedUTime(encodeWaitNotifyUTime);
+    globals_set1i(statsCh1Audio, encodeWakeLatency, wakeLatency);
+    if (wakeLatency > globals_get1i(statsCh1Audio, encodeWakeLatencyMax)) {
+      globals_set1i(statsCh1Audio, encodeWakeLatencyMax, wakeLatency);
     }
 
+    int encodeRingSize = audioring_size(&encodeRing);
+    globals_add1uiv(statsCh1Audio, streamMeterBins, STATS_STREAM_METER_BINS * encodeRingSize / encodeRingMaxSize, 1);
+
     if (encodeRingSize > 2 * targetEncodeRingSize) {
       // encodeRing is fuller than it should be due to this thread being preempted by the OS for too long.
       globals_add1ui(statsCh1Audio, encodeThreadJitterCount, 1);
     }
 
-    for (int i = 0; i < networkChannelCount * audioFrameSize; i++) {
-      sampleBufDouble[i] = utils_ringDequeueSample(&encodeRing, encodeRingBuf);
-      sampleBufFloat[i] = sampleBufDouble[i];
-    }
-
-    // Write sequence number to audioEncodedBuf
-    utils_writeU16LE(audioEncodedBuf, audioPacketSeq++);
-
-    int encodedLen = 0;
-    switch (audioEncoding) {
-      case AUDIO_ENCODING_OPUS:
-        encodedLen = opus_multistream_encode_float(opusEncoder, sampleBufFloat, audioFrameSize, &audioEncodedBuf[2], encodedPacketSize - 2);
-        if (encodedLen < 0 || encodedLen != encodedPacketSize - 2) {
-          globals_add1ui(statsCh1AudioOpus, codecErrorCount, 1);
-          continue;
-        }
-        break;
-
-      case AUDIO_ENCODING_PCM:
-        encodedLen = pcm_encode(&pcmEncoder, sampleBufDouble, networkChannelCount * audioFrameSize, &audioEncodedBuf[2]);
-        break;
+    while (encodeRingSize >= audioFrameSize) {
+      encodeRingSize -= audioFrameSize;
+      audioring_dequeueFrames(&encodeRing, sampleBuf, audioFrameSize);
+
+      // Write sequence number to audioEncodedBuf
+      utils_writeU16LE(audioEncodedBuf, audioPacketSeq++);
+
+      int encodedLen = 0;
+      switch (audioEncoding) {
+        case AUDIO_ENCODING_OPUS:
+          sampleconv_sampleToF32(sampleBuf, networkChannelCount, sampleBufFloat, networkChannelCount, audioFrameSize);
+          encodedLen = opusgroups_encode(sampleBufFloat, &audioEncodedBuf[2]);
+          if (encodedLen < 0) {
+            globals_add1ui(statsCh1AudioOpus, codecErrorCount, 1);
+            continue;
+          }
+          break;
+
+        case AUDIO_ENCODING_PCM:
+          encodedLen = pcm_encode(&pcmEncoder, sampleBuf, networkChannelCount * audioFrameSize, &audioEncodedBuf[2]);
+          break;
+
+        case AUDIO_ENCODING_LOSSLESS:
+          encodedLen = lossless_encode(sampleBuf, networkChannelCount, audioFrameSize, &audioEncodedBuf[2]);
+          utils_setLosslessStats(encodedLen, networkChannelCount * audioFrameSize);
+          break;
+      }
+
+      // TODO: do something if mux_writeData returns error
+      /*int err = */mux_writeData(chIdAudio, audioEncodedBuf, encodedLen + 2);
+      // Lossless packets are variable length, send one per block so the timing doesn't depend on the audio
+      if (audioEncoding == AUDIO_ENCODING_LOSSLESS) mux_flush(chIdAudio);
     }
-
-    // TODO: do something if mux_writeData returns error
-    /*int err = */mux_writeData(chIdAudio, audioEncodedBuf, encodedLen + 2);
   }
 
   return NULL;
@@ -164,6 +158,11 @@ int sender_init (void) {
       // 24-bit samples + 2 bytes for CRC + 2 bytes for sequence number
       encodedPacketSize = 3 * networkChannelCount * audioFrameSize + 4;
       break;
+    case AUDIO_ENCODING_LOSSLESS:
+      audioFrameSize = globals_get1i(lossless, frameSize);
+      // Worst case, packets are usually smaller + 2 bytes for sequence number
+      encodedPacketSize = lossless_maxEncodedLen(networkChannelCount, audioFrameSize) + 2;
+      break;
     default:
       printf("Error: Audio encoding %d not implemented.\n", audioEncoding);
       return -1;
@@ -214,44 +213,50 @@ int sender_init (void) {
   double deviceLatency = audio_getDeviceLatency();
 
   // We want there to be about targetEncodeRingSize values in the encodeRing each time the encodeThread
-  // wakes from sleep. If the device latency is shorter than the encoding latency, the encodeThread can wait
-  // longer for there to be a full frame in the encodeRing.
+  // wakes up. The audio thread wakes it once there is a full frame in the encodeRing, but if the device
+  // latency is longer than the encoding latency, each audio callback will deliver more than one frame.
   // NOTE: Each frame in encodeRing is 1/networkSampleRate seconds, not 1/deviceSampleRate seconds.
   if (deviceLatency * networkSampleRate > audioFrameSize) {
     targetEncodeRingSize = deviceLatency * networkSampleRate;
   } else {
     targetEncodeRingSize = audioFrameSize;
   }
-  targetEncodeRingSize *= networkChannelCount;
 
-  // encodeRingMaxSize is the maximum number of double values that can be stored in encodeRing, with
-  // networkChannelCount values per frame.
+  // encodeRingMaxSize is the maximum number of frames that can be stored in encodeRing.
   // In theory the encode thread should loop often enough that the encodeRing never gets much larger than
   // targetEncodeRingSize, but we multiply by 4 to allow plenty of room in encodeRing
-  // for timing jitter caused by the operating system's scheduler. Also ck requires a power of two size.
+  // for timing jitter caused by the operating system's scheduler. audioring allocates a power of two frames
+  // anyway so round up to use all of it.
   encodeRingMaxSize = utils_roundUpPowerOfTwo(4 * targetEncodeRingSize);
-  globals_set1i(statsCh1Audio, streamBufferSize, encodeRingMaxSize / networkChannelCount);
-
-  err = utils_ringInit(&encodeRing, &encodeRingBuf, encodeRingMaxSize);
-  if (err < 0) return err - 23;
+  globals_set1i(statsCh1Audio, streamBufferSize, encodeRingMaxSize);
 
-  err = audio_start(&encodeRing, encodeRingBuf, encodeRingMaxSize);
+  err = audioring_init(&encodeRing, networkChannelCount, encodeRingMaxSize);
   if (err < 0) return err - 24;
 
   err = initAudioLoop();
-  if (err < 0) return err - 36;
+  if (err < 0) return err - 26;
 
+  xwait_init(&encodeWaitHandle);
   threadsRunning = true;
-  if (pthread_create(&audioLoopThread, NULL, startAudioLoop, NULL) != 0) return -39;
-  if (pthread_create(&configLoopThread, NULL, startConfigLoop, NULL) != 0) return -40;
+  if (pthread_create(&audioLoopThread, NULL, startAudioLoop, NULL) != 0) return -29;
+
+  err = audio_start(&encodeRing, onAudioRingWrite);
+  if (err < 0) return err - 100;
+
+  if (pthread_create(&configLoopThread, NULL, startConfigLoop, NULL) != 0) return -200;
 
   return 0;
 }
 
 int sender_deinit (void) {
   threadsRunning = false;
+  xwait_notify(&encodeWaitHandle);
   pthread_join(audioLoopThread, NULL);
+  xwait_destroy(&encodeWaitHandle);
+  opusgroups_deinit();
   pthread_join(configLoopThread, NULL);
   mux_deinit();
-  return audio_deinit();
+  int err = audio_deinit();
+  audioring_deinit(&encodeRing);
+  return err;
 }
@@ -6,86 +6,67 @@
 #include <string.h>
 #include "globals.h"
 #include "utils.h"
+#include "sampleconv.h"
+#include "meter.h"
 #include "syncer.h"
 
 enum InBufTypeEnum { S16, S24, S32, F32 };
 
-static ck_ring_t *_ring;
-static ck_ring_buffer_t *_ringBuf;
+static audioring_t *_ring;
 static int networkChannelCount;
-static double **inBufsDouble;
-static int _fullRingSize;
+static sample_t *inBufSample; // interleaved
 
 /////////////////////
 // private
 /////////////////////
 
-int _syncer_enqueueSamples (double **samples, int frameCount, bool setStats) {
-  // Don't ever let the ring fill completely, that way the channels stay in order
-  if ((int)utils_ringSize(_ring) + networkChannelCount*frameCount > _fullRingSize) return -1;
-
-  for (int i = 0; i < frameCount; i++) {
-    for (int j = 0; j < networkChannelCount; j++) {
-      // NOTE: Sometimes the resampler pushes things a little bit outside of (-1.0, 1.0).
-      // If that happens, it will show on the stats.
-      if (setStats) utils_setAudioStats(samples[j][i], j);
-      utils_ringEnqueueSample(_ring, _ringBuf, samples[j][i]);
-    }
-  }
+int _syncer_enqueueSamples (const sample_t *samples, int frameCount, bool setStats) {
+  if (audioring_enqueueFrames(_ring, samples, frameCount) < 0) return -1;
+
+  // NOTE: Sometimes the resampler pushes things a little bit outside of (-1.0, 1.0).
+  // If that happens, it will show on the stats.
+  if (setStats) meter_process(samples, networkChannelCount, networkChannelCount, frameCount);
 
   return frameCount;
 }
 
 static int syncer_enqueueBuf(enum InBufTypeEnum inBufType, const void *inBuf, int inFrameCount, int inChannelCount, bool setStats) {
-  for (int i = 0; i < networkChannelCount; i++) {
-    for (int j = 0; j < inFrameCount; j++) {
-      // If the inBuf has more channels than we want to send over the network, use the first n channels of the inBuf.
-      switch (inBufType) {
-        case S16:
-          inBufsDouble[i][j] = utils_s16ToDouble((const int16_t *)inBuf, inChannelCount*j + i);
-          break;
-        case S24:
-          inBufsDouble[i][j] = utils_s24ToDouble((const uint8_t *)inBuf, inChannelCount*j + i);
-          break;
-        case S32:
-          inBufsDouble[i][j] = utils_s32ToDouble((const int32_t *)inBuf, inChannelCount*j + i);
-          break;
-        case F32:
-          inBufsDouble[i][j] = ((const float *)inBuf)[inChannelCount*j + i];
-          break;
-      }
-    }
+  // If the inBuf has more channels than we want to send over the network, use the first n channels of the inBuf.
+  switch (inBufType) {
+    case S16:
+      sampleconv_s16ToSample((const int16_t *)inBuf, inChannelCount, inBufSample, networkChannelCount, inFrameCount);
+      break;
+    case S24:
+      sampleconv_s24PackedToSample((const uint8_t *)inBuf, inChannelCount, inBufSample, networkChannelCount, inFrameCount);
+      break;
+    case S32:
+      sampleconv_s32ToSample((const int32_t *)inBuf, inChannelCount, inBufSample, networkChannelCount, inFrameCount);
+      break;
+    case F32:
+      sampleconv_f32ToSample((const float *)inBuf, inChannelCount, inBufSample, networkChannelCount, inFrameCount);
+      break;
   }
 
-  int outFrameCount = _syncer_stepResampState(inBufsDouble, inFrameCount, setStats, 0);
-  if (outFrameCount < 0) return outFrameCount;
-
-  return outFrameCount;
+  return _syncer_resample(inBufSample, inFrameCount, setStats);
 }
 
 /////////////////////
 // public
 /////////////////////
 
-int syncer_init (double srcRate, double dstRate, int maxInBufFrames, ck_ring_t *ring, ck_ring_buffer_t *ringBuf, int fullRingSize) {
+int syncer_init (double srcRate, double dstRate, int maxInBufFrames, audioring_t *ring) {
   try {
-    _fullRingSize = fullRingSize;
     _ring = ring;
-    _ringBuf = ringBuf;
     networkChannelCount = globals_get1i(audio, networkChannelCount);
-    inBufsDouble = new double*[networkChannelCount];
+    inBufSample = new sample_t[networkChannelCount * maxInBufFrames];
 
-    utils_setAudioLevelFilters();
-
-    for (int i = 0; i < networkChannelCount; i++) {
-      inBufsDouble[i] = new double[maxInBufFrames];
-    }
+    meter_setFilters();
   } catch (...) {
     return -1;
   }
 
   if (_syncer_initResampState(srcRate, dstRate, maxInBufFrames) < 0) return -1;
-  if (_syncer_initReceiverSync(srcRate) < 0) return -1;
+  if (_syncer_initReceiverSync(srcRate, dstRate) < 0) return -1;
   return 0;
 }
 
@@ -106,10 +87,7 @@ int syncer_enqueueBufF32 (const float *inBuf, int inFrameCount, int inChannelCou
 }
 
 void syncer_deinit (void) {
-  for (int i = 0; i < networkChannelCount; i++) {
-    delete[] inBufsDouble[i];
-  }
-  delete[] inBufsDouble;
+  delete[] inBufSample;
 
   _syncer_deinitResampState();
   _syncer_deinitReceiverSync();
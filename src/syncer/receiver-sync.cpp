@@ -5,119 +5,140 @@
 
 #include <pthread.h>
 #include <atomic>
-#include <math.h>
 #include "globals.h"
+#include "resampler.h"
 #include "syncer.h"
 
-static double _srcRate = 0.0;
+// receiverSync counts the device frames that packets have produced minus the device frames that the audio callback
+// has consumed, in units of 1e-8 frames. The audio thread averages it over each RS_SAMPLE_INTERVAL, which smooths
+// out the steps from packets and audio periods arriving at different times. The receiver sync thread feeds each
+// average to a two-state Kalman filter that tracks the offset and slope of receiverSync. The slope is the clock drift
+// left over at the current rate, and the offset from where it started is the ring fill error. The rate is set to
+// cancel the drift plus a small steer (at most RS_MAX_STEER_PPM) that brings the fill error back to zero.
+
+static double _srcRate = 0.0, _dstRate = 0.0;
 static pthread_t receiverSyncThread;
 static atomic_int threadState;
 static atomic_bool active = false;
 static atomic_int_fast64_t receiverSync = 0;
+static std::atomic<double> rsAverage; // in frames, written by syncer_onAudio each RS_SAMPLE_INTERVAL
+
+// Kalman filter state, only used on the receiver sync thread
+static bool filterStarted = false;
+static double rsOffset = 0.0, rsSlope = 0.0; // frames, frames per second
+static double p00 = 0.0, p01 = 0.0, p11 = 0.0; // covariance of (rsOffset, rsSlope)
+static double rsTarget = 0.0; // where rsOffset is steered back to
+static int outlierRun = 0;
+static double currentSrcRate = 0.0;
 
 /////////////////////
 // private
 /////////////////////
 
-// NOTE: not bounds checked, make sure length >= 2 and tail < length
-static double linearRegressionSlope (const double *data, int tail, int length) {
-  double yAvg = 0.0;
-  for (int i = 0; i < length; i++) {
-    yAvg += data[tail];
-    if (++tail == length) tail = 0;
-  }
-  yAvg /= (double)length;
-
-  double xAvg = (length - 1) / 2.0;
-  double variance = 0.0, covariance = 0.0;
-  for (int i = 0; i < length; i++) {
-    double xDiff = i - xAvg;
-    variance += xDiff * xDiff;
-    covariance += xDiff * (data[tail] - yAvg);
-    if (++tail == length) tail = 0;
+static void startFilter (double rs) {
+  rsOffset = rs;
+  rsTarget = rs;
+  p00 = RS_MEASUREMENT_NOISE * RS_MEASUREMENT_NOISE;
+  p01 = 0.0;
+  if (!filterStarted) {
+    // Any drift the resampler can correct is equally likely
+    double slopeStdDev = RESAMPLER_MAX_RATIO_DEVIATION * _dstRate;
+    rsSlope = 0.0;
+    p11 = slopeStdDev * slopeStdDev;
+    filterStarted = true;
   }
-
-  if (variance == 0.0) return 0.0; // division by zero check, not sure if it's required
-  return covariance / variance;
+  outlierRun = 0;
 }
 
-// NOTE: not bounds checked, make sure length >= 2 and tail < length
-static double variance (const double *data, int tail, int length) {
-  double avg = 0.0;
-  for (int i = 0; i < length; i++) {
-    avg += data[tail];
-    if (++tail == length) tail = 0;
+// returns: false if rs was rejected as an outlier
+static bool updateFilter (double rs) {
+  const double t = RS_SAMPLE_INTERVAL;
+  const double q = RS_DRIFT_NOISE * RS_DRIFT_NOISE;
+  const double r = RS_MEASUREMENT_NOISE * RS_MEASUREMENT_NOISE;
+
+  // Predict: the offset moves along the slope, the slope does a random walk
+  double offset = rsOffset + t * rsSlope;
+  double c00 = p00 + t * (2.0 * p01 + t * p11) + q * t * t * t / 3.0;
+  double c01 = p01 + t * p11 + q * t * t / 2.0;
+  double c11 = p11 + q * t;
+
+  double innovation = rs - offset;
+  double innovationVar = c00 + r;
+  if (innovation * innovation > RS_OUTLIER_GATE * RS_OUTLIER_GATE * innovationVar) {
+    // Keep the prediction. If this goes on, receiverSync has jumped to a new level (e.g. after an underrun) and the
+    // ring has settled there, so start steering to it instead of warping back to the old one.
+    rsOffset = offset;
+    p00 = c00;
+    p01 = c01;
+    p11 = c11;
+    if (++outlierRun >= RS_MAX_OUTLIERS) startFilter(rs);
+    return false;
   }
-  avg /= (double)length;
+  outlierRun = 0;
+
+  // Update
+  double k0 = c00 / innovationVar, k1 = c01 / innovationVar;
+  rsOffset = offset + k0 * innovation;
+  rsSlope += k1 * innovation;
+  p00 = (1.0 - k0) * c00;
+  p01 = (1.0 - k0) * c01;
+  p11 = c11 - k1 * c01;
+  return true;
+}
 
-  double squaresSum = 0.0;
-  for (int i = 0; i < length; i++) {
-    double diff = data[tail] - avg;
-    squaresSum += diff * diff;
-    if (++tail == length) tail = 0;
+static void updateRate (void) {
+  // The network audio produces (rsSlope + dstRate) device frames per second at the current rate, so its actual rate
+  // is this many frames per second in srcRate terms.
+  double networkRate = currentSrcRate * (rsSlope + _dstRate) / _dstRate;
+  globals_set1ff(statsCh1Audio, clockError, 1000000.0 * (1.0 - _srcRate / networkRate));
+
+  // Producing dstRate * (1 + steer) device frames per second moves the fill error towards zero
+  double steer = (rsTarget - rsOffset) / (RS_FILL_TIME_CONSTANT * _dstRate);
+  if (steer > 0.000001 * RS_MAX_STEER_PPM) steer = 0.000001 * RS_MAX_STEER_PPM;
+  else if (steer < -0.000001 * RS_MAX_STEER_PPM) steer = -0.000001 * RS_MAX_STEER_PPM;
+  double newSrcRate = networkRate / (1.0 + steer);
+
+  double maxStep = 0.000001 * RS_MAX_RATE_STEP_PPM * currentSrcRate;
+  if (newSrcRate > currentSrcRate + maxStep) newSrcRate = currentSrcRate + maxStep;
+  else if (newSrcRate < currentSrcRate - maxStep) newSrcRate = currentSrcRate - maxStep;
+
+  if (syncer_changeRate(newSrcRate) < 0) return;
+
+  // The filter's slope was measured at the old rate, move it to where it will be at the new rate
+  double slopeScale = currentSrcRate / newSrcRate;
+  rsSlope = (rsSlope + _dstRate) * slopeScale - _dstRate;
+  p01 *= slopeScale;
+  p11 *= slopeScale * slopeScale;
+  currentSrcRate = newSrcRate;
+}
+
+// rs: receiverSync averaged over the last RS_SAMPLE_INTERVAL, in frames
+static void onSample (double rs) {
+  if (!filterStarted) {
+    startFilter(rs);
+  } else if (updateFilter(rs)) {
+    updateRate();
   }
-  return squaresSum / (double)(length - 1);
 }
 
 // this is not a realtime thread
 static void *startReceiverSync (UNUSED void *arg) {
-  double rsHistory[RS_HISTORY_LENGTH] = { 0.0 }; // ring buffer
-  double errorWindow[RS_ERROR_VARIANCE_WINDOW] = { 0.0 }; // ring buffer
-  int rsSampleCount = 0, errorSampleCount = 0;
-  double rsAdjustedA = 0.0, rsAdjustedB = 0.0;
-  bool rsB = false;
-  static double currentSrcRate = _srcRate;
-
   while (true) {
     atomic_wait(&threadState, 1);
     if (atomic_load(&threadState) == 0) return NULL; // 0 means deinit
     atomic_store(&threadState, 1);
 
-    int_fast64_t rs = atomic_load(&receiverSync);
-
-    if (rsB) {
-      rsAdjustedB = 0.00000001 * (double)rs;
-    } else {
-      rsAdjustedA = 0.00000001 * (double)rs;
-    }
-    rsB = !rsB;
-
-    rsHistory[rsSampleCount % RS_HISTORY_LENGTH] = rsAdjustedA > rsAdjustedB ? rsAdjustedA : rsAdjustedB;
-    rsSampleCount++;
-    if (rsSampleCount < 2) continue;
-
-    double errorSamplesPerSecond;
-    if (rsSampleCount <= RS_HISTORY_LENGTH) {
-      errorSamplesPerSecond = linearRegressionSlope(rsHistory, 0, rsSampleCount);
-    } else {
-      errorSamplesPerSecond = linearRegressionSlope(rsHistory, rsSampleCount % RS_HISTORY_LENGTH, RS_HISTORY_LENGTH);
-    }
-
-    errorSamplesPerSecond /= RS_SAMPLE_INTERVAL; // DEBUG: not sure if this scaling is correct
-    errorWindow[errorSampleCount % RS_ERROR_VARIANCE_WINDOW] = errorSamplesPerSecond;
-    errorSampleCount++;
-
-    if (errorSampleCount >= RS_ERROR_VARIANCE_WINDOW) {
-      double errorVariance = variance(errorWindow, errorSampleCount % RS_ERROR_VARIANCE_WINDOW, RS_ERROR_VARIANCE_WINDOW);
-      if (errorVariance < RS_ERROR_VARIANCE_TARGET && fabs(errorSamplesPerSecond) > RS_ERROR_THRESHOLD) {
-        currentSrcRate += errorSamplesPerSecond; 
-        double clockErrorPPM = 1000000.0 * (1.0 - _srcRate / currentSrcRate);
-        globals_set1ff(statsCh1Audio, clockError, clockErrorPPM);
-
-        // clear rsHistory and errorWindow
-        rsSampleCount = 0;
-        errorSampleCount = 0;
-
-        syncer_changeRate(currentSrcRate);
-      }
-    }
+    onSample(rsAverage.load(std::memory_order_relaxed));
   }
 
   return NULL;
 }
 
-int _syncer_initReceiverSync (double srcRate) {
+int _syncer_initReceiverSync (double srcRate, double dstRate) {
   _srcRate = srcRate;
+  _dstRate = dstRate;
+  currentSrcRate = srcRate;
+  filterStarted = false;
 
   atomic_store(&threadState, 1); // running
   if (pthread_create(&receiverSyncThread, NULL, startReceiverSync, NULL) != 0) return -1;
@@ -141,15 +162,23 @@ void _syncer_deinitReceiverSync (void) {
 // - must call _syncer_initReceiverSync first (not checked)
 void syncer_onAudio (unsigned int frameCount) {
   static int sampleIntervalFrames = 0;
+  static double rsSum = 0.0;
+  static int rsCount = 0;
 
   if (atomic_load_explicit(&active, memory_order_relaxed)) {
-    atomic_fetch_sub_explicit(&receiverSync, 100000000 * (int_fast64_t)frameCount, memory_order_relaxed);
+    int_fast64_t decrement = 100000000 * (int_fast64_t)frameCount;
+    int_fast64_t rs = atomic_fetch_sub_explicit(&receiverSync, decrement, memory_order_relaxed) - decrement;
+    rsSum += 0.00000001 * (double)rs;
+    rsCount++;
 
     sampleIntervalFrames += frameCount;
-    if (sampleIntervalFrames >= RS_SAMPLE_INTERVAL * (int)_srcRate) {
+    if (sampleIntervalFrames >= (int)(RS_SAMPLE_INTERVAL * _dstRate)) {
+      rsAverage.store(rsSum / rsCount, std::memory_order_relaxed);
       atomic_store(&threadState, 2);
       atomic_notify_one(&threadState);
       sampleIntervalFrames = 0;
+      rsSum = 0.0;
+      rsCount = 0;
     }
   }
 }
@@ -9,6 +9,10 @@
 #elif defined(__linux__) || defined(__ANDROID__)
 #define _GNU_SOURCE
 #include <sched.h>
+#include <sys/syscall.h>
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
 #endif
 
 #include <pthread.h>
@@ -26,74 +30,6 @@
 #include "audio.h"
 #include "utils.h"
 
-static double levelFastAttack = 0.0, levelFastRelease = 0.0, levelSlowAttack = 0.0, levelSlowRelease = 0.0;
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-
-int utils_ringInit (ck_ring_t *ring, ck_ring_buffer_t **ringBuf, int size) {
-  #ifdef W_32_BIT_POINTERS
-  // on 32-bit arch we will store 1 double using 2 ring elements (2 x intptr_t)
-  size *= 2;
-  #endif
-
-  // ck requires the size to be a power of two but we will pretend ring contains
-  // size number of double values, and ignore the rest.
-  int ringAllocSize = utils_roundUpPowerOfTwo(size);
-  *ringBuf = (ck_ring_buffer_t*)malloc(sizeof(ck_ring_buffer_t) * ringAllocSize);
-  if (*ringBuf == NULL) return -1;
-  memset(*ringBuf, 0, sizeof(ck_ring_buffer_t) * ringAllocSize);
-
-  ck_ring_init(ring, ringAllocSize);
-  return 0;
-}
-
-// DEBUG: making these functions inline would be nice because they are used to process samples,
-// but I need to solve "static function is used in an inline function with external linkage"
-
-unsigned int utils_ringSize (const ck_ring_t *ring) {
-  #ifdef W_32_BIT_POINTERS
-  return ck_ring_size(ring) / 2;
-  #else
-  return ck_ring_size(ring);
-  #endif
-}
-
-double utils_ringDequeueSample (ck_ring_t *ring, ck_ring_buffer_t *ringBuf) {
-  double sampleDouble;
-
-  #ifdef W_32_BIT_POINTERS
-  intptr_t sample[2] __attribute__ ((aligned (8)));
-  ck_ring_dequeue_spsc(ring, ringBuf, (void*)&sample[0]);
-  ck_ring_dequeue_spsc(ring, ringBuf, (void*)&sample[1]);
-  // https://gist.github.com/shafik/848ae25ee209f698763cffee272a58f8#how-do-we-type-pun-correctly
-  memcpy(&sampleDouble, sample, 8);
-  #else
-  intptr_t sample = 0;
-  ck_ring_dequeue_spsc(ring, ringBuf, (void*)&sample);
-  memcpy(&sampleDouble, &sample, 8);
-  #endif
-
-  return sampleDouble;
-}
-
-void utils_ringEnqueueSample (ck_ring_t *ring, ck_ring_buffer_t *ringBuf, double x) {
-  #ifdef W_32_BIT_POINTERS
-  intptr_t sample[2] __attribute__ ((aligned (8)));
-  memcpy(sample, &x, 8);
-  ck_ring_enqueue_spsc(ring, ringBuf, (void*)sample[0]);
-  ck_ring_enqueue_spsc(ring, ringBuf, (void*)sample[1]);
-  #else
-  intptr_t sample = 0;
-  memcpy(&sample, &x, 8);
-  ck_ring_enqueue_spsc(ring, ringBuf, (void*)sample);
-  #endif
-}
-
-void utils_ringDeinit (UNUSED ck_ring_t *ring, ck_ring_buffer_t *ringBuf) {
-  free(ringBuf);
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -124,13 +60,20 @@ int utils_getElapsedUTime (int lastUTime) {
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
+int utils_checkCore (int core) {
+  long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+  return core < coreCount ? core : -1;
+}
+
 int utils_setCallerThreadRealtime (UNUSED int priority, UNUSED int core) {
 #if defined(__linux__) || defined(__ANDROID__)
   // Pin to CPU core
-  cpu_set_t cpuSet;
-  CPU_ZERO(&cpuSet);
-  CPU_SET(core, &cpuSet);
-  if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuSet) < 0) return -1;
+  if (core >= 0) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuSet) < 0) return -1;
+  }
 
   // Set to RT
   struct sched_param sp;
@@ -175,6 +118,32 @@ int utils_setCallerThreadRealtime (UNUSED int priority, UNUSED int core) {
 #endif
 }
 
+int utils_setCallerThreadDeadline (UNUSED uint64_t runtimeNs, UNUSED uint64_t deadlineNs, UNUSED uint64_t periodNs) {
+#if (defined(__linux__) || defined(__ANDROID__)) && defined(SYS_sched_setattr)
+  // glibc has no wrapper for sched_setattr, this is the kernel's struct sched_attr
+  struct {
+    uint32_t size;
+    uint32_t schedPolicy;
+    uint64_t schedFlags;
+    int32_t schedNice;
+    uint32_t schedPriority;
+    uint64_t schedRuntime;
+    uint64_t schedDeadline;
+    uint64_t schedPeriod;
+  } attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.schedPolicy = SCHED_DEADLINE;
+  attr.schedRuntime = runtimeNs;
+  attr.schedDeadline = deadlineNs;
+  attr.schedPeriod = periodNs;
+  if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0) return -1;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -191,59 +160,13 @@ inline int utils_writeU16LE (uint8_t *buf, uint16_t val) {
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-void utils_setAudioLevelFilters (void) {
-  globals_get1ff(audio, levelFastAttack, &levelFastAttack);
-  globals_get1ff(audio, levelFastRelease, &levelFastRelease);
-  globals_get1ff(audio, levelSlowAttack, &levelSlowAttack);
-  globals_get1ff(audio, levelSlowRelease, &levelSlowRelease);
-}
-
-// NOTE: this must be audio callback safe
-void utils_setAudioStats (double sample, int channel) {
-  if (sample >= 1.0 || sample <= -1.0) {
-    globals_add1uiv(statsCh1Audio, clippingCounts, channel, 1);
-  }
-
-  double levelFast, levelSlow;
-  globals_get1ffv(statsCh1Audio, levelsFast, channel, &levelFast);
-  globals_get1ffv(statsCh1Audio, levelsSlow, channel, &levelSlow);
-
-  double levelFastDiff = fabs(sample) - levelFast;
-  double levelSlowDiff = fabs(sample) - levelSlow;
-
-  if (levelFastDiff > 0) {
-    levelFast += levelFastAttack * levelFastDiff;
-  } else {
-    levelFast += levelFastRelease * levelFastDiff;
-  }
-  if (levelSlowDiff > 0) {
-    levelSlow += levelSlowAttack * levelSlowDiff;
-  } else {
-    levelSlow += levelSlowRelease * levelSlowDiff;
-  }
-
-  globals_set1ffv(statsCh1Audio, levelsFast, channel, levelFast);
-  globals_set1ffv(statsCh1Audio, levelsSlow, channel, levelSlow);
-}
-
-inline double utils_s16ToDouble (const int16_t *inBuf, int index) {
-  double sample = inBuf[index];
-  // http://blog.bjornroche.com/2009/12/int-float-int-its-jungle-out-there.html
-  return sample > 0.0 ? sample/32767.0 : sample/32768.0;
-}
-
-// 24-bit index, i.e. 1 unit in index equals 3 bytes in inBuf
-inline double utils_s24ToDouble (const uint8_t *inBuf, int index) {
-  int32_t sampleInt = 0;
-  // Leave the least significant byte of sampleInt empty and then shift back into it to sign extend.
-  memcpy((uint8_t *)&sampleInt + 1, inBuf + 3*index, 3);
-  sampleInt >>= 8;
-  return sampleInt > 0 ? sampleInt/8388607.0 : sampleInt/8388608.0;
-}
-
-inline double utils_s32ToDouble (const int32_t *inBuf, int index) {
-  double sample = inBuf[index];
-  return sample > 0.0 ? sample/2147483647.0 : sample/2147483648.0;
+// encodedLen includes the CRC, sampleCount = channelCount * frameCount
+void utils_setLosslessStats (int encodedLen, int sampleCount) {
+  double compressionRatio;
+  globals_get1ff(statsCh1AudioLossless, compressionRatio, &compressionRatio);
+  // Compare with a PCM packet, 3 bytes per sample + 2 bytes CRC. Smooth over about 100 frames.
+  compressionRatio += 0.01 * ((double)encodedLen / (3 * sampleCount + 2) - compressionRatio);
+  globals_set1ff(statsCh1AudioLossless, compressionRatio, compressionRatio);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -373,71 +296,266 @@ uint8_t *utils_base64Decode (const uint8_t *src, size_t len, size_t *out_len) {
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-// Poly: 0x8005
-// https://stackoverflow.com/questions/10564491/function-to-calculate-a-crc16-checksum#comment83704063_10569892
-uint16_t utils_crc16 (uint16_t crc, const uint8_t *buf, int bufLen) {
+// Both CRCs are reflected (LSB first), so they share the same table and folding code with a different width:
+// - CRC16 poly 0x8005 (CRC-16/ARC)
+//   https://stackoverflow.com/questions/10564491/function-to-calculate-a-crc16-checksum#comment83704063_10569892
+// - CRC32 poly 0x04C11DB7, with the output inverted but not the input
+//   https://web.mit.edu/freebsd/head/sys/libkern/crc32.c
+// Before utils_crcInit is called the bit-at-a-time versions are used. utils_crcInit builds the slicing-by-8 tables
+// then picks a folding kernel if the CPU has carry-less multiply: PCLMULQDQ on x86, PMULL on ARMv8 (which also
+// has CRC32 instructions for the CRC32 poly). The folding kernels reduce the buffer to 16 bytes 64 bytes at a time
+// then finish with the tables, so every kernel gives bit-identical output.
+#define CRC16_POLY 0xa001
+#define CRC32_POLY 0xedb88320u
+
+static uint16_t crc16Table[8][256];
+static uint32_t crc32Table[8][256];
+
+static uint32_t crc16Bitwise (uint32_t crc, const uint8_t *buf, int bufLen) {
   while (bufLen--) {
     crc ^= *buf++;
     for (int k = 0; k < 8; k++) {
-      crc = crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1;
+      crc = crc & 1 ? (crc >> 1) ^ CRC16_POLY : crc >> 1;
     }
   }
+  return crc;
+}
 
+static uint32_t crc32Bitwise (uint32_t crc, const uint8_t *buf, int bufLen) {
+  while (bufLen--) {
+    crc ^= *buf++;
+    for (int k = 0; k < 8; k++) {
+      crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+    }
+  }
   return crc;
 }
 
-// Poly: 0x04C11DB7
-// https://web.mit.edu/freebsd/head/sys/libkern/crc32.c
-static const uint32_t crc32Table[] = {
-  0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-  0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-  0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-  0xf3b97148, 0x84be41de,	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-  0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,	0x14015c4f, 0x63066cd9,
-  0xfa0f3d63, 0x8d080df5,	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-  0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,	0x35b5a8fa, 0x42b2986c,
-  0xdbbbc9d6, 0xacbcf940,	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-  0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-  0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-  0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,	0x76dc4190, 0x01db7106,
-  0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-  0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-  0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-  0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-  0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-  0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-  0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-  0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-  0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-  0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-  0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-  0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-  0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-  0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-  0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-  0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-  0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-  0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-  0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-  0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-  0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-  0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-  0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-  0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-  0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-  0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-  0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-  0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-  0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-  0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-  0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-  0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
+// Process 8 bytes per iteration with one lookup per byte
+#define CRC_SLICE_8(table, crc, buf, bufLen) do { \
+  while (bufLen >= 8) { \
+    uint32_t lo, hi; \
+    memcpy(&lo, buf, 4); \
+    memcpy(&hi, buf + 4, 4); \
+    lo ^= crc; \
+    crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^ \
+          table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24]; \
+    buf += 8; \
+    bufLen -= 8; \
+  } \
+  while (bufLen--) crc = table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8); \
+} while (0)
+
+static uint32_t crc16Slicing (uint32_t crc, const uint8_t *buf, int bufLen) {
+  CRC_SLICE_8(crc16Table, crc, buf, bufLen);
+  return crc;
+}
 
-uint32_t utils_crc32 (uint32_t crc, const uint8_t *buf, int bufLen) {
-  const uint8_t *p = buf;
-  while (bufLen--) {
-    crc = crc32Table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+static uint32_t crc32Slicing (uint32_t crc, const uint8_t *buf, int bufLen) {
+  CRC_SLICE_8(crc32Table, crc, buf, bufLen);
+  return crc;
+}
+
+// x^n mod P, reflected, placed in the top bits of a 64-bit value ready for carry-less multiply
+static uint64_t crcFoldConstant (int n, uint32_t poly, int width) {
+  uint32_t r = 1u << (width - 1); // x^0
+  while (n--) r = r & 1 ? (r >> 1) ^ poly : r >> 1;
+  return (uint64_t)r << (64 - width);
+}
+
+// Folding a 128-bit chunk forward by n bits multiplies its first 64 bits by x^(n+64) and its last 64 bits by x^n.
+// The carry-less product of two reflected values comes out one bit short, hence the - 1.
+typedef struct {
+  uint64_t fold4[2]; // n = 512, four chunks in parallel
+  uint64_t fold1[2]; // n = 128
+} crc_fold_consts_t;
+
+static crc_fold_consts_t crc16FoldConsts, crc32FoldConsts;
+
+static void initFoldConsts (crc_fold_consts_t *consts, uint32_t poly, int width) {
+  consts->fold4[0] = crcFoldConstant(512 + 64 - 1, poly, width);
+  consts->fold4[1] = crcFoldConstant(512 - 1, poly, width);
+  consts->fold1[0] = crcFoldConstant(128 + 64 - 1, poly, width);
+  consts->fold1[1] = crcFoldConstant(128 - 1, poly, width);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_CLMUL_X86
+#include <immintrin.h>
+
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i foldClmul (__m128i x, __m128i k) {
+  return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crcFoldClmul (uint32_t crc, const uint8_t *buf, int bufLen, const crc_fold_consts_t *consts, uint32_t (*finish)(uint32_t, const uint8_t *, int)) {
+  if (bufLen < 64) return finish(crc, buf, bufLen);
+
+  const __m128i k4 = _mm_loadu_si128((const __m128i *)consts->fold4);
+  const __m128i k1 = _mm_loadu_si128((const __m128i *)consts->fold1);
+  __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)buf), _mm_cvtsi32_si128(crc));
+  __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+  __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 32));
+  __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 48));
+  buf += 64;
+  bufLen -= 64;
+
+  while (bufLen >= 64) {
+    x0 = _mm_xor_si128(foldClmul(x0, k4), _mm_loadu_si128((const __m128i *)buf));
+    x1 = _mm_xor_si128(foldClmul(x1, k4), _mm_loadu_si128((const __m128i *)(buf + 16)));
+    x2 = _mm_xor_si128(foldClmul(x2, k4), _mm_loadu_si128((const __m128i *)(buf + 32)));
+    x3 = _mm_xor_si128(foldClmul(x3, k4), _mm_loadu_si128((const __m128i *)(buf + 48)));
+    buf += 64;
+    bufLen -= 64;
   }
-  return crc ^ 0xffffffffu;
+
+  x0 = _mm_xor_si128(foldClmul(x0, k1), x1);
+  x0 = _mm_xor_si128(foldClmul(x0, k1), x2);
+  x0 = _mm_xor_si128(foldClmul(x0, k1), x3);
+  while (bufLen >= 16) {
+    x0 = _mm_xor_si128(foldClmul(x0, k1), _mm_loadu_si128((const __m128i *)buf));
+    buf += 16;
+    bufLen -= 16;
+  }
+
+  uint8_t folded[16];
+  _mm_storeu_si128((__m128i *)folded, x0);
+  return finish(finish(0, folded, 16), buf, bufLen);
+}
+
+static uint32_t crc16Clmul (uint32_t crc, const uint8_t *buf, int bufLen) {
+  return crcFoldClmul(crc, buf, bufLen, &crc16FoldConsts, crc16Slicing);
+}
+
+static uint32_t crc32Clmul (uint32_t crc, const uint8_t *buf, int bufLen) {
+  return crcFoldClmul(crc, buf, bufLen, &crc32FoldConsts, crc32Slicing);
+}
+
+#elif defined(__aarch64__)
+#define CRC_CLMUL_ARM
+#include <arm_neon.h>
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#if defined(__clang__)
+#define CRC_ARM_TARGET __attribute__((target("crc,aes")))
+#else
+#define CRC_ARM_TARGET __attribute__((target("+crc+crypto")))
+#endif
+
+CRC_ARM_TARGET
+static inline uint64x2_t foldPmull (uint64x2_t x, poly64_t kLo, poly64_t kHi) {
+  poly128_t lo = vmull_p64((poly64_t)vgetq_lane_u64(x, 0), kLo);
+  poly128_t hi = vmull_p64((poly64_t)vgetq_lane_u64(x, 1), kHi);
+  return veorq_u64(vreinterpretq_u64_p128(lo), vreinterpretq_u64_p128(hi));
+}
+
+CRC_ARM_TARGET
+static inline uint64x2_t loadPmull (const uint8_t *buf) {
+  return vreinterpretq_u64_u8(vld1q_u8(buf));
+}
+
+CRC_ARM_TARGET
+static uint32_t crc16Pmull (uint32_t crc, const uint8_t *buf, int bufLen) {
+  if (bufLen < 64) return crc16Slicing(crc, buf, bufLen);
+
+  const poly64_t k4Lo = crc16FoldConsts.fold4[0], k4Hi = crc16FoldConsts.fold4[1];
+  const poly64_t k1Lo = crc16FoldConsts.fold1[0], k1Hi = crc16FoldConsts.fold1[1];
+  uint64x2_t x0 = veorq_u64(loadPmull(buf), vsetq_lane_u64(crc, vdupq_n_u64(0), 0));
+  uint64x2_t x1 = loadPmull(buf + 16);
+  uint64x2_t x2 = loadPmull(buf + 32);
+  uint64x2_t x3 = loadPmull(buf + 48);
+  buf += 64;
+  bufLen -= 64;
+
+  while (bufLen >= 64) {
+    x0 = veorq_u64(foldPmull(x0, k4Lo, k4Hi), loadPmull(buf));
+    x1 = veorq_u64(foldPmull(x1, k4Lo, k4Hi), loadPmull(buf + 16));
+    x2 = veorq_u64(foldPmull(x2, k4Lo, k4Hi), loadPmull(buf + 32));
+    x3 = veorq_u64(foldPmull(x3, k4Lo, k4Hi), loadPmull(buf + 48));
+    buf += 64;
+    bufLen -= 64;
+  }
+
+  x0 = veorq_u64(foldPmull(x0, k1Lo, k1Hi), x1);
+  x0 = veorq_u64(foldPmull(x0, k1Lo, k1Hi), x2);
+  x0 = veorq_u64(foldPmull(x0, k1Lo, k1Hi), x3);
+  while (bufLen >= 16) {
+    x0 = veorq_u64(foldPmull(x0, k1Lo, k1Hi), loadPmull(buf));
+    buf += 16;
+    bufLen -= 16;
+  }
+
+  uint8_t folded[16];
+  vst1q_u8(folded, vreinterpretq_u8_u64(x0));
+  return crc16Slicing(crc16Slicing(0, folded, 16), buf, bufLen);
+}
+
+// The ARMv8 CRC32 instructions use the same poly and don't invert the input or output
+CRC_ARM_TARGET
+static uint32_t crc32Arm (uint32_t crc, const uint8_t *buf, int bufLen) {
+  while (bufLen >= 8) {
+    uint64_t data;
+    memcpy(&data, buf, 8);
+    crc = __crc32d(crc, data);
+    buf += 8;
+    bufLen -= 8;
+  }
+  while (bufLen--) crc = __crc32b(crc, *buf++);
+  return crc;
+}
+
+#endif
+
+static uint32_t (*crc16Kernel)(uint32_t, const uint8_t *, int) = crc16Bitwise;
+static uint32_t (*crc32Kernel)(uint32_t, const uint8_t *, int) = crc32Bitwise;
+
+const char *utils_crcInit (void) {
+  for (int i = 0; i < 256; i++) {
+    crc16Table[0][i] = crc16Bitwise(0, (const uint8_t[]){ i }, 1);
+    crc32Table[0][i] = crc32Bitwise(0, (const uint8_t[]){ i }, 1);
+  }
+  for (int k = 1; k < 8; k++) {
+    for (int i = 0; i < 256; i++) {
+      crc16Table[k][i] = (crc16Table[k-1][i] >> 8) ^ crc16Table[0][crc16Table[k-1][i] & 0xff];
+      crc32Table[k][i] = (crc32Table[k-1][i] >> 8) ^ crc32Table[0][crc32Table[k-1][i] & 0xff];
+    }
+  }
+  initFoldConsts(&crc16FoldConsts, CRC16_POLY, 16);
+  initFoldConsts(&crc32FoldConsts, CRC32_POLY, 32);
+
+  crc16Kernel = crc16Slicing;
+  crc32Kernel = crc32Slicing;
+
+#if defined(CRC_CLMUL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    crc16Kernel = crc16Clmul;
+    crc32Kernel = crc32Clmul;
+    return "pclmul";
+  }
+#elif defined(CRC_CLMUL_ARM)
+  #if defined(__linux__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  bool hasPmull = hwcap & HWCAP_PMULL, hasCrc32 = hwcap & HWCAP_CRC32;
+  #else
+  bool hasPmull = true, hasCrc32 = true; // Apple silicon has both
+  #endif
+  if (hasPmull) crc16Kernel = crc16Pmull;
+  if (hasCrc32) crc32Kernel = crc32Arm;
+  if (hasPmull || hasCrc32) return hasPmull && hasCrc32 ? "pmull+crc32" : hasPmull ? "pmull" : "crc32";
+#endif
+
+  return "slicing-by-8";
+}
+
+uint16_t utils_crc16 (uint16_t crc, const uint8_t *buf, int bufLen) {
+  return crc16Kernel(crc, buf, bufLen);
+}
+
+uint32_t utils_crc32 (uint32_t crc, const uint8_t *buf, int bufLen) {
+  return crc32Kernel(crc, buf, bufLen) ^ 0xffffffffu;
 }